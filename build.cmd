@@ -36,10 +36,10 @@ CALL "%VCVARSALL%" %ARCH%
 :BUILD
 SET NOLOGO=/nologo
 ECHO Compiling...
-cl %NOLOGO% -c /EHsc /DUNICODE /D_UNICODE /UTF-8 /Tc"src\main.c" /Tc"src\audioid.c" /Tc"src\minfft.c" /Tc"src\miniaudio.c"
+cl %NOLOGO% -c /EHsc /DUNICODE /D_UNICODE /UTF-8 /Tc"src\main.c" /Tc"src\audioid.c" /Tc"src\kernels.c" /Tc"src\fixed.c" /Tc"src\minfft.c" /Tc"src\miniaudio.c"
 IF ERRORLEVEL 1 GOTO ERROR
 ECHO Linking...
-link %NOLOGO% /subsystem:console /out:audioid.exe main audioid minfft miniaudio
+link %NOLOGO% /subsystem:console /out:audioid.exe main audioid kernels fixed minfft miniaudio
 IF ERRORLEVEL 1 GOTO ERROR
 ECHO Done.
 
@@ -21,25 +21,40 @@
 #ifdef USE_FTIME
     #include <sys/timeb.h>
 #endif
+#ifdef _WIN32
+    #include <malloc.h>     // _aligned_malloc
+    #include <windows.h>    // CreateThread
+#else
+    #include <pthread.h>
+    #include <unistd.h>     // sysconf
+#endif
 
 #include "miniaudio.h"
 #include "dr_wav.h"
 #include "minfft.h"
+#include "kernels.h"
+#include "fixed.h"
 
 #include "audioid.h"
 
 #define AUDIOID_SAMPLE_RATE 16000
 #define AUDIOID_VERBOSE false
-#define WINDOW_OVERLAP 2        // <=1 = none, 2 = half
+#define WINDOW_OVERLAP 2        // default hop of (window size / WINDOW_OVERLAP): <=1 = none, 2 = half
 #define HAMMING_WEIGHT 0.53836  // 25.0/46.0
-#define FFT_WINDOW_SIZE 2048    // 1024+1 results
-#define FFT_BUCKET_COUNT 256    // 128
-#define AUDIOID_DEFAULT_CYCLE_COUNT (4*WINDOW_OVERLAP)  // 8
-#define LOG_SCALE
+#define FFT_WINDOW_SIZE 2048    // default, 1024+1 results (option "windowsize")
+#define FFT_BUCKET_COUNT 256    // default (option "bucketcount")
+#define AUDIOID_DEFAULT_CYCLE_COUNT (4*WINDOW_OVERLAP)  // default, 8 (option "cyclecount")
 #define LABEL_ID_UNKNOWN (-1)
-#define MODAL_SIZE ((AUDIOID_DEFAULT_CYCLE_COUNT) * 150 / 100)
-#define MAX_STATES 64
+#define MODAL_PERCENT 150       // modal filter length, as a percentage of the cycle count
 #define REPORT_MAX_INTERVAL 1.0
+#define BATCH_FRAME_COUNT 256   // frames fingerprinted per batch when processing recorded audio
+#define DECIMATOR_TAPS_PER_PHASE 16 // decimation filter length, per output sample
+#define DECIMATOR_CUTOFF 0.9    // decimation filter cutoff, as a proportion of the output Nyquist frequency
+#define GATE_MARGIN 6.0         // automatic gate level is this far (dB) below the quietest learned frame of any non-silent label
+#define GATE_GROUP "silence"    // label group that gated frames are classified as (unknown if there is none)
+#define SEARCH_TREE_MIN_LABELS 256  // automatic search uses the tree from this many labels (a scan of fewer is cheaper)
+#define SEARCH_GROUPS_DEFAULT 2     // groups whose labels are scored by the group search
+#define ADAPTIVE_MARGIN_DEFAULT 0.25  // margin of the nearest label (relative to its distance) for the adaptive rate to treat the hypothesis as stable
 
 
 // Returns the number of seconds since the epoch
@@ -57,56 +72,238 @@ static double TimeNow()
 }
 
 
+// Memory for arrays that are streamed by vectorized loops (aligned to a cache line, which also suits the widest vector loads)
+#define ALIGNED_BYTES 64
+static void *AlignedAlloc(size_t size) {
+#ifdef _WIN32
+    return _aligned_malloc(size > 0 ? size : 1, ALIGNED_BYTES);
+#else
+    void *p = NULL;
+    if (posix_memalign(&p, ALIGNED_BYTES, size > 0 ? size : 1) != 0) return NULL;
+    return p;
+#endif
+}
+static void AlignedFree(void *p) {
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
+
 // Reduced loss of precision for running stats, informed by: https://www.johndcook.com/blog/standard_deviation/
+// Stored as a structure of arrays (one running stat per element of a vector), so that a loop over one field streams a contiguous array.
+// The mean and sumVar are kept at zero while an element's count is zero, so the mean array can be read directly.
 typedef struct {
-	unsigned int count;
-	double mean, sumVar;
-    //double min, max;
+    size_t size;            // number of elements
+    unsigned int *count;
+    double *mean;
+    double *sumVar;
+    //double *min, *max;
 } running_stats_t;
 void running_stats_clear(running_stats_t *self) {
-	self->count = 0;
-}
-void running_stats_add(running_stats_t *self, double x) {
-    double newMean, newSumVar;
-	self->count++;
-	if (self->count == 1) {
-		newMean = x;
-		newSumVar = 0;
-		// self->min = x;
-		// self->max = x;
-	} else {
-		newMean = self->mean + (x - self->mean) / self->count;
-		newSumVar = self->sumVar + (x - self->mean) * (x - newMean);
-	}
-	self->mean = newMean;
-    self->sumVar = newSumVar;
-	// if (x < self->min) self->min = x;
-	// if (x > self->max) self->max = x;
-}
-unsigned int running_stats_count(running_stats_t *self) {
-	return self->count;
-}
-double running_stats_mean(running_stats_t *self) {
-	if (self->count == 0) return 0;
-	return self->mean;
-}
-double running_stats_variance(running_stats_t *self) {
-	if (self->count <= 1) return 0;
-	return self->sumVar / (self->count - 1);
-}
-double running_stats_stddev(running_stats_t *self) {
-	return sqrt(running_stats_variance(self));
-}
-// double running_stats_range(running_stats_t *self) {
-// 	if (self->count == 0) return 0;
-// 	return self->max - self->min;
+    for (size_t i = 0; i < self->size; i++) {
+        self->count[i] = 0;
+        self->mean[i] = 0;
+        self->sumVar[i] = 0;
+    }
+}
+void running_stats_init(running_stats_t *self, size_t size) {
+    self->size = size;
+    self->count = (unsigned int *)AlignedAlloc(sizeof(unsigned int) * size);
+    self->mean = (double *)AlignedAlloc(sizeof(double) * size);
+    self->sumVar = (double *)AlignedAlloc(sizeof(double) * size);
+    if (self->count == NULL || self->mean == NULL || self->sumVar == NULL) { fprintf(stderr, "ERROR: Memory failure (stats).\n"); exit(-1); }
+    running_stats_clear(self);
+}
+void running_stats_free(running_stats_t *self) {
+    if (self->count != NULL) { AlignedFree(self->count); self->count = NULL; }
+    if (self->mean != NULL) { AlignedFree(self->mean); self->mean = NULL; }
+    if (self->sumVar != NULL) { AlignedFree(self->sumVar); self->sumVar = NULL; }
+    self->size = 0;
+}
+// Add one value to each element's stats (as the first value leaves mean=0 and sumVar=0, it needs no special case: mean becomes x and sumVar stays 0)
+void running_stats_add(running_stats_t *self, const real_t *x) {
+    unsigned int *count = self->count;
+    double *mean = self->mean;
+    double *sumVar = self->sumVar;
+    for (size_t i = 0; i < self->size; i++) {
+        unsigned int n = ++count[i];
+        double delta = x[i] - mean[i];
+        double newMean = mean[i] + delta / n;
+        sumVar[i] += delta * (x[i] - newMean);
+        mean[i] = newMean;
+    }
+}
+// Combine another set of stats (of the same size) into this one, as if its values had been added here: the parallel variance combination of Chan, Golub & LeVeque
+void running_stats_merge(running_stats_t *self, const running_stats_t *other) {
+    for (size_t i = 0; i < self->size; i++) {
+        unsigned int countA = self->count[i];
+        unsigned int countB = other->count[i];
+        if (countB == 0) continue;
+        if (countA == 0) {
+            self->count[i] = countB;
+            self->mean[i] = other->mean[i];
+            self->sumVar[i] = other->sumVar[i];
+            continue;
+        }
+        double count = (double)countA + countB;
+        double delta = other->mean[i] - self->mean[i];
+        self->mean[i] += delta * countB / count;
+        self->sumVar[i] += other->sumVar[i] + delta * delta * ((double)countA * countB / count);
+        self->count[i] = countA + countB;
+    }
+}
+static inline unsigned int running_stats_count(const running_stats_t *self, size_t i) {
+    return self->count[i];
+}
+static inline double running_stats_mean(const running_stats_t *self, size_t i) {
+    return self->mean[i];
+}
+static inline double running_stats_variance(const running_stats_t *self, size_t i) {
+    if (self->count[i] <= 1) return 0;
+    return self->sumVar[i] / (self->count[i] - 1);
+}
+static inline double running_stats_stddev(const running_stats_t *self, size_t i) {
+    return sqrt(running_stats_variance(self, i));
+}
+// double running_stats_range(const running_stats_t *self, size_t i) {
+//     if (self->count[i] == 0) return 0;
+//     return self->max[i] - self->min[i];
 // }
 
 
-// Hamming window function (http://en.wikipedia.org/wiki/Window_function)
-static double HammingWindow(size_t index, size_t size) {
-    const double weight = HAMMING_WEIGHT;   // 0.53836;  // 25.0/46.0
-	return weight - (1.0 - weight) * cos(2 * M_PI * index / (size - 1));
+// Analysis window functions (http://en.wikipedia.org/wiki/Window_function)
+typedef enum {
+    WINDOW_HAMMING = 0,
+    WINDOW_HANN,
+    WINDOW_BLACKMAN_HARRIS,
+    WINDOW_FLAT_TOP,
+    WINDOW_COUNT
+} window_function_t;
+
+static const char *windowFunctionNames[WINDOW_COUNT] = { "hamming", "hann", "blackman-harris", "flat-top" };
+
+static const char *WindowFunctionName(window_function_t windowFunction) {
+    if (windowFunction < 0 || windowFunction >= WINDOW_COUNT) return NULL;
+    return windowFunctionNames[windowFunction];
+}
+
+static bool WindowFunctionFromName(const char *name, window_function_t *outWindowFunction) {
+    for (int i = 0; i < WINDOW_COUNT; i++) {
+        if (strcmp(name, windowFunctionNames[i]) == 0) {
+            *outWindowFunction = (window_function_t)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Generalized cosine-sum window: a0 - a1 cos(x) + a2 cos(2x) - a3 cos(3x) + ...
+static double CosineSumWindow(const double *coefficients, size_t countCoefficients, size_t index, size_t size) {
+    double value = coefficients[0];
+    for (size_t k = 1; k < countCoefficients; k++) {
+        double term = coefficients[k] * cos(2 * M_PI * k * index / (size - 1));
+        value += (k & 1) ? -term : term;
+    }
+    return value;
+}
+
+// Window function value for a single index -- slow (transcendental per call), use to build a table
+static double WindowFunction(window_function_t windowFunction, size_t index, size_t size) {
+    static const double hamming[] = { HAMMING_WEIGHT, 1.0 - HAMMING_WEIGHT };   // 0.53836;  // 25.0/46.0
+    static const double hann[] = { 0.5, 0.5 };
+    static const double blackmanHarris[] = { 0.35875, 0.48829, 0.14128, 0.01168 };
+    static const double flatTop[] = { 0.21557895, 0.41663158, 0.277263158, 0.083578947, 0.006947368 };
+    switch (windowFunction) {
+        case WINDOW_HANN: return CosineSumWindow(hann, sizeof(hann) / sizeof(hann[0]), index, size);
+        case WINDOW_BLACKMAN_HARRIS: return CosineSumWindow(blackmanHarris, sizeof(blackmanHarris) / sizeof(blackmanHarris[0]), index, size);
+        case WINDOW_FLAT_TOP: return CosineSumWindow(flatTop, sizeof(flatTop) / sizeof(flatTop[0]), index, size);
+        case WINDOW_HAMMING:
+        default: return CosineSumWindow(hamming, sizeof(hamming) / sizeof(hamming[0]), index, size);
+    }
+}
+
+// Fingerprint modes: the value averaged into each bucket
+typedef enum {
+    FINGERPRINT_MAGNITUDE = 0,  // magnitude of each result
+    FINGERPRINT_POWER,          // power of each result (no per-result square root)
+    FINGERPRINT_LOG_POWER,      // power of each result, with the bucket means compressed by an approximate log2
+    FINGERPRINT_MODE_COUNT
+} fingerprint_mode_t;
+
+static const char *fingerprintModeNames[FINGERPRINT_MODE_COUNT] = { "magnitude", "power", "logpower" };
+
+static const char *FingerprintModeName(fingerprint_mode_t mode) {
+    if (mode < 0 || mode >= FINGERPRINT_MODE_COUNT) return NULL;
+    return fingerprintModeNames[mode];
+}
+
+static bool FingerprintModeFromName(const char *name, fingerprint_mode_t *outMode) {
+    for (int i = 0; i < FINGERPRINT_MODE_COUNT; i++) {
+        if (strcmp(name, fingerprintModeNames[i]) == 0) {
+            *outMode = (fingerprint_mode_t)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+#define LOG_POWER_FLOOR 1e-10f  // added before the log so that silence remains finite
+
+#if !AUDIOID_FIXED_POINT
+// Approximate log2 from the float exponent and a quadratic fit of the mantissa (absolute error < 0.005), for x > 0
+static float FastLog2(float x) {
+    union { float f; uint32_t i; } v;
+    v.f = x;
+    float exponent = (float)(int)((v.i >> 23) & 0xff) - 127;
+    v.i = (v.i & 0x007fffff) | 0x3f800000;  // mantissa in [1, 2)
+    float m = v.f;
+    return exponent + (-0.34484843f * m + 2.02466578f) * m - 1.67487759f;
+}
+#endif
+
+// Layout of the bucket filterbank over the FFT results
+typedef enum {
+    FILTERBANK_LOG = 0,         // box average over log-spaced result ranges
+    FILTERBANK_LINEAR,          // box average over equal result ranges
+    FILTERBANK_MEL,             // triangular filters equally spaced on the mel scale
+    FILTERBANK_ERB,             // triangular filters equally spaced on the ERB-rate scale
+    FILTERBANK_COUNT
+} filterbank_t;
+
+static const char *filterbankNames[FILTERBANK_COUNT] = { "log", "linear", "mel", "erb" };
+
+static const char *FilterbankName(filterbank_t filterbank) {
+    if (filterbank < 0 || filterbank >= FILTERBANK_COUNT) return NULL;
+    return filterbankNames[filterbank];
+}
+
+static bool FilterbankFromName(const char *name, filterbank_t *outFilterbank) {
+    for (int i = 0; i < FILTERBANK_COUNT; i++) {
+        if (strcmp(name, filterbankNames[i]) == 0) {
+            *outFilterbank = (filterbank_t)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Box filterbanks are contiguous, non-overlapping, equally-weighted ranges
+static bool FilterbankIsBox(filterbank_t filterbank) {
+    return filterbank == FILTERBANK_LOG || filterbank == FILTERBANK_LINEAR;
+}
+
+// Frequency (Hz) to the perceptual scale of a triangular filterbank, and back
+static double FilterbankWarp(filterbank_t filterbank, double frequency) {
+    if (filterbank == FILTERBANK_ERB) return 21.4 * log10(1 + 0.00437 * frequency);
+    return 2595 * log10(1 + frequency / 700);
+}
+
+static double FilterbankUnwarp(filterbank_t filterbank, double value) {
+    if (filterbank == FILTERBANK_ERB) return (pow(10, value / 21.4) - 1) / 0.00437;
+    return 700 * (pow(10, value / 2595) - 1);
 }
 
 static unsigned int Lerp(const double *start, const double *end, double proportion) {
@@ -147,7 +344,7 @@ static unsigned int Gradient(double value) {
     }
 }
 
-static void DebugVisualizeValues(running_stats_t *values, size_t count, bool showMatch, int groupMatchInterval, const char *closestGroup, const char *closestLabel, double closestDistance) {
+static void DebugVisualizeValues(const running_stats_t *values, size_t count, bool showMatch, int groupMatchInterval, const char *closestGroup, const char *closestLabel, double closestDistance) {
     const int mode = 2;    // 0=solid block, 1=left-half block, 2=buffer previous line and upper-half block
     static double *buffer = NULL;   // horrible (non-threadsafe) hack to buffer previous line so output can be two virtual lines per physical line
     char thisResult[256] = "";
@@ -173,18 +370,18 @@ static void DebugVisualizeValues(running_stats_t *values, size_t count, bool sho
     }
     if (mode == 2 && (bufferLine & 1) == 0) {
         for (size_t x = 0; x < count; x++) {
-            buffer[x] = running_stats_mean(&values[x]);
+            buffer[x] = running_stats_mean(values, x);
         }
         strcpy(lastResult, thisResult);
         strcat(lastResult, "\t");
         thisResult[0] = '\0';
     } else {
         for (size_t x = 0; x < count; x++) {
-            double v = running_stats_mean(&values[x]);
+            double v = running_stats_mean(values, x);
             unsigned int c = Gradient(v);
             if (mode == 1) {
                 if ((x & 1) == 1) {
-                    double vPrev = running_stats_mean(&values[x - 1]);
+                    double vPrev = running_stats_mean(values, x - 1);
                     unsigned int cPrev = Gradient(vPrev);
                     // Left-half block - Unicode: \u258c - UTF-8: \xe2\x96\x8c
                     printf(u8"\x1b[38;2;%d;%d;%dm\x1b[48;2;%d;%d;%dm\u258c", (unsigned char)(cPrev>>0), (unsigned char)(cPrev>>8), (unsigned char)(cPrev>>16), (unsigned char)(c>>0), (unsigned char)(c>>8), (unsigned char)(c>>16));
@@ -207,90 +404,340 @@ static void DebugVisualizeValues(running_stats_t *values, size_t count, bool sho
 }
 
 
+// Samples held by the fingerprint: fixed-point builds (AUDIOID_FIXED_POINT=1) keep the 16-bit input and compute the bucket values with integer arithmetic, otherwise samples are converted to floating point as they arrive
+#if AUDIOID_FIXED_POINT
+typedef int16_t sample_t;
+#else
+typedef real_t sample_t;
+#endif
+
 // Fingerprint state
 typedef struct fingerprint_tag {
-    size_t maxSamples;      // number of samples per FFT (can be windowed at WINDOW_OVERLAP)
+    unsigned int sampleRate;// rate of the samples (Hz), used to place frequency-based filterbanks
+    size_t maxSamples;      // number of samples per FFT
+    size_t hopSize;         // number of new samples between each FFT (<= maxSamples, less to overlap windows)
     size_t countResults;    // (maxSamples/2)+1
     size_t countBuckets;    // count of quantized bucket
     size_t cycleCount;      // length of cycle stats are accumulated over
-    double *input;          // user-supplied input, converted to floating point
+    window_function_t windowFunction; // analysis window function
+    fingerprint_mode_t mode;  // value averaged into each bucket
+    filterbank_t filterbank;  // layout of the buckets over the results
+    kernels_t kernels;      // processing kernels (selected by CPU features)
+    real_t *window;         // precomputed window weights (maxSamples)
+    sample_t *input;        // circular buffer of user-supplied input
+    size_t inputIndex;      // position in the circular buffer of the next sample (the oldest sample, once filled)
+#if AUDIOID_FIXED_POINT
+    fixed_fft_t fixedFft;   // fixed-point real FFT
+    int32_t *fixedWindow;   // precomputed Q15 window weights (maxSamples)
+    int32_t *fixedData;     // window-weighted values, then the complex FFT output, in place (maxSamples + 2)
+    uint64_t *fixedMagnitude; // integer magnitude of each output (power, in the power modes)
+    uint64_t *fixedBuckets; // integer bucket values
+    uint32_t *fixedFilterWeights; // Q16 sparse bucket weights (non-box filterbanks)
+    int fixedBits;          // fractional bits of the integer bucket values
+#else
     minfft_real *weighted;  // window-weighted values before FFT
     minfft_cmpl *output;    // complex output of FFT
     minfft_aux *aux;        // auxillary data needed for FFT
-    double *magnitude;      // magnitude of each output
-    double *buckets;        // mean magnitude into fewer buckets
-    running_stats_t **stats;// stats for each bucket, repeated for overlap cycle of buckets
-    double *meanStats;      // mean stats
-    size_t sampleOffset;    // index for next sample
-    size_t cycle;           // index of stats cycle 
+    real_t *magnitude;      // magnitude of each output (power, in the power modes)
+#endif
+    real_t *buckets;        // mean magnitude into fewer buckets
+    size_t *bucketBounds;   // result index range of each bucket: [bucketBounds[i], bucketBounds[i + 1])
+    size_t *filterFirst;    // sparse bucket weights: first result index of each bucket's weights
+    size_t *filterOffsets;  // sparse bucket weights: range of each bucket's weights [filterOffsets[i], filterOffsets[i + 1])
+    real_t *filterWeights;  // sparse bucket weights (each bucket's weights sum to one)
+    sample_t *batchInput;   // linear buffer of input for batch processing (history then new samples)
+    size_t batchCapacity;   // allocated size of the batch input buffer
+    real_t *history;        // ring of the most recent bucket values (cycleCount x countBuckets)
+    size_t countHistory;    // number of bucket vectors in the ring (up to cycleCount)
+    double *shift;          // per-bucket offset subtracted before summing, near the mean so that the variance does not suffer from cancellation
+    double *sum;            // sum of each (offset) bucket over the ring
+    double *sumSquares;     // sum of squares of each (offset) bucket over the ring
+    running_stats_t stats;  // stats of each bucket over the ring (as returned by FingerprintStats())
+    size_t samplesUntilFrame; // number of samples still required until the next FFT
+    bool frameReady;        // the last sample added completed a frame (results are available)
+    uint64_t energy;        // sum of squared (16-bit) samples in the circular buffer, updated as samples arrive
+    double gateLevel;       // frames with a level (dBFS) below this skip the FFT and bucketing (-HUGE_VAL = none)
+    double frameLevel;      // level (dBFS) of the last completed frame
+    bool frameGated;        // the last completed frame was below the gate level (no bucket values)
+    size_t cycle;           // position in the ring of the next bucket values (the oldest, once full)
 } fingerprint_t;
 
-void FingerprintResetStats(fingerprint_t *fingerprint, size_t cycle) {
-    // Clear stats
+// Clear the accumulated stats (empty the ring)
+void FingerprintResetStats(fingerprint_t *fingerprint) {
+    fingerprint->countHistory = 0;
     for (size_t i = 0; i < fingerprint->countBuckets; i++) {
-        running_stats_clear(&fingerprint->stats[cycle][i]);
+        fingerprint->shift[i] = 0;
+        fingerprint->sum[i] = 0;
+        fingerprint->sumSquares[i] = 0;
     }
 }
 
-void FingerprintAccumulateStats(fingerprint_t *fingerprint) {
-    // Reset the oldest phase
-    FingerprintResetStats(fingerprint, fingerprint->cycle);
-    // Next phase
+// Add bucket values to the stats, which cover the most recent cycleCount frames: the sums are updated by the incoming and outgoing values, rather than a Welford update per phase of the cycle
+void FingerprintAccumulateStats(fingerprint_t *fingerprint, const real_t *buckets) {
+    size_t countBuckets = fingerprint->countBuckets;
+    real_t *slot = fingerprint->history + fingerprint->cycle * countBuckets;
+    if (fingerprint->countHistory >= fingerprint->cycleCount) {
+        // Remove the oldest values
+        for (size_t i = 0; i < countBuckets; i++) {
+            double value = slot[i] - fingerprint->shift[i];
+            fingerprint->sum[i] -= value;
+            fingerprint->sumSquares[i] -= value * value;
+        }
+    } else if (fingerprint->countHistory++ == 0) {
+        // Offset by the first values
+        for (size_t i = 0; i < countBuckets; i++) fingerprint->shift[i] = buckets[i];
+    }
+    for (size_t i = 0; i < countBuckets; i++) {
+        double value = buckets[i] - fingerprint->shift[i];
+        fingerprint->sum[i] += value;
+        fingerprint->sumSquares[i] += value * value;
+        slot[i] = buckets[i];
+    }
     fingerprint->cycle = (fingerprint->cycle + 1) % fingerprint->cycleCount;
-    // Add to all phases of the cycle
-    for (size_t j = 0; j < fingerprint->cycleCount; j++) {
-        for (size_t i = 0; i < fingerprint->countBuckets; i++) {
-            running_stats_add(&fingerprint->stats[j][i], fingerprint->buckets[i]);
+
+    // Each time the full ring wraps, re-center the offset on the mean and recompute the sums from the ring, so that rounding from removing values does not accumulate (amortized, this is one more update per bucket per frame)
+    if (fingerprint->cycle == 0 && fingerprint->countHistory >= fingerprint->cycleCount) {
+        for (size_t i = 0; i < countBuckets; i++) {
+            fingerprint->shift[i] += fingerprint->sum[i] / fingerprint->countHistory;
+            fingerprint->sum[i] = 0;
+            fingerprint->sumSquares[i] = 0;
+        }
+        for (size_t j = 0; j < fingerprint->cycleCount; j++) {
+            const real_t *values = fingerprint->history + j * countBuckets;
+            for (size_t i = 0; i < countBuckets; i++) {
+                double value = values[i] - fingerprint->shift[i];
+                fingerprint->sum[i] += value;
+                fingerprint->sumSquares[i] += value * value;
+            }
         }
     }
 }
 
+// Stats of each bucket over the most recent cycleCount frames (fewer after starting or a reset)
 running_stats_t *FingerprintStats(fingerprint_t *fingerprint) {
-    return fingerprint->stats[fingerprint->cycle];
+    size_t count = fingerprint->countHistory;
+    double scale = count > 0 ? 1.0 / count : 0;
+    for (size_t i = 0; i < fingerprint->countBuckets; i++) {
+        double offsetMean = fingerprint->sum[i] * scale;
+        double sumVar = fingerprint->sumSquares[i] - fingerprint->sum[i] * offsetMean;
+        fingerprint->stats.count[i] = (unsigned int)count;
+        fingerprint->stats.mean[i] = fingerprint->shift[i] + offsetMean;
+        fingerprint->stats.sumVar[i] = sumVar > 0 ? sumVar : 0;
+    }
+    return &fingerprint->stats;
 }
 
-/*
-double *FingerprintMeanStats(fingerprint_t *fingerprint) {
-    // Calculate mean stats for the current phase
-    for (size_t i = 0; i < fingerprint->countBuckets; i++) {
-        fingerprint->meanStats[i] = running_stats_mean(&fingerprint->stats[fingerprint->cycle][i]);
+// Per-frame results of batch processing, alongside the bucket values
+typedef struct {
+    double level;           // RMS level (dBFS) of the frame
+    bool gated;             // below the gate level: the FFT and bucket values were skipped
+} fingerprint_frame_t;
+
+// Squared (16-bit) sample value of a held sample (the conversion to floating point is exact, so this is too)
+static inline uint64_t FingerprintSampleSquare(sample_t value) {
+#if AUDIOID_FIXED_POINT
+    int32_t sample = value;
+#else
+    int32_t sample = (int32_t)(value * 32768);
+#endif
+    return (uint64_t)((int64_t)sample * sample);
+}
+
+// Copy 16-bit samples into the fingerprint's input buffers (converting to floating point, unless fixed-point)
+static inline void FingerprintConvert(fingerprint_t *fingerprint, sample_t *dst, const int16_t *src, size_t count) {
+#if AUDIOID_FIXED_POINT
+    (void)fingerprint;
+    memcpy(dst, src, sizeof(int16_t) * count);
+#else
+    fingerprint->kernels.convert(dst, src, count);
+#endif
+}
+
+// RMS level (dBFS) of a window from its sum of squared samples
+static double FingerprintLevel(fingerprint_t *fingerprint, uint64_t energy) {
+    return 10 * log10((double)energy / ((double)fingerprint->maxSamples * 32768.0 * 32768.0) + 1e-20);
+}
+
+// Set the level (dBFS) below which frames skip the FFT (-HUGE_VAL for none)
+void FingerprintSetGate(fingerprint_t *fingerprint, double gateLevel) {
+    fingerprint->gateLevel = gateLevel;
+}
+
+// Compute the range of results averaged into each bucket (the buckets are contiguous and do not overlap)
+static void FingerprintBucketBounds(fingerprint_t *fingerprint) {
+    size_t startFFT = 0;
+    size_t countFFT = fingerprint->countResults;
+    double logScale = log((double)countFFT) / log((double)fingerprint->countBuckets);
+    for (size_t i = 0; i <= fingerprint->countBuckets; i++) {
+        size_t bound;
+        if (fingerprint->filterbank == FILTERBANK_LINEAR) {
+            bound = startFFT + i * countFFT / fingerprint->countBuckets;
+        } else {
+            bound = startFFT + (size_t)pow((double)i, logScale);
+        }
+        if (bound > countFFT) bound = countFFT;
+        fingerprint->bucketBounds[i] = bound;
+    }
+}
+
+// Compute the sparse weights of each bucket over the results (a contiguous run per bucket, summing to one)
+static void FingerprintFilterbank(fingerprint_t *fingerprint) {
+    size_t countBuckets = fingerprint->countBuckets;
+    fingerprint->filterFirst = malloc(sizeof(size_t) * countBuckets);
+    fingerprint->filterOffsets = malloc(sizeof(size_t) * (countBuckets + 1));
+    fingerprint->filterOffsets[0] = 0;
+
+    // Box layouts: equal weights over each bucket's range
+    if (FilterbankIsBox(fingerprint->filterbank)) {
+        fingerprint->filterWeights = malloc(sizeof(real_t) * fingerprint->countResults);
+        for (size_t i = 0; i < countBuckets; i++) {
+            size_t count = fingerprint->bucketBounds[i + 1] - fingerprint->bucketBounds[i];
+            fingerprint->filterFirst[i] = fingerprint->bucketBounds[i];
+            fingerprint->filterOffsets[i + 1] = fingerprint->filterOffsets[i] + count;
+            for (size_t j = 0; j < count; j++) {
+                fingerprint->filterWeights[fingerprint->filterOffsets[i] + j] = (real_t)(1.0 / count);
+            }
+        }
+        return;
+    }
+
+    // Triangular filters: bucket centers equally spaced on the warped scale between 0 and Nyquist, each rising from the previous center and falling to the next
+    double binFrequency = (double)fingerprint->sampleRate / fingerprint->maxSamples;
+    double top = FilterbankWarp(fingerprint->filterbank, (double)fingerprint->sampleRate / 2);
+    size_t *last = malloc(sizeof(size_t) * countBuckets);
+    for (size_t pass = 0; pass < 2; pass++) {
+        // First pass determines each bucket's range, the second computes the weights
+        if (pass == 1) fingerprint->filterWeights = malloc(sizeof(real_t) * (fingerprint->filterOffsets[countBuckets] > 0 ? fingerprint->filterOffsets[countBuckets] : 1));
+        for (size_t i = 0; i < countBuckets; i++) {
+            double low = FilterbankUnwarp(fingerprint->filterbank, top * i / (countBuckets + 1));
+            double center = FilterbankUnwarp(fingerprint->filterbank, top * (i + 1) / (countBuckets + 1));
+            double high = FilterbankUnwarp(fingerprint->filterbank, top * (i + 2) / (countBuckets + 1));
+            if (pass == 0) {
+                // Results strictly within the filter, or the nearest result to the center if the filter is narrower than the result spacing
+                size_t first = (size_t)floor(low / binFrequency) + 1;
+                last[i] = (size_t)ceil(high / binFrequency) - 1;
+                if (last[i] >= fingerprint->countResults) last[i] = fingerprint->countResults - 1;
+                if (first > last[i]) {
+                    first = (size_t)(center / binFrequency + 0.5);
+                    if (first >= fingerprint->countResults) first = fingerprint->countResults - 1;
+                    last[i] = first;
+                }
+                fingerprint->filterFirst[i] = first;
+                fingerprint->filterOffsets[i + 1] = fingerprint->filterOffsets[i] + (last[i] - first + 1);
+            } else {
+                real_t *weights = fingerprint->filterWeights + fingerprint->filterOffsets[i];
+                size_t count = last[i] - fingerprint->filterFirst[i] + 1;
+                double sum = 0;
+                for (size_t j = 0; j < count; j++) {
+                    double frequency = (fingerprint->filterFirst[i] + j) * binFrequency;
+                    double weight = (frequency <= center) ? (frequency - low) / (center - low) : (high - frequency) / (high - center);
+                    if (weight < 0 || count == 1) weight = 1;
+                    weights[j] = (real_t)weight;
+                    sum += weight;
+                }
+                for (size_t j = 0; j < count; j++) {
+                    weights[j] = (real_t)(weights[j] / sum);
+                }
+            }
+        }
     }
-    return fingerprint->meanStats;
+    free(last);
 }
-*/
 
-void FingerprintInit(fingerprint_t *fingerprint, size_t maxSamples, size_t countBuckets, size_t cycleCount) {
+void FingerprintInit(fingerprint_t *fingerprint, unsigned int sampleRate, size_t maxSamples, size_t hopSize, size_t countBuckets, size_t cycleCount, window_function_t windowFunction, fingerprint_mode_t mode, filterbank_t filterbank, kernels_isa_t kernelsIsa) {
     memset(fingerprint, 0, sizeof(*fingerprint));
+    fingerprint->mode = mode;
+    fingerprint->filterbank = filterbank;
+    fingerprint->sampleRate = sampleRate;
+    if (!KernelsSelect(&fingerprint->kernels, kernelsIsa)) {
+        KernelsSelect(&fingerprint->kernels, KERNELS_SCALAR);
+    }
     fingerprint->maxSamples = maxSamples;
+    fingerprint->hopSize = (hopSize > 0 && hopSize <= maxSamples) ? hopSize : maxSamples;
+    fingerprint->windowFunction = windowFunction;
     fingerprint->countBuckets = countBuckets;
     fingerprint->cycleCount = cycleCount;
     fingerprint->countResults = (fingerprint->maxSamples / 2) + 1;
-    fingerprint->sampleOffset = 0;
+    fingerprint->inputIndex = 0;
+    fingerprint->samplesUntilFrame = fingerprint->maxSamples;
+    fingerprint->frameReady = false;
+    fingerprint->window = malloc(sizeof(real_t) * fingerprint->maxSamples);
+    for (size_t i = 0; i < fingerprint->maxSamples; i++) {
+        fingerprint->window[i] = (real_t)WindowFunction(fingerprint->windowFunction, i, fingerprint->maxSamples);
+    }
+    fingerprint->input = malloc(sizeof(sample_t) * fingerprint->maxSamples);
+    for (size_t i = 0; i < fingerprint->maxSamples; i++) fingerprint->input[i] = 0;
+    fingerprint->energy = 0;
+    fingerprint->gateLevel = -HUGE_VAL;
+    fingerprint->buckets = malloc(sizeof(real_t) * fingerprint->countBuckets);
+    fingerprint->bucketBounds = malloc(sizeof(size_t) * (fingerprint->countBuckets + 1));
+    FingerprintBucketBounds(fingerprint);
+    FingerprintFilterbank(fingerprint);
+#if AUDIOID_FIXED_POINT
+    if (!FixedFftInit(&fingerprint->fixedFft, fingerprint->maxSamples)) {
+        fprintf(stderr, "ERROR: Window size not supported by the fixed-point FFT: %zu\n", fingerprint->maxSamples);
+        exit(-1);
+    }
+    fingerprint->fixedWindow = malloc(sizeof(int32_t) * fingerprint->maxSamples);
+    for (size_t i = 0; i < fingerprint->maxSamples; i++) {
+        fingerprint->fixedWindow[i] = (int32_t)floor(fingerprint->window[i] * (1 << FIXED_WINDOW_BITS) + 0.5);
+    }
+    fingerprint->fixedData = malloc(sizeof(int32_t) * (fingerprint->maxSamples + 2));
+    fingerprint->fixedMagnitude = malloc(sizeof(uint64_t) * fingerprint->countResults);
+    fingerprint->fixedBuckets = malloc(sizeof(uint64_t) * fingerprint->countBuckets);
+    size_t countWeights = fingerprint->filterOffsets[fingerprint->countBuckets];
+    fingerprint->fixedFilterWeights = malloc(sizeof(uint32_t) * (countWeights > 0 ? countWeights : 1));
+    for (size_t i = 0; i < countWeights; i++) {
+        fingerprint->fixedFilterWeights[i] = (uint32_t)floor(fingerprint->filterWeights[i] * (1 << FIXED_WEIGHT_BITS) + 0.5);
+    }
+    // Magnitudes have the FFT's fractional bits; powers are shifted down by (guard bits - 1) so that summing a bucket of them cannot overflow
+    if (fingerprint->mode == FINGERPRINT_MAGNITUDE) {
+        fingerprint->fixedBits = fingerprint->fixedFft.fractionBits;
+    } else {
+        fingerprint->fixedBits = 2 * fingerprint->fixedFft.fractionBits - (fingerprint->fixedFft.guardBits - 1);
+    }
+#else
     fingerprint->aux = minfft_mkaux_realdft_1d((int)fingerprint->maxSamples);
-    fingerprint->input = malloc(sizeof(double) * fingerprint->maxSamples);
     fingerprint->weighted = malloc(sizeof(minfft_real) * fingerprint->maxSamples);
     fingerprint->output = malloc(sizeof(minfft_cmpl) * fingerprint->countResults);
-    fingerprint->magnitude = malloc(sizeof(double) * fingerprint->countResults);
-    fingerprint->buckets = malloc(sizeof(double) * fingerprint->countBuckets);
-    fingerprint->stats = malloc(sizeof(running_stats_t*) * fingerprint->countBuckets);
-    for (size_t i = 0; i < fingerprint->cycleCount; i++) {
-        fingerprint->stats[i] = malloc(sizeof(running_stats_t) * fingerprint->countBuckets);
-    }
-    for (size_t i = 0; i < fingerprint->cycleCount; i++) {
-        FingerprintResetStats(fingerprint, i);
-    }
-    fingerprint->meanStats = malloc(sizeof(double) * fingerprint->countBuckets);
+    fingerprint->magnitude = malloc(sizeof(real_t) * fingerprint->countResults);
+#endif
+    fingerprint->history = malloc(sizeof(real_t) * fingerprint->cycleCount * fingerprint->countBuckets);
+    fingerprint->shift = malloc(sizeof(double) * fingerprint->countBuckets);
+    fingerprint->sum = malloc(sizeof(double) * fingerprint->countBuckets);
+    fingerprint->sumSquares = malloc(sizeof(double) * fingerprint->countBuckets);
+    running_stats_init(&fingerprint->stats, fingerprint->countBuckets);
+    FingerprintResetStats(fingerprint);
 }
 
 void FingerprintDestroy(fingerprint_t *fingerprint) {
+#if AUDIOID_FIXED_POINT
+    FixedFftDestroy(&fingerprint->fixedFft);
+    if (fingerprint->fixedWindow != NULL) {
+        free(fingerprint->fixedWindow);
+        fingerprint->fixedWindow = NULL;
+    }
+    if (fingerprint->fixedData != NULL) {
+        free(fingerprint->fixedData);
+        fingerprint->fixedData = NULL;
+    }
+    if (fingerprint->fixedMagnitude != NULL) {
+        free(fingerprint->fixedMagnitude);
+        fingerprint->fixedMagnitude = NULL;
+    }
+    if (fingerprint->fixedBuckets != NULL) {
+        free(fingerprint->fixedBuckets);
+        fingerprint->fixedBuckets = NULL;
+    }
+    if (fingerprint->fixedFilterWeights != NULL) {
+        free(fingerprint->fixedFilterWeights);
+        fingerprint->fixedFilterWeights = NULL;
+    }
+#else
     if (fingerprint->aux != NULL) {
         minfft_free_aux(fingerprint->aux);
         fingerprint->aux = NULL;
     }
-    if (fingerprint->input != NULL) {
-        free(fingerprint->input);
-        fingerprint->input = NULL;
-    }
     if (fingerprint->weighted != NULL) {
         free(fingerprint->weighted);
         fingerprint->weighted = NULL;
@@ -303,23 +750,63 @@ void FingerprintDestroy(fingerprint_t *fingerprint) {
         free(fingerprint->magnitude);
         fingerprint->magnitude = NULL;
     }
+#endif
+    if (fingerprint->window != NULL) {
+        free(fingerprint->window);
+        fingerprint->window = NULL;
+    }
+    if (fingerprint->input != NULL) {
+        free(fingerprint->input);
+        fingerprint->input = NULL;
+    }
     if (fingerprint->buckets != NULL) {
         free(fingerprint->buckets);
         fingerprint->buckets = NULL;
     }
-    if (fingerprint->stats != NULL) {
-        free(fingerprint->stats);
-        fingerprint->stats = NULL;
+    if (fingerprint->bucketBounds != NULL) {
+        free(fingerprint->bucketBounds);
+        fingerprint->bucketBounds = NULL;
     }
-    if (fingerprint->meanStats != NULL) {
-        free(fingerprint->meanStats);
-        fingerprint->meanStats = NULL;
+    if (fingerprint->filterFirst != NULL) {
+        free(fingerprint->filterFirst);
+        fingerprint->filterFirst = NULL;
     }
+    if (fingerprint->filterOffsets != NULL) {
+        free(fingerprint->filterOffsets);
+        fingerprint->filterOffsets = NULL;
+    }
+    if (fingerprint->filterWeights != NULL) {
+        free(fingerprint->filterWeights);
+        fingerprint->filterWeights = NULL;
+    }
+    if (fingerprint->batchInput != NULL) {
+        free(fingerprint->batchInput);
+        fingerprint->batchInput = NULL;
+        fingerprint->batchCapacity = 0;
+    }
+    if (fingerprint->history != NULL) {
+        free(fingerprint->history);
+        fingerprint->history = NULL;
+    }
+    if (fingerprint->shift != NULL) {
+        free(fingerprint->shift);
+        fingerprint->shift = NULL;
+    }
+    if (fingerprint->sum != NULL) {
+        free(fingerprint->sum);
+        fingerprint->sum = NULL;
+    }
+    if (fingerprint->sumSquares != NULL) {
+        free(fingerprint->sumSquares);
+        fingerprint->sumSquares = NULL;
+    }
+    running_stats_free(&fingerprint->stats);
 }
 
+#if !AUDIOID_FIXED_POINT
 // If the buffer is full, return the magnitude data and count of results
-double *FingerprintMagnitude(fingerprint_t *fingerprint, size_t *outCountResults) {
-    if (fingerprint->sampleOffset >= fingerprint->maxSamples) {
+real_t *FingerprintMagnitude(fingerprint_t *fingerprint, size_t *outCountResults) {
+    if (fingerprint->frameReady) {
         if (outCountResults != NULL) *outCountResults = fingerprint->countResults;
         return fingerprint->magnitude;
     } else {
@@ -327,10 +814,11 @@ double *FingerprintMagnitude(fingerprint_t *fingerprint, size_t *outCountResults
         return NULL;
     }
 }
+#endif
 
-// If the buffer is full, return the bucket-mean magnitude data and count of results
-double *FingerprintBuckets(fingerprint_t *fingerprint, size_t *outCountResults) {
-    if (fingerprint->sampleOffset >= fingerprint->maxSamples) {
+// If the buffer is full (and the frame was not gated), return the bucket-mean magnitude data and count of results
+real_t *FingerprintBuckets(fingerprint_t *fingerprint, size_t *outCountResults) {
+    if (fingerprint->frameReady && !fingerprint->frameGated) {
         if (outCountResults != NULL) *outCountResults = fingerprint->countBuckets;
         return fingerprint->buckets;
     } else {
@@ -339,83 +827,106 @@ double *FingerprintBuckets(fingerprint_t *fingerprint, size_t *outCountResults)
     }
 }
 
-// Add samples to the buffer, returning the number of samples consumed in this step.  Use FingerprintMagnitude()/FingerprintBuckets() to check if results are available.
-size_t FingerprintAddSamples(fingerprint_t *fingerprint, int16_t *samples, size_t sampleCount) {
-    // Special case: adding no samples does not return as another filled buffer, even if the buffer is currently filled
-    if (sampleCount == 0) {
-        return 0;
+// Compute the bucket values of one frame of input (maxSamples, oldest first from the start position of a circular buffer)
+static void FingerprintFrame(fingerprint_t *fingerprint, const sample_t *input, size_t start, real_t *outBuckets) {
+#if AUDIOID_FIXED_POINT
+    // Window-weight (Q15 samples and weights) to the fixed-point scale of the FFT, FFT, then integer magnitude or power
+    FixedWindow(fingerprint->fixedData, fingerprint->fixedWindow, input, start, fingerprint->maxSamples, FIXED_WINDOW_BITS + 15 - fingerprint->fixedFft.fractionBits);
+    FixedFftReal(&fingerprint->fixedFft, fingerprint->fixedData);
+    if (fingerprint->mode == FINGERPRINT_MAGNITUDE) {
+        FixedMagnitude(fingerprint->fixedMagnitude, fingerprint->fixedData, fingerprint->countResults);
+    } else {
+        FixedPower(fingerprint->fixedMagnitude, fingerprint->fixedData, fingerprint->countResults, fingerprint->fixedFft.guardBits - 1);
     }
 
-    // If adding to a full buffer, restart the buffer -- slide window by half if overlapping
-    if (fingerprint->sampleOffset >= fingerprint->maxSamples && sampleCount > 0) {
-#if defined(WINDOW_OVERLAP) && (WINDOW_OVERLAP > 1)
-        size_t offset = fingerprint->maxSamples / WINDOW_OVERLAP;
-        size_t length = fingerprint->maxSamples - offset;
-        memmove(fingerprint->input, fingerprint->input + offset, length * sizeof(double));
-        fingerprint->sampleOffset = length;
-#else
-        fingerprint->sampleOffset = 0;
-#endif
+    // Integer buckets
+    if (FilterbankIsBox(fingerprint->filterbank)) {
+        FixedBucketMeans(fingerprint->fixedBuckets, fingerprint->fixedMagnitude, fingerprint->bucketBounds, fingerprint->countBuckets);
+    } else {
+        FixedProject(fingerprint->fixedBuckets, fingerprint->fixedMagnitude, fingerprint->filterFirst, fingerprint->filterOffsets, fingerprint->fixedFilterWeights, fingerprint->countBuckets);
     }
 
-    // Determine how many of these samples will be used
-    size_t samplesRemaining = fingerprint->maxSamples - fingerprint->sampleOffset;
-    size_t samplesUsed = sampleCount > samplesRemaining ? samplesRemaining : sampleCount;
-
-    // Add up to sampleCount samples to fingerprint->input (scaled as floating point real data)
-    for (size_t i = 0; i < samplesUsed; i++) {
-        size_t index = fingerprint->sampleOffset + i;
-        double value = (double)samples[i] / 32768;
-        fingerprint->input[index] = (double)value;
+    // Only the (fewer) bucket values are converted, to the units of the floating point path (log-power's floor is the least significant bit, rather than LOG_POWER_FLOOR)
+    real_t scale = (real_t)ldexp(1.0, -fingerprint->fixedBits);
+    for (size_t i = 0; i < fingerprint->countBuckets; i++) {
+        if (fingerprint->mode == FINGERPRINT_LOG_POWER) {
+            int32_t value = FixedLog2(fingerprint->fixedBuckets[i]) - (fingerprint->fixedBits << FIXED_LOG2_BITS);
+            outBuckets[i] = (real_t)value / (1 << FIXED_LOG2_BITS);
+        } else {
+            outBuckets[i] = (real_t)fingerprint->fixedBuckets[i] * scale;
+        }
     }
-    fingerprint->sampleOffset += samplesUsed;
+#else
+    // Window-weight samples for FFT
+    fingerprint->kernels.window(fingerprint->weighted, fingerprint->window, input, start, fingerprint->maxSamples);
 
-    // If the buffer has just filled
-    if (fingerprint->sampleOffset >= fingerprint->maxSamples && samplesUsed > 0) {
-        // Window-weight samples for FFT
-        for (size_t i = 0; i < fingerprint->maxSamples; i++) {
-            double weight = HammingWindow(i, fingerprint->maxSamples);
-            double value = weight * fingerprint->input[i];
-            fingerprint->weighted[i] = (minfft_real)value;
-        }
+    // Compute FFT
+    minfft_realdft(fingerprint->weighted, fingerprint->output, fingerprint->aux);
 
-        // Compute FFT
-        minfft_realdft(fingerprint->weighted, fingerprint->output, fingerprint->aux);
+    // Compute magnitude, or power (the complex output is interleaved real and imaginary parts)
+    if (fingerprint->mode == FINGERPRINT_MAGNITUDE) {
+        fingerprint->kernels.magnitude(fingerprint->magnitude, (const real_t *)fingerprint->output, fingerprint->countResults);
+    } else {
+        fingerprint->kernels.power(fingerprint->magnitude, (const real_t *)fingerprint->output, fingerprint->countResults);
+    }
 
-        // Compute magnitude
-        for (size_t i = 0; i < fingerprint->countResults; i++) {
-            #ifdef complex
-                fingerprint->magnitude[i] = cabs(fingerprint->output[i]);
-            #else
-                minfft_real nr = fingerprint->output[i][0];
-                minfft_real ni = fingerprint->output[i][1];
-                fingerprint->magnitude[i] = sqrt(nr * nr + ni * ni);
-            #endif
-        }
+    // Compute buckets: box layouts are a single pass over the magnitudes, emitting the mean at each bucket boundary; other filterbanks are a sparse projection
+    if (FilterbankIsBox(fingerprint->filterbank)) {
+        fingerprint->kernels.bucketMeans(outBuckets, fingerprint->magnitude, fingerprint->bucketBounds, fingerprint->countBuckets);
+    } else {
+        fingerprint->kernels.project(outBuckets, fingerprint->magnitude, fingerprint->filterFirst, fingerprint->filterOffsets, fingerprint->filterWeights, fingerprint->countBuckets);
+    }
 
-        // Compute averaged buckets
-        size_t startFFT = 0;
-        size_t countFFT = fingerprint->countResults;
-#ifdef LOG_SCALE
-        double logScale = log((double)countFFT) / log((double)fingerprint->countBuckets);
-#endif
+    // Log-power compresses only the (fewer) bucket means rather than every result
+    if (fingerprint->mode == FINGERPRINT_LOG_POWER) {
         for (size_t i = 0; i < fingerprint->countBuckets; i++) {
-#ifdef LOG_SCALE
-            size_t iStartAt = startFFT + (size_t)pow((double)i, logScale);
-            size_t iEndBefore = startFFT + (size_t)pow((double)(i + 1), logScale);
-//printf(">>> %d -> [%d-%d)\n", i, iStartAt, iEndBefore); fflush(stdout); if (i + 1 >= fingerprint->countBuckets) exit(1);
-#else
-            size_t iStartAt = startFFT + i * countFFT / fingerprint->countBuckets;
-            size_t iEndBefore = startFFT + (i + 1) * countFFT / fingerprint->countBuckets;
+            outBuckets[i] = (real_t)FastLog2((float)outBuckets[i] + LOG_POWER_FLOOR);
+        }
+    }
 #endif
-            double mean = 0;
-            for (size_t i = iStartAt; i < iEndBefore; i++) {
-                mean += fingerprint->magnitude[i];
-            }
-            if (iEndBefore > iStartAt) {
-                mean /= iEndBefore - iStartAt;
-            }
-            fingerprint->buckets[i] = mean;
+}
+
+// Add samples to the circular buffer, returning the number of samples consumed in this step (no further than the end of the next frame).  Use FingerprintMagnitude()/FingerprintBuckets() to check if results are available.
+size_t FingerprintAddSamples(fingerprint_t *fingerprint, int16_t *samples, size_t sampleCount) {
+    // Special case: adding no samples does not return as another filled buffer, even if the buffer is currently filled
+    if (sampleCount == 0) {
+        return 0;
+    }
+
+    // Any previous results are no longer current
+    fingerprint->frameReady = false;
+
+    // Determine how many of these samples will be used (no more than required to complete the next frame)
+    size_t samplesUsed = sampleCount > fingerprint->samplesUntilFrame ? fingerprint->samplesUntilFrame : sampleCount;
+
+    // Add samples to the circular buffer (scaled as floating point real data), in up to two contiguous runs
+    const int16_t *source = samples;
+    for (size_t remaining = samplesUsed; remaining > 0; ) {
+        size_t run = fingerprint->maxSamples - fingerprint->inputIndex;
+        if (run > remaining) run = remaining;
+        // Energy of the window: remove the samples being replaced, add the new ones
+        for (size_t i = 0; i < run; i++) {
+            fingerprint->energy -= FingerprintSampleSquare(fingerprint->input[fingerprint->inputIndex + i]);
+            fingerprint->energy += (uint64_t)((int32_t)source[i] * source[i]);
+        }
+        FingerprintConvert(fingerprint, fingerprint->input + fingerprint->inputIndex, source, run);
+        source += run;
+        remaining -= run;
+        fingerprint->inputIndex += run;
+        if (fingerprint->inputIndex >= fingerprint->maxSamples) fingerprint->inputIndex = 0;
+    }
+    fingerprint->samplesUntilFrame -= samplesUsed;
+
+    // If a frame has just completed
+    if (fingerprint->samplesUntilFrame == 0 && samplesUsed > 0) {
+        fingerprint->samplesUntilFrame = fingerprint->hopSize;
+        fingerprint->frameReady = true;
+
+        // Quiet frames are gated, otherwise window-weight (oldest first, from the next sample position of the circular buffer), FFT and bucket
+        fingerprint->frameLevel = FingerprintLevel(fingerprint, fingerprint->energy);
+        fingerprint->frameGated = (fingerprint->frameLevel < fingerprint->gateLevel);
+        if (!fingerprint->frameGated) {
+            FingerprintFrame(fingerprint, fingerprint->input, fingerprint->inputIndex, fingerprint->buckets);
         }
     }
 
@@ -423,809 +934,4441 @@ size_t FingerprintAddSamples(fingerprint_t *fingerprint, int16_t *samples, size_
     return samplesUsed;
 }
 
-double Distance(size_t countBuckets, running_stats_t *buckets, running_stats_t *stats) {
-#if 0
-    // Cosine similarity
-    double sumAB = 0;
-    double sumAA = 0;
-    double sumBB = 0;
-    for (size_t i = 0; i < countBuckets; i++) {
-        double a = running_stats_mean(&stats[i]);
-        double b = running_stats_mean(&buckets[i]);
-        sumAB += a * b;
-        sumAA += a * a;
-        sumBB += b * b;
-    }
-    double divisor = sqrt(sumAA) * sqrt(sumBB);
-
-    // Range -1=opposite to 1=same 
-    double cosineSimilarity;
-    if (divisor < 0.00001) {
-        cosineSimilarity = 0;
-    } else {
-        cosineSimilarity = sumAB / divisor;
+// Add a block of samples, writing each completed frame's bucket values as a row of a contiguous (frames x countBuckets) matrix, and its level/gating to outFrameInfo, returning the number of frames.
+// Samples are consumed no further than the end of the maxFrames-th frame (outSamplesUsed).  The per-frame work runs back-to-back over a linear copy of the input, rather than interleaved with per-frame recognition.
+size_t FingerprintAddSamplesBatch(fingerprint_t *fingerprint, const int16_t *samples, size_t sampleCount, real_t *outFrames, fingerprint_frame_t *outFrameInfo, size_t maxFrames, size_t *outSamplesUsed) {
+    // Number of frames completed by these samples (the first after samplesUntilFrame, then every hop)
+    size_t countFrames = 0;
+    if (sampleCount >= fingerprint->samplesUntilFrame) {
+        countFrames = 1 + (sampleCount - fingerprint->samplesUntilFrame) / fingerprint->hopSize;
+    }
+    size_t samplesUsed = sampleCount;
+    if (countFrames >= maxFrames) {
+        countFrames = maxFrames;
+        samplesUsed = (countFrames > 0) ? fingerprint->samplesUntilFrame + (countFrames - 1) * fingerprint->hopSize : 0;
+    }
+    if (outSamplesUsed != NULL) *outSamplesUsed = samplesUsed;
+    if (samplesUsed == 0) {
+        return 0;
     }
 
-    return 1.0 - cosineSimilarity;
-#elif 0
-    // Distribution comparison
-    double sumZ = 0;
-    for (size_t i = 0; i < countBuckets; i++) {
-        double meanA = running_stats_mean(&stats[i]);
-        double stddevA = running_stats_stddev(&stats[i]);
-        double countA = running_stats_count(&stats[i]);
-        double meanB = running_stats_mean(&buckets[i]);
-        double stddevB = running_stats_stddev(&buckets[i]);
-        double countB = running_stats_count(&buckets[i]);
-
-        double sigmaA = countA > 0 ? stddevA / sqrt(countA) : 0;
-        double sigmaB = countB > 0 ? stddevB / sqrt(countB) : 0;
-        double divisor = sqrt(sigmaA * sigmaA + sigmaB * sigmaB);
-
-        double meanDiff = meanA - meanB;
-        double z = meanDiff / (divisor > 0 ? divisor : 1);
-
-        sumZ += fabs(z);
-    }
-    return sumZ;
-#elif 0
-    // TF-IDF-inspired
-    #error "Not implemented"
-
-#elif 0
-    // Distance (normalized)
-    double sumAA = 0;
-    double sumBB = 0;
-    for (size_t i = 0; i < countBuckets; i++) {
-        double a = running_stats_mean(&stats[i]);
-        double b = running_stats_mean(&buckets[i]);
-        sumAA += a * a;
-        sumBB += b * b;
+    // Linear buffer: the circular buffer history (oldest first), followed by the new samples
+    size_t required = fingerprint->maxSamples + samplesUsed;
+    if (required > fingerprint->batchCapacity) {
+        fingerprint->batchInput = (sample_t *)realloc(fingerprint->batchInput, sizeof(sample_t) * required);
+        if (fingerprint->batchInput == NULL) { fprintf(stderr, "ERROR: Memory failure (batch input).\n"); exit(-1); }
+        fingerprint->batchCapacity = required;
+    }
+    size_t countOlder = fingerprint->maxSamples - fingerprint->inputIndex;
+    memcpy(fingerprint->batchInput, fingerprint->input + fingerprint->inputIndex, sizeof(sample_t) * countOlder);
+    memcpy(fingerprint->batchInput + countOlder, fingerprint->input, sizeof(sample_t) * fingerprint->inputIndex);
+    FingerprintConvert(fingerprint, fingerprint->batchInput + fingerprint->maxSamples, samples, samplesUsed);
+
+    // Each frame ends samplesUntilFrame (then a further hop each) into the new samples, the window energy slides along with it
+    size_t position = 0;
+    for (size_t frame = 0; frame < countFrames; frame++) {
+        size_t end = fingerprint->samplesUntilFrame + frame * fingerprint->hopSize;
+        for (; position < end; position++) {
+            fingerprint->energy += FingerprintSampleSquare(fingerprint->batchInput[fingerprint->maxSamples + position]) - FingerprintSampleSquare(fingerprint->batchInput[position]);
+        }
+        outFrameInfo[frame].level = FingerprintLevel(fingerprint, fingerprint->energy);
+        outFrameInfo[frame].gated = (outFrameInfo[frame].level < fingerprint->gateLevel);
+        if (!outFrameInfo[frame].gated) {
+            FingerprintFrame(fingerprint, fingerprint->batchInput + end, 0, outFrames + frame * fingerprint->countBuckets);
+        }
+    }
+    for (; position < samplesUsed; position++) {
+        fingerprint->energy += FingerprintSampleSquare(fingerprint->batchInput[fingerprint->maxSamples + position]) - FingerprintSampleSquare(fingerprint->batchInput[position]);
     }
-    double normA = sqrt(sumAA);
-    double normB = sqrt(sumBB);
-    if (normA < 0.001) normA = 0.001;
-    if (normB < 0.001) normB = 0.001;
 
-    double totalDistance = 0;
-    for (size_t i = 0; i < countBuckets; i++) {
-        double a = running_stats_mean(&stats[i]) / normA;
-        double b = running_stats_mean(&buckets[i]) / normB;
-        double diff = b - a;
-        double dist = sqrt(diff * diff);
-        totalDistance += dist;
-    }
-    double result = totalDistance / countBuckets;
-    return result;
-#elif 1
-    // Distance (not normalized)
-    double totalDistance = 0;
-    for (size_t i = 0; i < countBuckets; i++) {
-        double a = running_stats_mean(&stats[i]);
-        double b = running_stats_mean(&buckets[i]);
-        double diff = b - a;
-        double dist = sqrt(diff * diff);
-        totalDistance += dist;
-    }
-    double result = totalDistance / countBuckets;
-    return result;
-#else
-    #error "No distance metric"
-#endif
+    // Continue the circular buffer from the most recent samples
+    memcpy(fingerprint->input, fingerprint->batchInput + samplesUsed, sizeof(sample_t) * fingerprint->maxSamples);
+    fingerprint->inputIndex = 0;
+    fingerprint->frameReady = false;
+    if (countFrames > 0) {
+        size_t remainder = samplesUsed - (fingerprint->samplesUntilFrame + (countFrames - 1) * fingerprint->hopSize);
+        fingerprint->samplesUntilFrame = fingerprint->hopSize - remainder;
+        // As with FingerprintAddSamples(), results are current if the last sample completed a frame
+        if (remainder == 0) {
+            fingerprint->frameLevel = outFrameInfo[countFrames - 1].level;
+            fingerprint->frameGated = outFrameInfo[countFrames - 1].gated;
+            if (!fingerprint->frameGated) memcpy(fingerprint->buckets, outFrames + (countFrames - 1) * fingerprint->countBuckets, sizeof(real_t) * fingerprint->countBuckets);
+            fingerprint->frameReady = true;
+        }
+    } else {
+        fingerprint->samplesUntilFrame -= samplesUsed;
+    }
+
+    return countFrames;
 }
 
+// Decimator state: a windowed-sinc low-pass filter evaluated only for the retained outputs (the polyphase form, countTaps / factor multiply-adds per input sample)
+typedef struct {
+    size_t factor;          // input samples per output sample
+    size_t countTaps;       // filter length
+    real_t *taps;           // filter coefficients (symmetric)
+    real_t *history;        // input history, written twice (at index and index + countTaps) so the latest countTaps samples are contiguous
+    size_t historyIndex;    // position of the oldest sample in the history
+    size_t phase;           // input samples still required until the next output
+    kernels_t kernels;      // the filter is applied as a single-row sparse product
+    size_t dotFirst;
+    size_t dotOffsets[2];
+} decimator_t;
+
+void DecimatorInit(decimator_t *decimator, size_t factor, kernels_isa_t kernelsIsa) {
+    memset(decimator, 0, sizeof(*decimator));
+    if (!KernelsSelect(&decimator->kernels, kernelsIsa)) {
+        KernelsSelect(&decimator->kernels, KERNELS_SCALAR);
+    }
+    decimator->factor = factor > 0 ? factor : 1;
+    decimator->countTaps = DECIMATOR_TAPS_PER_PHASE * decimator->factor + 1;
+    decimator->taps = malloc(sizeof(real_t) * decimator->countTaps);
+    decimator->history = malloc(sizeof(real_t) * 2 * decimator->countTaps);
+    if (decimator->taps == NULL || decimator->history == NULL) { fprintf(stderr, "ERROR: Memory failure (decimator).\n"); exit(-1); }
+    for (size_t i = 0; i < 2 * decimator->countTaps; i++) decimator->history[i] = 0;
+    decimator->historyIndex = 0;
+    decimator->phase = decimator->factor;
+    decimator->dotFirst = 0;
+    decimator->dotOffsets[0] = 0;
+    decimator->dotOffsets[1] = decimator->countTaps;
+
+    // Low-pass below the output Nyquist frequency, Blackman-Harris windowed, unity gain
+    double cutoff = DECIMATOR_CUTOFF / (2.0 * decimator->factor);   // cycles per input sample
+    double center = (double)(decimator->countTaps - 1) / 2;
+    double sum = 0;
+    for (size_t i = 0; i < decimator->countTaps; i++) {
+        double x = 2 * cutoff * ((double)i - center);
+        double sinc = (x == 0) ? 1 : sin(M_PI * x) / (M_PI * x);
+        double tap = 2 * cutoff * sinc * WindowFunction(WINDOW_BLACKMAN_HARRIS, i, decimator->countTaps);
+        decimator->taps[i] = (real_t)tap;
+        sum += tap;
+    }
+    for (size_t i = 0; i < decimator->countTaps; i++) {
+        decimator->taps[i] = (real_t)(decimator->taps[i] / sum);
+    }
+}
 
-typedef struct interval_tag {
-    size_t id;      // label id for this interval
-    double start;
-    double end;
-} interval_t;
+void DecimatorDestroy(decimator_t *decimator) {
+    if (decimator->taps != NULL) {
+        free(decimator->taps);
+        decimator->taps = NULL;
+    }
+    if (decimator->history != NULL) {
+        free(decimator->history);
+        decimator->history = NULL;
+    }
+}
 
-typedef struct label_tag {
-    const char *labelText;
-    const char *labelGroup;
-    running_stats_t *stats;
-    double scale;
-    double limit;
-    size_t matchingGroup;
-    double minDuration;
-    int onlyAfterEvent;
-    double onlyWithinInterval;
-    double lastFinished;
-} label_t;
+// Decimate samples, returning the number of output samples written (at most sampleCount / factor + 1).  The output may be the same buffer as the input.
+size_t DecimatorProcess(decimator_t *decimator, const int16_t *samples, size_t sampleCount, int16_t *output) {
+    size_t countOutput = 0;
+    for (size_t i = 0; i < sampleCount; i++) {
+        real_t value = (real_t)samples[i];
+        decimator->history[decimator->historyIndex] = value;
+        decimator->history[decimator->historyIndex + decimator->countTaps] = value;
+        if (++decimator->historyIndex >= decimator->countTaps) decimator->historyIndex = 0;
+        if (--decimator->phase == 0) {
+            decimator->phase = decimator->factor;
+            real_t filtered;
+            decimator->kernels.project(&filtered, decimator->history + decimator->historyIndex, &decimator->dotFirst, decimator->dotOffsets, decimator->taps, 1);
+            long rounded = lround((double)filtered);
+            output[countOutput++] = (int16_t)(rounded > 32767 ? 32767 : rounded < -32768 ? -32768 : rounded);
+        }
+    }
+    return countOutput;
+}
 
-// Detector state
-typedef struct audioid_tag {
-    // Configuration
-    const char *filename;
-    const char *labelFile;
+// Metric for the distance between the input bucket means and a label's template
+typedef enum {
+    DISTANCE_L1 = 0,            // mean absolute difference
+    DISTANCE_NORMALIZED,        // mean absolute difference, with both vectors scaled to unit L2 norm
+    DISTANCE_COSINE,            // one minus the cosine similarity
+    DISTANCE_ZSCORE,            // total absolute difference in units of the label's learned standard deviation
+    DISTANCE_COUNT
+} distance_metric_t;
 
-    unsigned int sampleRate;
-    size_t windowSize;
-    size_t countBuckets;
-    size_t cycleCount;
-    bool verbose;
-    int visualize;
-    bool learn;
+static const char *distanceMetricNames[DISTANCE_COUNT] = { "l1", "normalized", "cosine", "zscore" };
 
-    // Audio device capture
-    ma_device_config deviceConfig;
-    ma_device device;
-    bool deviceInitialized;
+static const char *DistanceMetricName(distance_metric_t metric) {
+    if (metric < 0 || metric >= DISTANCE_COUNT) return NULL;
+    return distanceMetricNames[metric];
+}
 
-    // Audio file input
-    ma_decoder_config decoderConfig;
-    ma_decoder decoder;
-    bool decoderInitialized;
+static bool DistanceMetricFromName(const char *name, distance_metric_t *outMetric) {
+    for (int i = 0; i < DISTANCE_COUNT; i++) {
+        if (strcmp(name, distanceMetricNames[i]) == 0) {
+            *outMetric = (distance_metric_t)i;
+            return true;
+        }
+    }
+    return false;
+}
 
-    // Labels
+#define DISTANCE_NORM_MIN 0.001             // (normalized) norms are limited to at least this, so near-silence does not scale up to unit norm
+#define DISTANCE_COSINE_DIVISOR_MIN 0.00001 // (cosine) a smaller product of norms is treated as no similarity
+
+// Label templates: the learned stats packed for scoring, one row per label (rebuilt from the stats when they change, rather than read through them per frame)
+typedef struct {
+    distance_metric_t metric;
     size_t countLabels;
-    label_t *labels;
+    size_t countBuckets;
+    size_t stride;          // values per row (countBuckets padded so that each row is aligned)
+    size_t capacity;        // allocated values per matrix
+    double *mean;           // countLabels x stride matrix of learned means
+    double *invStddev;      // countLabels x stride matrix of 1/stddev of the learned values (1 where there is no spread, so the difference is unscaled)
+    double *normalized;     // countLabels x stride matrix of learned means divided by their (limited) norm
+    double *norm;           // L2 norm of each label's means
+    double *input;          // countBuckets scratch values for the transformed input
+    size_t *order;          // bucket order for early abandoning, most variable across the labels first (built by TemplatesOrder())
+    double *ordered;        // countLabels x stride matrix of the compared values (means, or normalized means), buckets in order
+    double *orderedWeights; // countLabels x stride matrix of the inverse spreads (zscore), buckets in order
+    double *orderedInput;   // countBuckets scratch values of the input, buckets in order
+    size_t orderedCapacity; // allocated values per ordered matrix
+    uint8_t *quantized;     // countLabels x quantizedStride matrix of the compared values quantized to bytes (built by TemplatesQuantize())
+    uint8_t *quantizedInput;    // quantizedStride scratch bytes of the quantized input (zero padded)
+    uint32_t *quantizedDistances;   // countLabels scratch sums of absolute byte differences
+    size_t quantizedStride; // bytes per quantized row (countBuckets padded so that each row is aligned)
+    size_t quantizedCapacity;   // allocated bytes of the quantized matrix
+    double quantizeOffset;  // value quantized to 0...
+    double quantizeScale;   // ...and steps per unit of value
+} templates_t;
+
+// Quantize a compared value to a byte, rounded and clamped to 0-255
+static inline uint8_t TemplatesQuantizeValue(const templates_t *templates, double value) {
+    double steps = (value - templates->quantizeOffset) * templates->quantizeScale + 0.5;
+    if (!(steps > 0)) return 0;
+    if (steps >= 255) return 255;
+    return (uint8_t)steps;
+}
 
-    // Intervals
-    interval_t *intervals;
-    size_t maxIntervals;
-    size_t countIntervals;
-    interval_t *lastInterval;
-    size_t nextInterval;
-
-    // State
-    size_t totalSamples;
-    int stateIndex;
-    int lastState;
-    int stateHistory[MODAL_SIZE];
-    double stateChangeTime;
-    double lastReport;
-    bool stateLatched;
-
-    // Current FFT fingerprint
-    fingerprint_t fingerprint;
-} audioid_t;
-
-static const char *AudioIdGetLabelName(audioid_t *audioid, size_t id) {
-    if (id >= audioid->countLabels) return NULL;
-    return audioid->labels[id].labelText;
+// Size the template matrix (contents undefined until each row is set)
+void TemplatesResize(templates_t *templates, size_t countLabels, size_t countBuckets) {
+    size_t stride = (countBuckets + (ALIGNED_BYTES / sizeof(double)) - 1) / (ALIGNED_BYTES / sizeof(double)) * (ALIGNED_BYTES / sizeof(double));
+    if (templates->mean == NULL || countLabels * stride > templates->capacity || countBuckets > templates->stride) {
+        if (templates->mean != NULL) AlignedFree(templates->mean);
+        if (templates->invStddev != NULL) AlignedFree(templates->invStddev);
+        if (templates->normalized != NULL) AlignedFree(templates->normalized);
+        if (templates->norm != NULL) free(templates->norm);
+        if (templates->input != NULL) AlignedFree(templates->input);
+        templates->mean = (double *)AlignedAlloc(sizeof(double) * countLabels * stride);
+        templates->invStddev = (double *)AlignedAlloc(sizeof(double) * countLabels * stride);
+        templates->normalized = (double *)AlignedAlloc(sizeof(double) * countLabels * stride);
+        templates->norm = (double *)malloc(sizeof(double) * (countLabels > 0 ? countLabels : 1));
+        templates->input = (double *)AlignedAlloc(sizeof(double) * stride);
+        if (templates->mean == NULL || templates->invStddev == NULL || templates->normalized == NULL || templates->norm == NULL || templates->input == NULL) { fprintf(stderr, "ERROR: Memory failure (templates).\n"); exit(-1); }
+        templates->capacity = countLabels * stride;
+    }
+    templates->countLabels = countLabels;
+    templates->countBuckets = countBuckets;
+    templates->stride = stride;
 }
 
-static size_t AudioIdGetLabelId(audioid_t *audioid, const char *labelText) {
-    // Return existing label id
-    for (size_t id = 0; id < audioid->countLabels; id++) {
-        if (strcmp(audioid->labels[id].labelText, labelText) == 0) {
-            return id;
-        }
+// Set a label's norm and normalized row from its means
+void TemplatesSetNorm(templates_t *templates, size_t id) {
+    const double *mean = templates->mean + id * templates->stride;
+    double *normalized = templates->normalized + id * templates->stride;
+    double sumSquares = 0;
+    for (size_t i = 0; i < templates->countBuckets; i++) {
+        sumSquares += mean[i] * mean[i];
     }
-
-    // Check limits
-    if (audioid->countLabels >= MAX_STATES) {
-        fprintf(stderr, "ERROR: Too many states (%zu)\n", audioid->countLabels);
-        exit(-1);
+    templates->norm[id] = sqrt(sumSquares);
+    double normA = templates->norm[id] < DISTANCE_NORM_MIN ? DISTANCE_NORM_MIN : templates->norm[id];
+    for (size_t i = 0; i < templates->stride; i++) {
+        normalized[i] = mean[i] / normA;
     }
+}
 
-    // Add the new label
-    audioid->labels = (label_t *)realloc((void *)audioid->labels, sizeof(label_t) * (audioid->countLabels + 1));
-    if (audioid->labels == NULL) { fprintf(stderr, "ERROR: Memory failure (labels).\n"); exit(-1); }
-
-    audioid->labels[audioid->countLabels].labelText = strdup(labelText);
+// Set a label's row of the templates from its learned stats
+void TemplatesSet(templates_t *templates, size_t id, const running_stats_t *stats) {
+    double *mean = templates->mean + id * templates->stride;
+    double *invStddev = templates->invStddev + id * templates->stride;
+    for (size_t i = 0; i < templates->stride; i++) {
+        if (i < templates->countBuckets) {
+            double stddev = running_stats_stddev(stats, i);
+            mean[i] = running_stats_mean(stats, i);
+            invStddev[i] = stddev > 0 ? 1.0 / stddev : 1;
+        } else {
+            mean[i] = 0;
+            invStddev[i] = 0;
+        }
+    }
+    TemplatesSetNorm(templates, id);
+}
 
-    // Initial '?'/'!'/ prefix to flag label (unused)
-    bool flagged = (labelText[0] == '?') || (labelText[0] == '!');
+void TemplatesFree(templates_t *templates) {
+    if (templates->mean != NULL) { AlignedFree(templates->mean); templates->mean = NULL; }
+    if (templates->invStddev != NULL) { AlignedFree(templates->invStddev); templates->invStddev = NULL; }
+    if (templates->normalized != NULL) { AlignedFree(templates->normalized); templates->normalized = NULL; }
+    if (templates->norm != NULL) { free(templates->norm); templates->norm = NULL; }
+    if (templates->input != NULL) { AlignedFree(templates->input); templates->input = NULL; }
+    if (templates->order != NULL) { free(templates->order); templates->order = NULL; }
+    if (templates->ordered != NULL) { AlignedFree(templates->ordered); templates->ordered = NULL; }
+    if (templates->orderedWeights != NULL) { AlignedFree(templates->orderedWeights); templates->orderedWeights = NULL; }
+    if (templates->orderedInput != NULL) { AlignedFree(templates->orderedInput); templates->orderedInput = NULL; }
+    if (templates->quantized != NULL) { AlignedFree(templates->quantized); templates->quantized = NULL; }
+    if (templates->quantizedInput != NULL) { AlignedFree(templates->quantizedInput); templates->quantizedInput = NULL; }
+    if (templates->quantizedDistances != NULL) { free(templates->quantizedDistances); templates->quantizedDistances = NULL; }
+    templates->orderedCapacity = 0;
+    templates->quantizedCapacity = 0;
+    templates->quantizedStride = 0;
+    templates->countLabels = 0;
+    templates->capacity = 0;
+    templates->stride = 0;
+}
 
-    // Add the new label's group
-    char *group = strdup(labelText + (flagged ? 1 : 0)); // Duplicate (and remove flag prefix)
-    char *groupSep = strchr(group, '/');
-    if (groupSep != NULL) *groupSep = '\0'; // Leave only the group
-    audioid->labels[audioid->countLabels].labelGroup = group;
+// Distance between the input bucket means and a label's template (the reference for Distances())
+double Distance(size_t countBuckets, const double *input, const templates_t *templates, size_t id) {
+    const double *mean = templates->mean + id * templates->stride;
+    switch (templates->metric) {
+        case DISTANCE_COSINE: {
+            double sumAB = 0;
+            double sumBB = 0;
+            for (size_t i = 0; i < countBuckets; i++) {
+                double a = mean[i];
+                double b = input[i];
+                sumAB += a * b;
+                sumBB += b * b;
+            }
+            double divisor = templates->norm[id] * sqrt(sumBB);
 
-    // Stats
-    audioid->labels[audioid->countLabels].stats = (running_stats_t *)malloc(sizeof(running_stats_t) * audioid->countBuckets);
-    for (size_t i = 0; i < audioid->countBuckets; i++) {
-        running_stats_clear(&audioid->labels[audioid->countLabels].stats[i]);
-    }
+            // Range -1=opposite to 1=same 
+            double cosineSimilarity;
+            if (divisor < DISTANCE_COSINE_DIVISOR_MIN) {
+                cosineSimilarity = 0;
+            } else {
+                cosineSimilarity = sumAB / divisor;
+            }
 
-    // Other per-label values
-    audioid->labels[audioid->countLabels].scale = 1.0;
-    audioid->labels[audioid->countLabels].limit = -1.0; // < 0 = no limit applied
-    audioid->labels[audioid->countLabels].minDuration = -1.0; // < 0 = disabled
-    audioid->labels[audioid->countLabels].onlyAfterEvent = LABEL_ID_UNKNOWN;
-    audioid->labels[audioid->countLabels].onlyWithinInterval = 0.0;
-    audioid->labels[audioid->countLabels].lastFinished = -1.0;
+            return 1.0 - cosineSimilarity;
+        }
 
-    // Find an earlier matching group
-    size_t matchingGroup = audioid->countLabels;
-    for (size_t id = 0; id < audioid->countLabels; id++) {
-        if (strcmp(audioid->labels[id].labelGroup, group) == 0) {
-            matchingGroup = id;
-            break;
+        case DISTANCE_ZSCORE: {
+            // Distribution comparison: |meanA - meanB| * invStddevA
+            const double *invStddev = templates->invStddev + id * templates->stride;
+            double sumZ = 0;
+            for (size_t i = 0; i < countBuckets; i++) {
+                double meanDiff = mean[i] - input[i];
+                sumZ += fabs(meanDiff * invStddev[i]);
+            }
+            return sumZ;
         }
-    }
-    audioid->labels[audioid->countLabels].matchingGroup = matchingGroup;
 
-    // Return the new label id
-    return audioid->countLabels++;
-}
+        case DISTANCE_NORMALIZED: {
+            double sumBB = 0;
+            for (size_t i = 0; i < countBuckets; i++) {
+                double b = input[i];
+                sumBB += b * b;
+            }
+            double normA = templates->norm[id];
+            double normB = sqrt(sumBB);
+            if (normA < DISTANCE_NORM_MIN) normA = DISTANCE_NORM_MIN;
+            if (normB < DISTANCE_NORM_MIN) normB = DISTANCE_NORM_MIN;
+
+            double totalDistance = 0;
+            for (size_t i = 0; i < countBuckets; i++) {
+                double a = mean[i] / normA;
+                double b = input[i] / normB;
+                double diff = b - a;
+                double dist = fabs(diff);
+                totalDistance += dist;
+            }
+            double result = totalDistance / countBuckets;
+            return result;
+        }
 
-static void AudioIdFreeLabels(audioid_t *audioid) {
-    for (size_t id = 0; id < audioid->countLabels; id++) {
-        free((void *)audioid->labels[id].labelText);
-        free((void *)audioid->labels[id].labelGroup);
-        free((void *)audioid->labels[id].stats);
+        case DISTANCE_L1:
+        default: {
+            double totalDistance = 0;
+            for (size_t i = 0; i < countBuckets; i++) {
+                double a = mean[i];
+                double b = input[i];
+                double diff = b - a;
+                double dist = fabs(diff);
+                totalDistance += dist;
+            }
+            double result = totalDistance / countBuckets;
+            return result;
+        }
     }
-    free(audioid->labels);
-    audioid->labels = NULL;
-    audioid->countLabels = 0;
 }
 
-
-
-static size_t AudioIdAddInterval(audioid_t *audioid, const char *label, double start, double end) {
-    // Allocate more space
-    if (audioid->countIntervals >= audioid->maxIntervals) {
-        audioid->maxIntervals += audioid->maxIntervals + 1;
-        audioid->intervals = (interval_t *)realloc(audioid->intervals, sizeof(interval_t) * audioid->maxIntervals);
-        if (audioid->intervals == NULL) { fprintf(stderr, "ERROR: Memory failure (intervals).\n"); exit(-1); }
-    }
-    interval_t *newInterval = &audioid->intervals[audioid->countIntervals];
-    memset(newInterval, 0, sizeof(*newInterval));
-    newInterval->id = AudioIdGetLabelId(audioid, label);
-    newInterval->start = start;
-    newInterval->end = end;
-    if (audioid->countIntervals > 0 && start < audioid->intervals[audioid->countIntervals - 1].end) {
-        fprintf(stderr, "WARNING: Interval #%zu starts (%0.2f) before the previous interval ends (%0.2f) -- intervals must not overlap.\n", audioid->countIntervals, start, audioid->intervals[audioid->countIntervals - 1].end);
+// Normalize the input as the normalized metric does, returns the (scratch) normalized values
+static const double *TemplatesNormalizeInput(templates_t *templates, size_t countBuckets, const double *input) {
+    double sumBB = 0;
+    for (size_t i = 0; i < countBuckets; i++) {
+        sumBB += input[i] * input[i];
     }
-    if (end < start) {
-        fprintf(stderr, "WARNING: Interval #%zu ends (%0.2f) before it starts (%0.2f) -- does not form a valid interval.\n", audioid->countIntervals, end, start);
+    double normB = sqrt(sumBB);
+    if (normB < DISTANCE_NORM_MIN) normB = DISTANCE_NORM_MIN;
+    for (size_t i = 0; i < countBuckets; i++) {
+        templates->input[i] = input[i] / normB;
     }
-    audioid->countIntervals++;
-    return audioid->countIntervals - 1;
+    return templates->input;
 }
 
-
-
-// Process sample data
-static void AudioIdProcess(audioid_t *audioid, int16_t *samples, size_t sampleCount) {
-    audioid->totalSamples += sampleCount;
-    if (audioid->verbose) fprintf(stderr, "SAMPLE-DATA: %zu samples (%zu ms), total %0.2f seconds\n", sampleCount, (1000 * sampleCount / audioid->sampleRate), (double)audioid->totalSamples / audioid->sampleRate);
-    size_t offset = 0;
-    while (offset < sampleCount) {
-        offset += FingerprintAddSamples(&audioid->fingerprint, samples + offset, sampleCount - offset);
-        size_t countResults = 0;
-        double *buckets = FingerprintBuckets(&audioid->fingerprint, &countResults);
-        if (buckets != NULL && countResults > 0) {            
-            // Current recording time
-            double time = (double)audioid->totalSamples / audioid->sampleRate;
-
-            // For live recordings, use the system epoch time
-            if (audioid->filename == NULL) {
-                time = TimeNow();
+// Distances between the input bucket means and a range of labels' templates (count labels from first, to distances[0] onwards), as Distance(), in one vectorized kernel call over the template matrix (anything depending only on the templates is precomputed, leaving only per-input terms per call)
+void DistancesRange(const kernels_t *kernels, size_t countBuckets, const double *input, templates_t *templates, size_t first, size_t count, double *distances) {
+    size_t offset = first * templates->stride;
+    switch (templates->metric) {
+        case DISTANCE_COSINE: {
+            // Dot products with the learned means, divided by the precomputed template norms
+            double sumBB = 0;
+            for (size_t i = 0; i < countBuckets; i++) {
+                sumBB += input[i] * input[i];
             }
-
-            // If we are making our way through the labelled intervals...
-            interval_t *interval = NULL;
-            if (audioid->countIntervals > 0) {
-                // Advance until we are within one
-                while (audioid->nextInterval < audioid->countIntervals) {
-                    // Next interval has not started yet (between intervals)
-                    if (time < audioid->intervals[audioid->nextInterval].start) {
-                        break;
-                    }
-                    // Within the next interval
-                    if (time < audioid->intervals[audioid->nextInterval].end) {
-                        interval = &audioid->intervals[audioid->nextInterval];
-                        break;
-                    }
-                    // After the next interval
-                    audioid->nextInterval++;
-                }
+            double normB = sqrt(sumBB);
+            kernels->dot(distances, input, templates->mean + offset, templates->stride, countBuckets, count);
+            for (size_t n = 0; n < count; n++) {
+                double divisor = templates->norm[first + n] * normB;
+                double cosineSimilarity = divisor < DISTANCE_COSINE_DIVISOR_MIN ? 0 : distances[n] / divisor;
+                distances[n] = 1.0 - cosineSimilarity;
             }
+            break;
+        }
 
-            // Interval boundary
-            if (audioid->lastInterval != interval) {
-                if (audioid->verbose || true) {
-                    if (audioid->lastInterval != NULL) {
-                        fprintf(stderr, "\n--- END INTERVAL ---\n");
-                    }
+        case DISTANCE_ZSCORE:
+            // Differences weighted by the precomputed inverse spreads
+            kernels->distanceWeightedL1(distances, input, templates->mean + offset, templates->invStddev + offset, templates->stride, countBuckets, count);
+            break;
 
-                    if (interval != NULL) {
-                        fprintf(stderr, "\n--- @%.2f INTERVAL #%d (%.2f-%.2f): %s ---\n", time, (int)audioid->nextInterval, audioid->intervals[audioid->nextInterval].start, audioid->intervals[audioid->nextInterval].end, AudioIdGetLabelName(audioid, audioid->intervals[audioid->nextInterval].id));
-                    }
-                }
-                audioid->lastInterval = interval;
+        case DISTANCE_NORMALIZED:
+            // Normalize the input once, against the precomputed normalized templates
+            kernels->distanceL1(distances, TemplatesNormalizeInput(templates, countBuckets, input), templates->normalized + offset, templates->stride, countBuckets, count);
+            for (size_t n = 0; n < count; n++) {
+                distances[n] /= countBuckets;
             }
+            break;
 
-            // Add stats to current interval
-            if (interval != NULL && audioid->learn) {
-                size_t id = interval->id;
-                running_stats_t *stats = audioid->labels[id].stats;
-                for (size_t i = 0; i < audioid->countBuckets; i++) {
-                    running_stats_add(&stats[i], audioid->fingerprint.buckets[i]);
-                }
+        case DISTANCE_L1:
+        default:
+            kernels->distanceL1(distances, input, templates->mean + offset, templates->stride, countBuckets, count);
+            for (size_t n = 0; n < count; n++) {
+                distances[n] /= countBuckets;
             }
+            break;
+    }
+}
 
-            // Add to cycled stats (only 1-cycle in learning mode)
-            FingerprintAccumulateStats(&audioid->fingerprint);
-            running_stats_t *inputStats = FingerprintStats(&audioid->fingerprint);
-
-//buckets = FingerprintMeanStats(&audioid->fingerprint);
-
-            // Recognition mode
-            int closestLabel = LABEL_ID_UNKNOWN;
-            double closestDistance = 0;
-            if (!audioid->learn) {
-                for (size_t id = 0; id < audioid->countLabels; id++) {
-                    running_stats_t *stats = audioid->labels[id].stats;
-                    double scale = audioid->labels[id].scale;
-                    double limit = audioid->labels[id].limit;
-                    double rawDistance = Distance(audioid->countBuckets, inputStats, stats);
-                    double distance = scale * rawDistance;
-                    bool withinLimit = (limit < 0) || (distance < limit);
-                    if (withinLimit && (closestLabel == LABEL_ID_UNKNOWN || distance < closestDistance)) {
-                        closestLabel = (int)id;
-                        closestDistance = distance;
-                    }
-                }
-
+// Distances between the input bucket means and every label's template
+void Distances(const kernels_t *kernels, size_t countBuckets, const double *input, templates_t *templates, double *distances) {
+    DistancesRange(kernels, countBuckets, input, templates, 0, templates->countLabels, distances);
+}
 
-                // ------ STATE ------
-                // State is matching group
-                int thisState = (closestLabel == LABEL_ID_UNKNOWN) ? LABEL_ID_UNKNOWN : (int)audioid->labels[closestLabel].matchingGroup;
-
-                // Add to modal filter
-                audioid->stateHistory[audioid->stateIndex % MODAL_SIZE] = thisState;
-                audioid->stateIndex++;
-
-                // Modal filter
-                int unknownCount = 0;
-                int matchingGroupCount[MAX_STATES] = {0};
-                for (size_t i = 0; i < MODAL_SIZE; i++) {
-                    int label = audioid->stateHistory[i];
-                    if (label == LABEL_ID_UNKNOWN) {
-                        unknownCount++;
-                    } else if (label < audioid->countLabels) {
-                        size_t group = audioid->labels[label].matchingGroup;
-                        if (group < MAX_STATES) matchingGroupCount[group]++;
-                        else { fprintf(stderr, "ERROR: Internal error in group index (@%zu = label %d = group %zu)\n", i, label, group); exit(-1); }
-                    } else { fprintf(stderr, "ERROR: Internal error in history label (@%zu = label %d)\n", i, label); exit(-1); }
-                }
-                int currentState = LABEL_ID_UNKNOWN;
-                int maxCount = unknownCount;
-                for (size_t i = 0; i < audioid->countLabels; i++) {
-                    if (matchingGroupCount[i] > maxCount) {
-                        maxCount = matchingGroupCount[i];
-                        currentState = (int)i;
-                    }
-                }
+// Nearest label by scanning every label's distance: scale * the distance of Distances(), of those within their limit (ties to the lowest id), returns the label (or -1 for none) and sets its scaled distance
+static int ScanNearest(const kernels_t *kernels, templates_t *templates, const double *input, const double *scales, const double *limits, double *distances, double *outDistance) {
+    int closest = -1;
+    double closestDistance = 0;
+    Distances(kernels, templates->countBuckets, input, templates, distances);
+    for (size_t id = 0; id < templates->countLabels; id++) {
+        double distance = scales[id] * distances[id];
+        bool withinLimit = (limits[id] < 0) || (distance < limits[id]);
+        if (withinLimit && (closest < 0 || distance < closestDistance)) {
+            closest = (int)id;
+            closestDistance = distance;
+        }
+    }
+    *outDistance = closestDistance;
+    return closest;
+}
 
-                // Previous state duration
-                double duration = time - audioid->stateChangeTime;
-
-                // Hypothesis change
-                if (currentState != audioid->lastState) {
-                    // Latched event end
-                    if (audioid->lastState != LABEL_ID_UNKNOWN && audioid->stateLatched) {
-                        audioid->labels[audioid->lastState].lastFinished = time;
-                        if (!audioid->visualize) {
-                            fprintf(stdout, "%.3f\te:end\t%s\t%.3f\n", time, (audioid->lastState == LABEL_ID_UNKNOWN ? "-" : audioid->labels[audioid->lastState].labelGroup), duration);
-                            fflush(stdout);
-                        }
-                    }
-                    audioid->stateLatched = false;
-                    audioid->stateChangeTime = time;
-                    audioid->lastState = currentState;
-                    duration = 0;
-                    audioid->lastReport = 0;    // force report
-                }
+// Quantize the compared values of the templates (means, or normalized means) to bytes for TemplatesNearestQuantized(), with one linear scale over the range of all the labels' values
+void TemplatesQuantize(templates_t *templates) {
+    size_t countLabels = templates->countLabels, countBuckets = templates->countBuckets;
+    size_t stride = (countBuckets + ALIGNED_BYTES - 1) / ALIGNED_BYTES * ALIGNED_BYTES;
+    if (templates->quantized == NULL || countLabels * stride > templates->quantizedCapacity || stride > templates->quantizedStride) {
+        if (templates->quantized != NULL) AlignedFree(templates->quantized);
+        if (templates->quantizedInput != NULL) AlignedFree(templates->quantizedInput);
+        if (templates->quantizedDistances != NULL) free(templates->quantizedDistances);
+        templates->quantized = (uint8_t *)AlignedAlloc((countLabels > 0 ? countLabels : 1) * stride);
+        templates->quantizedInput = (uint8_t *)AlignedAlloc(stride);
+        templates->quantizedDistances = (uint32_t *)malloc(sizeof(uint32_t) * (countLabels > 0 ? countLabels : 1));
+        if (templates->quantized == NULL || templates->quantizedInput == NULL || templates->quantizedDistances == NULL) { fprintf(stderr, "ERROR: Memory failure (templates).\n"); exit(-1); }
+        templates->quantizedCapacity = (countLabels > 0 ? countLabels : 1) * stride;
+    }
+    templates->quantizedStride = stride;
+
+    // The range of the values maps to 0-255 (inputs outside it are clamped, which adds the same to the distance of every label)
+    const double *rows = (templates->metric == DISTANCE_NORMALIZED) ? templates->normalized : templates->mean;
+    double minimum = HUGE_VAL, maximum = -HUGE_VAL;
+    for (size_t id = 0; id < countLabels; id++) {
+        for (size_t i = 0; i < countBuckets; i++) {
+            double value = rows[id * templates->stride + i];
+            if (value < minimum) minimum = value;
+            if (value > maximum) maximum = value;
+        }
+    }
+    templates->quantizeOffset = (minimum <= maximum) ? minimum : 0;
+    templates->quantizeScale = (maximum > minimum) ? 255 / (maximum - minimum) : 1;
+    memset(templates->quantizedInput, 0, stride);
+    for (size_t id = 0; id < countLabels; id++) {
+        uint8_t *quantized = templates->quantized + id * stride;
+        for (size_t i = 0; i < stride; i++) {
+            quantized[i] = i < countBuckets ? TemplatesQuantizeValue(templates, rows[id * templates->stride + i]) : 0;
+        }
+    }
+}
 
-                // Report current state
-                bool report = false;
-                report |= audioid->lastReport == 0; // just changed
-                report |= time >= audioid->lastReport + REPORT_MAX_INTERVAL;    // maximum interval exceeded
-                if (report) {
-                    // Report 'hear'
-                    if (!audioid->visualize) {
-                        fprintf(stdout, "%.3f\t%s\t%s\t%.3f\n", time, audioid->stateLatched ? "e:cont" : "hear", (currentState == LABEL_ID_UNKNOWN ? "-" : audioid->labels[currentState].labelGroup), duration);
-                        fflush(stdout);
-                    }
-                    audioid->lastReport = time;
-                }
+// Nearest label to the input by scaled distance, as ScanNearest(), from the L1 distances between the quantized input and templates (for the l1 and normalized metrics, after TemplatesQuantize()): an approximation of the distances, so a label whose distance is within the quantization error of the nearest may be chosen instead
+int TemplatesNearestQuantized(const kernels_t *kernels, templates_t *templates, const double *input, const double *scales, const double *limits, double *outDistance) {
+    size_t countLabels = templates->countLabels, countBuckets = templates->countBuckets;
+    const double *query = (templates->metric == DISTANCE_NORMALIZED) ? TemplatesNormalizeInput(templates, countBuckets, input) : input;
+    for (size_t i = 0; i < countBuckets; i++) {
+        templates->quantizedInput[i] = TemplatesQuantizeValue(templates, query[i]);
+    }
+    kernels->distanceSad(templates->quantizedDistances, templates->quantizedInput, templates->quantized, templates->quantizedStride, countBuckets, countLabels);
+
+    // (in units of the unquantized values, divided by the bucket count as Distances() does)
+    double unit = 1 / (templates->quantizeScale * countBuckets);
+    int closest = -1;
+    double closestDistance = 0;
+    for (size_t id = 0; id < countLabels; id++) {
+        double distance = scales[id] * (templates->quantizedDistances[id] * unit);
+        bool withinLimit = (limits[id] < 0) || (distance < limits[id]);
+        if (withinLimit && (closest < 0 || distance < closestDistance)) {
+            closest = (int)id;
+            closestDistance = distance;
+        }
+    }
+    *outDistance = closestDistance;
+    return closest;
+}
 
-                // Latch state?
-                if (!audioid->stateLatched && currentState != LABEL_ID_UNKNOWN) {
-                    bool latch = true;
-                    // If there is not required minimum duration set (>=0): do not latch; or there is and it has not yet occurred: do not latch
-                    if (audioid->labels[currentState].minDuration < 0) latch = false;
-                    if (audioid->labels[currentState].minDuration >= 0 && duration < audioid->labels[currentState].minDuration) latch = false;
-                    // If there is a required previous event...
-                    if (audioid->labels[currentState].onlyAfterEvent >= 0) {
-                        double lastFinished = audioid->labels[audioid->labels[currentState].onlyAfterEvent].lastFinished;
-                        double onlyWithinInterval = audioid->labels[currentState].onlyWithinInterval;
-                        // ...if it has not occurred, or finished longer ago than the maximum interval before this event started: do not latch 
-                        if (lastFinished < 0 || time > lastFinished + onlyWithinInterval + duration) latch = false;
-                    }
-                    if (latch) {
-                        fprintf(stdout, "%.3f\te:start\t%s\t%.3f\n", time, (audioid->lastState == LABEL_ID_UNKNOWN ? "-" : audioid->labels[audioid->lastState].labelGroup), duration);
-                        audioid->stateLatched = true;
-                        audioid->lastReport = time;
-                    }
-                }
 
-                // ------------
-            }
+#define ABANDON_SLACK 1e-9      // relative allowance for the rounding of a partial sum in a different order from the full distance
 
-            // Output
-            if (audioid->verbose) fprintf(stderr, ">>> %d results.\n", (int)countResults);
-            if (audioid->visualize) {
-if (audioid->visualize == 1 || (audioid->visualize == 2 && ((audioid->learn || audioid->labelFile == NULL || (interval != NULL && strcmp(audioid->labels[interval->id].labelGroup, "silence") != 0)) && audioid->fingerprint.cycle == 0))) // only output labelled regions
-{
-                const char *closestLabelName = closestLabel == LABEL_ID_UNKNOWN ? NULL : audioid->labels[closestLabel].labelText;
-                const char *closestGroupName = closestLabel == LABEL_ID_UNKNOWN ? NULL : audioid->labels[closestLabel].labelGroup;
-                const char *intervalGroup = interval != NULL ? audioid->labels[interval->id].labelGroup : NULL;
-                
-                bool showMatch = !audioid->learn;
+// An index and the value it is ordered by
+typedef struct {
+    size_t index;
+    double key;
+} order_item_t;
+
+// Largest key first, ties by the lowest index
+static int OrderItemCompareDescending(const void *a, const void *b) {
+    const order_item_t *itemA = (const order_item_t *)a;
+    const order_item_t *itemB = (const order_item_t *)b;
+    if (itemA->key != itemB->key) return (itemA->key > itemB->key) ? -1 : 1;
+    return (itemA->index < itemB->index) ? -1 : (itemA->index > itemB->index) ? 1 : 0;
+}
 
-                int groupMatchInterval = -1;    // don't care
-                if (intervalGroup != NULL) {
-                    if (closestGroupName == NULL || strcmp(intervalGroup, closestGroupName) != 0) {
-                        groupMatchInterval = 0; // Does not match
-                    } else {
-                        groupMatchInterval = 1; // Matches
-                    }
-                }
+// Order the buckets for early abandoning with TemplatesNearest(), by the variance of the compared values across the labels (where the labels differ most, the distances grow fastest), and copy the compared values in that order
+void TemplatesOrder(templates_t *templates) {
+    size_t countLabels = templates->countLabels, countBuckets = templates->countBuckets, stride = templates->stride;
+    if (templates->ordered == NULL || countLabels * stride > templates->orderedCapacity || templates->order == NULL) {
+        if (templates->order != NULL) free(templates->order);
+        if (templates->ordered != NULL) AlignedFree(templates->ordered);
+        if (templates->orderedWeights != NULL) AlignedFree(templates->orderedWeights);
+        if (templates->orderedInput != NULL) AlignedFree(templates->orderedInput);
+        templates->order = (size_t *)malloc(sizeof(size_t) * stride);
+        templates->ordered = (double *)AlignedAlloc(sizeof(double) * (countLabels > 0 ? countLabels : 1) * stride);
+        templates->orderedWeights = (double *)AlignedAlloc(sizeof(double) * (countLabels > 0 ? countLabels : 1) * stride);
+        templates->orderedInput = (double *)AlignedAlloc(sizeof(double) * stride);
+        if (templates->order == NULL || templates->ordered == NULL || templates->orderedWeights == NULL || templates->orderedInput == NULL) { fprintf(stderr, "ERROR: Memory failure (templates).\n"); exit(-1); }
+        templates->orderedCapacity = (countLabels > 0 ? countLabels : 1) * stride;
+    }
 
-                DebugVisualizeValues(inputStats, countResults, showMatch, groupMatchInterval, closestGroupName, closestLabelName, closestDistance);
+    // Variance of each bucket's compared values across the labels
+    const double *rows = (templates->metric == DISTANCE_NORMALIZED) ? templates->normalized : templates->mean;
+    running_stats_t stats;
+    running_stats_init(&stats, countBuckets);
+    real_t *values = (real_t *)malloc(sizeof(real_t) * (countBuckets > 0 ? countBuckets : 1));
+    order_item_t *variance = (order_item_t *)malloc(sizeof(order_item_t) * (countBuckets > 0 ? countBuckets : 1));
+    if (values == NULL || variance == NULL) { fprintf(stderr, "ERROR: Memory failure (templates).\n"); exit(-1); }
+    for (size_t id = 0; id < countLabels; id++) {
+        const double *weight = templates->invStddev + id * stride;
+        for (size_t i = 0; i < countBuckets; i++) {
+            values[i] = (real_t)(rows[id * stride + i] * (templates->metric == DISTANCE_ZSCORE ? weight[i] : 1));
+        }
+        running_stats_add(&stats, values);
+    }
+    for (size_t i = 0; i < countBuckets; i++) {
+        variance[i].index = i;
+        variance[i].key = running_stats_variance(&stats, i);
+    }
+    qsort(variance, countBuckets, sizeof(order_item_t), OrderItemCompareDescending);
+    for (size_t i = 0; i < countBuckets; i++) {
+        templates->order[i] = variance[i].index;
+    }
+    free(variance);
+    free(values);
+    running_stats_free(&stats);
+
+    for (size_t id = 0; id < countLabels; id++) {
+        for (size_t i = 0; i < stride; i++) {
+            size_t bucket = i < countBuckets ? templates->order[i] : i;
+            templates->ordered[id * stride + i] = rows[id * stride + bucket];
+            templates->orderedWeights[id * stride + i] = templates->invStddev[id * stride + bucket];
+        }
+    }
 }
-            }
 
+// Nearest label to the input by scaled distance (scale * the distance of Distances()), of those within their limit, as a scan of every label finds it (including ties to the lowest id), for the L1 metrics (l1, normalized, zscore: sums of non-negative terms).
+// Each label's distance is summed a block of buckets at a time in the order of TemplatesOrder(), abandoning it once it cannot be nearer than the best so far (or within its limit), and only a label that could be nearest has its full distance computed as Distances() does.  Scoring the hint label first (e.g. the previous nearest, or -1) gives an early bound.
+// Returns the label (or -1 for none), sets the scaled distance, and adds the bucket distances evaluated to a count (of countLabels * countBuckets, for a scan).
+int TemplatesNearest(const kernels_t *kernels, templates_t *templates, const double *input, const double *scales, const double *limits, int hint, double *outDistance, size_t *outEvaluated) {
+    size_t countLabels = templates->countLabels, countBuckets = templates->countBuckets, stride = templates->stride;
+    distance_metric_t metric = templates->metric;
+    const double *query = (metric == DISTANCE_NORMALIZED) ? TemplatesNormalizeInput(templates, countBuckets, input) : input;
+    const double *rows = (metric == DISTANCE_NORMALIZED) ? templates->normalized : templates->mean;
+    double divisor = (metric == DISTANCE_ZSCORE) ? 1 : (double)countBuckets;
+    for (size_t i = 0; i < countBuckets; i++) {
+        templates->orderedInput[i] = query[templates->order[i]];
+    }
 
+    int closest = -1;
+    double closestDistance = 0;
+    size_t evaluated = 0;
+    for (size_t n = 0; n <= countLabels; n++) {
+        // The hint first, then the others in order
+        size_t id;
+        if (n == 0) {
+            if (hint < 0 || (size_t)hint >= countLabels) continue;
+            id = (size_t)hint;
+        } else {
+            id = n - 1;
+            if ((int)id == hint) continue;
+        }
 
+        // Abandon once the partial distance (less an allowance for rounding) passes the best or the limit (not on reaching it, a tie may be a lower id)
+        double cutoff = (closest >= 0) ? closestDistance : HUGE_VAL;
+        if (limits[id] >= 0 && limits[id] < cutoff) cutoff = limits[id];
+        double factor = scales[id] / divisor * (1 - ABANDON_SLACK);
+        double bound = (factor > 0 && cutoff < HUGE_VAL) ? cutoff / factor : HUGE_VAL;
+        double partial;
+        evaluated += kernels->distanceL1Bounded(&partial, templates->orderedInput, templates->ordered + id * stride, (metric == DISTANCE_ZSCORE) ? templates->orderedWeights + id * stride : NULL, countBuckets, bound);
+        if (partial > bound) continue;
+
+        // The full distance, exactly as Distances() computes it
+        double rawDistance;
+        if (metric == DISTANCE_ZSCORE) {
+            kernels->distanceWeightedL1(&rawDistance, query, rows + id * stride, templates->invStddev + id * stride, stride, countBuckets, 1);
+        } else {
+            kernels->distanceL1(&rawDistance, query, rows + id * stride, stride, countBuckets, 1);
+            rawDistance /= countBuckets;
+        }
+        double distance = scales[id] * rawDistance;
+        bool withinLimit = (limits[id] < 0) || (distance < limits[id]);
+        if (withinLimit && (closest < 0 || distance < closestDistance || (distance == closestDistance && (int)id < closest))) {
+            closest = (int)id;
+            closestDistance = distance;
         }
     }
-    return;
+    *outDistance = closestDistance;
+    if (outEvaluated != NULL) *outEvaluated += evaluated;
+    return closest;
 }
 
-// MiniAudio device data callback
-static void data_callback(ma_device *device, void *_output, const void *input, ma_uint32 frameCount) {
-    audioid_t *audioid = (audioid_t *)device->pUserData;
-    AudioIdProcess(audioid, (int16_t *)input, (size_t)frameCount);
-    return;
+// Layout of the labels searched for the nearest to each input
+typedef enum {
+    SEARCH_AUTO = 0,            // tree for larger label sets, when the metric allows
+    SEARCH_SCAN,                // every label's distance
+    SEARCH_ABANDON,             // every label, abandoning each distance once it cannot be nearest, when the metric allows
+    SEARCH_TREE,                // vantage-point tree, when the metric allows
+    SEARCH_GROUPS,              // the nearest group centroids, then only their groups' labels
+    SEARCH_COUNT
+} search_mode_t;
+
+static const char *searchModeNames[SEARCH_COUNT] = { "auto", "scan", "abandon", "tree", "groups" };
+
+static const char *SearchModeName(search_mode_t mode) {
+    if (mode < 0 || mode >= SEARCH_COUNT) return NULL;
+    return searchModeNames[mode];
 }
 
-// Allocate an audioid object, this will also initialize the object.
-audioid_t *AudioIdCreate() {
-    audioid_t *audioid = (audioid_t *)malloc(sizeof(audioid_t));
-    AudioIdInit(audioid, false);
-    return audioid;
+static bool SearchModeFromName(const char *name, search_mode_t *outMode) {
+    for (int i = 0; i < SEARCH_COUNT; i++) {
+        if (strcmp(name, searchModeNames[i]) == 0) {
+            *outMode = (search_mode_t)i;
+            return true;
+        }
+    }
+    return false;
 }
 
-// Destroy the audioid object, this will also shutdown the object.
-void AudioIdDestroy(audioid_t *audioid) {
-    AudioIdShutdown(audioid);
-    free(audioid);
+// Precision of the label scores
+typedef enum {
+    QUANTIZE_OFF = 0,           // double-precision distances
+    QUANTIZE_ON,                // byte templates and input, scored by sums of absolute differences, when the metric allows
+    QUANTIZE_CHECK,             // as on, also counting the frames where the double-precision scan agrees
+    QUANTIZE_COUNT
+} quantize_mode_t;
+
+static const char *quantizeModeNames[QUANTIZE_COUNT] = { "off", "on", "check" };
+
+static bool QuantizeModeFromName(const char *name, quantize_mode_t *outMode) {
+    for (int i = 0; i < QUANTIZE_COUNT; i++) {
+        if (strcmp(name, quantizeModeNames[i]) == 0) {
+            *outMode = (quantize_mode_t)i;
+            return true;
+        }
+    }
+    return false;
 }
 
-// Initialize an audioid object with an empty configuration
-void AudioIdInit(audioid_t *audioid, int visualize) {
-    memset(audioid, 0, sizeof(*audioid));
+#define VP_TREE_NONE ((size_t)-1)
+#define VP_TREE_SLACK 1e-12     // relative allowance for rounding in the triangle-inequality bounds, so that an exact search never prunes the nearest label
 
-    // Defaults
-    audioid->sampleRate = AUDIOID_SAMPLE_RATE;
-    audioid->windowSize = FFT_WINDOW_SIZE; // 2048 / AUDIOID_SAMPLE_RATE = 0.128s // 1024+1 results
-    audioid->countBuckets = FFT_BUCKET_COUNT; // 128
-    audioid->verbose = AUDIOID_VERBOSE;
-    audioid->visualize = visualize;
-    audioid->cycleCount = AUDIOID_DEFAULT_CYCLE_COUNT;
+// Vantage-point tree node: a label, and the remaining labels of its subtree split by their distance from it
+typedef struct {
+    size_t id;              // vantage point label
+    size_t inside;          // child node of the labels nearer the vantage point (VP_TREE_NONE if none)
+    size_t outside;         // child node of the labels further from the vantage point (VP_TREE_NONE if none)
+    double insideMax;       // largest (unscaled, undivided) L1 distance from the vantage point to an inside label
+    double outsideMin;      // smallest (unscaled, undivided) L1 distance from the vantage point to an outside label
+    double scale;           // the vantage point label's scale
+    double limit;           // the vantage point label's limit (< 0 = none)
+    double minScale;        // smallest scale of any label in the subtree
+    double maxLimit;        // largest limit of any label in the subtree (HUGE_VAL if any has none)
+} vp_node_t;
+
+// Vantage-point tree over the label templates, for the nearest label under an L1 distance (a metric, so the triangle inequality bounds the distance to every label of a subtree)
+typedef struct {
+    size_t countNodes;      // one per label (0 = no tree)
+    vp_node_t *nodes;       // node 0 is the root
+    size_t *stack;          // search stack of nodes...
+    double *stackBounds;    // ...and a lower bound on the L1 distance to any label of each
+    uint32_t seed;          // vantage point choice
+} vp_tree_t;
 
-    // State
-    for (size_t i = 0; i < sizeof(audioid->stateHistory) / sizeof(audioid->stateHistory[0]); i++) {
-        audioid->stateHistory[i] = LABEL_ID_UNKNOWN;
-    }
-    audioid->stateIndex = 0;
-    audioid->lastState = LABEL_ID_UNKNOWN;
+typedef struct {
+    size_t id;
+    double distance;
+} vp_item_t;
+
+static int VpItemCompare(const void *a, const void *b) {
+    const vp_item_t *itemA = (const vp_item_t *)a;
+    const vp_item_t *itemB = (const vp_item_t *)b;
+    if (itemA->distance != itemB->distance) return (itemA->distance < itemB->distance) ? -1 : 1;
+    return (itemA->id < itemB->id) ? -1 : (itemA->id > itemB->id) ? 1 : 0;
 }
 
-// Configure to learn from labelled audio
-void AudioIdConfigLearn(audioid_t *audioid, const char *filename, const char *labelFile) {
-    audioid->learn = true;
-    audioid->filename = filename;
-    audioid->labelFile = labelFile;
+// Build the subtree of the items, returns its node
+static size_t VpTreeBuildNode(vp_tree_t *tree, const kernels_t *kernels, const double *rows, size_t stride, size_t countBuckets, const double *scales, const double *limits, vp_item_t *items, size_t count) {
+    if (count == 0) return VP_TREE_NONE;
+    size_t index = tree->countNodes++;
+
+    // A pseudo-random vantage point, and the distance to it from each of the others, ordered
+    tree->seed = tree->seed * 1664525 + 1013904223;
+    size_t choice = (size_t)(tree->seed >> 8) % count;
+    vp_item_t vantage = items[choice];
+    items[choice] = items[0];
+    items[0] = vantage;
+    const double *vantageRow = rows + vantage.id * stride;
+    for (size_t i = 1; i < count; i++) {
+        kernels->distanceL1(&items[i].distance, vantageRow, rows + items[i].id * stride, stride, countBuckets, 1);
+    }
+    qsort(items + 1, count - 1, sizeof(vp_item_t), VpItemCompare);
+
+    // The nearer half inside, the rest outside
+    size_t countInside = (count - 1) / 2;
+    size_t countOutside = count - 1 - countInside;
+    double insideMax = countInside > 0 ? items[countInside].distance : 0;
+    double outsideMin = countOutside > 0 ? items[1 + countInside].distance : 0;
+    size_t inside = VpTreeBuildNode(tree, kernels, rows, stride, countBuckets, scales, limits, items + 1, countInside);
+    size_t outside = VpTreeBuildNode(tree, kernels, rows, stride, countBuckets, scales, limits, items + 1 + countInside, countOutside);
+
+    vp_node_t *node = &tree->nodes[index];
+    node->id = vantage.id;
+    node->inside = inside;
+    node->outside = outside;
+    node->insideMax = insideMax;
+    node->outsideMin = outsideMin;
+    node->scale = scales[vantage.id];
+    node->limit = limits[vantage.id];
+    node->minScale = node->scale;
+    node->maxLimit = node->limit < 0 ? HUGE_VAL : node->limit;
+    for (int c = 0; c < 2; c++) {
+        size_t child = c == 0 ? inside : outside;
+        if (child == VP_TREE_NONE) continue;
+        if (tree->nodes[child].minScale < node->minScale) node->minScale = tree->nodes[child].minScale;
+        if (tree->nodes[child].maxLimit > node->maxLimit) node->maxLimit = tree->nodes[child].maxLimit;
+    }
+    return index;
 }
 
-// Configure to recognize from audio -- optionally pre-recoded audio from a file, live captured audio otherwise; optionally with labels for diagnostic use
-void AudioIdConfigRecognize(audioid_t *audioid, const char *filename, const char *labelFile) {
-    audioid->learn = false;
-    audioid->filename = filename;
-    audioid->labelFile = labelFile;
+void VpTreeFree(vp_tree_t *tree) {
+    free(tree->nodes);
+    free(tree->stack);
+    free(tree->stackBounds);
+    memset(tree, 0, sizeof(*tree));
 }
 
-// Start audio processing on an audioid object
-bool AudioIdStart(audioid_t *audioid) {
-    ma_result result;
-
-    FingerprintInit(&audioid->fingerprint, audioid->windowSize, audioid->countBuckets, audioid->cycleCount);
+// Build the tree over the rows of a template matrix (each row a label), with the labels' scales (which must not be negative) and limits (< 0 = none)
+void VpTreeBuild(vp_tree_t *tree, const kernels_t *kernels, const double *rows, size_t stride, size_t countBuckets, size_t countLabels, const double *scales, const double *limits) {
+    VpTreeFree(tree);
+    if (countLabels == 0) return;
+    tree->nodes = (vp_node_t *)malloc(sizeof(vp_node_t) * countLabels);
+    tree->stack = (size_t *)malloc(sizeof(size_t) * (countLabels + 1));
+    tree->stackBounds = (double *)malloc(sizeof(double) * (countLabels + 1));
+    vp_item_t *items = (vp_item_t *)malloc(sizeof(vp_item_t) * countLabels);
+    if (tree->nodes == NULL || tree->stack == NULL || tree->stackBounds == NULL || items == NULL) { fprintf(stderr, "ERROR: Memory failure (tree).\n"); exit(-1); }
+    for (size_t id = 0; id < countLabels; id++) {
+        items[id].id = id;
+        items[id].distance = 0;
+    }
+    tree->seed = 0x3c6ef372;
+    VpTreeBuildNode(tree, kernels, rows, stride, countBuckets, scales, limits, items, countLabels);
+    free(items);
+}
 
-    if (audioid->labelFile != NULL) {
-        fprintf(stderr, "AUDIOID: Opening label file: %s\n", audioid->labelFile);
-        FILE *fp = fopen(audioid->labelFile, "r");
-        if (fp == NULL) {
-            fprintf(stderr, "ERROR: Problem opening label file: %s\n", audioid->labelFile);
-            return false;
-        }
-        char lineBuffer[256];
-        for (size_t lineNumber = 1; ; lineNumber++) {
-            char *line = fgets(lineBuffer, sizeof(lineBuffer) - 1, fp);
-            if (line == NULL) break;
-
-            double start = -1, end = -1;
-            const char *labelString = NULL;
-            const char *token = strtok(line,"\t");
-            if (token != NULL) start = atof(token);
-            token = strtok(NULL, "\t");
-            if (token != NULL) end = atof(token);
-            token = strtok(NULL, "\t\r\n");
-            if (token != NULL) labelString = token;
-
-            if (labelString == NULL) {
-                fprintf(stderr, "ERROR: Labels file line %zu does not contain required values.\n", lineNumber);
-            } else {
-                AudioIdAddInterval(audioid, labelString, start, end);
-            }
+// Nearest label to the query by scaled distance (scale * L1 / countBuckets), of those within their limit, as a scan of every label would find it (including ties to the lowest id).  Returns the label (or -1 for none), and sets the scaled distance and the number of labels whose distance was computed.
+// An error allowance > 0 also skips subtrees that cannot be closer by more than that proportion, so the result's scaled distance is at most (1 + error) times the nearest.
+int VpTreeSearch(vp_tree_t *tree, const kernels_t *kernels, const double *query, const double *rows, size_t stride, size_t countBuckets, double error, double *outDistance, size_t *outScored) {
+    int closest = -1;
+    double closestDistance = HUGE_VAL;
+    size_t scored = 0;
+    size_t depth = 0;
+    if (tree->countNodes > 0) {
+        tree->stack[depth] = 0;
+        tree->stackBounds[depth] = 0;
+        depth++;
+    }
+    while (depth > 0) {
+        depth--;
+        const vp_node_t *node = &tree->nodes[tree->stack[depth]];
+        double bound = node->minScale * (tree->stackBounds[depth] / countBuckets);
+        if (bound * (1 + error) > closestDistance) continue;   // (not >=, a tie may be a lower id)
+        if (bound >= node->maxLimit) continue;
+
+        double rawDistance;
+        kernels->distanceL1(&rawDistance, query, rows + node->id * stride, stride, countBuckets, 1);
+        scored++;
+        double distance = node->scale * (rawDistance / countBuckets);
+        bool withinLimit = (node->limit < 0) || (distance < node->limit);
+        if (withinLimit && (closest < 0 || distance < closestDistance || (distance == closestDistance && (int)node->id < closest))) {
+            closest = (int)node->id;
+            closestDistance = distance;
         }
-        fclose(fp);
 
-        // Display intervals
-        for (size_t i = 0; i < audioid->countIntervals; i++) {
-            interval_t *interval = &audioid->intervals[i];
-            if (audioid->verbose) fprintf(stderr, "INTERVAL: #%zu %zu/%s (%0.2f-%0.2f)\n", i + 1, interval->id, AudioIdGetLabelName(audioid, interval->id), interval->start, interval->end);
+        // Children by the triangle inequality (less an allowance for rounding), no less than this node's bound, the nearer pushed last to be searched first
+        double slack = VP_TREE_SLACK * (rawDistance + node->insideMax + node->outsideMin);
+        double insideBound = rawDistance - node->insideMax - slack;
+        double outsideBound = node->outsideMin - rawDistance - slack;
+        if (insideBound < tree->stackBounds[depth]) insideBound = tree->stackBounds[depth];
+        if (outsideBound < tree->stackBounds[depth]) outsideBound = tree->stackBounds[depth];
+        size_t inside = node->inside, outside = node->outside;
+        for (int c = 0; c < 2; c++) {
+            bool pushInside = (c == 0) == (insideBound > outsideBound);
+            size_t child = pushInside ? inside : outside;
+            if (child == VP_TREE_NONE) continue;
+            tree->stack[depth] = child;
+            tree->stackBounds[depth] = pushInside ? insideBound : outsideBound;
+            depth++;
         }
     }
+    *outDistance = closestDistance;
+    if (outScored != NULL) *outScored = scored;
+    return closest;
+}
 
-    if (audioid->filename != NULL) {
-        if (audioid->verbose) fprintf(stderr, "AUDIOID: Opening sound file: %s\n", audioid->filename);
 
-        audioid->decoderConfig = ma_decoder_config_init(ma_format_s16, 1, audioid->sampleRate);
+// Two-stage search over the label groups: the group centroids first, then only the labels of the nearest groups
+typedef struct {
+    size_t countGroups;     // (0 = no group search)
+    size_t countLabels;
+    size_t *members;        // label ids, each group's together (in id order)
+    size_t *offsets;        // start of each group's labels in members (countGroups + 1 entries)
+    templates_t centroids;  // one row per group: the mean of its labels' templates
+    templates_t rows;       // the label templates in the order of members (so each group is one kernel call)
+    double *centroidDistances;  // scratch distances to each group's centroid...
+    double *distances;      // ...and to each label of the groups scored (in the order of members)
+    size_t *nearest;        // scratch groups to score, nearest centroid first
+} group_search_t;
+
+void GroupSearchFree(group_search_t *search) {
+    free(search->members);
+    free(search->offsets);
+    TemplatesFree(&search->centroids);
+    TemplatesFree(&search->rows);
+    free(search->centroidDistances);
+    free(search->distances);
+    free(search->nearest);
+    memset(search, 0, sizeof(*search));
+}
 
-        result = ma_decoder_init_file(audioid->filename, &audioid->decoderConfig, &audioid->decoder);
-        if (result != MA_SUCCESS) {
-            fprintf(stderr, "ERROR: Could not load file: %s\n", audioid->filename);
-            return false;
+// Build the group search over the label templates, where groups[id] is the first label of each label's group (its matching group)
+void GroupSearchBuild(group_search_t *search, const templates_t *templates, const size_t *groups) {
+    GroupSearchFree(search);
+    size_t countLabels = templates->countLabels, countBuckets = templates->countBuckets, stride = templates->stride;
+    if (countLabels == 0) return;
+    search->countLabels = countLabels;
+    search->members = (size_t *)malloc(sizeof(size_t) * countLabels);
+    search->offsets = (size_t *)malloc(sizeof(size_t) * (countLabels + 1));
+    search->distances = (double *)malloc(sizeof(double) * countLabels);
+    search->centroidDistances = (double *)malloc(sizeof(double) * countLabels);
+    search->nearest = (size_t *)malloc(sizeof(size_t) * countLabels);
+    size_t *groupIndex = (size_t *)malloc(sizeof(size_t) * countLabels);
+    if (search->members == NULL || search->offsets == NULL || search->distances == NULL || search->centroidDistances == NULL || search->nearest == NULL || groupIndex == NULL) { fprintf(stderr, "ERROR: Memory failure (groups).\n"); exit(-1); }
+
+    // Number the groups in order of their first label, and count their labels
+    for (size_t id = 0; id < countLabels; id++) {
+        if (groups[id] == id) groupIndex[id] = search->countGroups++;
+    }
+    memset(search->offsets, 0, sizeof(size_t) * (search->countGroups + 1));
+    for (size_t id = 0; id < countLabels; id++) {
+        search->offsets[groupIndex[groups[id]] + 1]++;
+    }
+    for (size_t g = 0; g < search->countGroups; g++) {
+        search->offsets[g + 1] += search->offsets[g];
+    }
+
+    // Each group's labels together, and the centroid of their templates
+    TemplatesResize(&search->rows, countLabels, countBuckets);
+    TemplatesResize(&search->centroids, search->countGroups, countBuckets);
+    search->rows.metric = templates->metric;
+    search->centroids.metric = templates->metric;
+    memset(search->centroids.mean, 0, sizeof(double) * search->countGroups * stride);
+    memset(search->centroids.invStddev, 0, sizeof(double) * search->countGroups * stride);
+    size_t *fill = search->nearest;     // (the next member of each group)
+    memcpy(fill, search->offsets, sizeof(size_t) * search->countGroups);
+    for (size_t id = 0; id < countLabels; id++) {
+        size_t g = groupIndex[groups[id]];
+        size_t n = fill[g]++;
+        search->members[n] = id;
+        memcpy(search->rows.mean + n * stride, templates->mean + id * stride, sizeof(double) * stride);
+        memcpy(search->rows.invStddev + n * stride, templates->invStddev + id * stride, sizeof(double) * stride);
+        memcpy(search->rows.normalized + n * stride, templates->normalized + id * stride, sizeof(double) * stride);
+        search->rows.norm[n] = templates->norm[id];
+        for (size_t i = 0; i < countBuckets; i++) {
+            search->centroids.mean[g * stride + i] += templates->mean[id * stride + i];
+            search->centroids.invStddev[g * stride + i] += templates->invStddev[id * stride + i];
+        }
+    }
+    for (size_t g = 0; g < search->countGroups; g++) {
+        double count = (double)(search->offsets[g + 1] - search->offsets[g]);
+        for (size_t i = 0; i < countBuckets; i++) {
+            search->centroids.mean[g * stride + i] /= count;
+            search->centroids.invStddev[g * stride + i] /= count;
+        }
+        TemplatesSetNorm(&search->centroids, g);
+    }
+    free(groupIndex);
+}
+
+// Nearest label to the input by scaled distance (scale * the distance of Distances()), of those within their limit, scoring only the labels of the countNearest groups with the nearest centroids (by unscaled distance, ties to the first group).
+// With countNearest at least the number of groups, every label is scored and the result is the same as a scan (including ties to the lowest id); with fewer, a label of another group may have been nearer.
+// Returns the label (or -1 for none), and sets the scaled distance and the number of labels scored (not counting the centroids).
+int GroupSearchNearest(const kernels_t *kernels, group_search_t *search, const double *input, const double *scales, const double *limits, size_t countNearest, double *outDistance, size_t *outScored) {
+    size_t countGroups = search->countGroups, countBuckets = search->rows.countBuckets;
+    size_t countScored = countNearest < countGroups ? countNearest : countGroups;
+    if (countScored < countGroups) {
+        // Insert each group into the nearest so far, by centroid distance
+        Distances(kernels, countBuckets, input, &search->centroids, search->centroidDistances);
+        size_t countFound = 0;
+        for (size_t g = 0; g < countGroups; g++) {
+            double distance = search->centroidDistances[g];
+            size_t n = countFound;
+            while (n > 0 && distance < search->centroidDistances[search->nearest[n - 1]]) n--;
+            if (n >= countScored) continue;
+            size_t last = (countFound < countScored) ? countFound++ : countFound - 1;
+            memmove(search->nearest + n + 1, search->nearest + n, sizeof(size_t) * (last - n));
+            search->nearest[n] = g;
         }
-        audioid->decoderInitialized = true;
     } else {
-        if (audioid->verbose) fprintf(stderr, "AUDIOID: Configuring audio capture...\n");
+        for (size_t g = 0; g < countGroups; g++) {
+            search->nearest[g] = g;
+        }
+    }
+
+    int closest = -1;
+    double closestDistance = 0;
+    size_t scored = 0;
+    for (size_t n = 0; n < countScored; n++) {
+        size_t g = search->nearest[n];
+        size_t first = search->offsets[g], count = search->offsets[g + 1] - first;
+        DistancesRange(kernels, countBuckets, input, &search->rows, first, count, search->distances + first);
+        scored += count;
+        for (size_t m = first; m < first + count; m++) {
+            size_t id = search->members[m];
+            double distance = scales[id] * search->distances[m];
+            bool withinLimit = (limits[id] < 0) || (distance < limits[id]);
+            if (withinLimit && (closest < 0 || distance < closestDistance || (distance == closestDistance && (int)id < closest))) {
+                closest = (int)id;
+                closestDistance = distance;
+            }
+        }
+    }
+    *outDistance = closestDistance;
+    if (outScored != NULL) *outScored = scored;
+    return closest;
+}
+
+
+#define PROJECTION_BLOCK 256        // buckets per column block of the projection (each block of the input stays in the L1 cache while every row streams past it)
+#define PROJECTION_OVERSAMPLE 8     // vectors iterated beyond the dimensions fitted (the iteration converges with the ratio of the eigenvalues just beyond and within them)
+#define PROJECTION_MAX_ITERATIONS 1000  // limit on the iterations fitting a projection
+#define PROJECTION_TOLERANCE 1e-9   // residual of each fitted component, relative to the largest eigenvalue, at which the iteration stops
+#define PROJECTION_MAX_SWEEPS 50    // limit on the Jacobi sweeps of the eigen-decomposition within the iterated vectors (each sweep squares the off-diagonal error once it is small)
+
+// Linear projection of the bucket values to fewer dimensions (the principal components of the learned frames), applied to the input and the label templates before scoring
+typedef struct {
+    size_t dimension;       // rows (0 = none)
+    size_t countBuckets;    // columns (0 = no mean set)
+    size_t stride;          // values per row (countBuckets padded so that each row is aligned)
+    double *mean;           // countBuckets mean of the learned frames, subtracted before projecting
+    double *rows;           // dimension x stride matrix, one component per row, most variance first
+    double *offset;         // dimension projections of the mean (set by ProjectionUpdate(), so that the input is projected without subtracting it)
+    double *partial;        // dimension scratch dot products of one column block
+    double *output;         // dimension scratch projected values
+} projection_t;
+
+void ProjectionFree(projection_t *projection) {
+    if (projection->mean != NULL) AlignedFree(projection->mean);
+    if (projection->rows != NULL) AlignedFree(projection->rows);
+    free(projection->offset);
+    free(projection->partial);
+    if (projection->output != NULL) AlignedFree(projection->output);
+    memset(projection, 0, sizeof(*projection));
+}
+
+// Start a projection of a number of buckets with the mean to subtract (and no rows)
+void ProjectionInit(projection_t *projection, size_t countBuckets, const double *mean) {
+    ProjectionFree(projection);
+    projection->countBuckets = countBuckets;
+    projection->stride = (countBuckets + (ALIGNED_BYTES / sizeof(double)) - 1) / (ALIGNED_BYTES / sizeof(double)) * (ALIGNED_BYTES / sizeof(double));
+    projection->mean = (double *)AlignedAlloc(sizeof(double) * projection->stride);
+    if (projection->mean == NULL) { fprintf(stderr, "ERROR: Memory failure (projection).\n"); exit(-1); }
+    memset(projection->mean, 0, sizeof(double) * projection->stride);
+    memcpy(projection->mean, mean, sizeof(double) * countBuckets);
+}
+
+// Add a row (countBuckets values) to the projection
+void ProjectionAddRow(projection_t *projection, const double *values) {
+    size_t dimension = projection->dimension + 1, stride = projection->stride;
+    double *rows = (double *)AlignedAlloc(sizeof(double) * dimension * stride);
+    projection->offset = (double *)realloc(projection->offset, sizeof(double) * dimension);
+    projection->partial = (double *)realloc(projection->partial, sizeof(double) * dimension);
+    if (projection->output != NULL) AlignedFree(projection->output);
+    projection->output = (double *)AlignedAlloc(sizeof(double) * stride);
+    if (rows == NULL || projection->offset == NULL || projection->partial == NULL || projection->output == NULL) { fprintf(stderr, "ERROR: Memory failure (projection).\n"); exit(-1); }
+    if (projection->rows != NULL) {
+        memcpy(rows, projection->rows, sizeof(double) * projection->dimension * stride);
+        AlignedFree(projection->rows);
+    }
+    memset(rows + projection->dimension * stride, 0, sizeof(double) * stride);
+    memcpy(rows + projection->dimension * stride, values, sizeof(double) * projection->countBuckets);
+    projection->rows = rows;
+    projection->offset[projection->dimension] = 0;
+    projection->dimension = dimension;
+}
+
+// Projection of the values to the first dimensions (at most the rows), returns the (scratch) projected values: rows * values, a block of PROJECTION_BLOCK columns at a time through every row (a cache-blocked matrix-vector product), each block's dot products by the vectorized kernel, less the projected mean
+const double *ProjectionApply(projection_t *projection, const kernels_t *kernels, const double *values, size_t dimension) {
+    if (dimension > projection->dimension) dimension = projection->dimension;
+    double *output = projection->output;
+    for (size_t r = 0; r < dimension; r++) {
+        output[r] = -projection->offset[r];
+    }
+    for (size_t start = 0; start < projection->countBuckets; start += PROJECTION_BLOCK) {
+        size_t count = (projection->countBuckets - start < PROJECTION_BLOCK) ? projection->countBuckets - start : PROJECTION_BLOCK;
+        kernels->dot(projection->partial, values + start, projection->rows + start, projection->stride, count, dimension);
+        for (size_t r = 0; r < dimension; r++) {
+            output[r] += projection->partial[r];
+        }
+    }
+    return output;
+}
+
+// Update the projected mean after the rows or mean change
+void ProjectionUpdate(projection_t *projection, const kernels_t *kernels) {
+    if (projection->dimension == 0) return;
+    memset(projection->offset, 0, sizeof(double) * projection->dimension);
+    const double *projected = ProjectionApply(projection, kernels, projection->mean, projection->dimension);
+    memcpy(projection->offset, projected, sizeof(double) * projection->dimension);
+}
+
+// Set a label's row of the templates from its learned means, projected (to the templates' dimensions, each difference unscaled)
+void TemplatesSetProjected(templates_t *templates, size_t id, projection_t *projection, const kernels_t *kernels, const double *means) {
+    double *mean = templates->mean + id * templates->stride;
+    double *invStddev = templates->invStddev + id * templates->stride;
+    const double *projected = ProjectionApply(projection, kernels, means, templates->countBuckets);
+    for (size_t i = 0; i < templates->stride; i++) {
+        mean[i] = (i < templates->countBuckets) ? projected[i] : 0;
+        invStddev[i] = (i < templates->countBuckets) ? 1 : 0;
+    }
+    TemplatesSetNorm(templates, id);
+}
+
+// Running mean and co-moments of the learned frames' bucket values, for fitting a projection
+typedef struct {
+    size_t countBuckets;    // (0 = no frames added)
+    size_t count;           // frames added
+    double *mean;           // countBuckets running mean
+    double *comoment;       // countBuckets x countBuckets sums of products of the deviations from the mean (upper triangle, row-major)
+    double *delta;          // countBuckets scratch deviations
+} projection_fit_t;
+
+void ProjectionFitFree(projection_fit_t *fit) {
+    free(fit->mean);
+    free(fit->comoment);
+    free(fit->delta);
+    memset(fit, 0, sizeof(*fit));
+}
+
+static void ProjectionFitInit(projection_fit_t *fit, size_t countBuckets) {
+    ProjectionFitFree(fit);
+    fit->countBuckets = countBuckets;
+    fit->mean = (double *)calloc(countBuckets, sizeof(double));
+    fit->comoment = (double *)calloc(countBuckets * countBuckets, sizeof(double));
+    fit->delta = (double *)calloc(countBuckets, sizeof(double));
+    if (fit->mean == NULL || fit->comoment == NULL || fit->delta == NULL) { fprintf(stderr, "ERROR: Memory failure (projection).\n"); exit(-1); }
+}
+
+// Add a frame (as running_stats_add(), extended to the co-moments of each pair of buckets)
+void ProjectionFitAdd(projection_fit_t *fit, size_t countBuckets, const real_t *x) {
+    if (fit->countBuckets != countBuckets) ProjectionFitInit(fit, countBuckets);
+    size_t n = ++fit->count;
+    for (size_t i = 0; i < countBuckets; i++) {
+        fit->delta[i] = x[i] - fit->mean[i];
+        fit->mean[i] += fit->delta[i] / n;
+    }
+    for (size_t i = 0; i < countBuckets; i++) {
+        double *comoment = fit->comoment + i * countBuckets;
+        double delta = fit->delta[i];
+        for (size_t j = i; j < countBuckets; j++) {
+            comoment[j] += delta * (x[j] - fit->mean[j]);
+        }
+    }
+}
+
+// Combine another fit's frames into this one (as running_stats_merge())
+void ProjectionFitMerge(projection_fit_t *fit, const projection_fit_t *other) {
+    if (other->count == 0) return;
+    size_t countBuckets = other->countBuckets;
+    if (fit->count == 0 || fit->countBuckets != countBuckets) ProjectionFitInit(fit, countBuckets);
+    double countA = (double)fit->count, countB = (double)other->count, count = countA + countB;
+    for (size_t i = 0; i < countBuckets; i++) {
+        fit->delta[i] = other->mean[i] - fit->mean[i];
+    }
+    for (size_t i = 0; i < countBuckets; i++) {
+        for (size_t j = i; j < countBuckets; j++) {
+            fit->comoment[i * countBuckets + j] += other->comoment[i * countBuckets + j] + fit->delta[i] * fit->delta[j] * (countA * countB / count);
+        }
+        fit->mean[i] += fit->delta[i] * countB / count;
+    }
+    fit->count += other->count;
+}
+
+// Eigen-decomposition of a symmetric n x n matrix by cyclic Jacobi rotations: the matrix is reduced to its eigenvalues (on the diagonal), and vectors (n x n) is set to the eigenvectors (in its columns)
+static void SymmetricEigen(double *a, double *vectors, size_t n) {
+    for (size_t i = 0; i < n * n; i++) vectors[i] = 0;
+    for (size_t i = 0; i < n; i++) vectors[i * n + i] = 1;
+    double diagonal = 0;
+    for (size_t i = 0; i < n; i++) diagonal += a[i * n + i] * a[i * n + i];
+    for (int sweep = 0; sweep < PROJECTION_MAX_SWEEPS; sweep++) {
+        double offDiagonal = 0;
+        for (size_t p = 0; p < n; p++) {
+            for (size_t q = p + 1; q < n; q++) offDiagonal += a[p * n + q] * a[p * n + q];
+        }
+        if (offDiagonal <= 1e-30 * diagonal) break;
+
+        for (size_t p = 0; p + 1 < n; p++) {
+            for (size_t q = p + 1; q < n; q++) {
+                double apq = a[p * n + q];
+                if (apq == 0) continue;
+                // The rotation zeroing a[p][q]
+                double theta = (a[q * n + q] - a[p * n + p]) / (2 * apq);
+                double t = (fabs(theta) > 1e100) ? 0.5 / theta : ((theta >= 0) ? 1 : -1) / (fabs(theta) + sqrt(theta * theta + 1));
+                double c = 1 / sqrt(t * t + 1), s = t * c;
+                for (size_t k = 0; k < n; k++) {
+                    double akp = a[k * n + p], akq = a[k * n + q];
+                    a[k * n + p] = c * akp - s * akq;
+                    a[k * n + q] = s * akp + c * akq;
+                }
+                for (size_t k = 0; k < n; k++) {
+                    double apk = a[p * n + k], aqk = a[q * n + k];
+                    a[p * n + k] = c * apk - s * aqk;
+                    a[q * n + k] = s * apk + c * aqk;
+                }
+                for (size_t k = 0; k < n; k++) {
+                    double vkp = vectors[k * n + p], vkq = vectors[k * n + q];
+                    vectors[k * n + p] = c * vkp - s * vkq;
+                    vectors[k * n + q] = s * vkp + c * vkq;
+                }
+            }
+        }
+    }
+}
+
+// Orthonormalize the m vectors of n values (rows of q) by modified Gram-Schmidt, applied twice for accuracy, replacing any vector that is (nearly) dependent on the earlier ones with a pseudo-random one
+static void Orthonormalize(double *q, size_t m, size_t n, uint32_t *seed) {
+    for (size_t j = 0; j < m; j++) {
+        double *v = q + j * n;
+        for (int attempt = 0; ; attempt++) {
+            double before = 0, after = 0;
+            for (size_t i = 0; i < n; i++) before += v[i] * v[i];
+            for (int pass = 0; pass < 2; pass++) {
+                for (size_t k = 0; k < j; k++) {
+                    const double *u = q + k * n;
+                    double dot = 0;
+                    for (size_t i = 0; i < n; i++) dot += u[i] * v[i];
+                    for (size_t i = 0; i < n; i++) v[i] -= dot * u[i];
+                }
+            }
+            for (size_t i = 0; i < n; i++) after += v[i] * v[i];
+            if (after > 1e-20 * before && after > 0) {
+                double scale = 1 / sqrt(after);
+                for (size_t i = 0; i < n; i++) v[i] *= scale;
+                break;
+            }
+            for (size_t i = 0; i < n; i++) {
+                *seed = *seed * 1664525 + 1013904223;
+                v[i] = (double)(*seed >> 8) / (1 << 24) - 0.5;
+            }
+        }
+    }
+}
+
+// Fit a projection to the principal components of the frames (the eigenvectors of their covariance with the largest eigenvalues, each signed so that its largest component is positive), returns the proportion of the variance kept (or -1 if there are too few frames).
+// The components are found by subspace iteration: a few more vectors than needed are repeatedly multiplied by the covariance and re-orthonormalized, and rotated to the eigenvectors of the covariance within their span (Rayleigh-Ritz, by Jacobi on the small matrix), until the residuals of the components needed are negligible.
+double ProjectionFitSolve(const projection_fit_t *fit, projection_t *projection, size_t dimension) {
+    size_t n = fit->countBuckets;
+    if (fit->count < 2 || n == 0) return -1;
+    if (dimension > n) dimension = n;
+    size_t m = (dimension + PROJECTION_OVERSAMPLE < n) ? dimension + PROJECTION_OVERSAMPLE : n;
+    double *covariance = (double *)malloc(sizeof(double) * n * n);
+    double *q = (double *)malloc(sizeof(double) * m * n);          // m x n current vectors
+    double *z = (double *)malloc(sizeof(double) * m * n);          // m x n covariance times each vector
+    double *rotated = (double *)malloc(sizeof(double) * m * n);
+    double *small = (double *)malloc(sizeof(double) * m * m);      // covariance within the span of the vectors
+    double *vectors = (double *)malloc(sizeof(double) * m * m);
+    order_item_t *eigen = (order_item_t *)malloc(sizeof(order_item_t) * m);   // eigenvalues within the span, largest first
+    if (covariance == NULL || q == NULL || z == NULL || rotated == NULL || small == NULL || vectors == NULL || eigen == NULL) { fprintf(stderr, "ERROR: Memory failure (projection).\n"); exit(-1); }
+    double total = 0;
+    for (size_t i = 0; i < n; i++) {
+        for (size_t j = i; j < n; j++) {
+            covariance[i * n + j] = covariance[j * n + i] = fit->comoment[i * n + j] / (fit->count - 1);
+        }
+        total += covariance[i * n + i];
+    }
+
+    uint32_t seed = 0x6a09e667;
+    for (size_t i = 0; i < m * n; i++) {
+        seed = seed * 1664525 + 1013904223;
+        q[i] = (double)(seed >> 8) / (1 << 24) - 0.5;
+    }
+    Orthonormalize(q, m, n, &seed);
+    for (int iteration = 0; ; iteration++) {
+        // z = covariance * q, and the covariance within the span of q
+        for (size_t k = 0; k < m; k++) {
+            for (size_t i = 0; i < n; i++) {
+                const double *row = covariance + i * n;
+                double sum = 0;
+                for (size_t j = 0; j < n; j++) sum += row[j] * q[k * n + j];
+                z[k * n + i] = sum;
+            }
+        }
+        for (size_t a = 0; a < m; a++) {
+            for (size_t b = a; b < m; b++) {
+                double sum = 0;
+                for (size_t i = 0; i < n; i++) sum += q[a * n + i] * z[b * n + i];
+                small[a * m + b] = small[b * m + a] = sum;
+            }
+        }
+
+        // Rotate q and z to the eigenvectors within the span, largest first
+        SymmetricEigen(small, vectors, m);
+        for (size_t k = 0; k < m; k++) {
+            eigen[k].index = k;
+            eigen[k].key = small[k * m + k];
+        }
+        qsort(eigen, m, sizeof(order_item_t), OrderItemCompareDescending);
+        for (double *matrix = q; matrix != NULL; matrix = (matrix == q) ? z : NULL) {
+            for (size_t k = 0; k < m; k++) {
+                double *dst = rotated + k * n;
+                for (size_t i = 0; i < n; i++) dst[i] = 0;
+                for (size_t a = 0; a < m; a++) {
+                    double weight = vectors[a * m + eigen[k].index];
+                    for (size_t i = 0; i < n; i++) dst[i] += weight * matrix[a * n + i];
+                }
+            }
+            memcpy(matrix, rotated, sizeof(double) * m * n);
+        }
+
+        // Done when covariance * q = eigenvalue * q for each component needed (relative to the largest)
+        double largest = fabs(eigen[0].key), worst = 0;
+        for (size_t k = 0; k < dimension; k++) {
+            double sum = 0;
+            for (size_t i = 0; i < n; i++) {
+                double residual = z[k * n + i] - eigen[k].key * q[k * n + i];
+                sum += residual * residual;
+            }
+            if (sqrt(sum) > worst) worst = sqrt(sum);
+        }
+        if (worst <= PROJECTION_TOLERANCE * largest || iteration >= PROJECTION_MAX_ITERATIONS) break;
+        memcpy(q, z, sizeof(double) * m * n);
+        Orthonormalize(q, m, n, &seed);
+    }
+
+    ProjectionInit(projection, n, fit->mean);
+    double kept = 0;
+    for (size_t k = 0; k < dimension; k++) {
+        double *row = q + k * n;
+        size_t largest = 0;
+        for (size_t i = 0; i < n; i++) {
+            if (fabs(row[i]) > fabs(row[largest])) largest = i;
+        }
+        if (row[largest] < 0) {
+            for (size_t i = 0; i < n; i++) row[i] = -row[i];
+        }
+        ProjectionAddRow(projection, row);
+        kept += eigen[k].key;
+    }
+    free(eigen);
+    free(vectors);
+    free(small);
+    free(rotated);
+    free(z);
+    free(q);
+    free(covariance);
+    return total > 0 ? kept / total : 1;
+}
+
+
+typedef struct interval_tag {
+    size_t id;      // label id for this interval
+    double start;
+    double end;
+} interval_t;
+
+// Hash index from strings to ids, by open addressing with linear probing (the strings are owned elsewhere, and must outlive their entries)
+typedef struct {
+    size_t capacity;        // slots, a power of two kept at least twice the count
+    size_t count;
+    const char **keys;      // NULL = empty slot
+    size_t *values;
+} string_index_t;
+
+// FNV-1a hash of a string
+static uint32_t StringHash(const char *text) {
+    uint32_t hash = 2166136261u;
+    for (const unsigned char *c = (const unsigned char *)text; *c != '\0'; c++) {
+        hash = (hash ^ *c) * 16777619u;
+    }
+    return hash;
+}
+
+// Find the id of a string, returns false if it is not in the index
+static bool StringIndexFind(const string_index_t *index, const char *key, size_t *outValue) {
+    if (index->count == 0) return false;
+    size_t mask = index->capacity - 1;
+    for (size_t slot = StringHash(key) & mask; index->keys[slot] != NULL; slot = (slot + 1) & mask) {
+        if (strcmp(index->keys[slot], key) == 0) {
+            *outValue = index->values[slot];
+            return true;
+        }
+    }
+    return false;
+}
+
+// Add a string that is not already in the index, doubling the slots (and rehashing) when half full
+static void StringIndexAdd(string_index_t *index, const char *key, size_t value) {
+    if ((index->count + 1) * 2 > index->capacity) {
+        string_index_t grown = {0};
+        grown.capacity = (index->capacity > 0) ? index->capacity * 2 : 64;
+        grown.keys = (const char **)calloc(grown.capacity, sizeof(const char *));
+        grown.values = (size_t *)malloc(sizeof(size_t) * grown.capacity);
+        if (grown.keys == NULL || grown.values == NULL) { fprintf(stderr, "ERROR: Memory failure (string index).\n"); exit(-1); }
+        for (size_t slot = 0; slot < index->capacity; slot++) {
+            if (index->keys[slot] != NULL) StringIndexAdd(&grown, index->keys[slot], index->values[slot]);
+        }
+        free((void *)index->keys);
+        free(index->values);
+        *index = grown;
+    }
+    size_t mask = index->capacity - 1;
+    size_t slot = StringHash(key) & mask;
+    while (index->keys[slot] != NULL) slot = (slot + 1) & mask;
+    index->keys[slot] = key;
+    index->values[slot] = value;
+    index->count++;
+}
+
+static void StringIndexFree(string_index_t *index) {
+    free((void *)index->keys);
+    free(index->values);
+    memset(index, 0, sizeof(*index));
+}
+
+typedef struct label_tag {
+    const char *labelText;
+    const char *labelGroup;
+    running_stats_t stats;  // learned stats of each bucket
+    double scale;
+    double limit;
+    size_t matchingGroup;
+    double minDuration;
+    int onlyAfterEvent;
+    double onlyWithinInterval;
+    double lastFinished;
+    double gateLevel;       // lowest frame level (dBFS) learned for this label (HUGE_VAL = none)
+} label_t;
+
+// Detector state
+typedef struct audioid_tag {
+    // Configuration
+    const char *filename;
+    const char *labelFile;
+
+    unsigned int sampleRate;    // capture rate
+    unsigned int analysisRate;  // rate the fingerprint is computed at (the capture rate divided by an integer factor)
+    size_t windowSize;      // 0 = default (FFT_WINDOW_SIZE, scaled to the analysis rate)
+    size_t hopSize;         // 0 = default (windowSize / WINDOW_OVERLAP)
+    size_t countBuckets;
+    size_t cycleCount;
+    window_function_t windowFunction;
+    fingerprint_mode_t fingerprintMode;
+    filterbank_t filterbank;
+    distance_metric_t distanceMetric;
+    search_mode_t searchMode;
+    double searchError;     // relative error allowed in the tree search (0 = exact)
+    size_t searchGroups;    // groups whose labels are scored by the group search
+    quantize_mode_t quantizeMode;
+    size_t projectionDimension; // dimensions the buckets are projected to (fitted when learning, 0 = no projection)
+    bool adaptive;          // while the hypothesis is stable, skip scoring frames (the adaptive rate)
+    double adaptiveMargin;  // margin of the nearest label (relative to its distance) for the hypothesis to be stable
+    kernels_isa_t kernelsIsa;
+    unsigned int threads;   // worker threads when learning from a manifest (0 = one per processor)
+    bool gateAuto;          // gate level from the labels' learned levels
+    double gateLevel;       // configured gate level (dBFS, -HUGE_VAL = none), when not automatic
+    bool verbose;
+    int visualize;
+    bool quiet;             // events are not reported (as when the self-test drives the frame processing)
+    bool learn;
+    bool learnWorker;       // learning one entry of a manifest (the projection is fitted once the workers' frames are combined)
+
+    // Audio device capture
+    ma_device_config deviceConfig;
+    ma_device device;
+    bool deviceInitialized;
+
+    // Audio file input
+    ma_decoder_config decoderConfig;
+    ma_decoder decoder;
+    bool decoderInitialized;
+
+    // Labels
+    size_t countLabels;
+    size_t maxLabels;       // allocated label entries (grown geometrically)
+    label_t *labels;
+    string_index_t labelIndex;  // label text to label id
+    string_index_t groupIndex;  // label group to the id of the group's first label (the matching group of each of its labels)
+    int *groupCounts;       // modal filter votes for each matching group (maxLabels entries, left zero between frames)
+    templates_t templates;  // label templates for scoring
+    double *labelDistances; // raw distance from the current input to each label
+    bool templatesStale;    // the label stats have changed since the templates were built
+    double *labelScales;    // each label's scale and limit, for the search
+    double *labelLimits;
+    vp_tree_t tree;         // search tree over the templates (no nodes = scan every label)
+    bool abandon;           // scan with early abandoning (TemplatesNearest()), when there is no tree
+    int lastClosest;        // nearest label of the last frame scored (the first scored by the early-abandoning scan)
+    group_search_t groupSearch; // group centroids and the labels of each group (no groups = not used)
+    size_t countSearches;   // frames searched with the tree...
+    size_t countScored;     // ...and the label distances they computed
+    size_t countAbandoning; // frames scored by the early-abandoning scan...
+    size_t countEvaluated;  // ...and the bucket distances they computed
+    bool quantized;         // labels scored from quantized templates (TemplatesNearestQuantized())
+    size_t countQuantized;  // frames scored from quantized templates...
+    size_t countQuantizedSameLabel; // ...and those (when checked) where the double-precision scan chose the same label...
+    size_t countQuantizedSameGroup; // ...or a label of the same group
+    size_t countGroupSearches;  // frames searched by group...
+    size_t countGroupScored;    // ...and the label distances they computed
+    projection_t projection;    // learned projection of the buckets (no rows = none)
+    projection_fit_t projectionFit; // frames learned for fitting the projection
+    bool projected;         // the templates and input are projected (to templates.countBuckets dimensions)
+    size_t adaptiveMaxAssumed;  // votes in the modal filter history that may be assumed at once (0 = the adaptive rate is not used)...
+    bool adaptiveScan;      // ...and whether the search in use scans every label, giving the margin (not the tree, abandoning or group searches)
+    bool adaptiveStable;    // the hypothesis is stable (the history votes for the current state, and its nearest label's margin is large)
+    int adaptiveLabel;      // nearest label of the last scored frame, voted for by the skipped frames...
+    double adaptiveDistance;    // ...and its distance
+    bool *adaptiveAssumed;  // whether each vote in the modal filter history is assumed (its frame skipped)...
+    size_t adaptiveAssumedCount;    // ...the number of them...
+    double *adaptiveInputs; // ...and the inputs of their frames (modalSize x templates.stride), scored if the hypothesis is left
+    size_t countAdaptiveSkipped;    // frames not scored while the hypothesis was stable...
+    size_t countAdaptiveRescored;   // ...and those scored on leaving it
+
+    // Intervals
+    interval_t *intervals;
+    size_t maxIntervals;
+    size_t countIntervals;
+    interval_t *lastInterval;
+    size_t nextInterval;
+
+    // State
+    size_t totalSamples;
+    size_t countFrames;     // frames processed
+    size_t countGated;      // frames below the gate level (the FFT and distances were skipped)
+    int gateLabel;          // label gated frames are classified as
+    bool lastGated;
+    int stateIndex;
+    int lastState;
+    int *stateHistory;      // modal filter history (modalSize entries)
+    size_t modalSize;
+    double stateChangeTime;
+    double lastReport;
+    bool stateLatched;
+
+    // Decimation from the capture rate to the analysis rate
+    decimator_t decimator;
+
+    // Current FFT fingerprint
+    fingerprint_t fingerprint;
+} audioid_t;
+
+static const char *AudioIdGetLabelName(audioid_t *audioid, size_t id) {
+    if (id >= audioid->countLabels) return NULL;
+    return audioid->labels[id].labelText;
+}
+
+static size_t AudioIdGetLabelId(audioid_t *audioid, const char *labelText) {
+    // Return existing label id
+    size_t existingId;
+    if (StringIndexFind(&audioid->labelIndex, labelText, &existingId)) {
+        return existingId;
+    }
+
+    // Add the new label, doubling the allocation when full
+    if (audioid->countLabels >= audioid->maxLabels) {
+        size_t maxLabels = (audioid->maxLabels > 0) ? audioid->maxLabels * 2 : 16;
+        audioid->labels = (label_t *)realloc((void *)audioid->labels, sizeof(label_t) * maxLabels);
+        audioid->groupCounts = (int *)realloc(audioid->groupCounts, sizeof(int) * maxLabels);
+        if (audioid->labels == NULL || audioid->groupCounts == NULL) { fprintf(stderr, "ERROR: Memory failure (labels).\n"); exit(-1); }
+        memset(audioid->groupCounts + audioid->maxLabels, 0, sizeof(int) * (maxLabels - audioid->maxLabels));
+        audioid->maxLabels = maxLabels;
+    }
+
+    audioid->labels[audioid->countLabels].labelText = strdup(labelText);
+    StringIndexAdd(&audioid->labelIndex, audioid->labels[audioid->countLabels].labelText, audioid->countLabels);
+
+    // Initial '?'/'!'/ prefix to flag label (unused)
+    bool flagged = (labelText[0] == '?') || (labelText[0] == '!');
+
+    // Add the new label's group
+    char *group = strdup(labelText + (flagged ? 1 : 0)); // Duplicate (and remove flag prefix)
+    char *groupSep = strchr(group, '/');
+    if (groupSep != NULL) *groupSep = '\0'; // Leave only the group
+    audioid->labels[audioid->countLabels].labelGroup = group;
+
+    // Stats
+    running_stats_init(&audioid->labels[audioid->countLabels].stats, audioid->countBuckets);
+    audioid->templatesStale = true;
+
+    // Other per-label values
+    audioid->labels[audioid->countLabels].scale = 1.0;
+    audioid->labels[audioid->countLabels].limit = -1.0; // < 0 = no limit applied
+    audioid->labels[audioid->countLabels].minDuration = -1.0; // < 0 = disabled
+    audioid->labels[audioid->countLabels].onlyAfterEvent = LABEL_ID_UNKNOWN;
+    audioid->labels[audioid->countLabels].onlyWithinInterval = 0.0;
+    audioid->labels[audioid->countLabels].lastFinished = -1.0;
+    audioid->labels[audioid->countLabels].gateLevel = HUGE_VAL;
+
+    // Find an earlier matching group, or start one
+    size_t matchingGroup;
+    if (!StringIndexFind(&audioid->groupIndex, group, &matchingGroup)) {
+        matchingGroup = audioid->countLabels;
+        StringIndexAdd(&audioid->groupIndex, group, matchingGroup);
+    }
+    audioid->labels[audioid->countLabels].matchingGroup = matchingGroup;
+
+    // Return the new label id
+    return audioid->countLabels++;
+}
+
+static void AudioIdFreeLabels(audioid_t *audioid) {
+    for (size_t id = 0; id < audioid->countLabels; id++) {
+        free((void *)audioid->labels[id].labelText);
+        free((void *)audioid->labels[id].labelGroup);
+        running_stats_free(&audioid->labels[id].stats);
+    }
+    free(audioid->labels);
+    audioid->labels = NULL;
+    audioid->countLabels = 0;
+    audioid->maxLabels = 0;
+    free(audioid->groupCounts);
+    audioid->groupCounts = NULL;
+    StringIndexFree(&audioid->labelIndex);
+    StringIndexFree(&audioid->groupIndex);
+    audioid->templatesStale = true;
+}
+
+// Rebuild the label templates if the learned stats have changed (labels added, learning, or a state load)
+static void AudioIdUpdateTemplates(audioid_t *audioid) {
+    if (!audioid->templatesStale) return;
+
+    // Projection of the buckets to fewer dimensions, for the metrics of distances between values (not zscore, which weights the buckets by each label's deviations)
+    size_t dimension = audioid->projectionDimension < audioid->projection.dimension ? audioid->projectionDimension : audioid->projection.dimension;
+    audioid->projected = false;
+    if (audioid->projectionDimension > 0) {
+        if (audioid->projection.dimension == 0 || audioid->projection.countBuckets != audioid->countBuckets) {
+            fprintf(stderr, "WARNING: No projection of the %zu buckets has been learned, they are not projected.\n", audioid->countBuckets);
+        } else if (audioid->distanceMetric == DISTANCE_ZSCORE) {
+            fprintf(stderr, "WARNING: The projection is not used with the %s distance metric.\n", DistanceMetricName(audioid->distanceMetric));
+        } else {
+            if (audioid->projectionDimension > audioid->projection.dimension) {
+                fprintf(stderr, "WARNING: Only %zu projected dimensions have been learned (not %zu).\n", audioid->projection.dimension, audioid->projectionDimension);
+            }
+            ProjectionUpdate(&audioid->projection, &audioid->fingerprint.kernels);
+            audioid->projected = true;
+        }
+    }
+
+    TemplatesResize(&audioid->templates, audioid->countLabels, audioid->projected ? dimension : audioid->countBuckets);
+    audioid->templates.metric = audioid->distanceMetric;
+    audioid->labelDistances = (double *)realloc(audioid->labelDistances, sizeof(double) * (audioid->countLabels + 1));
+    audioid->labelScales = (double *)realloc(audioid->labelScales, sizeof(double) * (audioid->countLabels + 1));
+    audioid->labelLimits = (double *)realloc(audioid->labelLimits, sizeof(double) * (audioid->countLabels + 1));
+    if (audioid->labelDistances == NULL || audioid->labelScales == NULL || audioid->labelLimits == NULL) { fprintf(stderr, "ERROR: Memory failure (distances).\n"); exit(-1); }
+    audioid->adaptiveInputs = (double *)realloc(audioid->adaptiveInputs, sizeof(double) * (audioid->modalSize + 1) * audioid->templates.stride);
+    audioid->adaptiveAssumed = (bool *)realloc(audioid->adaptiveAssumed, sizeof(bool) * (audioid->modalSize + 1));
+    if (audioid->adaptiveInputs == NULL || audioid->adaptiveAssumed == NULL) { fprintf(stderr, "ERROR: Memory failure (adaptive).\n"); exit(-1); }
+    for (size_t i = 0; i < audioid->modalSize; i++) {
+        audioid->adaptiveAssumed[i] = false;
+    }
+    audioid->adaptiveAssumedCount = 0;
+    audioid->adaptiveStable = false;
+    bool scalesPositive = true;
+    for (size_t id = 0; id < audioid->countLabels; id++) {
+        if (audioid->projected) {
+            TemplatesSetProjected(&audioid->templates, id, &audioid->projection, &audioid->fingerprint.kernels, audioid->labels[id].stats.mean);
+        } else {
+            TemplatesSet(&audioid->templates, id, &audioid->labels[id].stats);
+        }
+        audioid->labelScales[id] = audioid->labels[id].scale;
+        audioid->labelLimits[id] = audioid->labels[id].limit;
+        if (!(audioid->labels[id].scale >= 0)) scalesPositive = false;
+    }
+
+    // Search tree for the L1 metrics (only the triangle inequality bounds the distances of a subtree), or early abandoning for any sum of non-negative terms, both with non-negative scales
+    VpTreeFree(&audioid->tree);
+    GroupSearchFree(&audioid->groupSearch);
+    bool large = (audioid->countLabels >= SEARCH_TREE_MIN_LABELS);
+    bool treeAllowed = scalesPositive && (audioid->distanceMetric == DISTANCE_L1 || audioid->distanceMetric == DISTANCE_NORMALIZED);
+    bool abandonAllowed = scalesPositive && (audioid->distanceMetric != DISTANCE_COSINE);
+    bool quantizeAllowed = (audioid->distanceMetric == DISTANCE_L1 || audioid->distanceMetric == DISTANCE_NORMALIZED);
+    audioid->quantized = quantizeAllowed && (audioid->quantizeMode != QUANTIZE_OFF);
+    bool useTree = !audioid->quantized && treeAllowed && (audioid->searchMode == SEARCH_TREE || (audioid->searchMode == SEARCH_AUTO && large));
+    audioid->abandon = !audioid->quantized && !useTree && abandonAllowed && (audioid->searchMode == SEARCH_ABANDON || (audioid->searchMode == SEARCH_AUTO && large));
+    if (audioid->quantizeMode != QUANTIZE_OFF && !quantizeAllowed) {
+        fprintf(stderr, "WARNING: Quantized scoring is not used with the %s distance metric.\n", DistanceMetricName(audioid->distanceMetric));
+    }
+    if (audioid->quantized) {
+        // Quantized scores of every label (a scan of bytes is cheaper than a search of doubles)
+        TemplatesQuantize(&audioid->templates);
+        if (audioid->searchMode != SEARCH_AUTO && audioid->searchMode != SEARCH_SCAN) {
+            fprintf(stderr, "WARNING: The %s search is not used with quantized scoring, every label is scanned.\n", SearchModeName(audioid->searchMode));
+        }
+    } else if (useTree) {
+        const double *rows = (audioid->distanceMetric == DISTANCE_NORMALIZED) ? audioid->templates.normalized : audioid->templates.mean;
+        VpTreeBuild(&audioid->tree, &audioid->fingerprint.kernels, rows, audioid->templates.stride, audioid->templates.countBuckets, audioid->countLabels, audioid->labelScales, audioid->labelLimits);
+    } else if (audioid->abandon) {
+        TemplatesOrder(&audioid->templates);
+    } else if (audioid->searchMode == SEARCH_GROUPS) {
+        // Group centroids for any metric or scales (only a search of fewer groups than there are can differ from a scan)
+        size_t *groups = (size_t *)malloc(sizeof(size_t) * (audioid->countLabels + 1));
+        if (groups == NULL) { fprintf(stderr, "ERROR: Memory failure (groups).\n"); exit(-1); }
+        for (size_t id = 0; id < audioid->countLabels; id++) {
+            groups[id] = audioid->labels[id].matchingGroup;
+        }
+        GroupSearchBuild(&audioid->groupSearch, &audioid->templates, groups);
+        free(groups);
+    } else if (audioid->searchMode == SEARCH_TREE || audioid->searchMode == SEARCH_ABANDON) {
+        fprintf(stderr, "WARNING: The %s search is not used with the %s distance metric, or negative label scales, every label is scanned.\n", SearchModeName(audioid->searchMode), DistanceMetricName(audioid->distanceMetric));
+    }
+
+    // The adaptive rate's margin needs the distance of every label, which only a scan gives
+    audioid->adaptiveScan = !useTree && !audioid->abandon && audioid->groupSearch.countGroups == 0;
+    if (audioid->adaptiveMaxAssumed > 0 && !audioid->adaptiveScan) {
+        fprintf(stderr, "WARNING: The adaptive rate is not used with the %s search, only when every label is scanned.\n", SearchModeName(useTree ? SEARCH_TREE : audioid->abandon ? SEARCH_ABANDON : SEARCH_GROUPS));
+    }
+    audioid->lastClosest = LABEL_ID_UNKNOWN;
+    audioid->templatesStale = false;
+}
+
+// Nearest label to the input (by the configured search), as it is scored for each frame
+static int AudioIdScore(audioid_t *audioid, const double *input, double *outDistance) {
+    int closest = LABEL_ID_UNKNOWN;
+    if (audioid->quantized) {
+        // Quantized scores of every label, checked against the double-precision scan if configured
+        closest = TemplatesNearestQuantized(&audioid->fingerprint.kernels, &audioid->templates, input, audioid->labelScales, audioid->labelLimits, outDistance);
+        audioid->countQuantized++;
+        if (audioid->quantizeMode == QUANTIZE_CHECK) {
+            double scanDistance;
+            int scanClosest = ScanNearest(&audioid->fingerprint.kernels, &audioid->templates, input, audioid->labelScales, audioid->labelLimits, audioid->labelDistances, &scanDistance);
+            if (scanClosest == closest) audioid->countQuantizedSameLabel++;
+            if (scanClosest == closest || (scanClosest >= 0 && closest >= 0 && audioid->labels[scanClosest].matchingGroup == audioid->labels[closest].matchingGroup)) audioid->countQuantizedSameGroup++;
+        }
+    } else if (audioid->tree.countNodes > 0) {
+        // Tree search, finding the same label as the scan (or within the error allowed)
+        const double *query = input;
+        const double *rows = audioid->templates.mean;
+        if (audioid->distanceMetric == DISTANCE_NORMALIZED) {
+            query = TemplatesNormalizeInput(&audioid->templates, audioid->templates.countBuckets, input);
+            rows = audioid->templates.normalized;
+        }
+        size_t scored = 0;
+        closest = VpTreeSearch(&audioid->tree, &audioid->fingerprint.kernels, query, rows, audioid->templates.stride, audioid->templates.countBuckets, audioid->searchError, outDistance, &scored);
+        if (closest < 0) *outDistance = 0;
+        audioid->countSearches++;
+        audioid->countScored += scored;
+    } else if (audioid->groupSearch.countGroups > 0) {
+        // Group centroids, then the labels of the nearest groups
+        size_t scored = 0;
+        closest = GroupSearchNearest(&audioid->fingerprint.kernels, &audioid->groupSearch, input, audioid->labelScales, audioid->labelLimits, audioid->searchGroups, outDistance, &scored);
+        if (closest < 0) *outDistance = 0;
+        audioid->countGroupSearches++;
+        audioid->countGroupScored += scored;
+    } else if (audioid->abandon) {
+        // Early-abandoning scan, finding the same label as the scan, starting with the last frame's nearest
+        closest = TemplatesNearest(&audioid->fingerprint.kernels, &audioid->templates, input, audioid->labelScales, audioid->labelLimits, audioid->lastClosest, outDistance, &audioid->countEvaluated);
+        if (closest < 0) *outDistance = 0;
+        audioid->countAbandoning++;
+    } else {
+        closest = ScanNearest(&audioid->fingerprint.kernels, &audioid->templates, input, audioid->labelScales, audioid->labelLimits, audioid->labelDistances, outDistance);
+    }
+    return closest;
+}
+
+// Nearest label to the input by a scan of every label (or of the quantized templates), and its margin: the ratio of the nearest distance of a label of another group (or of the nearest label's limit) to the nearest distance, less one (0 if no label is nearest)
+static int AudioIdScoreMargin(audioid_t *audioid, const double *input, double *outDistance, double *outMargin) {
+    const templates_t *templates = &audioid->templates;
+    int closest;
+    double unit = 1 / (templates->quantizeScale * templates->countBuckets);
+    if (audioid->quantized) {
+        closest = TemplatesNearestQuantized(&audioid->fingerprint.kernels, &audioid->templates, input, audioid->labelScales, audioid->labelLimits, outDistance);
+    } else {
+        closest = ScanNearest(&audioid->fingerprint.kernels, &audioid->templates, input, audioid->labelScales, audioid->labelLimits, audioid->labelDistances, outDistance);
+    }
+    *outMargin = 0;
+    if (closest < 0) return closest;
+    size_t group = audioid->labels[closest].matchingGroup;
+    double runnerUp = (audioid->labelLimits[closest] >= 0) ? audioid->labelLimits[closest] : HUGE_VAL;
+    for (size_t id = 0; id < audioid->countLabels; id++) {
+        if (audioid->labels[id].matchingGroup == group) continue;
+        double distance = audioid->labelScales[id] * (audioid->quantized ? templates->quantizedDistances[id] * unit : audioid->labelDistances[id]);
+        if (audioid->labelLimits[id] >= 0 && distance >= audioid->labelLimits[id]) continue;
+        if (distance < runnerUp) runnerUp = distance;
+    }
+    if (*outDistance > 0) *outMargin = runnerUp / *outDistance - 1;
+    else *outMargin = (runnerUp > 0) ? HUGE_VAL : 0;
+    return closest;
+}
+
+// Whether every vote in the modal filter history is for the current state (a known group)
+static bool AudioIdHistoryUniform(audioid_t *audioid) {
+    if (audioid->lastState == LABEL_ID_UNKNOWN) return false;
+    for (size_t i = 0; i < audioid->modalSize; i++) {
+        if (audioid->stateHistory[i] != audioid->lastState) return false;
+    }
+    return true;
+}
+
+// Leave a stable hypothesis: score every skipped frame still in the modal filter history (oldest first), replacing its assumed vote
+static void AudioIdAdaptiveLeave(audioid_t *audioid) {
+    for (size_t k = 0; k < audioid->modalSize; k++) {
+        size_t slot = (audioid->stateIndex + k) % audioid->modalSize;
+        if (!audioid->adaptiveAssumed[slot]) continue;
+        double distance;
+        int label = AudioIdScore(audioid, audioid->adaptiveInputs + slot * audioid->templates.stride, &distance);
+        audioid->stateHistory[slot] = (label == LABEL_ID_UNKNOWN) ? LABEL_ID_UNKNOWN : (int)audioid->labels[label].matchingGroup;
+        audioid->adaptiveAssumed[slot] = false;
+        audioid->lastClosest = label;
+    }
+    audioid->countAdaptiveRescored += audioid->adaptiveAssumedCount;
+    audioid->adaptiveAssumedCount = 0;
+    audioid->adaptiveStable = false;
+}
+
+
+
+static size_t AudioIdAddInterval(audioid_t *audioid, const char *label, double start, double end) {
+    // Allocate more space
+    if (audioid->countIntervals >= audioid->maxIntervals) {
+        audioid->maxIntervals += audioid->maxIntervals + 1;
+        audioid->intervals = (interval_t *)realloc(audioid->intervals, sizeof(interval_t) * audioid->maxIntervals);
+        if (audioid->intervals == NULL) { fprintf(stderr, "ERROR: Memory failure (intervals).\n"); exit(-1); }
+    }
+    interval_t *newInterval = &audioid->intervals[audioid->countIntervals];
+    memset(newInterval, 0, sizeof(*newInterval));
+    newInterval->id = AudioIdGetLabelId(audioid, label);
+    newInterval->start = start;
+    newInterval->end = end;
+    if (audioid->countIntervals > 0 && start < audioid->intervals[audioid->countIntervals - 1].end) {
+        fprintf(stderr, "WARNING: Interval #%zu starts (%0.2f) before the previous interval ends (%0.2f) -- intervals must not overlap.\n", audioid->countIntervals, start, audioid->intervals[audioid->countIntervals - 1].end);
+    }
+    if (end < start) {
+        fprintf(stderr, "WARNING: Interval #%zu ends (%0.2f) before it starts (%0.2f) -- does not form a valid interval.\n", audioid->countIntervals, end, start);
+    }
+    audioid->countIntervals++;
+    return audioid->countIntervals - 1;
+}
+
+
+
+// Process the bucket values of one completed frame (learn, or recognize and report) at the given time, buckets are NULL if the frame was gated
+static void AudioIdProcessFrame(audioid_t *audioid, const real_t *buckets, size_t countResults, double level, double time) {
+    // If we are making our way through the labelled intervals...
+    interval_t *interval = NULL;
+    if (audioid->countIntervals > 0) {
+        // Advance until we are within one
+        while (audioid->nextInterval < audioid->countIntervals) {
+            // Next interval has not started yet (between intervals)
+            if (time < audioid->intervals[audioid->nextInterval].start) {
+                break;
+            }
+            // Within the next interval
+            if (time < audioid->intervals[audioid->nextInterval].end) {
+                interval = &audioid->intervals[audioid->nextInterval];
+                break;
+            }
+            // After the next interval
+            audioid->nextInterval++;
+        }
+    }
+
+    // Interval boundary
+    if (audioid->lastInterval != interval) {
+        if (audioid->verbose || true) {
+            if (audioid->lastInterval != NULL) {
+                fprintf(stderr, "\n--- END INTERVAL ---\n");
+            }
+
+            if (interval != NULL) {
+                fprintf(stderr, "\n--- @%.2f INTERVAL #%d (%.2f-%.2f): %s ---\n", time, (int)audioid->nextInterval, audioid->intervals[audioid->nextInterval].start, audioid->intervals[audioid->nextInterval].end, AudioIdGetLabelName(audioid, audioid->intervals[audioid->nextInterval].id));
+            }
+        }
+        audioid->lastInterval = interval;
+    }
+
+    // Add stats to current interval (learning does not gate frames)
+    if (interval != NULL && audioid->learn && buckets != NULL) {
+        size_t id = interval->id;
+        running_stats_add(&audioid->labels[id].stats, buckets);
+        audioid->templatesStale = true;
+        if (level < audioid->labels[id].gateLevel) audioid->labels[id].gateLevel = level;
+        if (audioid->projectionDimension > 0) ProjectionFitAdd(&audioid->projectionFit, audioid->countBuckets, buckets);
+    }
+
+    // Add to cycled stats (only 1-cycle in learning mode), or clear them on entering the gate so that they do not carry over from before
+    audioid->countFrames++;
+    if (buckets != NULL) {
+        FingerprintAccumulateStats(&audioid->fingerprint, buckets);
+    } else {
+        audioid->countGated++;
+        if (!audioid->lastGated) {
+            FingerprintResetStats(&audioid->fingerprint);
+        }
+    }
+    audioid->lastGated = (buckets == NULL);
+    running_stats_t *inputStats = FingerprintStats(&audioid->fingerprint);
+
+    // Recognition mode
+    int closestLabel = LABEL_ID_UNKNOWN;
+    double closestDistance = 0;
+    bool assumed = false;
+    if (!audioid->learn) {
+        // Gated frames are classified without computing distances
+        if (buckets == NULL) closestLabel = audioid->gateLabel;
+        AudioIdUpdateTemplates(audioid);
+        const double *input = inputStats->mean;
+        if (buckets != NULL && audioid->projected) input = ProjectionApply(&audioid->projection, &audioid->fingerprint.kernels, input, audioid->templates.countBuckets);
+        if (buckets == NULL) {
+            // (the gate label's group may differ from a stable hypothesis)
+            if (audioid->adaptiveStable) AudioIdAdaptiveLeave(audioid);
+        } else if (audioid->adaptiveStable && audioid->adaptiveAssumedCount < audioid->adaptiveMaxAssumed) {
+            // Stable hypothesis: the frame is not scored, but votes as the last scored frame did, its input kept in case a later scored frame leaves the hypothesis while its vote is in the history
+            // (with fewer than half the votes assumed, the scored votes for the current state are a majority, so the state is as it would be at the full rate)
+            size_t slot = audioid->stateIndex % audioid->modalSize;
+            memcpy(audioid->adaptiveInputs + slot * audioid->templates.stride, input, sizeof(double) * audioid->templates.countBuckets);
+            assumed = true;
+            audioid->countAdaptiveSkipped++;
+            closestLabel = audioid->adaptiveLabel;
+            closestDistance = audioid->adaptiveDistance;
+        } else if (audioid->adaptiveMaxAssumed > 0 && audioid->adaptiveScan && (audioid->adaptiveStable || AudioIdHistoryUniform(audioid))) {
+            // Every vote is for the current state: score every label for the margin, the hypothesis is stable while the same group is nearest by a large margin
+            double margin;
+            closestLabel = AudioIdScoreMargin(audioid, input, &closestDistance, &margin);
+            bool stable = (closestLabel >= 0) && ((int)audioid->labels[closestLabel].matchingGroup == audioid->lastState) && (margin >= audioid->adaptiveMargin);
+            if (!stable && audioid->adaptiveStable) AudioIdAdaptiveLeave(audioid);
+            audioid->adaptiveStable = stable;
+            audioid->adaptiveLabel = closestLabel;
+            audioid->adaptiveDistance = closestDistance;
+        } else {
+            closestLabel = AudioIdScore(audioid, input, &closestDistance);
+        }
+        if (buckets != NULL) audioid->lastClosest = closestLabel;
+
+
+        // ------ STATE ------
+        // State is matching group
+        int thisState = (closestLabel == LABEL_ID_UNKNOWN) ? LABEL_ID_UNKNOWN : (int)audioid->labels[closestLabel].matchingGroup;
+
+        // Add to modal filter (replacing the oldest vote, which may have been assumed)
+        size_t slot = audioid->stateIndex % audioid->modalSize;
+        if (audioid->adaptiveMaxAssumed > 0) {
+            if (audioid->adaptiveAssumed[slot]) audioid->adaptiveAssumedCount--;
+            if (assumed) audioid->adaptiveAssumedCount++;
+            audioid->adaptiveAssumed[slot] = assumed;
+        }
+        audioid->stateHistory[slot] = thisState;
+        audioid->stateIndex++;
+
+        // Modal filter (counting only the groups in the history, so independent of the number of labels)
+        int unknownCount = 0;
+        for (size_t i = 0; i < audioid->modalSize; i++) {
+            int group = audioid->stateHistory[i];
+            if (group == LABEL_ID_UNKNOWN) {
+                unknownCount++;
+            } else if (group >= 0 && (size_t)group < audioid->countLabels) {
+                audioid->groupCounts[group]++;
+            } else { fprintf(stderr, "ERROR: Internal error in history group (@%zu = group %d)\n", i, group); exit(-1); }
+        }
+        // Most frequent, ties to unknown then the lowest group
+        int currentState = LABEL_ID_UNKNOWN;
+        int maxCount = unknownCount;
+        for (size_t i = 0; i < audioid->modalSize; i++) {
+            int group = audioid->stateHistory[i];
+            if (group == LABEL_ID_UNKNOWN) continue;
+            int count = audioid->groupCounts[group];
+            if (count > maxCount || (count == maxCount && currentState != LABEL_ID_UNKNOWN && group < currentState)) {
+                maxCount = count;
+                currentState = group;
+            }
+        }
+        for (size_t i = 0; i < audioid->modalSize; i++) {
+            if (audioid->stateHistory[i] != LABEL_ID_UNKNOWN) audioid->groupCounts[audioid->stateHistory[i]] = 0;
+        }
+
+        // Previous state duration
+        double duration = time - audioid->stateChangeTime;
+
+        // Hypothesis change
+        if (currentState != audioid->lastState) {
+            // Latched event end
+            if (audioid->lastState != LABEL_ID_UNKNOWN && audioid->stateLatched) {
+                audioid->labels[audioid->lastState].lastFinished = time;
+                if (!audioid->visualize && !audioid->quiet) {
+                    fprintf(stdout, "%.3f\te:end\t%s\t%.3f\n", time, (audioid->lastState == LABEL_ID_UNKNOWN ? "-" : audioid->labels[audioid->lastState].labelGroup), duration);
+                    fflush(stdout);
+                }
+            }
+            audioid->stateLatched = false;
+            audioid->stateChangeTime = time;
+            audioid->lastState = currentState;
+            duration = 0;
+            audioid->lastReport = 0;    // force report
+        }
+
+        // Report current state
+        bool report = false;
+        report |= audioid->lastReport == 0; // just changed
+        report |= time >= audioid->lastReport + REPORT_MAX_INTERVAL;    // maximum interval exceeded
+        if (report) {
+            // Report 'hear'
+            if (!audioid->visualize && !audioid->quiet) {
+                fprintf(stdout, "%.3f\t%s\t%s\t%.3f\n", time, audioid->stateLatched ? "e:cont" : "hear", (currentState == LABEL_ID_UNKNOWN ? "-" : audioid->labels[currentState].labelGroup), duration);
+                fflush(stdout);
+            }
+            audioid->lastReport = time;
+        }
+
+        // Latch state?
+        if (!audioid->stateLatched && currentState != LABEL_ID_UNKNOWN) {
+            bool latch = true;
+            // If there is not required minimum duration set (>=0): do not latch; or there is and it has not yet occurred: do not latch
+            if (audioid->labels[currentState].minDuration < 0) latch = false;
+            if (audioid->labels[currentState].minDuration >= 0 && duration < audioid->labels[currentState].minDuration) latch = false;
+            // If there is a required previous event...
+            if (audioid->labels[currentState].onlyAfterEvent >= 0) {
+                double lastFinished = audioid->labels[audioid->labels[currentState].onlyAfterEvent].lastFinished;
+                double onlyWithinInterval = audioid->labels[currentState].onlyWithinInterval;
+                // ...if it has not occurred, or finished longer ago than the maximum interval before this event started: do not latch 
+                if (lastFinished < 0 || time > lastFinished + onlyWithinInterval + duration) latch = false;
+            }
+            if (latch) {
+                if (!audioid->quiet) fprintf(stdout, "%.3f\te:start\t%s\t%.3f\n", time, (audioid->lastState == LABEL_ID_UNKNOWN ? "-" : audioid->labels[audioid->lastState].labelGroup), duration);
+                audioid->stateLatched = true;
+                audioid->lastReport = time;
+            }
+        }
+
+        // ------------
+    }
+
+    // Output
+    if (audioid->verbose) fprintf(stderr, ">>> %d results.\n", (int)countResults);
+    if (audioid->visualize) {
+if (audioid->visualize == 1 || (audioid->visualize == 2 && ((audioid->learn || audioid->labelFile == NULL || (interval != NULL && strcmp(audioid->labels[interval->id].labelGroup, "silence") != 0)) && audioid->fingerprint.cycle == 0))) // only output labelled regions
+{
+        const char *closestLabelName = closestLabel == LABEL_ID_UNKNOWN ? NULL : audioid->labels[closestLabel].labelText;
+        const char *closestGroupName = closestLabel == LABEL_ID_UNKNOWN ? NULL : audioid->labels[closestLabel].labelGroup;
+        const char *intervalGroup = interval != NULL ? audioid->labels[interval->id].labelGroup : NULL;
+        
+        bool showMatch = !audioid->learn;
+
+        int groupMatchInterval = -1;    // don't care
+        if (intervalGroup != NULL) {
+            if (closestGroupName == NULL || strcmp(intervalGroup, closestGroupName) != 0) {
+                groupMatchInterval = 0; // Does not match
+            } else {
+                groupMatchInterval = 1; // Matches
+            }
+        }
+
+        DebugVisualizeValues(inputStats, countResults, showMatch, groupMatchInterval, closestGroupName, closestLabelName, closestDistance);
+}
+    }
+}
+
+// Process samples at the analysis rate
+static void AudioIdProcessSamples(audioid_t *audioid, int16_t *samples, size_t sampleCount) {
+    audioid->totalSamples += sampleCount;
+    if (audioid->verbose) fprintf(stderr, "SAMPLE-DATA: %zu samples (%zu ms), total %0.2f seconds\n", sampleCount, (1000 * sampleCount / audioid->analysisRate), (double)audioid->totalSamples / audioid->analysisRate);
+    size_t offset = 0;
+    while (offset < sampleCount) {
+        offset += FingerprintAddSamples(&audioid->fingerprint, samples + offset, sampleCount - offset);
+        if (audioid->fingerprint.frameReady) {
+            // Bucket values (NULL if gated)
+            real_t *buckets = FingerprintBuckets(&audioid->fingerprint, NULL);
+
+            // Current recording time
+            double time = (double)audioid->totalSamples / audioid->analysisRate;
+
+            // For live recordings, use the system epoch time
+            if (audioid->filename == NULL) {
+                time = TimeNow();
+            }
+
+            AudioIdProcessFrame(audioid, buckets, audioid->countBuckets, audioid->fingerprint.frameLevel, time);
+        }
+    }
+    return;
+}
+
+// Process samples at the capture rate
+static void AudioIdProcess(audioid_t *audioid, const int16_t *samples, size_t sampleCount) {
+    if (audioid->decimator.factor <= 1) {
+        AudioIdProcessSamples(audioid, (int16_t *)samples, sampleCount);
+        return;
+    }
+    // Decimate in steps
+    int16_t decimated[1024];
+    size_t step = sizeof(decimated) / sizeof(decimated[0]);
+    for (size_t offset = 0; offset < sampleCount; offset += step) {
+        size_t count = (sampleCount - offset < step) ? sampleCount - offset : step;
+        size_t countDecimated = DecimatorProcess(&audioid->decimator, samples + offset, count, decimated);
+        if (countDecimated > 0) AudioIdProcessSamples(audioid, decimated, countDecimated);
+    }
+}
+
+// Process a block of recorded samples at the analysis rate: the fingerprints of all frames are computed as a batch, then each frame is processed in turn (at the time of its final sample)
+static void AudioIdProcessBatch(audioid_t *audioid, int16_t *samples, size_t sampleCount, real_t *frames, fingerprint_frame_t *frameInfo, size_t maxFrames) {
+    if (audioid->verbose) fprintf(stderr, "SAMPLE-DATA: %zu samples (%zu ms), total %0.2f seconds\n", sampleCount, (1000 * sampleCount / audioid->analysisRate), (double)(audioid->totalSamples + sampleCount) / audioid->analysisRate);
+    size_t offset = 0;
+    while (offset < sampleCount) {
+        size_t firstFrameEnd = audioid->totalSamples + audioid->fingerprint.samplesUntilFrame;
+        size_t samplesUsed = 0;
+        size_t countFrames = FingerprintAddSamplesBatch(&audioid->fingerprint, samples + offset, sampleCount - offset, frames, frameInfo, maxFrames, &samplesUsed);
+        for (size_t frame = 0; frame < countFrames; frame++) {
+            double time = (double)(firstFrameEnd + frame * audioid->fingerprint.hopSize) / audioid->analysisRate;
+            real_t *buckets = frameInfo[frame].gated ? NULL : frames + frame * audioid->countBuckets;
+            AudioIdProcessFrame(audioid, buckets, audioid->countBuckets, frameInfo[frame].level, time);
+        }
+        audioid->totalSamples += samplesUsed;
+        offset += samplesUsed;
+    }
+}
+
+// MiniAudio device data callback
+static void data_callback(ma_device *device, void *_output, const void *input, ma_uint32 frameCount) {
+    audioid_t *audioid = (audioid_t *)device->pUserData;
+    AudioIdProcess(audioid, (const int16_t *)input, (size_t)frameCount);
+    return;
+}
+
+// Allocate an audioid object, this will also initialize the object.
+audioid_t *AudioIdCreate() {
+    audioid_t *audioid = (audioid_t *)malloc(sizeof(audioid_t));
+    AudioIdInit(audioid, false);
+    return audioid;
+}
+
+// Destroy the audioid object, this will also shutdown the object.
+void AudioIdDestroy(audioid_t *audioid) {
+    AudioIdShutdown(audioid);
+    free(audioid);
+}
+
+// Initialize an audioid object with an empty configuration
+void AudioIdInit(audioid_t *audioid, int visualize) {
+    memset(audioid, 0, sizeof(*audioid));
+
+    // Defaults
+    audioid->sampleRate = AUDIOID_SAMPLE_RATE;
+    audioid->analysisRate = AUDIOID_SAMPLE_RATE;
+    audioid->windowSize = 0; // FFT_WINDOW_SIZE: 2048 / AUDIOID_SAMPLE_RATE = 0.128s // 1024+1 results
+    audioid->countBuckets = FFT_BUCKET_COUNT;
+    audioid->verbose = AUDIOID_VERBOSE;
+    audioid->visualize = visualize;
+    audioid->cycleCount = AUDIOID_DEFAULT_CYCLE_COUNT;
+    audioid->windowFunction = WINDOW_HAMMING;
+    audioid->fingerprintMode = FINGERPRINT_MAGNITUDE;
+    audioid->filterbank = FILTERBANK_LOG;
+    audioid->distanceMetric = DISTANCE_L1;
+    audioid->searchMode = SEARCH_AUTO;
+    audioid->searchError = 0;
+    audioid->searchGroups = SEARCH_GROUPS_DEFAULT;
+    audioid->quantizeMode = QUANTIZE_OFF;
+    audioid->adaptiveMargin = ADAPTIVE_MARGIN_DEFAULT;
+    audioid->gateAuto = true;
+    audioid->gateLevel = -HUGE_VAL;
+    audioid->kernelsIsa = KERNELS_AUTO;
+
+    // State
+    audioid->stateIndex = 0;
+    audioid->lastState = LABEL_ID_UNKNOWN;
+}
+
+// Configure to learn from labelled audio
+void AudioIdConfigLearn(audioid_t *audioid, const char *filename, const char *labelFile) {
+    audioid->learn = true;
+    audioid->filename = filename;
+    audioid->labelFile = labelFile;
+}
+
+// Configure to recognize from audio -- optionally pre-recoded audio from a file, live captured audio otherwise; optionally with labels for diagnostic use
+void AudioIdConfigRecognize(audioid_t *audioid, const char *filename, const char *labelFile) {
+    audioid->learn = false;
+    audioid->filename = filename;
+    audioid->labelFile = labelFile;
+}
+
+// Determine whether any label has learned statistics (model parameters must not change after this)
+static bool AudioIdHasLearnedStats(audioid_t *audioid) {
+    for (size_t id = 0; id < audioid->countLabels; id++) {
+        for (size_t i = 0; i < audioid->countBuckets; i++) {
+            if (running_stats_count(&audioid->labels[id].stats, i) > 0) return true;
+        }
+    }
+    return false;
+}
+
+// Window size, resolving the default (scaled from FFT_WINDOW_SIZE to the analysis rate, to a power of two)
+static size_t AudioIdWindowSize(audioid_t *audioid) {
+    if (audioid->windowSize > 0) return audioid->windowSize;
+    size_t windowSize = 16;
+    while (windowSize * AUDIOID_SAMPLE_RATE < (size_t)FFT_WINDOW_SIZE * audioid->analysisRate) windowSize *= 2;
+    return windowSize;
+}
+
+// Hop size, resolving the default (window size / WINDOW_OVERLAP)
+static size_t AudioIdHopSize(audioid_t *audioid) {
+    if (audioid->hopSize > 0) return audioid->hopSize;
+    size_t windowSize = AudioIdWindowSize(audioid);
+    return (WINDOW_OVERLAP > 1) ? windowSize / WINDOW_OVERLAP : windowSize;
+}
+
+// Gate level (dBFS) for recognition: configured, or automatically below the quietest learned frame of every label (outside the silence group) that has learned statistics
+static double AudioIdGateLevel(audioid_t *audioid) {
+    if (audioid->learn) return -HUGE_VAL;   // learning sees every frame
+    if (!audioid->gateAuto) return audioid->gateLevel;
+    double quietest = HUGE_VAL;
+    for (size_t id = 0; id < audioid->countLabels; id++) {
+        if (strcmp(audioid->labels[id].labelGroup, GATE_GROUP) == 0) continue;
+        if (running_stats_count(&audioid->labels[id].stats, 0) == 0) continue;
+        if (audioid->labels[id].gateLevel == HUGE_VAL) return -HUGE_VAL;   // a label without a learned level
+        if (audioid->labels[id].gateLevel < quietest) quietest = audioid->labels[id].gateLevel;
+    }
+    return (quietest < HUGE_VAL) ? quietest - GATE_MARGIN : -HUGE_VAL;
+}
+
+// Parse a list of values separated by semicolons ("v; v; ..."), returns false unless there are exactly count
+static bool ParseValueList(const char *value, double *values, size_t count) {
+    size_t index = 0;
+    for (const char *p = value; ; ) {
+        while (*p == ' ') p++;
+        if (*p == '\0') break;
+        char *end = NULL;
+        double v = strtod(p, &end);
+        if (end == p || index >= count) return false;
+        values[index++] = v;
+        for (p = end; *p == ' '; p++);
+        if (*p == ';') p++;
+        else if (*p != '\0') return false;
+    }
+    return index == count;
+}
+
+// Set a named configuration option (as used in the global section of the state file)
+bool AudioIdSetOption(audioid_t *audioid, const char *name, const char *value) {
+    if (strcmp(name, "window") == 0) {
+        window_function_t windowFunction;
+        if (!WindowFunctionFromName(value, &windowFunction)) {
+            fprintf(stderr, "ERROR: Unknown window function: %s\n", value);
+            return false;
+        }
+        if (windowFunction != audioid->windowFunction && AudioIdHasLearnedStats(audioid)) {
+            fprintf(stderr, "ERROR: Window function (%s) is not compatible with the existing learned state (%s).\n", value, WindowFunctionName(audioid->windowFunction));
+            return false;
+        }
+        audioid->windowFunction = windowFunction;
+    } else if (strcmp(name, "fingerprint") == 0) {
+        fingerprint_mode_t mode;
+        if (!FingerprintModeFromName(value, &mode)) {
+            fprintf(stderr, "ERROR: Unknown fingerprint mode: %s\n", value);
+            return false;
+        }
+        if (mode != audioid->fingerprintMode && AudioIdHasLearnedStats(audioid)) {
+            fprintf(stderr, "ERROR: Fingerprint mode (%s) is not compatible with the existing learned state (%s).\n", value, FingerprintModeName(audioid->fingerprintMode));
+            return false;
+        }
+        audioid->fingerprintMode = mode;
+    } else if (strcmp(name, "filterbank") == 0) {
+        filterbank_t filterbank;
+        if (!FilterbankFromName(value, &filterbank)) {
+            fprintf(stderr, "ERROR: Unknown filterbank: %s\n", value);
+            return false;
+        }
+        if (filterbank != audioid->filterbank && AudioIdHasLearnedStats(audioid)) {
+            fprintf(stderr, "ERROR: Filterbank (%s) is not compatible with the existing learned state (%s).\n", value, FilterbankName(audioid->filterbank));
+            return false;
+        }
+        audioid->filterbank = filterbank;
+    } else if (strcmp(name, "distance") == 0) {
+        // The learned stats are metric-independent, so this may change freely
+        distance_metric_t metric;
+        if (!DistanceMetricFromName(value, &metric)) {
+            fprintf(stderr, "ERROR: Unknown distance metric: %s\n", value);
+            return false;
+        }
+        audioid->distanceMetric = metric;
+        audioid->templatesStale = true;
+    } else if (strcmp(name, "search") == 0) {
+        search_mode_t mode;
+        if (!SearchModeFromName(value, &mode)) {
+            fprintf(stderr, "ERROR: Unknown search: %s\n", value);
+            return false;
+        }
+        audioid->searchMode = mode;
+        audioid->templatesStale = true;
+    } else if (strcmp(name, "searcherror") == 0) {
+        char *end = NULL;
+        double error = strtod(value, &end);
+        if (end == value || *end != '\0' || !(error >= 0)) {
+            fprintf(stderr, "ERROR: Invalid search error (must be a proportion of at least 0): %s\n", value);
+            return false;
+        }
+        audioid->searchError = error;
+    } else if (strcmp(name, "searchgroups") == 0) {
+        int searchGroups = atoi(value);
+        if (searchGroups < 1) {
+            fprintf(stderr, "ERROR: Invalid search group count (must be at least 1): %s\n", value);
+            return false;
+        }
+        audioid->searchGroups = (size_t)searchGroups;
+    } else if (strcmp(name, "quantize") == 0) {
+        quantize_mode_t mode;
+        if (!QuantizeModeFromName(value, &mode)) {
+            fprintf(stderr, "ERROR: Unknown quantize mode: %s\n", value);
+            return false;
+        }
+        audioid->quantizeMode = mode;
+        audioid->templatesStale = true;
+    } else if (strcmp(name, "projection") == 0) {
+        int dimension = atoi(value);
+        if (strcmp(value, "off") == 0) dimension = 0;
+        else if (dimension < 1) {
+            fprintf(stderr, "ERROR: Invalid projection (off, or a dimension of at least 1): %s\n", value);
+            return false;
+        }
+        audioid->projectionDimension = (size_t)dimension;
+        audioid->templatesStale = true;
+    } else if (strcmp(name, "adaptive") == 0) {
+        if (strcmp(value, "on") == 0) audioid->adaptive = true;
+        else if (strcmp(value, "off") == 0) audioid->adaptive = false;
+        else {
+            fprintf(stderr, "ERROR: Invalid adaptive rate (off or on): %s\n", value);
+            return false;
+        }
+    } else if (strcmp(name, "adaptivemargin") == 0) {
+        char *end = NULL;
+        double margin = strtod(value, &end);
+        if (end == value || *end != '\0' || !(margin >= 0)) {
+            fprintf(stderr, "ERROR: Invalid adaptive margin (must be a proportion of at least 0): %s\n", value);
+            return false;
+        }
+        audioid->adaptiveMargin = margin;
+    } else if (strcmp(name, "projectionmean") == 0 || strcmp(name, "projectionrow") == 0) {
+        // The learned projection: its mean, then each row
+        bool mean = (strcmp(name, "projectionmean") == 0);
+        if (!mean && audioid->projection.countBuckets != audioid->countBuckets) {
+            fprintf(stderr, "ERROR: Projection row without a projection mean of %zu buckets.\n", audioid->countBuckets);
+            return false;
+        }
+        double *values = (double *)malloc(sizeof(double) * (audioid->countBuckets + 1));
+        if (values == NULL) { fprintf(stderr, "ERROR: Memory failure (projection).\n"); exit(-1); }
+        bool ok = ParseValueList(value, values, audioid->countBuckets);
+        if (!ok) {
+            fprintf(stderr, "ERROR: Invalid %s (must be %zu values separated by semicolons).\n", name, audioid->countBuckets);
+        } else if (mean) {
+            ProjectionInit(&audioid->projection, audioid->countBuckets, values);
+        } else {
+            ProjectionAddRow(&audioid->projection, values);
+        }
+        free(values);
+        if (!ok) return false;
+        audioid->templatesStale = true;
+    } else if (strcmp(name, "kernels") == 0) {
+        kernels_isa_t kernelsIsa;
+        if (!KernelsFromName(value, &kernelsIsa)) {
+            fprintf(stderr, "ERROR: Unknown kernels: %s\n", value);
+            return false;
+        }
+        if (!KernelsAvailable(kernelsIsa)) {
+            fprintf(stderr, "ERROR: Kernels are not available on this system: %s\n", value);
+            return false;
+        }
+        audioid->kernelsIsa = kernelsIsa;
+    } else if (strcmp(name, "threads") == 0) {
+        int threads = atoi(value);
+        if (threads < 0 || (threads == 0 && strcmp(value, "0") != 0 && strcmp(value, "auto") != 0)) {
+            fprintf(stderr, "ERROR: Invalid thread count: %s\n", value);
+            return false;
+        }
+        audioid->threads = (unsigned int)threads;
+    } else if (strcmp(name, "windowsize") == 0) {
+        int windowSize = atoi(value);
+        if (windowSize < 16 || (windowSize & (windowSize - 1)) != 0) {
+            fprintf(stderr, "ERROR: Invalid window size (must be a power of two of at least 16): %s\n", value);
+            return false;
+        }
+        if ((size_t)windowSize != AudioIdWindowSize(audioid) && AudioIdHasLearnedStats(audioid)) {
+            fprintf(stderr, "ERROR: Window size (%s) is not compatible with the existing learned state (%zu).\n", value, AudioIdWindowSize(audioid));
+            return false;
+        }
+        audioid->windowSize = (size_t)windowSize;
+    } else if (strcmp(name, "analysisrate") == 0) {
+        int analysisRate = atoi(value);
+        if (analysisRate <= 0 || (unsigned int)analysisRate > audioid->sampleRate || audioid->sampleRate % (unsigned int)analysisRate != 0) {
+            fprintf(stderr, "ERROR: Invalid analysis rate (must divide the capture rate %u): %s\n", audioid->sampleRate, value);
+            return false;
+        }
+        if ((unsigned int)analysisRate != audioid->analysisRate && AudioIdHasLearnedStats(audioid)) {
+            fprintf(stderr, "ERROR: Analysis rate (%s) is not compatible with the existing learned state (%u).\n", value, audioid->analysisRate);
+            return false;
+        }
+        audioid->analysisRate = (unsigned int)analysisRate;
+    } else if (strcmp(name, "bucketcount") == 0) {
+        int countBuckets = atoi(value);
+        if (countBuckets < 1) {
+            fprintf(stderr, "ERROR: Invalid bucket count: %s\n", value);
+            return false;
+        }
+        if ((size_t)countBuckets != audioid->countBuckets) {
+            if (AudioIdHasLearnedStats(audioid)) {
+                fprintf(stderr, "ERROR: Bucket count (%s) is not compatible with the existing learned state (%zu).\n", value, audioid->countBuckets);
+                return false;
+            }
+            // Resize the (empty) stats of any existing labels
+            audioid->countBuckets = (size_t)countBuckets;
+            for (size_t id = 0; id < audioid->countLabels; id++) {
+                running_stats_free(&audioid->labels[id].stats);
+                running_stats_init(&audioid->labels[id].stats, audioid->countBuckets);
+            }
+            audioid->templatesStale = true;
+        }
+    } else if (strcmp(name, "cyclecount") == 0) {
+        int cycleCount = atoi(value);
+        if (cycleCount < 1) {
+            fprintf(stderr, "ERROR: Invalid cycle count: %s\n", value);
+            return false;
+        }
+        audioid->cycleCount = (size_t)cycleCount;
+    } else if (strcmp(name, "gate") == 0) {
+        char *end = NULL;
+        double level = strtod(value, &end);
+        if (strcmp(value, "auto") == 0) {
+            audioid->gateAuto = true;
+        } else if (strcmp(value, "off") == 0) {
+            audioid->gateAuto = false;
+            audioid->gateLevel = -HUGE_VAL;
+        } else if (end != value && *end == '\0' && level <= 0) {
+            audioid->gateAuto = false;
+            audioid->gateLevel = level;
+        } else {
+            fprintf(stderr, "ERROR: Invalid gate (auto, off, or a level in dBFS): %s\n", value);
+            return false;
+        }
+    } else if (strcmp(name, "hop") == 0) {
+        int hopSize = atoi(value);
+        if (hopSize < 0) {
+            fprintf(stderr, "ERROR: Invalid hop size: %s\n", value);
+            return false;
+        }
+        audioid->hopSize = (size_t)hopSize;
+    } else {
+        fprintf(stderr, "ERROR: Unrecognized option: %s\n", name);
+        return false;
+    }
+    return true;
+}
+
+// Add the labelled intervals (tab-separated start/end/label lines) from a label file
+static bool AudioIdLoadLabels(audioid_t *audioid, const char *labelFile) {
+    fprintf(stderr, "AUDIOID: Opening label file: %s\n", labelFile);
+    FILE *fp = fopen(labelFile, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "ERROR: Problem opening label file: %s\n", labelFile);
+        return false;
+    }
+    char lineBuffer[256];
+    for (size_t lineNumber = 1; ; lineNumber++) {
+        char *line = fgets(lineBuffer, sizeof(lineBuffer) - 1, fp);
+        if (line == NULL) break;
+
+        double start = -1, end = -1;
+        const char *labelString = NULL;
+        const char *token = strtok(line,"\t");
+        if (token != NULL) start = atof(token);
+        token = strtok(NULL, "\t");
+        if (token != NULL) end = atof(token);
+        token = strtok(NULL, "\t\r\n");
+        if (token != NULL) labelString = token;
+
+        if (labelString == NULL) {
+            fprintf(stderr, "ERROR: Labels file line %zu does not contain required values.\n", lineNumber);
+        } else {
+            AudioIdAddInterval(audioid, labelString, start, end);
+        }
+    }
+    fclose(fp);
+
+    // Display intervals
+    for (size_t i = 0; i < audioid->countIntervals; i++) {
+        interval_t *interval = &audioid->intervals[i];
+        if (audioid->verbose) fprintf(stderr, "INTERVAL: #%zu %zu/%s (%0.2f-%0.2f)\n", i + 1, interval->id, AudioIdGetLabelName(audioid, interval->id), interval->start, interval->end);
+    }
+    return true;
+}
+
+// Prepare to process frames: the fingerprint, the modal filter and the adaptive rate
+static bool AudioIdStartFrames(audioid_t *audioid) {
+    // Window size and hop between windows, at the analysis rate
+    audioid->windowSize = AudioIdWindowSize(audioid);
+    size_t hopSize = AudioIdHopSize(audioid);
+    if (hopSize > audioid->windowSize) {
+        fprintf(stderr, "ERROR: Hop size (%zu) must not exceed the window size (%zu).\n", hopSize, audioid->windowSize);
+        return false;
+    }
+    audioid->hopSize = hopSize;
+
+    FingerprintInit(&audioid->fingerprint, audioid->analysisRate, audioid->windowSize, audioid->hopSize, audioid->countBuckets, audioid->cycleCount, audioid->windowFunction, audioid->fingerprintMode, audioid->filterbank, audioid->kernelsIsa);
+    DecimatorInit(&audioid->decimator, audioid->sampleRate / audioid->analysisRate, audioid->kernelsIsa);
+    FingerprintSetGate(&audioid->fingerprint, AudioIdGateLevel(audioid));
+    size_t gateLabel;
+    audioid->gateLabel = StringIndexFind(&audioid->groupIndex, GATE_GROUP, &gateLabel) ? (int)gateLabel : LABEL_ID_UNKNOWN;
+
+    // Modal filter history, sized by the cycle count
+    audioid->modalSize = audioid->cycleCount * MODAL_PERCENT / 100;
+    if (audioid->modalSize < 1) audioid->modalSize = 1;
+    audioid->stateHistory = (int *)realloc(audioid->stateHistory, sizeof(int) * audioid->modalSize);
+    if (audioid->stateHistory == NULL) { fprintf(stderr, "ERROR: Memory failure (state history).\n"); exit(-1); }
+    for (size_t i = 0; i < audioid->modalSize; i++) {
+        audioid->stateHistory[i] = LABEL_ID_UNKNOWN;
+    }
+    audioid->stateIndex = 0;
+
+    // Adaptive rate, assuming fewer than half the votes in the modal filter at once, and not when each frame's scores are shown
+    bool adaptive = audioid->adaptive && !audioid->learn && !audioid->visualize;
+    audioid->adaptiveMaxAssumed = adaptive ? (audioid->modalSize - 1) / 2 : 0;
+    if (adaptive && audioid->adaptiveMaxAssumed == 0) fprintf(stderr, "WARNING: The adaptive rate is not used with a modal filter of %zu frames.\n", audioid->modalSize);
+    return true;
+}
+
+// Start audio processing on an audioid object
+bool AudioIdStart(audioid_t *audioid) {
+    ma_result result;
+
+    if (!AudioIdStartFrames(audioid)) return false;
+
+    if (audioid->labelFile != NULL) {
+        if (!AudioIdLoadLabels(audioid, audioid->labelFile)) return false;
+    }
+
+    if (audioid->filename != NULL) {
+        if (audioid->verbose) fprintf(stderr, "AUDIOID: Opening sound file: %s\n", audioid->filename);
+
+        audioid->decoderConfig = ma_decoder_config_init(ma_format_s16, 1, audioid->sampleRate);
+
+        result = ma_decoder_init_file(audioid->filename, &audioid->decoderConfig, &audioid->decoder);
+        if (result != MA_SUCCESS) {
+            fprintf(stderr, "ERROR: Could not load file: %s\n", audioid->filename);
+            return false;
+        }
+        audioid->decoderInitialized = true;
+    } else {
+        if (audioid->verbose) fprintf(stderr, "AUDIOID: Configuring audio capture...\n");
+
+        audioid->deviceConfig = ma_device_config_init(ma_device_type_capture);
+        audioid->deviceConfig.capture.format   = ma_format_s16;
+        audioid->deviceConfig.capture.channels = 1;
+        audioid->deviceConfig.sampleRate       = audioid->sampleRate;
+        audioid->deviceConfig.dataCallback     = data_callback;
+        audioid->deviceConfig.pUserData        = audioid;
+
+        result = ma_device_init(NULL, &audioid->deviceConfig, &audioid->device);
+        if (result != MA_SUCCESS) {
+            fprintf(stderr, "ERROR: Failed to initialize capture device.\n");
+            return false;
+        }
+
+        result = ma_device_start(&audioid->device);
+        if (result != MA_SUCCESS) {
+            ma_device_uninit(&audioid->device);
+            fprintf(stderr, "ERROR: Failed to start device.\n");
+            return false;
+        }
+
+        if (audioid->verbose) fprintf(stderr, "AUDIOID: ...audio capture configured.\n");
+        audioid->deviceInitialized = true;
+    }
+    return true;
+}
+
+// Fit the projection to the frames learned (if configured), replacing any loaded
+static void AudioIdFitProjection(audioid_t *audioid) {
+    if (audioid->projectionDimension == 0 || audioid->projectionFit.count == 0) return;
+    double kept = ProjectionFitSolve(&audioid->projectionFit, &audioid->projection, audioid->projectionDimension);
+    if (kept < 0) {
+        fprintf(stderr, "WARNING: Too few frames were learned to fit a projection.\n");
+    } else {
+        fprintf(stderr, "AUDIOID: Fitted a projection of %zu buckets to %zu dimensions over %zu frames, keeping %.1f%% of their variance.\n", audioid->projection.countBuckets, audioid->projection.dimension, audioid->projectionFit.count, 100.0 * kept);
+    }
+    ProjectionFitFree(&audioid->projectionFit);
+    audioid->templatesStale = true;
+}
+
+// Wait until audio processing has completed
+void AudioIdWaitUntilDone(audioid_t *audioid) {
+    if (audioid->filename != NULL) {
+        if (audioid->decoderInitialized) {
+            // Read blocks of (approximately) a batch of hops at the capture rate, decimated in place and processed as a batch
+            size_t maxSampleCount = BATCH_FRAME_COUNT * audioid->fingerprint.hopSize * audioid->decimator.factor;
+            int16_t *samples = (int16_t *)malloc(sizeof(int16_t) * maxSampleCount);
+            real_t *frames = (real_t *)malloc(sizeof(real_t) * BATCH_FRAME_COUNT * audioid->countBuckets);
+            fingerprint_frame_t *frameInfo = (fingerprint_frame_t *)malloc(sizeof(fingerprint_frame_t) * BATCH_FRAME_COUNT);
+            if (samples == NULL || frames == NULL || frameInfo == NULL) { fprintf(stderr, "ERROR: Memory failure (batch).\n"); exit(-1); }
+            for(;;) {
+                ma_uint64 framesRead = 0;
+                ma_result result = ma_decoder_read_pcm_frames(&audioid->decoder, samples, maxSampleCount, &framesRead);
+                if (framesRead <= 0) break;
+                if (audioid->verbose) fprintf(stderr, "READ: %d\n", (int)framesRead);
+                size_t sampleCount = (size_t)framesRead;
+                if (audioid->decimator.factor > 1) sampleCount = DecimatorProcess(&audioid->decimator, samples, sampleCount, samples);
+                AudioIdProcessBatch(audioid, samples, sampleCount, frames, frameInfo, BATCH_FRAME_COUNT);
+                if (result != MA_SUCCESS) break;
+            }
+            free(frameInfo);
+            free(frames);
+            free(samples);
+        }
+    } else {
+        if (audioid->deviceInitialized) {
+            fprintf(stderr, "AUDIOID: Press Enter to stop live input...\n");
+            getchar();
+        }
+    }
+    if (audioid->countGated > 0) {
+        fprintf(stderr, "AUDIOID: %zu of %zu frames (%.1f%%) were below the gate level (%.1f dBFS) and skipped the FFT and distances.\n", audioid->countGated, audioid->countFrames, 100.0 * audioid->countGated / audioid->countFrames, audioid->fingerprint.gateLevel);
+    }
+    if (audioid->countSearches > 0) {
+        fprintf(stderr, "AUDIOID: The search tree scored a mean of %.1f of %zu labels (%.1f%%) per frame.\n", (double)audioid->countScored / audioid->countSearches, audioid->countLabels, 100.0 * audioid->countScored / audioid->countSearches / audioid->countLabels);
+    }
+    if (audioid->countQuantized > 0 && audioid->quantizeMode == QUANTIZE_CHECK) {
+        fprintf(stderr, "AUDIOID: Quantized scoring chose the same label as double precision for %.2f%% of %zu frames, and a label of the same group for %.2f%%.\n", 100.0 * audioid->countQuantizedSameLabel / audioid->countQuantized, audioid->countQuantized, 100.0 * audioid->countQuantizedSameGroup / audioid->countQuantized);
+    }
+    if (audioid->countGroupSearches > 0) {
+        size_t countGroups = audioid->groupSearch.countGroups;
+        fprintf(stderr, "AUDIOID: The group search (the nearest %zu of %zu groups) scored a mean of %.1f of %zu labels (%.1f%%) per frame.\n", audioid->searchGroups < countGroups ? audioid->searchGroups : countGroups, countGroups, (double)audioid->countGroupScored / audioid->countGroupSearches, audioid->countLabels, 100.0 * audioid->countGroupScored / audioid->countGroupSearches / audioid->countLabels);
+    }
+    if (audioid->countAbandoning > 0) {
+        double evaluated = (double)audioid->countEvaluated / ((double)audioid->countAbandoning * audioid->countLabels * audioid->templates.countBuckets);
+        fprintf(stderr, "AUDIOID: Early abandoning skipped %.1f%% of the bucket distances (%zu labels, %zu buckets, %zu frames).\n", 100.0 * (1 - evaluated), audioid->countLabels, audioid->templates.countBuckets, audioid->countAbandoning);
+    }
+    if (audioid->countAdaptiveSkipped > 0) {
+        fprintf(stderr, "AUDIOID: The adaptive rate skipped scoring %zu of %zu frames (%.1f%%), re-scoring %zu on leaving a stable hypothesis.\n", audioid->countAdaptiveSkipped, audioid->countFrames, 100.0 * audioid->countAdaptiveSkipped / audioid->countFrames, audioid->countAdaptiveRescored);
+    }
+    if (audioid->learn && !audioid->learnWorker) AudioIdFitProjection(audioid);
+}
+
+// Shared state of the workers learning from a manifest
+typedef struct {
+    audioid_t *audioid;     // configuration and labels being learned
+    size_t countEntries;
+    char **soundFiles;
+    char **labelFiles;
+    ma_mutex mutex;         // guards the fields below
+    size_t nextEntry;       // next manifest entry to be learned
+    size_t errors;
+} learn_pool_t;
+
+// A worker's label stats, merged into the labels once all entries are learned
+typedef struct {
+    learn_pool_t *pool;
+    running_stats_t *stats; // per label
+    double *gateLevel;      // per label (HUGE_VAL = none)
+    projection_fit_t fit;   // frames for the projection
+    size_t countFrames;
+    double duration;        // seconds of audio learned
+} learn_worker_t;
+
+// Copy the configuration and labels (without their stats) to another object, so that the label ids match
+static void AudioIdCopyConfig(audioid_t *dst, const audioid_t *src) {
+    dst->sampleRate = src->sampleRate;
+    dst->analysisRate = src->analysisRate;
+    dst->windowSize = src->windowSize;
+    dst->hopSize = src->hopSize;
+    dst->countBuckets = src->countBuckets;
+    dst->cycleCount = src->cycleCount;
+    dst->windowFunction = src->windowFunction;
+    dst->fingerprintMode = src->fingerprintMode;
+    dst->filterbank = src->filterbank;
+    dst->distanceMetric = src->distanceMetric;
+    dst->searchMode = src->searchMode;
+    dst->searchError = src->searchError;
+    dst->searchGroups = src->searchGroups;
+    dst->quantizeMode = src->quantizeMode;
+    dst->projectionDimension = src->projectionDimension;
+    dst->adaptive = src->adaptive;
+    dst->adaptiveMargin = src->adaptiveMargin;
+    dst->kernelsIsa = src->kernelsIsa;
+    dst->gateAuto = src->gateAuto;
+    dst->gateLevel = src->gateLevel;
+    dst->verbose = src->verbose;
+    for (size_t id = 0; id < src->countLabels; id++) {
+        AudioIdGetLabelId(dst, src->labels[id].labelText);
+    }
+}
+
+// Learn each remaining manifest entry in turn, with a separate object for each recording, accumulating into the worker's stats
+static void AudioIdLearnWorker(learn_worker_t *worker) {
+    learn_pool_t *pool = worker->pool;
+    size_t countLabels = pool->audioid->countLabels;
+    for (;;) {
+        ma_mutex_lock(&pool->mutex);
+        size_t entry = pool->nextEntry++;
+        ma_mutex_unlock(&pool->mutex);
+        if (entry >= pool->countEntries) break;
+
+        audioid_t *learner = AudioIdCreate();
+        AudioIdCopyConfig(learner, pool->audioid);
+        learner->learnWorker = true;
+        AudioIdConfigLearn(learner, pool->soundFiles[entry], pool->labelFiles[entry]);
+        bool ok = AudioIdStart(learner);
+        if (ok) {
+            AudioIdWaitUntilDone(learner);
+            if (learner->countLabels != countLabels) {
+                fprintf(stderr, "ERROR: Labels changed while learning: %s\n", pool->labelFiles[entry]);
+                ok = false;
+            }
+        }
+        if (ok) {
+            for (size_t id = 0; id < countLabels; id++) {
+                running_stats_merge(&worker->stats[id], &learner->labels[id].stats);
+                if (learner->labels[id].gateLevel < worker->gateLevel[id]) worker->gateLevel[id] = learner->labels[id].gateLevel;
+            }
+            ProjectionFitMerge(&worker->fit, &learner->projectionFit);
+            worker->countFrames += learner->countFrames;
+            worker->duration += (double)learner->totalSamples / learner->analysisRate;
+        } else {
+            fprintf(stderr, "ERROR: Problem learning manifest entry %zu: %s\n", entry + 1, pool->soundFiles[entry]);
+            ma_mutex_lock(&pool->mutex);
+            pool->errors++;
+            ma_mutex_unlock(&pool->mutex);
+        }
+        AudioIdDestroy(learner);
+    }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI AudioIdLearnThread(LPVOID arg) {
+    AudioIdLearnWorker((learn_worker_t *)arg);
+    return 0;
+}
+#else
+static void *AudioIdLearnThread(void *arg) {
+    AudioIdLearnWorker((learn_worker_t *)arg);
+    return NULL;
+}
+#endif
+
+// Number of processors available to run worker threads
+static unsigned int AudioIdProcessorCount(void) {
+#ifdef _WIN32
+    SYSTEM_INFO systemInfo;
+    GetSystemInfo(&systemInfo);
+    return systemInfo.dwNumberOfProcessors > 0 ? (unsigned int)systemInfo.dwNumberOfProcessors : 1;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (unsigned int)count : 1;
+#endif
+}
+
+// Learn from a manifest of labelled recordings (each line: sound file, tab, label file), processed in parallel
+bool AudioIdLearnManifest(audioid_t *audioid, const char *manifestFile) {
+    learn_pool_t pool;
+    memset(&pool, 0, sizeof(pool));
+    pool.audioid = audioid;
+
+    // Read the manifest entries
+    FILE *fp = fopen(manifestFile, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "ERROR: Problem opening manifest file: %s\n", manifestFile);
+        return false;
+    }
+    size_t maxEntries = 0;
+    char lineBuffer[1024];
+    for (size_t lineNumber = 1; ; lineNumber++) {
+        char *line = fgets(lineBuffer, sizeof(lineBuffer) - 1, fp);
+        if (line == NULL) break;
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') continue;
+
+        const char *soundFile = strtok(line, "\t");
+        const char *labelFile = strtok(NULL, "\t");
+        if (soundFile == NULL || labelFile == NULL) {
+            fprintf(stderr, "ERROR: Manifest file %s line %zu does not contain a sound file and label file (tab-separated).\n", manifestFile, lineNumber);
+            pool.errors++;
+            continue;
+        }
+        if (pool.countEntries >= maxEntries) {
+            maxEntries += maxEntries + 1;
+            pool.soundFiles = (char **)realloc(pool.soundFiles, sizeof(char *) * maxEntries);
+            pool.labelFiles = (char **)realloc(pool.labelFiles, sizeof(char *) * maxEntries);
+            if (pool.soundFiles == NULL || pool.labelFiles == NULL) { fprintf(stderr, "ERROR: Memory failure (manifest).\n"); exit(-1); }
+        }
+        pool.soundFiles[pool.countEntries] = strdup(soundFile);
+        pool.labelFiles[pool.countEntries] = strdup(labelFile);
+        pool.countEntries++;
+    }
+    fclose(fp);
+
+    // Add every label in the order first seen (as learning the entries in turn would), so that each worker's label ids match
+    for (size_t entry = 0; entry < pool.countEntries && pool.errors == 0; entry++) {
+        if (!AudioIdLoadLabels(audioid, pool.labelFiles[entry])) pool.errors++;
+        audioid->countIntervals = 0;
+    }
+
+    // Workers, each with its own stats for every label
+    unsigned int countWorkers = audioid->threads > 0 ? audioid->threads : AudioIdProcessorCount();
+    if (countWorkers > pool.countEntries) countWorkers = pool.countEntries > 0 ? (unsigned int)pool.countEntries : 1;
+    learn_worker_t *workers = (learn_worker_t *)calloc(countWorkers, sizeof(learn_worker_t));
+    if (workers == NULL) { fprintf(stderr, "ERROR: Memory failure (workers).\n"); exit(-1); }
+    for (unsigned int w = 0; w < countWorkers; w++) {
+        workers[w].pool = &pool;
+        workers[w].stats = (running_stats_t *)malloc(sizeof(running_stats_t) * (audioid->countLabels + 1));
+        workers[w].gateLevel = (double *)malloc(sizeof(double) * (audioid->countLabels + 1));
+        if (workers[w].stats == NULL || workers[w].gateLevel == NULL) { fprintf(stderr, "ERROR: Memory failure (workers).\n"); exit(-1); }
+        for (size_t id = 0; id < audioid->countLabels; id++) {
+            running_stats_init(&workers[w].stats[id], audioid->countBuckets);
+            workers[w].gateLevel[id] = HUGE_VAL;
+        }
+    }
+
+    // Learn the entries on the workers (the first on this thread)
+    double startTime = TimeNow();
+    if (pool.errors == 0 && pool.countEntries > 0) {
+        if (ma_mutex_init(&pool.mutex) != MA_SUCCESS) { fprintf(stderr, "ERROR: Problem creating mutex.\n"); exit(-1); }
+        fprintf(stderr, "AUDIOID: Learning %zu manifest entries on %u thread(s)...\n", pool.countEntries, countWorkers);
+#ifdef _WIN32
+        HANDLE *threads = (HANDLE *)malloc(sizeof(HANDLE) * countWorkers);
+#else
+        pthread_t *threads = (pthread_t *)malloc(sizeof(pthread_t) * countWorkers);
+#endif
+        bool *started = (bool *)calloc(countWorkers, sizeof(bool));
+        if (threads == NULL || started == NULL) { fprintf(stderr, "ERROR: Memory failure (threads).\n"); exit(-1); }
+        for (unsigned int w = 1; w < countWorkers; w++) {
+#ifdef _WIN32
+            threads[w] = CreateThread(NULL, 0, AudioIdLearnThread, &workers[w], 0, NULL);
+            started[w] = (threads[w] != NULL);
+#else
+            started[w] = (pthread_create(&threads[w], NULL, AudioIdLearnThread, &workers[w]) == 0);
+#endif
+            if (!started[w]) fprintf(stderr, "WARNING: Problem starting worker thread %u, continuing with fewer.\n", w);
+        }
+        AudioIdLearnWorker(&workers[0]);
+        for (unsigned int w = 1; w < countWorkers; w++) {
+            if (!started[w]) continue;
+#ifdef _WIN32
+            WaitForSingleObject(threads[w], INFINITE);
+            CloseHandle(threads[w]);
+#else
+            pthread_join(threads[w], NULL);
+#endif
+        }
+        free(started);
+        free(threads);
+        ma_mutex_uninit(&pool.mutex);
+    }
+    double elapsed = TimeNow() - startTime;
+
+    // Reduce the workers' stats into the labels
+    size_t countFrames = 0;
+    double duration = 0;
+    for (unsigned int w = 0; w < countWorkers; w++) {
+        for (size_t id = 0; id < audioid->countLabels; id++) {
+            running_stats_merge(&audioid->labels[id].stats, &workers[w].stats[id]);
+            if (workers[w].gateLevel[id] < audioid->labels[id].gateLevel) audioid->labels[id].gateLevel = workers[w].gateLevel[id];
+            running_stats_free(&workers[w].stats[id]);
+        }
+        ProjectionFitMerge(&audioid->projectionFit, &workers[w].fit);
+        ProjectionFitFree(&workers[w].fit);
+        countFrames += workers[w].countFrames;
+        duration += workers[w].duration;
+        free(workers[w].stats);
+        free(workers[w].gateLevel);
+    }
+    free(workers);
+    audioid->hopSize = AudioIdHopSize(audioid);    // as resolved by the workers
+    audioid->templatesStale = true;
+    if (pool.errors == 0) {
+        fprintf(stderr, "AUDIOID: Learned %zu frames (%.1f s of audio) from %zu manifest entries in %.2f s (%.0fx real time).\n", countFrames, duration, pool.countEntries, elapsed, elapsed > 0 ? duration / elapsed : 0);
+        AudioIdFitProjection(audioid);
+    }
+    ProjectionFitFree(&audioid->projectionFit);
+
+    for (size_t entry = 0; entry < pool.countEntries; entry++) {
+        free(pool.soundFiles[entry]);
+        free(pool.labelFiles[entry]);
+    }
+    free(pool.soundFiles);
+    free(pool.labelFiles);
+    return pool.errors == 0;
+}
+
+// Load state
+bool AudioIdStateLoad(audioid_t *audioid, const char *filename) {
+    int errors = 0;
+
+    FILE *fp = fopen(filename, "rt");
+    if (!fp) {
+        fprintf(stderr, "ERROR: Problem opening state file for reading: %s\n", filename);
+        return false;
+    }
+
+    bool globalSection = true;
+    size_t labelId = -1;
+    const size_t bufferSize = 65536;
+    char *buffer = (char *)malloc(bufferSize);
+    if (!buffer) {
+        fprintf(stderr, "ERROR: Problem allocating memory for reading: %zu\n", bufferSize);
+        fclose(fp);
+        return false;
+    }
+
+    for (size_t lineNumber = 1; ; lineNumber++) {
+        // Read next line
+        char *line = fgets(buffer, (int)bufferSize - 1, fp);
+        buffer[bufferSize - 1] = '\0';
+
+        // EOF (or read error)
+        if (line == NULL) break;
+
+        // Trim trailing whitespace
+        for (char *end = line + strlen(line); end > line && (*(end - 1) == '\n' || *(end - 1) == '\r' || *(end - 1) == ' '); end--) *(end - 1) = '\0';
+
+        // Empty line
+        if (line[0] == '\0') continue;
+
+        // Comment line
+        if (line[0] == '#') continue;
+
+        // Label section
+        if (line[0] == '[') {
+            if (line[1] == ']') {
+                globalSection = true;
+            } else {
+                char *label = strtok(line + 1, "]\r\n");
+                labelId = AudioIdGetLabelId(audioid, label);
+                globalSection = false;
+            }
+            continue;
+        }
+
+        // Split into name/value pair
+        static char *empty = "";
+        const char *name = line;
+        char *value = empty;
+        char *equals = strchr(line, '=');
+        if (equals != NULL) {
+            *equals = '\0';
+            value = equals + 1;
+            // Trim space either side of the equals
+            for (char *p = equals; p > line && *(p - 1) == ' '; p--) *(p - 1) = '\0'; 
+            for (char *p = equals + 1; *p == ' '; p++) { *p = '\0'; value = p + 1; }
+            // Trim quotes
+            if (value[0] == '\"') value++;
+            if (value[0] != '\0' && value[strlen(value) - 1] == '\"') value[strlen(value) - 1] = '\0';
+        }
+
+        if (globalSection) {
+            if (!AudioIdSetOption(audioid, name, value)) {
+                fprintf(stderr, "ERROR: Problem reading state file %s global-section line %zu option: %s\n", filename, lineNumber, name);
+                errors++;
+            }
+        } else {
+            if (strcmp(name, "stats") == 0) {
+                // Read stats
+                size_t index = 0;
+                char *stat = value;
+                for (;;) {
+                    // Trim and find end of token
+                    while (*stat == ' ') stat++;
+                    if (*stat == '\0') break;
+                    char *end = strchr(stat, ';');
+                    if (end != NULL) { *end = '\0'; }
+
+                    char *count = strtok(stat, " ");
+                    char *mean = strtok(NULL, " ");
+                    char *sumVar = strtok(NULL, " ");
+                    if (count != NULL && mean != NULL && sumVar != NULL) {
+                        if (index < audioid->countBuckets) {
+                            running_stats_t *stats = &audioid->labels[labelId].stats;
+                            stats->count[index] = (unsigned int)atoi(count);
+                            stats->mean[index] = stats->count[index] > 0 ? atof(mean) : 0;
+                            stats->sumVar[index] = stats->count[index] > 0 ? atof(sumVar) : 0;
+                            audioid->templatesStale = true;
+                        } else {
+                            fprintf(stderr, "ERROR: Problem reading state file %s section %s line %zu stat index %zu exceeds bucket count %zu: %s\n", filename, audioid->labels[labelId].labelText, lineNumber, index, audioid->countBuckets, name);
+                            errors++;
+                        }
+                        index++;
+                    } else {
+                        fprintf(stderr, "ERROR: Problem reading state file %s section %s line %zu malformed stat at index %zu: %s\n", filename, audioid->labels[labelId].labelText, lineNumber, index, name);
+                        errors++;
+                    }
+
+                    // Next token
+                    if (!end) break;
+                    stat = end + 1; 
+                }
+                
+                if (index != audioid->countBuckets) {
+                    fprintf(stderr, "ERROR: Problem reading state file %s section %s line %zu stat count %zu does not equal bucket count %zu: %s\n", filename, AudioIdGetLabelName(audioid, labelId), lineNumber, index, audioid->countBuckets, name);
+                    errors++;
+                }
+            } else if (strcmp(name, "scale") == 0) {
+                audioid->labels[labelId].scale = atof(value);
+                audioid->templatesStale = true;     // (the search tree bounds the scaled distances)
+            } else if (strcmp(name, "limit") == 0) {
+                audioid->labels[labelId].limit = atof(value);
+                audioid->templatesStale = true;
+            } else if (strcmp(name, "minduration") == 0) {
+                audioid->labels[labelId].minDuration = atof(value);
+            } else if (strcmp(name, "afterevent") == 0) {
+                audioid->labels[labelId].onlyAfterEvent = (int)AudioIdGetLabelId(audioid, value);
+            } else if (strcmp(name, "withininterval") == 0) {
+                audioid->labels[labelId].onlyWithinInterval = atof(value);
+            } else if (strcmp(name, "gatelevel") == 0) {
+                audioid->labels[labelId].gateLevel = atof(value);
+            } else {
+                fprintf(stderr, "ERROR: Problem reading state file %s section %s line %zu unrecognized name: %s\n", filename, AudioIdGetLabelName(audioid, labelId), lineNumber, name);
+                errors++;
+            }
+        }
+    }
+    free(buffer);
+    fclose(fp);
+    return (errors == 0);
+}
+
+// Save state
+bool AudioIdStateSave(audioid_t *audioid, const char *filename) {
+    FILE *fp = fopen(filename, "wt");
+    if (!fp) {
+        fprintf(stderr, "ERROR: Problem opening state file for writing: %s\n", filename);
+        return false;
+    }
+
+    fprintf(fp, "# AudioID state file -- this file will be overwritten if the --write-state option is used\n");
+    fprintf(fp, "\n");
+    fprintf(fp, "analysisrate = %u\n", audioid->analysisRate);
+    fprintf(fp, "windowsize = %zu\n", AudioIdWindowSize(audioid));
+    fprintf(fp, "bucketcount = %zu\n", audioid->countBuckets);
+    if (audioid->hopSize > 0) fprintf(fp, "hop = %zu\n", audioid->hopSize);
+    fprintf(fp, "cyclecount = %zu\n", audioid->cycleCount);
+    if (audioid->gateAuto) fprintf(fp, "gate = auto\n");
+    else if (audioid->gateLevel == -HUGE_VAL) fprintf(fp, "gate = off\n");
+    else fprintf(fp, "gate = %f\n", audioid->gateLevel);
+    fprintf(fp, "fingerprint = %s\n", FingerprintModeName(audioid->fingerprintMode));
+    fprintf(fp, "filterbank = %s\n", FilterbankName(audioid->filterbank));
+    fprintf(fp, "distance = %s\n", DistanceMetricName(audioid->distanceMetric));
+    fprintf(fp, "window = %s\n", WindowFunctionName(audioid->windowFunction));
+    if (audioid->projectionDimension > 0) fprintf(fp, "projection = %zu\n", audioid->projectionDimension);
+    if (audioid->projection.dimension > 0) {
+        const projection_t *projection = &audioid->projection;
+        for (size_t r = 0; r <= projection->dimension; r++) {
+            const double *values = (r == 0) ? projection->mean : projection->rows + (r - 1) * projection->stride;
+            fprintf(fp, "%s = \"", (r == 0) ? "projectionmean" : "projectionrow");
+            for (size_t i = 0; i < projection->countBuckets; i++) {
+                fprintf(fp, "%s%.9g", i == 0 ? "" : "; ", values[i]);
+            }
+            fprintf(fp, "\"\n");
+        }
+    }
+    fprintf(fp, "\n");
+    for (size_t id = 0; id < audioid->countLabels; id++) {
+        fprintf(fp, "[%s]\n", audioid->labels[id].labelText);
+
+        fprintf(fp, "stats = \"");
+        for (size_t i = 0; i < audioid->countBuckets; i++) {
+            const running_stats_t *stats = &audioid->labels[id].stats;
+            fprintf(fp, "%s%u %f %f", i == 0 ? "" : "; ", running_stats_count(stats, i), running_stats_mean(stats, i), stats->sumVar[i]);
+        }
+        fprintf(fp, "\"\n");
+        fprintf(fp, "scale = %f\n", audioid->labels[id].scale);
+        fprintf(fp, "limit = %f\n", audioid->labels[id].limit);
+        if (audioid->labels[id].gateLevel < HUGE_VAL) fprintf(fp, "gatelevel = %f\n", audioid->labels[id].gateLevel);
+
+        fprintf(fp, "\n");
+    }
+
+    fclose(fp);
+    return true;
+}
+
+// Shutdown an audioid object (but do not destroy it), the object can be used again
+void AudioIdShutdown(audioid_t *audioid) {
+    if (audioid->deviceInitialized) {
+        if (audioid->verbose) fprintf(stderr, "AUDIOID: Stopping audio capture.\n");
+        ma_device_uninit(&audioid->device);
+        audioid->deviceInitialized = false;
+    }
+    if (audioid->decoderInitialized) {
+        if (audioid->verbose) fprintf(stderr, "AUDIOID: Closing audio file.\n");
+        ma_decoder_uninit(&audioid->decoder);
+        audioid->decoderInitialized = false;
+    }
+    if (audioid->intervals != NULL) {
+        free(audioid->intervals);
+        audioid->intervals = NULL;
+    }
+    audioid->countIntervals = 0;
+    if (audioid->stateHistory != NULL) {
+        free(audioid->stateHistory);
+        audioid->stateHistory = NULL;
+    }
+    AudioIdFreeLabels(audioid);
+    TemplatesFree(&audioid->templates);
+    VpTreeFree(&audioid->tree);
+    GroupSearchFree(&audioid->groupSearch);
+    ProjectionFree(&audioid->projection);
+    ProjectionFitFree(&audioid->projectionFit);
+    free(audioid->labelScales);
+    audioid->labelScales = NULL;
+    free(audioid->labelLimits);
+    audioid->labelLimits = NULL;
+    free(audioid->adaptiveInputs);
+    audioid->adaptiveInputs = NULL;
+    free(audioid->adaptiveAssumed);
+    audioid->adaptiveAssumed = NULL;
+    if (audioid->labelDistances != NULL) {
+        free(audioid->labelDistances);
+        audioid->labelDistances = NULL;
+    }
+    DecimatorDestroy(&audioid->decimator);
+    FingerprintDestroy(&audioid->fingerprint);
+}
+
+
+// --- Benchmarks ---
+
+static volatile double benchmarkSink;   // prevents benchmarked results being optimized away
+
+// Deterministic pseudo-random test signal
+static void BenchmarkSignal(int16_t *samples, size_t count) {
+    uint32_t seed = 0x12345678;
+    for (size_t i = 0; i < count; i++) {
+        seed = seed * 1664525 + 1013904223;
+        samples[i] = (int16_t)(seed >> 16);
+    }
+}
+
+#if !AUDIOID_FIXED_POINT
+// Per-frame cost of window weighting: evaluating the window function per sample, against the precomputed table
+static void BenchmarkWindow(fingerprint_t *fingerprint, int frames) {
+    size_t size = fingerprint->maxSamples;
+    for (size_t i = 0; i < size; i++) fingerprint->input[i] = (real_t)(int16_t)(i * 7919) / 32768;
+
+    double start = TimeNow();
+    for (int frame = 0; frame < frames; frame++) {
+        for (size_t i = 0; i < size; i++) {
+            double weight = WindowFunction(fingerprint->windowFunction, i, size);
+            fingerprint->weighted[i] = (real_t)(weight * fingerprint->input[i]);
+        }
+        benchmarkSink += fingerprint->weighted[frame % size];
+    }
+    double elapsedFunction = TimeNow() - start;
+
+    start = TimeNow();
+    for (int frame = 0; frame < frames; frame++) {
+        for (size_t i = 0; i < size; i++) {
+            fingerprint->weighted[i] = fingerprint->window[i] * fingerprint->input[i];
+        }
+        benchmarkSink += fingerprint->weighted[frame % size];
+    }
+    double elapsedTable = TimeNow() - start;
+
+    printf("BENCHMARK: window %s (%zu samples): per-sample function %.3f us/frame, table %.3f us/frame (%.1fx)\n", WindowFunctionName(fingerprint->windowFunction), size, 1e6 * elapsedFunction / frames, 1e6 * elapsedTable / frames, elapsedTable > 0 ? elapsedFunction / elapsedTable : 0);
+}
+#endif
+
+// Arithmetic of the fingerprint front end, as built
+static const char *FingerprintPrecision(void) {
+#if AUDIOID_FIXED_POINT
+    return "fixed-point";
+#else
+    return (sizeof(real_t) == sizeof(float)) ? "single precision" : "double precision";
+#endif
+}
+
+// Whole fingerprint front end cost per hop
+static void BenchmarkFingerprint(fingerprint_t *fingerprint, int frames) {
+    size_t countSamples = fingerprint->maxSamples * 4;
+    int16_t *samples = malloc(sizeof(int16_t) * countSamples);
+    if (samples == NULL) { fprintf(stderr, "ERROR: Memory failure (benchmark).\n"); exit(-1); }
+    BenchmarkSignal(samples, countSamples);
+
+    int count = 0;
+    size_t offset = 0;
+    double start = TimeNow();
+    while (count < frames) {
+        offset += FingerprintAddSamples(fingerprint, samples + offset, countSamples - offset);
+        if (offset >= countSamples) offset = 0;
+        real_t *buckets = FingerprintBuckets(fingerprint, NULL);
+        if (buckets != NULL) {
+            benchmarkSink += buckets[count % fingerprint->countBuckets];
+            count++;
+        }
+    }
+    double elapsed = TimeNow() - start;
+    free(samples);
+
+    printf("BENCHMARK: fingerprint %s (%zu samples, %zu %s buckets, %s, %s kernels): %.3f us/frame\n", FingerprintModeName(fingerprint->mode), fingerprint->maxSamples, fingerprint->countBuckets, FilterbankName(fingerprint->filterbank), FingerprintPrecision(), fingerprint->kernels.name, 1e6 * elapsed / frames);
+}
+
+// Per-frame cost of batch fingerprinting (as used for recorded audio), and the resulting speed relative to realtime
+static void BenchmarkBatch(fingerprint_t *fingerprint, int frames) {
+    size_t countSamples = BATCH_FRAME_COUNT * fingerprint->hopSize;
+    int16_t *samples = malloc(sizeof(int16_t) * countSamples);
+    real_t *output = malloc(sizeof(real_t) * BATCH_FRAME_COUNT * fingerprint->countBuckets);
+    fingerprint_frame_t *frameInfo = malloc(sizeof(fingerprint_frame_t) * BATCH_FRAME_COUNT);
+    if (samples == NULL || output == NULL || frameInfo == NULL) { fprintf(stderr, "ERROR: Memory failure (benchmark).\n"); exit(-1); }
+    BenchmarkSignal(samples, countSamples);
+
+    int count = 0;
+    size_t offset = 0;
+    double start = TimeNow();
+    while (count < frames) {
+        size_t samplesUsed = 0;
+        size_t countFrames = FingerprintAddSamplesBatch(fingerprint, samples + offset, countSamples - offset, output, frameInfo, BATCH_FRAME_COUNT, &samplesUsed);
+        offset += samplesUsed;
+        if (offset >= countSamples) offset = 0;
+        if (countFrames > 0) benchmarkSink += output[(countFrames - 1) * fingerprint->countBuckets];
+        count += (int)countFrames;
+    }
+    double elapsed = TimeNow() - start;
+    free(frameInfo);
+    free(output);
+    free(samples);
+
+    double frameDuration = (double)fingerprint->hopSize / fingerprint->sampleRate;
+    printf("BENCHMARK: fingerprint batch (%d frames per batch, %s kernels): %.3f us/frame, %.0fx realtime\n", BATCH_FRAME_COUNT, fingerprint->kernels.name, 1e6 * elapsed / count, frameDuration * count / elapsed);
+}
+
+// Score an input against label templates of random stats, at several label counts, with the kernels (or per label with Distance() if NULL)
+static void BenchmarkDistances(const kernels_t *kernels, distance_metric_t metric, size_t countBuckets, int frames) {
+    const size_t labelCounts[] = { 10, 100, 1000 };
+    for (size_t c = 0; c < sizeof(labelCounts) / sizeof(labelCounts[0]); c++) {
+        size_t countLabels = labelCounts[c];
+        running_stats_t stats;
+        templates_t templates = {0};
+        running_stats_init(&stats, countBuckets);
+        TemplatesResize(&templates, countLabels, countBuckets);
+        templates.metric = metric;
+        double *input = malloc(sizeof(double) * countBuckets);
+        double *distances = malloc(sizeof(double) * countLabels);
+        real_t *values = malloc(sizeof(real_t) * countBuckets);
+        if (input == NULL || distances == NULL || values == NULL) { fprintf(stderr, "ERROR: Memory failure (benchmark).\n"); exit(-1); }
+        uint32_t seed = 0x12345678;
+        for (size_t id = 0; id < countLabels; id++) {
+            running_stats_clear(&stats);
+            for (int n = 0; n < 2; n++) {
+                for (size_t i = 0; i < countBuckets; i++) {
+                    seed = seed * 1664525 + 1013904223;
+                    values[i] = (real_t)((double)(seed >> 8) / (1 << 24));
+                }
+                running_stats_add(&stats, values);
+            }
+            TemplatesSet(&templates, id, &stats);
+        }
+        for (size_t i = 0; i < countBuckets; i++) input[i] = (double)values[i] * 0.5;
+
+        // Fewer frames for more labels, for a similar run time
+        int iterations = (int)(frames * 100 / countLabels);
+        double start = TimeNow();
+        for (int frame = 0; frame < iterations; frame++) {
+            input[frame % countBuckets] += 1e-6;
+            if (kernels != NULL) {
+                Distances(kernels, countBuckets, input, &templates, distances);
+            } else {
+                for (size_t id = 0; id < countLabels; id++) distances[id] = Distance(countBuckets, input, &templates, id);
+            }
+            benchmarkSink += distances[frame % countLabels];
+        }
+        double elapsed = TimeNow() - start;
+
+        printf("BENCHMARK: distances (%s, %zu labels, %zu buckets, %s): %.3f us/frame\n", DistanceMetricName(metric), countLabels, countBuckets, kernels != NULL ? kernels->name : "per-label Distance()", 1e6 * elapsed / iterations);
+        free(values);
+        free(distances);
+        free(input);
+        TemplatesFree(&templates);
+        running_stats_free(&stats);
+    }
+}
+
+// Label templates of random stats: variants (each bucket within spread of the mean) of fewer random sounds, or independent sounds if the spread is 0
+static void RandomTemplates(templates_t *templates, size_t countLabels, size_t countBuckets, size_t countSounds, double spread, uint32_t seed) {
+    running_stats_t stats;
+    running_stats_init(&stats, countBuckets);
+    real_t *values = malloc(sizeof(real_t) * countBuckets);
+    double *sounds = malloc(sizeof(double) * countSounds * countBuckets);
+    if (values == NULL || sounds == NULL) { fprintf(stderr, "ERROR: Memory failure (benchmark).\n"); exit(-1); }
+    for (size_t i = 0; i < countSounds * countBuckets; i++) {
+        seed = seed * 1664525 + 1013904223;
+        sounds[i] = (double)(seed >> 8) / (1 << 24);
+    }
+    TemplatesResize(templates, countLabels, countBuckets);
+    for (size_t id = 0; id < countLabels; id++) {
+        const double *sound = sounds + (id % countSounds) * countBuckets;
+        running_stats_clear(&stats);
+        for (int n = 0; n < 2; n++) {
+            for (size_t i = 0; i < countBuckets; i++) {
+                seed = seed * 1664525 + 1013904223;
+                double noise = (double)(seed >> 8) / (1 << 24) - 0.5;
+                values[i] = (real_t)(spread > 0 ? sound[i] * (1 + spread * noise) : noise + 0.5);
+            }
+            running_stats_add(&stats, values);
+        }
+        TemplatesSet(templates, id, &stats);
+    }
+    free(sounds);
+    free(values);
+    running_stats_free(&stats);
+}
+
+// Labels and inputs of the search benchmarks: label templates of random stats (as RandomTemplates), unit scales without limits, and inputs near some of the labels with the nearest label a scan finds for each
+typedef struct {
+    size_t countLabels;
+    size_t countBuckets;
+    size_t countInputs;
+    templates_t templates;
+    double *scales;
+    double *limits;
+    double *distances;      // countLabels scratch distances (for a scan of every label)
+    double *inputs;         // countInputs x countBuckets values
+    int *nearest;           // countInputs nearest labels of a scan of every label
+} search_benchmark_t;
+
+static void SearchBenchmarkInit(search_benchmark_t *bench, const kernels_t *kernels, size_t countLabels, size_t countBuckets, size_t countSounds, double spread, uint32_t seed) {
+    memset(bench, 0, sizeof(*bench));
+    bench->countLabels = countLabels;
+    bench->countBuckets = countBuckets;
+    bench->countInputs = 64;
+    RandomTemplates(&bench->templates, countLabels, countBuckets, countSounds, spread, seed);
+    bench->scales = malloc(sizeof(double) * countLabels);
+    bench->limits = malloc(sizeof(double) * countLabels);
+    bench->distances = malloc(sizeof(double) * countLabels);
+    bench->inputs = malloc(sizeof(double) * countBuckets * bench->countInputs);
+    bench->nearest = malloc(sizeof(int) * bench->countInputs);
+    if (bench->scales == NULL || bench->limits == NULL || bench->distances == NULL || bench->inputs == NULL || bench->nearest == NULL) { fprintf(stderr, "ERROR: Memory failure (benchmark).\n"); exit(-1); }
+    for (size_t id = 0; id < countLabels; id++) { bench->scales[id] = 1; bench->limits[id] = -1; }
+
+    // Inputs near some of the labels
+    uint32_t inputSeed = 0x5be0cd19;
+    for (size_t n = 0; n < bench->countInputs; n++) {
+        const double *mean = bench->templates.mean + (n * 7919 % countLabels) * bench->templates.stride;
+        double *input = bench->inputs + n * countBuckets;
+        for (size_t i = 0; i < countBuckets; i++) {
+            inputSeed = inputSeed * 1664525 + 1013904223;
+            input[i] = mean[i] * (1 + 0.05 * ((double)(inputSeed >> 8) / (1 << 24) - 0.5));
+        }
+        double distance;
+        bench->nearest[n] = ScanNearest(kernels, &bench->templates, input, bench->scales, bench->limits, bench->distances, &distance);
+    }
+}
+
+static const double *SearchBenchmarkInput(const search_benchmark_t *bench, size_t n) {
+    return bench->inputs + (n % bench->countInputs) * bench->countBuckets;
+}
+
+static void SearchBenchmarkFree(search_benchmark_t *bench) {
+    free(bench->nearest);
+    free(bench->inputs);
+    free(bench->distances);
+    free(bench->limits);
+    free(bench->scales);
+    TemplatesFree(&bench->templates);
+}
+
+// Cost of finding the nearest label with the search tree, exact and approximate, against a scan of every label, for variants of fewer sounds and for independent sounds
+static void BenchmarkSearch(const kernels_t *kernels, size_t countBuckets, int frames) {
+    const size_t labelCounts[] = { 100, 1000, 10000 };
+    const double approximateError = 0.1;
+    for (int clustered = 1; clustered >= 0; clustered--) {
+        for (size_t c = 0; c < sizeof(labelCounts) / sizeof(labelCounts[0]); c++) {
+            size_t countLabels = labelCounts[c];
+            search_benchmark_t bench;
+            SearchBenchmarkInit(&bench, kernels, countLabels, countBuckets, clustered ? countLabels / 10 : countLabels, clustered ? 0.1 : 0, 0x1f83d9ab);
+            templates_t *templates = &bench.templates;
+
+            double start = TimeNow();
+            vp_tree_t tree = {0};
+            VpTreeBuild(&tree, kernels, templates->mean, templates->stride, countBuckets, countLabels, bench.scales, bench.limits);
+            double buildTime = TimeNow() - start;
+
+            int iterations = (int)(frames * 100 / countLabels);
+            if (iterations < 64) iterations = 64;
+            // Scan, exact tree, approximate tree, early-abandoning scan
+            TemplatesOrder(templates);
+            double elapsed[4];
+            size_t scored[4] = {0};
+            int hint = -1;
+            for (int method = 0; method < 4; method++) {
+                start = TimeNow();
+                for (int frame = 0; frame < iterations; frame++) {
+                    const double *input = SearchBenchmarkInput(&bench, (size_t)frame);
+                    double distance;
+                    size_t count = countLabels;
+                    int closest;
+                    if (method == 0) {
+                        closest = ScanNearest(kernels, templates, input, bench.scales, bench.limits, bench.distances, &distance);
+                    } else if (method == 3) {
+                        // (bucket distances evaluated, as a proportion of the labels)
+                        size_t evaluated = 0;
+                        closest = TemplatesNearest(kernels, templates, input, bench.scales, bench.limits, hint, &distance, &evaluated);
+                        hint = (frame % 4 == 3) ? -1 : closest;     // (as a stable input would)
+                        count = evaluated / countBuckets;
+                    } else {
+                        closest = VpTreeSearch(&tree, kernels, input, templates->mean, templates->stride, countBuckets, method == 2 ? approximateError : 0, &distance, &count);
+                    }
+                    scored[method] += count;
+                    benchmarkSink += distance + closest;
+                }
+                elapsed[method] = TimeNow() - start;
+            }
+
+            // Agreement of the approximate search with the scan
+            size_t agree = 0;
+            for (size_t n = 0; n < bench.countInputs; n++) {
+                double distance;
+                if (VpTreeSearch(&tree, kernels, SearchBenchmarkInput(&bench, n), templates->mean, templates->stride, countBuckets, approximateError, &distance, NULL) == bench.nearest[n]) agree++;
+            }
+
+            printf("BENCHMARK: search (%s, %zu labels, %zu buckets, %s): scan %.3f us/frame, early-abandoning scan %.3f us/frame (%.1f%% of bucket distances), tree %.3f us/frame (%.1f%% of labels scored, built in %.1f ms), approximate (error %g) %.3f us/frame (%.1f%% scored, %zu/%zu agree with the scan)\n",
+                clustered ? "variants of 1/10 as many sounds" : "independent sounds", countLabels, countBuckets, kernels->name,
+                1e6 * elapsed[0] / iterations, 1e6 * elapsed[3] / iterations, 100.0 * scored[3] / iterations / countLabels,
+                1e6 * elapsed[1] / iterations, 100.0 * scored[1] / iterations / countLabels, 1e3 * buildTime,
+                approximateError, 1e6 * elapsed[2] / iterations, 100.0 * scored[2] / iterations / countLabels, agree, bench.countInputs);
+            VpTreeFree(&tree);
+            SearchBenchmarkFree(&bench);
+        }
+    }
+}
+
+// Cost of the group search, scoring the labels of the nearest one or two groups, against a scan of every label, for groups of variants of one sound each (as more labels are added to each group, as well as more groups)
+static void BenchmarkGroupSearch(const kernels_t *kernels, size_t countBuckets, int frames) {
+    const size_t groupCounts[] = { 10, 32, 100 };   // (with as many labels in each group)
+    for (size_t c = 0; c < sizeof(groupCounts) / sizeof(groupCounts[0]); c++) {
+        size_t countGroups = groupCounts[c], countLabels = countGroups * countGroups;
+        search_benchmark_t bench;
+        group_search_t search = {0};
+        SearchBenchmarkInit(&bench, kernels, countLabels, countBuckets, countGroups, 0.1, 0x1f83d9ab);
+        size_t *groups = malloc(sizeof(size_t) * countLabels);
+        if (groups == NULL) { fprintf(stderr, "ERROR: Memory failure (benchmark).\n"); exit(-1); }
+        for (size_t id = 0; id < countLabels; id++) groups[id] = id % countGroups;
+        GroupSearchBuild(&search, &bench.templates, groups);
+
+        int iterations = (int)(frames * 100 / countLabels);
+        if (iterations < 64) iterations = 64;
+        // Scan, nearest group, nearest two groups
+        double elapsed[3];
+        size_t agree[3] = {0};
+        for (int method = 0; method < 3; method++) {
+            double start = TimeNow();
+            for (int frame = 0; frame < iterations; frame++) {
+                const double *input = SearchBenchmarkInput(&bench, (size_t)frame);
+                double distance;
+                int closest;
+                if (method == 0) {
+                    closest = ScanNearest(kernels, &bench.templates, input, bench.scales, bench.limits, bench.distances, &distance);
+                } else {
+                    closest = GroupSearchNearest(kernels, &search, input, bench.scales, bench.limits, (size_t)method, &distance, NULL);
+                }
+                benchmarkSink += distance + closest;
+            }
+            elapsed[method] = TimeNow() - start;
+            for (size_t n = 0; n < bench.countInputs && method > 0; n++) {
+                double distance;
+                if (GroupSearchNearest(kernels, &search, SearchBenchmarkInput(&bench, n), bench.scales, bench.limits, (size_t)method, &distance, NULL) == bench.nearest[n]) agree[method]++;
+            }
+        }
+
+        printf("BENCHMARK: group search (%zu groups of %zu labels, %zu buckets, %s): scan %.3f us/frame, nearest group %.3f us/frame (%zu/%zu agree with the scan), nearest 2 groups %.3f us/frame (%zu/%zu agree)\n",
+            countGroups, countGroups, countBuckets, kernels->name, 1e6 * elapsed[0] / iterations, 1e6 * elapsed[1] / iterations, agree[1], bench.countInputs, 1e6 * elapsed[2] / iterations, agree[2], bench.countInputs);
+        GroupSearchFree(&search);
+        free(groups);
+        SearchBenchmarkFree(&bench);
+    }
+}
+
+// Cost of scoring every label from quantized templates against the double-precision scan, for variants of fewer sounds
+static void BenchmarkQuantized(const kernels_t *kernels, size_t countBuckets, int frames) {
+    const size_t labelCounts[] = { 100, 1000, 10000 };
+    for (size_t c = 0; c < sizeof(labelCounts) / sizeof(labelCounts[0]); c++) {
+        size_t countLabels = labelCounts[c];
+        search_benchmark_t bench;
+        SearchBenchmarkInit(&bench, kernels, countLabels, countBuckets, countLabels / 10, 0.1, 0x1f83d9ab);
+        TemplatesQuantize(&bench.templates);
+
+        int iterations = (int)(frames * 100 / countLabels);
+        if (iterations < 64) iterations = 64;
+        // Double precision, quantized
+        double elapsed[2];
+        for (int method = 0; method < 2; method++) {
+            double start = TimeNow();
+            for (int frame = 0; frame < iterations; frame++) {
+                const double *input = SearchBenchmarkInput(&bench, (size_t)frame);
+                double distance;
+                int closest;
+                if (method == 0) {
+                    closest = ScanNearest(kernels, &bench.templates, input, bench.scales, bench.limits, bench.distances, &distance);
+                } else {
+                    closest = TemplatesNearestQuantized(kernels, &bench.templates, input, bench.scales, bench.limits, &distance);
+                }
+                benchmarkSink += distance + closest;
+            }
+            elapsed[method] = TimeNow() - start;
+        }
+        size_t agree = 0;
+        for (size_t n = 0; n < bench.countInputs; n++) {
+            double distance;
+            if (TemplatesNearestQuantized(kernels, &bench.templates, SearchBenchmarkInput(&bench, n), bench.scales, bench.limits, &distance) == bench.nearest[n]) agree++;
+        }
+
+        printf("BENCHMARK: quantized scan (%zu labels, %zu buckets, %s): double %.3f us/frame (%.0f frames/s), quantized %.3f us/frame (%.0f frames/s, %zu/%zu agree with double)\n",
+            countLabels, countBuckets, kernels->name, 1e6 * elapsed[0] / iterations, iterations / elapsed[0], 1e6 * elapsed[1] / iterations, iterations / elapsed[1], agree, bench.countInputs);
+        SearchBenchmarkFree(&bench);
+    }
+}
+
+// Cost of the projection, unblocked and blocked, and of a scan of labels projected to fewer dimensions against a scan of their buckets
+static void BenchmarkProjection(const kernels_t *kernels, size_t countBuckets, int frames) {
+    const size_t countLabels = 1000, dimension = 24;
+    search_benchmark_t bench;
+    templates_t projected = {0};
+    SearchBenchmarkInit(&bench, kernels, countLabels, countBuckets, countLabels / 10, 0.1, 0x510e527f);
+    templates_t *templates = &bench.templates;
+    real_t *values = malloc(sizeof(real_t) * countBuckets);
+    if (values == NULL) { fprintf(stderr, "ERROR: Memory failure (benchmark).\n"); exit(-1); }
+
+    // Projection fitted to the labels' means, and the labels projected
+    projection_fit_t fit = {0};
+    projection_t projection = {0};
+    for (size_t id = 0; id < countLabels; id++) {
+        for (size_t i = 0; i < countBuckets; i++) values[i] = (real_t)templates->mean[id * templates->stride + i];
+        ProjectionFitAdd(&fit, countBuckets, values);
+    }
+    double kept = ProjectionFitSolve(&fit, &projection, dimension);
+    ProjectionUpdate(&projection, kernels);
+    TemplatesResize(&projected, countLabels, projection.dimension);
+    for (size_t id = 0; id < countLabels; id++) {
+        TemplatesSetProjected(&projected, id, &projection, kernels, templates->mean + id * templates->stride);
+    }
+
+    int iterations = frames * 10;
+    // Projection alone (one pass over the columns, or blocked), projection and scan of the projected labels, scan of the labels
+    double elapsed[4];
+    for (int method = 0; method < 4; method++) {
+        double start = TimeNow();
+        for (int frame = 0; frame < iterations; frame++) {
+            const double *input = SearchBenchmarkInput(&bench, (size_t)frame);
+            double distance = 0;
+            int closest = 0;
+            if (method == 0) {
+                kernels->dot(projection.partial, input, projection.rows, projection.stride, countBuckets, projection.dimension);
+                distance = projection.partial[0];
+            } else if (method == 1) {
+                distance = ProjectionApply(&projection, kernels, input, projection.dimension)[0];
+            } else if (method == 2) {
+                closest = ScanNearest(kernels, &projected, ProjectionApply(&projection, kernels, input, projection.dimension), bench.scales, bench.limits, bench.distances, &distance);
+            } else {
+                closest = ScanNearest(kernels, templates, input, bench.scales, bench.limits, bench.distances, &distance);
+            }
+            benchmarkSink += distance + closest;
+        }
+        elapsed[method] = TimeNow() - start;
+    }
+    size_t agree = 0;
+    for (size_t n = 0; n < bench.countInputs; n++) {
+        double distance;
+        if (ScanNearest(kernels, &projected, ProjectionApply(&projection, kernels, SearchBenchmarkInput(&bench, n), projection.dimension), bench.scales, bench.limits, bench.distances, &distance) == bench.nearest[n]) agree++;
+    }
+
+    printf("BENCHMARK: projection (%zu buckets to %zu dimensions, %.1f%% of the variance, %s): unblocked %.3f us/frame, blocked %.3f us/frame\n", countBuckets, projection.dimension, 100.0 * kept, kernels->name, 1e6 * elapsed[0] / iterations, 1e6 * elapsed[1] / iterations);
+    printf("BENCHMARK: projected scan (%zu labels, %s): %zu buckets %.3f us/frame (%.0f frames/s), projected to %zu %.3f us/frame (%.0f frames/s, %zu/%zu agree)\n",
+        countLabels, kernels->name, countBuckets, 1e6 * elapsed[3] / iterations, iterations / elapsed[3], projection.dimension, 1e6 * elapsed[2] / iterations, iterations / elapsed[2], agree, bench.countInputs);
+    ProjectionFree(&projection);
+    ProjectionFitFree(&fit);
+    free(values);
+    TemplatesFree(&projected);
+    SearchBenchmarkFree(&bench);
+}
+
+// Cost of decimating from the capture rate to the analysis rate
+static void BenchmarkDecimator(audioid_t *audioid, int frames) {
+    decimator_t decimator;
+    DecimatorInit(&decimator, audioid->sampleRate / audioid->analysisRate, audioid->kernelsIsa);
+    size_t countSamples = audioid->sampleRate;  // one second
+    int16_t *samples = malloc(sizeof(int16_t) * countSamples);
+    int16_t *output = malloc(sizeof(int16_t) * countSamples);
+    if (samples == NULL || output == NULL) { fprintf(stderr, "ERROR: Memory failure (benchmark).\n"); exit(-1); }
+    BenchmarkSignal(samples, countSamples);
+
+    double start = TimeNow();
+    for (int i = 0; i < frames / 10; i++) {
+        size_t countOutput = DecimatorProcess(&decimator, samples, countSamples, output);
+        benchmarkSink += output[countOutput / 2];
+    }
+    double elapsed = TimeNow() - start;
+    free(output);
+    free(samples);
+
+    printf("BENCHMARK: decimator %u Hz to %u Hz (%zu taps, %s kernels): %.3f us per second of input\n", audioid->sampleRate, audioid->analysisRate, decimator.countTaps, decimator.kernels.name, 1e6 * elapsed / (frames / 10));
+    DecimatorDestroy(&decimator);
+}
+
+// Run micro-benchmarks of the processing stages using the current configuration
+void AudioIdBenchmark(audioid_t *audioid) {
+    const int frames = 2000;
+    size_t windowSize = AudioIdWindowSize(audioid);
+    size_t hopSize = audioid->hopSize > 0 ? audioid->hopSize : windowSize / WINDOW_OVERLAP;
+    fingerprint_t fingerprint;
+#if !AUDIOID_FIXED_POINT
+    FingerprintInit(&fingerprint, audioid->analysisRate, windowSize, hopSize, audioid->countBuckets, audioid->cycleCount, audioid->windowFunction, audioid->fingerprintMode, audioid->filterbank, KERNELS_SCALAR);
+    BenchmarkWindow(&fingerprint, frames);
+    FingerprintDestroy(&fingerprint);
+#endif
+    if (audioid->analysisRate < audioid->sampleRate) BenchmarkDecimator(audioid, frames);
+    BenchmarkDistances(NULL, audioid->distanceMetric, audioid->countBuckets, frames);
+
+    // Each available kernel instruction set (or only the configured one)
+    for (int isa = KERNELS_SCALAR; isa < KERNELS_COUNT; isa++) {
+        if (audioid->kernelsIsa != KERNELS_AUTO && isa != audioid->kernelsIsa) continue;
+        if (!KernelsAvailable((kernels_isa_t)isa)) continue;
+        FingerprintInit(&fingerprint, audioid->analysisRate, windowSize, hopSize, audioid->countBuckets, audioid->cycleCount, audioid->windowFunction, audioid->fingerprintMode, audioid->filterbank, (kernels_isa_t)isa);
+        BenchmarkFingerprint(&fingerprint, frames);
+        BenchmarkBatch(&fingerprint, frames);
+        BenchmarkDistances(&fingerprint.kernels, audioid->distanceMetric, audioid->countBuckets, frames);
+        BenchmarkSearch(&fingerprint.kernels, audioid->countBuckets, frames);
+        BenchmarkGroupSearch(&fingerprint.kernels, audioid->countBuckets, frames);
+        BenchmarkQuantized(&fingerprint.kernels, audioid->countBuckets, frames);
+        BenchmarkProjection(&fingerprint.kernels, audioid->countBuckets, frames);
+        FingerprintDestroy(&fingerprint);
+    }
+}
+
+// Check batch fingerprinting produces the same frames (levels, gating and bucket values) as adding samples in (irregular) small steps
+static bool FingerprintSelfTestBatch(void) {
+    const size_t windowSize = 2048, hopSize = 700, countBuckets = 256, maxFrames = 5;
+    const size_t countSamples = 40 * hopSize + windowSize;
+    const double gateLevel = -30;
+    int16_t *samples = malloc(sizeof(int16_t) * countSamples);
+    real_t *frames = malloc(sizeof(real_t) * maxFrames * countBuckets);
+    fingerprint_frame_t frameInfo[5];
+    if (samples == NULL || frames == NULL) { fprintf(stderr, "ERROR: Memory failure (self-test).\n"); exit(-1); }
+    BenchmarkSignal(samples, countSamples);
+    // A quiet section, below the gate level
+    for (size_t i = countSamples / 3; i < 2 * countSamples / 3; i++) samples[i] /= 256;
+
+    fingerprint_t stream, batch;
+    FingerprintInit(&stream, AUDIOID_SAMPLE_RATE, windowSize, hopSize, countBuckets, 1, WINDOW_HAMMING, FINGERPRINT_MAGNITUDE, FILTERBANK_LOG, KERNELS_AUTO);
+    FingerprintInit(&batch, AUDIOID_SAMPLE_RATE, windowSize, hopSize, countBuckets, 1, WINDOW_HAMMING, FINGERPRINT_MAGNITUDE, FILTERBANK_LOG, KERNELS_AUTO);
+    FingerprintSetGate(&stream, gateLevel);
+    FingerprintSetGate(&batch, gateLevel);
+
+    size_t countFrames = 0, countGated = 0, mismatches = 0;
+    size_t streamOffset = 0, batchOffset = 0, batchFrames = 0, batchFrame = 0;
+    const size_t steps[] = { 1, 333, 1500, 77, 4096 };
+    for (size_t step = 0; streamOffset < countSamples; step++) {
+        size_t count = steps[step % (sizeof(steps) / sizeof(steps[0]))];
+        if (count > countSamples - streamOffset) count = countSamples - streamOffset;
+        streamOffset += FingerprintAddSamples(&stream, samples + streamOffset, count);
+        if (!stream.frameReady) continue;
+        real_t *buckets = FingerprintBuckets(&stream, NULL);
+
+        // Next batch of frames (in blocks that do not align with the hops)
+        while (batchFrame >= batchFrames && batchOffset < countSamples) {
+            size_t blockSize = countSamples - batchOffset < 3000 ? countSamples - batchOffset : 3000;
+            size_t samplesUsed = 0;
+            batchFrames = FingerprintAddSamplesBatch(&batch, samples + batchOffset, blockSize, frames, frameInfo, maxFrames, &samplesUsed);
+            batchOffset += samplesUsed;
+            batchFrame = 0;
+        }
+        if (batchFrame >= batchFrames || frameInfo[batchFrame].level != stream.frameLevel || frameInfo[batchFrame].gated != stream.frameGated) {
+            mismatches++;
+        } else if (buckets != NULL && memcmp(buckets, frames + batchFrame * countBuckets, sizeof(real_t) * countBuckets) != 0) {
+            mismatches++;
+        }
+        if (stream.frameGated) countGated++;
+        batchFrame++;
+        countFrames++;
+    }
+
+    FingerprintDestroy(&batch);
+    FingerprintDestroy(&stream);
+    free(frames);
+    free(samples);
+
+    bool pass = (mismatches == 0 && countFrames > 0 && countGated > 0 && countGated < countFrames);
+    printf("SELF-TEST: fingerprint batch: %zu of %zu frames (%zu gated) differ from streaming %s\n", mismatches, countFrames, countGated, pass ? "ok" : "FAILED");
+    return pass;
+}
+
+// Check the fingerprint's bucket values (floating or fixed point, as built) against a direct double-precision evaluation of the same window, spectrum and filterbank
+static bool FingerprintSelfTestReference(void) {
+    const size_t windowSize = 2048, countBuckets = 256, countFrames = 3;
+    const size_t countResults = windowSize / 2 + 1, countSamples = countFrames * windowSize;
+    const filterbank_t filterbanks[] = { FILTERBANK_LOG, FILTERBANK_MEL };
+    // Relative tolerance (absolute for log-power, which uses an approximate log2), the fixed-point magnitude is itself an approximation
+#if AUDIOID_FIXED_POINT
+    const double tolerances[FINGERPRINT_MODE_COUNT] = { 0.012, 1e-3, 0.01 };
+#else
+    const double tolerance = (sizeof(real_t) == sizeof(float)) ? 1e-4 : 1e-9;
+    const double tolerances[FINGERPRINT_MODE_COUNT] = { tolerance, tolerance, 0.01 };
+#endif
+    int16_t *samples = malloc(sizeof(int16_t) * countSamples);
+    double *window = malloc(sizeof(double) * windowSize);
+    double *table = malloc(sizeof(double) * 2 * windowSize);
+    double *spectrum = malloc(sizeof(double) * 2 * countResults * countFrames);
+    double *values = malloc(sizeof(double) * countResults);
+    if (samples == NULL || window == NULL || table == NULL || spectrum == NULL || values == NULL) { fprintf(stderr, "ERROR: Memory failure (self-test).\n"); exit(-1); }
+
+    // Tones over quieter noise
+    BenchmarkSignal(samples, countSamples);
+    for (size_t i = 0; i < countSamples; i++) {
+        samples[i] = (int16_t)(samples[i] / 32 + 6000 * sin(2 * M_PI * 440 * i / AUDIOID_SAMPLE_RATE) + 3000 * sin(2 * M_PI * 3150 * i / AUDIOID_SAMPLE_RATE));
+    }
+
+    // Reference spectrum of each (consecutive) frame, by a direct DFT
+    for (size_t i = 0; i < windowSize; i++) {
+        window[i] = WindowFunction(WINDOW_HAMMING, i, windowSize);
+        table[2 * i] = cos(2 * M_PI * i / windowSize);
+        table[2 * i + 1] = -sin(2 * M_PI * i / windowSize);
+    }
+    for (size_t frame = 0; frame < countFrames; frame++) {
+        const int16_t *input = samples + frame * windowSize;
+        for (size_t k = 0; k < countResults; k++) {
+            double re = 0, im = 0;
+            for (size_t n = 0; n < windowSize; n++) {
+                double x = window[n] * input[n] / 32768;
+                size_t index = (k * n) % windowSize;
+                re += x * table[2 * index];
+                im += x * table[2 * index + 1];
+            }
+            spectrum[2 * (frame * countResults + k)] = re;
+            spectrum[2 * (frame * countResults + k) + 1] = im;
+        }
+    }
+
+    bool pass = true;
+    for (size_t f = 0; f < sizeof(filterbanks) / sizeof(filterbanks[0]); f++) {
+        for (int mode = 0; mode < FINGERPRINT_MODE_COUNT; mode++) {
+            fingerprint_t fingerprint;
+            FingerprintInit(&fingerprint, AUDIOID_SAMPLE_RATE, windowSize, windowSize, countBuckets, 1, WINDOW_HAMMING, (fingerprint_mode_t)mode, filterbanks[f], KERNELS_AUTO);
+            double maxError = 0;
+            for (size_t frame = 0; frame < countFrames; frame++) {
+                FingerprintAddSamples(&fingerprint, samples + frame * windowSize, windowSize);
+                const real_t *buckets = FingerprintBuckets(&fingerprint, NULL);
+                if (buckets == NULL) { maxError = HUGE_VAL; break; }
+                const double *s = spectrum + 2 * frame * countResults;
+                double maxValue = 0;
+                for (size_t k = 0; k < countResults; k++) {
+                    double power = s[2 * k] * s[2 * k] + s[2 * k + 1] * s[2 * k + 1];
+                    values[k] = (mode == FINGERPRINT_MAGNITUDE) ? sqrt(power) : power;
+                    if (values[k] > maxValue) maxValue = values[k];
+                }
+                for (size_t i = 0; i < countBuckets; i++) {
+                    double reference = 0;
+                    if (FilterbankIsBox(filterbanks[f])) {
+                        size_t count = fingerprint.bucketBounds[i + 1] - fingerprint.bucketBounds[i];
+                        for (size_t j = fingerprint.bucketBounds[i]; j < fingerprint.bucketBounds[i + 1]; j++) reference += values[j];
+                        if (count > 0) reference /= count;
+                    } else {
+                        for (size_t j = fingerprint.filterOffsets[i]; j < fingerprint.filterOffsets[i + 1]; j++) {
+                            reference += fingerprint.filterWeights[j] * values[fingerprint.filterFirst[i] + j - fingerprint.filterOffsets[i]];
+                        }
+                    }
+                    double error;
+                    if (mode == FINGERPRINT_LOG_POWER) {
+                        error = fabs(buckets[i] - log2(reference + LOG_POWER_FLOOR));
+                    } else {
+                        double scale = fabs(reference) > 1e-6 * maxValue ? fabs(reference) : 1e-6 * maxValue;
+                        error = fabs(buckets[i] - reference) / scale;
+                    }
+                    if (error > maxError || error != error) maxError = error;
+                }
+            }
+            FingerprintDestroy(&fingerprint);
+            bool ok = maxError <= tolerances[mode];
+            printf("SELF-TEST: fingerprint %s %s (%s): max error %g against double precision (tolerance %g) %s\n", FingerprintModeName((fingerprint_mode_t)mode), FilterbankName(filterbanks[f]), FingerprintPrecision(), maxError, tolerances[mode], ok ? "ok" : "FAILED");
+            pass &= ok;
+        }
+    }
 
-        audioid->deviceConfig = ma_device_config_init(ma_device_type_capture);
-        audioid->deviceConfig.capture.format   = ma_format_s16;
-        audioid->deviceConfig.capture.channels = 1;
-        audioid->deviceConfig.sampleRate       = audioid->sampleRate;
-        audioid->deviceConfig.dataCallback     = data_callback;
-        audioid->deviceConfig.pUserData        = audioid;
+    free(values);
+    free(spectrum);
+    free(table);
+    free(window);
+    free(samples);
+    return pass;
+}
 
-        result = ma_device_init(NULL, &audioid->deviceConfig, &audioid->device);
-        if (result != MA_SUCCESS) {
-            fprintf(stderr, "ERROR: Failed to initialize capture device.\n");
-            return false;
+// Check that merging stats accumulated over separate parts of the values (as the learning workers do) matches adding all of the values to one
+static bool RunningStatsSelfTestMerge(void) {
+    const size_t size = 64, countValues = 3000, countParts = 5;
+    running_stats_t whole, merged, part;
+    running_stats_init(&whole, size);
+    running_stats_init(&merged, size);
+    running_stats_init(&part, size);
+    real_t *values = malloc(sizeof(real_t) * size);
+    if (values == NULL) { fprintf(stderr, "ERROR: Memory failure (self-test).\n"); exit(-1); }
+
+    // Uneven parts (including an empty one), with values whose offset is large compared to their spread
+    uint32_t seed = 0x2545f491;
+    size_t partEnds[] = { 0, 17, 1000, 1001, countValues };
+    size_t value = 0;
+    for (size_t p = 0; p < countParts; p++) {
+        running_stats_clear(&part);
+        for (; value < partEnds[p]; value++) {
+            for (size_t i = 0; i < size; i++) {
+                seed = seed * 1664525 + 1013904223;
+                values[i] = (real_t)((1 + i) * 100 + (double)(seed >> 8) / (1 << 24) * (1 + value % 7));
+            }
+            running_stats_add(&whole, values);
+            running_stats_add(&part, values);
         }
+        running_stats_merge(&merged, &part);
+    }
 
-        result = ma_device_start(&audioid->device);
-        if (result != MA_SUCCESS) {
-            ma_device_uninit(&audioid->device);
-            fprintf(stderr, "ERROR: Failed to start device.\n");
-            return false;
+    double errorMean = 0, errorVariance = 0;
+    size_t mismatchedCounts = 0;
+    for (size_t i = 0; i < size; i++) {
+        double error = fabs(running_stats_mean(&merged, i) - running_stats_mean(&whole, i)) / fabs(running_stats_mean(&whole, i));
+        if (error > errorMean || error != error) errorMean = error;
+        error = fabs(running_stats_variance(&merged, i) - running_stats_variance(&whole, i)) / running_stats_variance(&whole, i);
+        if (error > errorVariance || error != error) errorVariance = error;
+        if (running_stats_count(&merged, i) != running_stats_count(&whole, i)) mismatchedCounts++;
+    }
+
+    free(values);
+    running_stats_free(&part);
+    running_stats_free(&merged);
+    running_stats_free(&whole);
+
+    // Both are rounded (the sequential variance by each update), so they agree only to well within the precision of the values
+    const double tolerance = 1e-11;
+    bool pass = (mismatchedCounts == 0 && errorMean <= tolerance && errorVariance <= tolerance);
+    printf("SELF-TEST: running stats merge: %zu values in %zu parts, max error of mean %g, variance %g (tolerance %g), %zu count mismatches %s\n", countValues, countParts, errorMean, errorVariance, tolerance, mismatchedCounts, pass ? "ok" : "FAILED");
+    return pass;
+}
+
+// Check the sliding-window stats against the per-phase running stats they replace (a Welford update of every phase of the cycle per frame), as the inputs to Distance() against label templates
+static bool FingerprintSelfTestStats(void) {
+    const size_t countBuckets = 64, cycleCount = 8, countFrames = 2000, countLabels = 8;
+    fingerprint_t fingerprint;
+    FingerprintInit(&fingerprint, AUDIOID_SAMPLE_RATE, 1024, 512, countBuckets, cycleCount, WINDOW_HAMMING, FINGERPRINT_MAGNITUDE, FILTERBANK_LOG, KERNELS_AUTO);
+    running_stats_t *phases = malloc(sizeof(running_stats_t) * cycleCount);
+    running_stats_t *labels = malloc(sizeof(running_stats_t) * countLabels);
+    real_t *buckets = malloc(sizeof(real_t) * countBuckets);
+    if (phases == NULL || labels == NULL || buckets == NULL) { fprintf(stderr, "ERROR: Memory failure (self-test).\n"); exit(-1); }
+    for (size_t j = 0; j < cycleCount; j++) running_stats_init(&phases[j], countBuckets);
+    for (size_t id = 0; id < countLabels; id++) running_stats_init(&labels[id], countBuckets);
+
+    // Label templates, and bucket values drifting between them (with a wide range of magnitudes across the buckets)
+    uint32_t seed = 0x9e3779b9;
+    for (size_t id = 0; id < countLabels; id++) {
+        for (size_t i = 0; i < countBuckets; i++) {
+            seed = seed * 1664525 + 1013904223;
+            labels[id].count[i] = 100;
+            labels[id].mean[i] = (double)(seed >> 8) / (1 << 24) * (1 + (double)i * i);
+        }
+    }
+    templates_t templates = {0};
+    TemplatesResize(&templates, countLabels, countBuckets);
+    for (size_t id = 0; id < countLabels; id++) TemplatesSet(&templates, id, &labels[id]);
+
+    size_t cycle = 0, mismatchedLabels = 0;
+    double errorMean = 0, errorVariance = 0, errorDistance = 0;
+    for (size_t frame = 0; frame < countFrames; frame++) {
+        const running_stats_t *source = &labels[(frame / 150) % countLabels];
+        for (size_t i = 0; i < countBuckets; i++) {
+            seed = seed * 1664525 + 1013904223;
+            buckets[i] = (real_t)(running_stats_mean(source, i) * (0.5 + (double)(seed >> 8) / (1 << 24)));
         }
 
-        if (audioid->verbose) fprintf(stderr, "AUDIOID: ...audio capture configured.\n");
-        audioid->deviceInitialized = true;
+        // Reset part-way through, as on entering the gate
+        if (frame % 700 == 350) {
+            FingerprintResetStats(&fingerprint);
+            for (size_t j = 0; j < cycleCount; j++) running_stats_clear(&phases[j]);
+        }
+
+        // Reference: reset the oldest phase, add to all phases, read the next
+        running_stats_clear(&phases[cycle]);
+        cycle = (cycle + 1) % cycleCount;
+        for (size_t j = 0; j < cycleCount; j++) running_stats_add(&phases[j], buckets);
+        const running_stats_t *reference = &phases[cycle];
+
+        FingerprintAccumulateStats(&fingerprint, buckets);
+        const running_stats_t *stats = FingerprintStats(&fingerprint);
+
+        for (size_t i = 0; i < countBuckets; i++) {
+            double scale = fabs(running_stats_mean(reference, i)) > 1 ? fabs(running_stats_mean(reference, i)) : 1;
+            double error = fabs(running_stats_mean(stats, i) - running_stats_mean(reference, i)) / scale;
+            if (error > errorMean || error != error) errorMean = error;
+            error = fabs(running_stats_variance(stats, i) - running_stats_variance(reference, i)) / (scale * scale);
+            if (error > errorVariance || error != error) errorVariance = error;
+            if (running_stats_count(stats, i) != running_stats_count(reference, i)) mismatchedLabels++;
+        }
+
+        // Distances to each label, and the closest
+        int closest = -1, closestReference = -1;
+        double closestDistance = 0, closestReferenceDistance = 0;
+        for (size_t id = 0; id < countLabels; id++) {
+            double distance = Distance(countBuckets, stats->mean, &templates, id);
+            double referenceDistance = Distance(countBuckets, reference->mean, &templates, id);
+            double error = fabs(distance - referenceDistance) / (referenceDistance > 1 ? referenceDistance : 1);
+            if (error > errorDistance || error != error) errorDistance = error;
+            if (closest < 0 || distance < closestDistance) { closest = (int)id; closestDistance = distance; }
+            if (closestReference < 0 || referenceDistance < closestReferenceDistance) { closestReference = (int)id; closestReferenceDistance = referenceDistance; }
+        }
+        if (closest != closestReference) mismatchedLabels++;
     }
-    return true;
+
+    FingerprintDestroy(&fingerprint);
+    free(buckets);
+    TemplatesFree(&templates);
+    for (size_t id = 0; id < countLabels; id++) running_stats_free(&labels[id]);
+    for (size_t j = 0; j < cycleCount; j++) running_stats_free(&phases[j]);
+    free(labels);
+    free(phases);
+
+    // The sums differ from the reference only by rounding (including that left by values leaving the window, until the next re-centering)
+    const double tolerance = 1e-9;
+    bool pass = (mismatchedLabels == 0 && errorMean <= tolerance && errorVariance <= tolerance && errorDistance <= tolerance);
+    printf("SELF-TEST: fingerprint stats: %zu frames, max error of mean %g, variance %g, distance %g (tolerance %g), %zu count or closest label mismatches %s\n", countFrames, errorMean, errorVariance, errorDistance, tolerance, mismatchedLabels, pass ? "ok" : "FAILED");
+    return pass;
 }
 
-// Wait until audio processing has completed
-void AudioIdWaitUntilDone(audioid_t *audioid) {
-    if (audioid->filename != NULL) {
-        if (audioid->decoderInitialized) {
-            #define MAX_FRAME_COUNT 1024
-            int16_t samples[MAX_FRAME_COUNT];
-            for(;;) {
-                ma_uint64 framesRead = 0;
-                ma_result result = ma_decoder_read_pcm_frames(&audioid->decoder, &samples, MAX_FRAME_COUNT, &framesRead);
-                if (framesRead <= 0) break;
-                if (audioid->verbose) fprintf(stderr, "READ: %d\n", (int)framesRead);
-                AudioIdProcess(audioid, samples, (size_t)framesRead);
-                if (result != MA_SUCCESS) break;
+// Check the vectorized distances of each metric against the per-label Distance() reference, with each available kernel instruction set
+static bool DistanceSelfTestMetrics(void) {
+    const size_t countBuckets = 61, countLabels = 13, countInputs = 20;    // (not multiples of the vector widths)
+    running_stats_t stats;
+    running_stats_init(&stats, countBuckets);
+    templates_t templates = {0};
+    TemplatesResize(&templates, countLabels, countBuckets);
+    double *input = malloc(sizeof(double) * countBuckets);
+    double *distances = malloc(sizeof(double) * countLabels);
+    real_t *values = malloc(sizeof(real_t) * countBuckets);
+    if (input == NULL || distances == NULL || values == NULL) { fprintf(stderr, "ERROR: Memory failure (self-test).\n"); exit(-1); }
+
+    // Labels of random stats, including one that is all zero (below the norm limits) and one with no spread
+    uint32_t seed = 0x6a09e667;
+    for (size_t id = 0; id < countLabels; id++) {
+        running_stats_clear(&stats);
+        for (int n = 0; n < (id == 1 ? 1 : 3); n++) {
+            for (size_t i = 0; i < countBuckets; i++) {
+                seed = seed * 1664525 + 1013904223;
+                values[i] = id == 0 ? 0 : (real_t)((double)(seed >> 8) / (1 << 24) * (1 + (double)i));
             }
+            running_stats_add(&stats, values);
         }
-    } else {
-        if (audioid->deviceInitialized) {
-            fprintf(stderr, "AUDIOID: Press Enter to stop live input...\n");
-            getchar();
+        TemplatesSet(&templates, id, &stats);
+    }
+
+    bool pass = true;
+    for (int metric = 0; metric < DISTANCE_COUNT; metric++) {
+        templates.metric = (distance_metric_t)metric;
+        double maxError = 0;
+        size_t countIsa = 0;
+        for (int isa = KERNELS_SCALAR; isa < KERNELS_COUNT; isa++) {
+            kernels_t kernels;
+            if (!KernelsSelect(&kernels, (kernels_isa_t)isa)) continue;
+            countIsa++;
+            uint32_t inputSeed = 0xbb67ae85;
+            for (size_t n = 0; n < countInputs; n++) {
+                // Inputs near each label (and the first all zero)
+                for (size_t i = 0; i < countBuckets; i++) {
+                    inputSeed = inputSeed * 1664525 + 1013904223;
+                    input[i] = n == 0 ? 0 : templates.mean[(n % countLabels) * templates.stride + i] + ((double)(inputSeed >> 8) / (1 << 24) - 0.5);
+                }
+                Distances(&kernels, countBuckets, input, &templates, distances);
+                for (size_t id = 0; id < countLabels; id++) {
+                    double reference = Distance(countBuckets, input, &templates, id);
+                    double error = fabs(distances[id] - reference) / (fabs(reference) > 1 ? fabs(reference) : 1);
+                    if (error > maxError || error != error) maxError = error;
+                }
+            }
         }
+        // Only the summation order and the point of division differ
+        const double tolerance = 1e-12;
+        bool ok = (maxError <= tolerance);
+        printf("SELF-TEST: distance metric %s: max error %g against per-label Distance() with %zu kernel sets (tolerance %g) %s\n", DistanceMetricName((distance_metric_t)metric), maxError, countIsa, tolerance, ok ? "ok" : "FAILED");
+        pass &= ok;
     }
+
+    free(values);
+    free(distances);
+    free(input);
+    TemplatesFree(&templates);
+    running_stats_free(&stats);
+    return pass;
 }
 
-// Load state
-bool AudioIdStateLoad(audioid_t *audioid, const char *filename) {
-    int errors = 0;
+// Labels and inputs of the search self-tests
+typedef struct {
+    size_t countLabels;
+    size_t countBuckets;
+    kernels_t kernels;
+    templates_t templates;
+    double *scales;
+    double *limits;
+    double *distances;      // countLabels scratch distances (for a scan of every label)
+    double *input;          // countBuckets values of the last input
+    uint32_t seed;
+} search_test_t;
+
+static void SearchTestInit(search_test_t *test, size_t countLabels, size_t countBuckets) {
+    memset(test, 0, sizeof(*test));
+    test->countLabels = countLabels;
+    test->countBuckets = countBuckets;
+    KernelsSelect(&test->kernels, KERNELS_AUTO);
+    test->scales = malloc(sizeof(double) * countLabels);
+    test->limits = malloc(sizeof(double) * countLabels);
+    test->distances = malloc(sizeof(double) * countLabels);
+    test->input = malloc(sizeof(double) * countBuckets);
+    if (test->scales == NULL || test->limits == NULL || test->distances == NULL || test->input == NULL) { fprintf(stderr, "ERROR: Memory failure (self-test).\n"); exit(-1); }
+}
 
-    FILE *fp = fopen(filename, "rt");
-    if (!fp) {
-        fprintf(stderr, "ERROR: Problem opening state file for reading: %s\n", filename);
-        return false;
+// Make a label a duplicate of another (with the same scale and limit, so exact ties)
+static void SearchTestCopy(search_test_t *test, size_t id, size_t copy) {
+    templates_t *templates = &test->templates;
+    size_t stride = templates->stride;
+    memcpy(templates->mean + id * stride, templates->mean + copy * stride, sizeof(double) * stride);
+    memcpy(templates->invStddev + id * stride, templates->invStddev + copy * stride, sizeof(double) * stride);
+    memcpy(templates->normalized + id * stride, templates->normalized + copy * stride, sizeof(double) * stride);
+    templates->norm[id] = templates->norm[copy];
+    test->scales[id] = test->scales[copy];
+    test->limits[id] = test->limits[copy];
+}
+
+// Labels for a metric: variants of a few sounds (label id of sound id % countSounds), with scales and some limits, the last labels duplicating earlier ones (with the same scale and limit, so exact ties)
+static void SearchTestLabels(search_test_t *test, distance_metric_t metric, size_t countSounds, uint32_t seed) {
+    const size_t countDuplicates = 20;
+    templates_t *templates = &test->templates;
+    RandomTemplates(templates, test->countLabels, test->countBuckets, countSounds, 0.3, seed);
+    templates->metric = metric;
+    test->seed = ~seed;
+    for (size_t id = 0; id < test->countLabels; id++) {
+        test->seed = test->seed * 1664525 + 1013904223;
+        test->scales[id] = (id % 3 == 0) ? 1 : 0.5 + (double)(test->seed >> 8) / (1 << 24);
+        test->limits[id] = (id % 4 == 0) ? (metric == DISTANCE_ZSCORE ? 20 : metric == DISTANCE_L1 ? 0.05 : 0.01) : -1;
+    }
+    for (size_t id = test->countLabels - countDuplicates; id < test->countLabels; id++) {
+        SearchTestCopy(test, id, id % 50);
     }
+}
 
-    bool globalSection = true;
-    size_t labelId = -1;
-    const size_t bufferSize = 65536;
-    char *buffer = (char *)malloc(bufferSize);
-    if (!buffer) {
-        fprintf(stderr, "ERROR: Problem allocating memory for reading: %zu\n", bufferSize);
-        fclose(fp);
-        return false;
+// An input near a label, or for every tenth input (by its number), far from all
+static const double *SearchTestInput(search_test_t *test, size_t n, size_t id) {
+    const double *mean = test->templates.mean + id * test->templates.stride;
+    for (size_t i = 0; i < test->countBuckets; i++) {
+        test->seed = test->seed * 1664525 + 1013904223;
+        double noise = (double)(test->seed >> 8) / (1 << 24) - 0.5;
+        test->input[i] = (n % 10 == 9) ? noise + 0.5 : mean[i] * (1 + 0.1 * noise);
     }
+    return test->input;
+}
 
-    for (size_t lineNumber = 1; ; lineNumber++) {
-        // Read next line
-        char *line = fgets(buffer, (int)bufferSize - 1, fp);
-        buffer[bufferSize - 1] = '\0';
+static void SearchTestFree(search_test_t *test) {
+    free(test->input);
+    free(test->distances);
+    free(test->limits);
+    free(test->scales);
+    TemplatesFree(&test->templates);
+}
 
-        // EOF (or read error)
-        if (line == NULL) break;
+// Check the tree search finds the same label as a scan of every label (with scales, limits and duplicated templates), and the approximate search is within its error bound
+static bool VpTreeSelfTest(void) {
+    const size_t countBuckets = 37, countLabels = 300, countInputs = 200;
+    const double approximateError = 0.2;
+    search_test_t test;
+    SearchTestInit(&test, countLabels, countBuckets);
+
+    bool pass = true;
+    for (int metric = DISTANCE_L1; metric <= DISTANCE_NORMALIZED; metric++) {
+        SearchTestLabels(&test, (distance_metric_t)metric, 20, 0x510e527f);
+        templates_t *templates = &test.templates;
+        const double *rows = (metric == DISTANCE_NORMALIZED) ? templates->normalized : templates->mean;
+        vp_tree_t tree = {0};
+        VpTreeBuild(&tree, &test.kernels, rows, templates->stride, countBuckets, countLabels, test.scales, test.limits);
+
+        size_t mismatches = 0, outOfBounds = 0, scored = 0;
+        for (size_t n = 0; n < countInputs; n++) {
+            const double *input = SearchTestInput(&test, n, n % countLabels);
+            double scanDistance, distance, approximateDistance;
+            size_t count;
+            int scanClosest = ScanNearest(&test.kernels, templates, input, test.scales, test.limits, test.distances, &scanDistance);
+            const double *query = (metric == DISTANCE_NORMALIZED) ? TemplatesNormalizeInput(templates, countBuckets, input) : input;
+            int closest = VpTreeSearch(&tree, &test.kernels, query, rows, templates->stride, countBuckets, 0, &distance, &count);
+            int approximate = VpTreeSearch(&tree, &test.kernels, query, rows, templates->stride, countBuckets, approximateError, &approximateDistance, NULL);
+            scored += count;
+            if (closest != scanClosest || (closest >= 0 && distance != scanDistance)) mismatches++;
+            if ((approximate < 0) != (scanClosest < 0) || (approximate >= 0 && approximateDistance > scanDistance * (1 + approximateError))) outOfBounds++;
+        }
+        VpTreeFree(&tree);
 
-        // Trim trailing whitespace
-        for (char *end = line + strlen(line); end > line && (*(end - 1) == '\n' || *(end - 1) == '\r' || *(end - 1) == ' '); end--) *(end - 1) = '\0';
+        bool ok = (mismatches == 0 && outOfBounds == 0);
+        printf("SELF-TEST: search tree (%s): %zu of %zu inputs differ from a scan of %zu labels (%.1f%% scored), %zu approximate results beyond error %g %s\n", DistanceMetricName((distance_metric_t)metric), mismatches, countInputs, countLabels, 100.0 * scored / countInputs / countLabels, outOfBounds, approximateError, ok ? "ok" : "FAILED");
+        pass &= ok;
+    }
 
-        // Empty line
-        if (line[0] == '\0') continue;
+    SearchTestFree(&test);
+    return pass;
+}
 
-        // Comment line
-        if (line[0] == '#') continue;
+// Check the early-abandoning scan finds the same label as a full scan (with scales, limits, duplicated templates, zero scales, and hints of the last nearest or any label)
+static bool AbandonSelfTest(void) {
+    const size_t countBuckets = 45, countLabels = 200, countInputs = 200;
+    search_test_t test;
+    SearchTestInit(&test, countLabels, countBuckets);
+
+    bool pass = true;
+    const distance_metric_t metrics[] = { DISTANCE_L1, DISTANCE_NORMALIZED, DISTANCE_ZSCORE };
+    for (size_t m = 0; m < sizeof(metrics) / sizeof(metrics[0]); m++) {
+        SearchTestLabels(&test, metrics[m], 20, 0x1f83d9ab);
+        TemplatesOrder(&test.templates);
+
+        // Labels of zero scale (a distance of 0 from every input, which no bound abandons): within no limit of 0, except for some inputs, when the lower id of the two without it is nearest, the higher given as the hint
+        const size_t zeroLabels[] = { 11, 157, 183 };
+        for (size_t z = 0; z < sizeof(zeroLabels) / sizeof(zeroLabels[0]); z++) {
+            test.scales[zeroLabels[z]] = 0;
+            test.limits[zeroLabels[z]] = 0;
+        }
 
-        // Label section
-        if (line[0] == '[') {
-            if (line[1] == ']') {
-                globalSection = true;
-            } else {
-                char *label = strtok(line + 1, "]\r\n");
-                labelId = AudioIdGetLabelId(audioid, label);
-                globalSection = false;
-            }
-            continue;
+        size_t mismatches = 0, evaluated = 0;
+        int hint = -1;
+        for (size_t n = 0; n < countInputs; n++) {
+            // (runs of inputs near the same label, so the last nearest is a good hint)
+            const double *input = SearchTestInput(&test, n, n / 3 % countLabels);
+            bool zeroNearest = (n % 25 == 24);
+            test.limits[157] = test.limits[183] = zeroNearest ? -1 : 0;
+            double scanDistance, distance;
+            int scanClosest = ScanNearest(&test.kernels, &test.templates, input, test.scales, test.limits, test.distances, &scanDistance);
+            if (n % 5 == 4) hint = (int)(n % countLabels);
+            if (zeroNearest) hint = 183;
+            int closest = TemplatesNearest(&test.kernels, &test.templates, input, test.scales, test.limits, hint, &distance, &evaluated);
+            if (closest != scanClosest || (closest >= 0 && distance != scanDistance) || (zeroNearest && closest != 157)) mismatches++;
+            hint = closest;
         }
 
-        // Split into name/value pair
-        static char *empty = "";
-        const char *name = line;
-        char *value = empty;
-        char *equals = strchr(line, '=');
-        if (equals != NULL) {
-            *equals = '\0';
-            value = equals + 1;
-            // Trim space either side of the equals
-            for (char *p = equals; p > line && *(p - 1) == ' '; p--) *(p - 1) = '\0'; 
-            for (char *p = equals + 1; *p == ' '; p++) { *p = '\0'; value = p + 1; }
-            // Trim quotes
-            if (value[0] == '\"') value++;
-            if (value[0] != '\0' && value[strlen(value) - 1] == '\"') value[strlen(value) - 1] = '\0';
+        bool ok = (mismatches == 0);
+        printf("SELF-TEST: early abandoning (%s): %zu of %zu inputs differ from a scan of %zu labels, %.1f%% of bucket distances skipped %s\n", DistanceMetricName(metrics[m]), mismatches, countInputs, countLabels, 100.0 * (1 - (double)evaluated / countInputs / countLabels / countBuckets), ok ? "ok" : "FAILED");
+        pass &= ok;
+    }
+
+    SearchTestFree(&test);
+    return pass;
+}
+
+// Check the group search finds the same label as a scan of every label when it scores all the groups (with scales, limits, duplicated templates, within and across groups, and groups of interleaved labels), and how often it agrees when it scores fewer
+static bool GroupSearchSelfTest(void) {
+    const size_t countBuckets = 41, countLabels = 240, countGroups = 24, countInputs = 200;
+    search_test_t test;
+    SearchTestInit(&test, countLabels, countBuckets);
+    group_search_t search = {0};
+    size_t *groups = malloc(sizeof(size_t) * countLabels);
+    if (groups == NULL) { fprintf(stderr, "ERROR: Memory failure (self-test).\n"); exit(-1); }
+
+    bool pass = true;
+    for (int metric = DISTANCE_L1; metric < DISTANCE_COUNT; metric++) {
+        // One sound per group, each group's labels interleaved with the others' (so the duplicates are of labels in other groups)
+        SearchTestLabels(&test, (distance_metric_t)metric, countGroups, 0x6a09e667);
+        for (size_t id = 0; id < countLabels; id++) {
+            groups[id] = id % countGroups;
+        }
+        // A group of labels before the duplicates each copied from a lower id in the next group (the copy nearest by a tie, though its group may be searched after the duplicate's)
+        for (size_t id = countLabels - 20 - countGroups; id < countLabels - 20; id++) {
+            SearchTestCopy(&test, id, id - 2 * countGroups + 1);
+        }
+        GroupSearchBuild(&search, &test.templates, groups);
+
+        size_t mismatches = 0, agree = 0, scored = 0;
+        for (size_t n = 0; n < countInputs; n++) {
+            const double *input = SearchTestInput(&test, n, n % countLabels);
+            double scanDistance, distance;
+            size_t count;
+            int scanClosest = ScanNearest(&test.kernels, &test.templates, input, test.scales, test.limits, test.distances, &scanDistance);
+            int closest = GroupSearchNearest(&test.kernels, &search, input, test.scales, test.limits, (n % 2 == 0) ? countGroups : countGroups + 5, &distance, NULL);
+            if (closest != scanClosest || (closest >= 0 && distance != scanDistance)) mismatches++;
+            if (GroupSearchNearest(&test.kernels, &search, input, test.scales, test.limits, 2, &distance, &count) == scanClosest) agree++;
+            scored += count;
         }
 
-        if (globalSection) {
-            if (strcmp(name, "bucketcount") == 0) {
-                size_t bucketCount = (size_t)atoi(value);
-                if (bucketCount != audioid->countBuckets) {
-                    fprintf(stderr, "ERROR: State file was saved with a different bucket count (%zu) to this program (%zu) and is not compatible: %s\n", bucketCount, audioid->countBuckets, filename);
-                    errors++;
-                }
+        bool ok = (mismatches == 0 && search.countGroups == countGroups);
+        printf("SELF-TEST: group search (%s): %zu of %zu inputs differ from a scan of %zu labels with all %zu groups, %zu agree with the nearest 2 groups (%.1f%% scored) %s\n", DistanceMetricName((distance_metric_t)metric), mismatches, countInputs, countLabels, search.countGroups, agree, 100.0 * scored / countInputs / countLabels, ok ? "ok" : "FAILED");
+        pass &= ok;
+    }
+
+    GroupSearchFree(&search);
+    free(groups);
+    SearchTestFree(&test);
+    return pass;
+}
+
+// Check the quantized scan chooses a label whose distance is within the quantization error of the nearest (each label's quantized distance is within one step per bucket of its distance from the clamped input), and how often it is the same label
+static bool QuantizeSelfTest(void) {
+    const size_t countBuckets = 45, countLabels = 200, countInputs = 200;
+    search_test_t test;
+    SearchTestInit(&test, countLabels, countBuckets);
+    double *clamped = malloc(sizeof(double) * countBuckets);
+    if (clamped == NULL) { fprintf(stderr, "ERROR: Memory failure (self-test).\n"); exit(-1); }
+
+    bool pass = true;
+    for (int metric = DISTANCE_L1; metric <= DISTANCE_NORMALIZED; metric++) {
+        // (without limits, which the reference scan of the clamped input does not apply)
+        SearchTestLabels(&test, (distance_metric_t)metric, 20, 0x3c6ef372);
+        for (size_t id = 0; id < countLabels; id++) {
+            test.limits[id] = -1;
+        }
+        templates_t *templates = &test.templates;
+        TemplatesQuantize(templates);
+
+        size_t outOfBounds = 0, agree = 0;
+        for (size_t n = 0; n < countInputs; n++) {
+            // The distances from the input clamped to the quantized range (beyond it, the distances of labels with different scales change differently)
+            const double *input = SearchTestInput(&test, n, n % countLabels);
+            const double *query = (metric == DISTANCE_NORMALIZED) ? TemplatesNormalizeInput(templates, countBuckets, input) : input;
+            double maximum = templates->quantizeOffset + 255 / templates->quantizeScale;
+            for (size_t i = 0; i < countBuckets; i++) {
+                clamped[i] = query[i] < templates->quantizeOffset ? templates->quantizeOffset : query[i] > maximum ? maximum : query[i];
+            }
+            const double *rows = (metric == DISTANCE_NORMALIZED) ? templates->normalized : templates->mean;
+            double *distances = test.distances;
+            double scanDistance = 0, distance;
+            int scanClosest = -1;
+            for (size_t id = 0; id < countLabels; id++) {
+                test.kernels.distanceL1(&distances[id], clamped, rows + id * templates->stride, templates->stride, countBuckets, 1);
+                distances[id] = test.scales[id] * distances[id] / countBuckets;
+                if (scanClosest < 0 || distances[id] < scanDistance) { scanClosest = (int)id; scanDistance = distances[id]; }
+            }
+            int closest = TemplatesNearestQuantized(&test.kernels, templates, input, test.scales, test.limits, &distance);
+            if (closest < 0) {
+                outOfBounds++;
             } else {
-                fprintf(stderr, "ERROR: Problem reading state file %s global-section line %zu unrecognized name: %s\n", filename, lineNumber, name);
-                errors++;
+                double allowance = (test.scales[closest] + test.scales[scanClosest]) / templates->quantizeScale * (1 + 1e-9);
+                if (distances[closest] > scanDistance + allowance) outOfBounds++;
             }
-        } else {
-            if (strcmp(name, "stats") == 0) {
-                // Read stats
-                size_t index = 0;
-                char *stat = value;
-                for (;;) {
-                    // Trim and find end of token
-                    while (*stat == ' ') stat++;
-                    if (*stat == '\0') break;
-                    char *end = strchr(stat, ';');
-                    if (end != NULL) { *end = '\0'; }
+            if (closest == scanClosest) agree++;
+        }
 
-                    char *count = strtok(stat, " ");
-                    char *mean = strtok(NULL, " ");
-                    char *sumVar = strtok(NULL, " ");
-                    if (count != NULL && mean != NULL && sumVar != NULL) {
-                        if (index < audioid->countBuckets) {
-                            running_stats_t *stats = &audioid->labels[labelId].stats[index];
-                            stats->count = atoi(count);
-                            stats->mean = atoi(mean);
-                            stats->sumVar = atoi(sumVar);
-                        } else {
-                            fprintf(stderr, "ERROR: Problem reading state file %s section %s line %zu stat index %zu exceeds bucket count %zu: %s\n", filename, audioid->labels[labelId].labelText, lineNumber, index, audioid->countBuckets, name);
-                            errors++;
-                        }
-                        index++;
-                    } else {
-                        fprintf(stderr, "ERROR: Problem reading state file %s section %s line %zu malformed stat at index %zu: %s\n", filename, audioid->labels[labelId].labelText, lineNumber, index, name);
-                        errors++;
-                    }
+        bool ok = (outOfBounds == 0);
+        printf("SELF-TEST: quantized scan (%s): %zu of %zu inputs choose a label beyond the quantization error, %zu agree with the double-precision scan %s\n", DistanceMetricName((distance_metric_t)metric), outOfBounds, countInputs, agree, ok ? "ok" : "FAILED");
+        pass &= ok;
+    }
 
-                    // Next token
-                    if (!end) break;
-                    stat = end + 1; 
-                }
-                
-                if (index != audioid->countBuckets) {
-                    fprintf(stderr, "ERROR: Problem reading state file %s section %s line %zu stat count %zu does not equal bucket count %zu: %s\n", filename, AudioIdGetLabelName(audioid, labelId), lineNumber, index, audioid->countBuckets, name);
-                    errors++;
-                }
-            } else if (strcmp(name, "scale") == 0) {
-                audioid->labels[labelId].scale = atof(value);
-            } else if (strcmp(name, "limit") == 0) {
-                audioid->labels[labelId].limit = atof(value);
-            } else if (strcmp(name, "minduration") == 0) {
-                audioid->labels[labelId].minDuration = atof(value);
-            } else if (strcmp(name, "afterevent") == 0) {
-                audioid->labels[labelId].onlyAfterEvent = (int)AudioIdGetLabelId(audioid, value);
-            } else if (strcmp(name, "withininterval") == 0) {
-                audioid->labels[labelId].onlyWithinInterval = atof(value);
-            } else {
-                fprintf(stderr, "ERROR: Problem reading state file %s section %s line %zu unrecognized name: %s\n", filename, AudioIdGetLabelName(audioid, labelId), lineNumber, name);
-                errors++;
+    free(clamped);
+    SearchTestFree(&test);
+    return pass;
+}
+
+// Check the projection fit (merging, orthonormal eigenvectors spanning the frames' components) and the blocked projection against a direct product
+static bool ProjectionSelfTest(void) {
+    const size_t countBuckets = 40, countFrames = 2000, countComponents = 3;
+    kernels_t kernels;
+    KernelsSelect(&kernels, KERNELS_AUTO);
+    double *basis = malloc(sizeof(double) * countComponents * countBuckets);
+    real_t *values = malloc(sizeof(real_t) * countBuckets);
+    double *product = malloc(sizeof(double) * countBuckets);
+    if (basis == NULL || values == NULL || product == NULL) { fprintf(stderr, "ERROR: Memory failure (self-test).\n"); exit(-1); }
+    bool pass = true;
+
+    // Frames from a mean, three orthonormal components of decreasing spread, and a little noise: learned as one fit, and as two fits merged
+    uint32_t seed = 0x1f83d9ab;
+    for (size_t i = 0; i < countComponents * countBuckets; i++) {
+        seed = seed * 1664525 + 1013904223;
+        basis[i] = (double)(seed >> 8) / (1 << 24) - 0.5;
+    }
+    Orthonormalize(basis, countComponents, countBuckets, &seed);
+    projection_fit_t whole = {0}, part = {0}, other = {0};
+    for (size_t n = 0; n < countFrames; n++) {
+        double weights[3];
+        for (size_t k = 0; k < countComponents; k++) {
+            seed = seed * 1664525 + 1013904223;
+            weights[k] = (3.0 - k) * ((double)(seed >> 8) / (1 << 24) - 0.5);
+        }
+        for (size_t i = 0; i < countBuckets; i++) {
+            seed = seed * 1664525 + 1013904223;
+            double value = 1 + 0.1 * i + 0.01 * ((double)(seed >> 8) / (1 << 24) - 0.5);
+            for (size_t k = 0; k < countComponents; k++) value += weights[k] * basis[k * countBuckets + i];
+            values[i] = (real_t)value;
+        }
+        ProjectionFitAdd(&whole, countBuckets, values);
+        ProjectionFitAdd((n < countFrames / 3) ? &part : &other, countBuckets, values);
+    }
+    ProjectionFitMerge(&part, &other);
+    double mergeError = 0, scale = 0;
+    for (size_t i = 0; i < countBuckets * countBuckets; i++) {
+        if (fabs(part.comoment[i] - whole.comoment[i]) > mergeError) mergeError = fabs(part.comoment[i] - whole.comoment[i]);
+        if (fabs(whole.comoment[i]) > scale) scale = fabs(whole.comoment[i]);
+    }
+    bool ok = (part.count == whole.count) && (mergeError <= 1e-9 * scale);
+    printf("SELF-TEST: projection fit merge (%zu frames): max co-moment error %.3g of %.3g %s\n", whole.count, mergeError, scale, ok ? "ok" : "FAILED");
+    pass &= ok;
+
+    // The fitted rows are orthonormal eigenvectors of the covariance, spanning the components
+    projection_t projection = {0};
+    double kept = ProjectionFitSolve(&whole, &projection, countComponents);
+    double orthoError = 0, residual = 0, largest = 0, missed = 0;
+    for (size_t a = 0; a < projection.dimension; a++) {
+        const double *row = projection.rows + a * projection.stride;
+        for (size_t b = 0; b < projection.dimension; b++) {
+            double dot = 0;
+            for (size_t i = 0; i < countBuckets; i++) dot += row[i] * projection.rows[b * projection.stride + i];
+            if (fabs(dot - (a == b ? 1 : 0)) > orthoError) orthoError = fabs(dot - (a == b ? 1 : 0));
+        }
+        double eigenvalue = 0, sum = 0;
+        for (size_t i = 0; i < countBuckets; i++) {
+            product[i] = 0;
+            for (size_t j = 0; j < countBuckets; j++) {
+                product[i] += whole.comoment[i < j ? i * countBuckets + j : j * countBuckets + i] / (whole.count - 1) * row[j];
             }
+            eigenvalue += row[i] * product[i];
         }
+        for (size_t i = 0; i < countBuckets; i++) sum += (product[i] - eigenvalue * row[i]) * (product[i] - eigenvalue * row[i]);
+        if (sqrt(sum) > residual) residual = sqrt(sum);
+        if (eigenvalue > largest) largest = eigenvalue;
     }
-    free(buffer);
-    fclose(fp);
-    return (errors == 0);
+    for (size_t k = 0; k < countComponents; k++) {
+        double captured = 0;
+        for (size_t a = 0; a < projection.dimension; a++) {
+            double dot = 0;
+            for (size_t i = 0; i < countBuckets; i++) dot += basis[k * countBuckets + i] * projection.rows[a * projection.stride + i];
+            captured += dot * dot;
+        }
+        if (1 - captured > missed) missed = 1 - captured;
+    }
+    ok = (projection.dimension == countComponents) && (orthoError < 1e-9) && (residual < 1e-6 * largest) && (missed < 0.001) && (kept > 0.99);
+    printf("SELF-TEST: projection fit (%zu buckets to %zu): orthonormal within %.3g, residual %.3g of %.3g, components captured within %.3g, %.2f%% of the variance kept %s\n", countBuckets, projection.dimension, orthoError, residual, largest, missed, 100.0 * kept, ok ? "ok" : "FAILED");
+    pass &= ok;
+
+    // The blocked projection matches a direct matrix-vector product (over more than one block)
+    const size_t countWide = PROJECTION_BLOCK * 2 + 37, dimension = 7;
+    double *mean = malloc(sizeof(double) * countWide);
+    double *row = malloc(sizeof(double) * countWide);
+    double *input = malloc(sizeof(double) * countWide);
+    double *expected = malloc(sizeof(double) * dimension);
+    if (mean == NULL || row == NULL || input == NULL || expected == NULL) { fprintf(stderr, "ERROR: Memory failure (self-test).\n"); exit(-1); }
+    for (size_t i = 0; i < countWide; i++) {
+        seed = seed * 1664525 + 1013904223;
+        mean[i] = (double)(seed >> 8) / (1 << 24);
+        seed = seed * 1664525 + 1013904223;
+        input[i] = (double)(seed >> 8) / (1 << 24);
+    }
+    ProjectionInit(&projection, countWide, mean);
+    for (size_t r = 0; r < dimension; r++) {
+        expected[r] = 0;
+        for (size_t i = 0; i < countWide; i++) {
+            seed = seed * 1664525 + 1013904223;
+            row[i] = (double)(seed >> 8) / (1 << 24) - 0.5;
+            expected[r] += row[i] * (input[i] - mean[i]);
+        }
+        ProjectionAddRow(&projection, row);
+    }
+    ProjectionUpdate(&projection, &kernels);
+    const double *projected = ProjectionApply(&projection, &kernels, input, dimension);
+    double applyError = 0;
+    for (size_t r = 0; r < dimension; r++) {
+        if (fabs(projected[r] - expected[r]) > applyError) applyError = fabs(projected[r] - expected[r]);
+    }
+    ok = (applyError < 1e-9);
+    printf("SELF-TEST: projection apply (%zu buckets to %zu, blocks of %d, %s): max error %.3g %s\n", countWide, dimension, PROJECTION_BLOCK, kernels.name, applyError, ok ? "ok" : "FAILED");
+    pass &= ok;
+
+    free(expected);
+    free(input);
+    free(row);
+    free(mean);
+    ProjectionFree(&projection);
+    ProjectionFitFree(&other);
+    ProjectionFitFree(&part);
+    ProjectionFitFree(&whole);
+    free(product);
+    free(values);
+    free(basis);
+    return pass;
 }
 
-// Save state
-bool AudioIdStateSave(audioid_t *audioid, const char *filename) {
-    FILE *fp = fopen(filename, "wt");
-    if (!fp) {
-        fprintf(stderr, "ERROR: Problem opening state file for writing: %s\n", filename);
-        return false;
+// Process the frames of the adaptive rate self-test (NULL buckets when gated) with the adaptive rate off or on, giving the state after each frame
+static void AdaptiveSelfTestRun(const char *adaptive, size_t countBuckets, const real_t *labelMeans, size_t countLabels, const real_t *buckets, const bool *gated, size_t countFrames, int *states, size_t *outSkipped, size_t *outRescored) {
+    static const char *labelNames[] = { "b/1", "a/1", "c/1" };
+    audioid_t *audioid = AudioIdCreate();
+    audioid->quiet = true;
+    char value[16];
+    snprintf(value, sizeof(value), "%zu", countBuckets);
+    AudioIdSetOption(audioid, "bucketcount", value);
+    AudioIdSetOption(audioid, "adaptive", adaptive);
+    for (size_t n = 0; n < countLabels; n++) {
+        size_t id = AudioIdGetLabelId(audioid, labelNames[n]);
+        running_stats_add(&audioid->labels[id].stats, labelMeans + n * countBuckets);
     }
+    AudioIdStartFrames(audioid);
+    for (size_t frame = 0; frame < countFrames; frame++) {
+        AudioIdProcessFrame(audioid, gated[frame] ? NULL : buckets + frame * countBuckets, countBuckets, 0, (double)frame * audioid->hopSize / audioid->analysisRate);
+        states[frame] = audioid->lastState;
+    }
+    *outSkipped = audioid->countAdaptiveSkipped;
+    *outRescored = audioid->countAdaptiveRescored;
+    AudioIdDestroy(audioid);
+}
 
-    fprintf(fp, "# AudioID state file -- this file will be overwritten if the --write-state option is used\n");
-    fprintf(fp, "\n");
-    fprintf(fp, "bucketcount = %zu\n", audioid->countBuckets);
-    fprintf(fp, "\n");
-    for (size_t id = 0; id < audioid->countLabels; id++) {
-        fprintf(fp, "[%s]\n", audioid->labels[id].labelText);
+// Check the adaptive rate gives the same state at every frame as scoring every frame, for inputs that are stable, that alternate groups between scored frames, that are nearest a label by a small margin, and that are gated
+static bool AdaptiveSelfTest(void) {
+    const size_t countBuckets = 8, countLabels = 3, cycleCount = AUDIOID_DEFAULT_CYCLE_COUNT;
+    // Input at each frame by segments of a repeated pattern: labels 'a', 'b', 'c', 'm' between 'a' and 'b' (nearer 'a' by a small margin), '-' gated
+    static const struct { size_t count; const char *pattern; } segments[] = {
+        { 60, "a" }, { 60, "ab" }, { 30, "a" }, { 60, "abb" }, { 30, "a" }, { 60, "aab" }, { 40, "b" }, { 30, "ba" },
+        { 20, "m" }, { 30, "a" }, { 10, "-" }, { 40, "a" }, { 40, "aaac" }, { 40, "c" }, { 30, "cab" }, { 40, "a" }, { 40, "aaaab" },
+    };
+    size_t countFrames = 0;
+    for (size_t s = 0; s < sizeof(segments) / sizeof(segments[0]); s++) countFrames += segments[s].count;
+    real_t *labelMeans = malloc(sizeof(real_t) * countLabels * countBuckets);
+    real_t *buckets = malloc(sizeof(real_t) * countFrames * countBuckets);
+    bool *gated = malloc(sizeof(bool) * countFrames);
+    double *ring = malloc(sizeof(double) * cycleCount * countBuckets);
+    double *ringSum = malloc(sizeof(double) * countBuckets);
+    int *expected = malloc(sizeof(int) * countFrames);
+    int *states = malloc(sizeof(int) * countFrames);
+    if (labelMeans == NULL || buckets == NULL || gated == NULL || ring == NULL || ringSum == NULL || expected == NULL || states == NULL) { fprintf(stderr, "ERROR: Memory failure (self-test).\n"); exit(-1); }
+
+    // Labels 'b', 'a' and 'c' (so that 'b' is the lowest group, winning ties)
+    for (size_t i = 0; i < countBuckets; i++) {
+        labelMeans[0 * countBuckets + i] = (real_t)(countBuckets - i);
+        labelMeans[1 * countBuckets + i] = (real_t)(1 + i);
+        labelMeans[2 * countBuckets + i] = (real_t)(4 + 3 * (i % 2));
+    }
 
-        fprintf(fp, "stats = \"");
-        for (size_t i = 0; i < audioid->countBuckets; i++) {
-            running_stats_t *stats = &audioid->labels[id].stats[i];
-            fprintf(fp, "%s%u %f %f", i == 0 ? "" : "; ", stats->count, stats->mean, stats->sumVar);
+    // Bucket values giving each frame's input as the mean over the ring of the last cycleCount frames (emptied on entering the gate)
+    size_t frame = 0, countRing = 0, ringIndex = 0;
+    for (size_t i = 0; i < countBuckets; i++) ringSum[i] = 0;
+    for (size_t s = 0; s < sizeof(segments) / sizeof(segments[0]); s++) {
+        for (size_t n = 0; n < segments[s].count; n++, frame++) {
+            char input = segments[s].pattern[n % strlen(segments[s].pattern)];
+            gated[frame] = (input == '-');
+            if (gated[frame]) {
+                countRing = 0;
+                for (size_t i = 0; i < countBuckets; i++) ringSum[i] = 0;
+                continue;
+            }
+            for (size_t i = 0; i < countBuckets; i++) {
+                double a = labelMeans[1 * countBuckets + i], b = labelMeans[0 * countBuckets + i];
+                double want = (input == 'a') ? a : (input == 'b') ? b : (input == 'c') ? labelMeans[2 * countBuckets + i] : 0.55 * a + 0.45 * b;
+                double outgoing = (countRing >= cycleCount) ? ring[ringIndex * countBuckets + i] : 0;
+                double count = (countRing >= cycleCount) ? cycleCount : countRing + 1;
+                real_t value = (real_t)(count * want - (ringSum[i] - outgoing));
+                buckets[frame * countBuckets + i] = value;
+                ring[ringIndex * countBuckets + i] = value;
+                ringSum[i] += value - outgoing;
+            }
+            ringIndex = (ringIndex + 1) % cycleCount;
+            if (countRing < cycleCount) countRing++;
         }
-        fprintf(fp, "\"\n");
-        fprintf(fp, "scale = %f\n", audioid->labels[id].scale);
-        fprintf(fp, "limit = %f\n", audioid->labels[id].limit);
-
-        fprintf(fp, "\n");
     }
 
-    fclose(fp);
-    return true;
+    // Every frame scored, then the adaptive rate
+    size_t skipped, rescored;
+    AdaptiveSelfTestRun("off", countBuckets, labelMeans, countLabels, buckets, gated, countFrames, expected, &skipped, &rescored);
+    AdaptiveSelfTestRun("on", countBuckets, labelMeans, countLabels, buckets, gated, countFrames, states, &skipped, &rescored);
+    size_t countDiffer = 0;
+    for (size_t f = 0; f < countFrames; f++) {
+        if (states[f] != expected[f]) countDiffer++;
+    }
+    bool pass = (countDiffer == 0) && (skipped > 0) && (rescored > 0);
+    printf("SELF-TEST: adaptive rate: %zu of %zu frames skipped, %zu re-scored, %zu states differ from every frame scored %s\n", skipped, countFrames, rescored, countDiffer, pass ? "ok" : "FAILED");
+
+    free(labelMeans);
+    free(buckets);
+    free(gated);
+    free(ring);
+    free(ringSum);
+    free(expected);
+    free(states);
+    return pass;
 }
 
-// Shutdown an audioid object (but do not destroy it), the object can be used again
-void AudioIdShutdown(audioid_t *audioid) {
-    if (audioid->deviceInitialized) {
-        if (audioid->verbose) fprintf(stderr, "AUDIOID: Stopping audio capture.\n");
-        ma_device_uninit(&audioid->device);
-        audioid->deviceInitialized = false;
-    }
-    if (audioid->decoderInitialized) {
-        if (audioid->verbose) fprintf(stderr, "AUDIOID: Closing audio file.\n");
-        ma_decoder_uninit(&audioid->decoder);
-        audioid->decoderInitialized = false;
-    }
-    if (audioid->intervals != NULL) {
-        free(audioid->intervals);
-        audioid->intervals = NULL;
+// Check the decimator passes a tone below the output Nyquist frequency, and attenuates one that would alias
+static bool DecimatorSelfTest(void) {
+    const size_t factor = 2, countSamples = 8000;
+    const double frequencies[] = { 1000, 6000 };    // (Hz, at 16 kHz input)
+    double gain[2];
+    int16_t *samples = malloc(sizeof(int16_t) * countSamples);
+    if (samples == NULL) { fprintf(stderr, "ERROR: Memory failure (self-test).\n"); exit(-1); }
+    for (size_t f = 0; f < 2; f++) {
+        decimator_t decimator;
+        DecimatorInit(&decimator, factor, KERNELS_AUTO);
+        for (size_t i = 0; i < countSamples; i++) {
+            samples[i] = (int16_t)(16000 * sin(2 * M_PI * frequencies[f] * i / AUDIOID_SAMPLE_RATE));
+        }
+        size_t countOutput = DecimatorProcess(&decimator, samples, countSamples, samples);   // (in place)
+        // RMS after the filter has settled, relative to the input RMS
+        double sumSquares = 0;
+        for (size_t i = decimator.countTaps; i < countOutput; i++) {
+            sumSquares += (double)samples[i] * samples[i];
+        }
+        gain[f] = sqrt(sumSquares / (countOutput - decimator.countTaps)) / (16000 / sqrt(2));
+        DecimatorDestroy(&decimator);
     }
-    audioid->countIntervals = 0;
-    AudioIdFreeLabels(audioid);
-    FingerprintDestroy(&audioid->fingerprint);
+    free(samples);
+    bool pass = (gain[0] > 0.99 && gain[0] < 1.01 && gain[1] < 0.01);
+    printf("SELF-TEST: decimator: pass-band gain %.4f, stop-band gain %.5f %s\n", gain[0], gain[1], pass ? "ok" : "FAILED");
+    return pass;
+}
+
+// Run self-tests of the processing stages, returns true if all pass
+bool AudioIdSelfTest(void) {
+    bool pass = true;
+    pass &= KernelsSelfTest();
+    pass &= FixedSelfTest();
+    pass &= FingerprintSelfTestReference();
+    pass &= FingerprintSelfTestBatch();
+    pass &= FingerprintSelfTestStats();
+    pass &= DistanceSelfTestMetrics();
+    pass &= VpTreeSelfTest();
+    pass &= AbandonSelfTest();
+    pass &= GroupSearchSelfTest();
+    pass &= QuantizeSelfTest();
+    pass &= ProjectionSelfTest();
+    pass &= AdaptiveSelfTest();
+    pass &= RunningStatsSelfTestMerge();
+    pass &= DecimatorSelfTest();
+    printf("SELF-TEST: %s\n", pass ? "passed" : "FAILED");
+    return pass;
 }
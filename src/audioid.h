@@ -32,12 +32,24 @@ bool AudioIdStart(audioid_t *audioid);
 // Wait until audio processing has completed
 void AudioIdWaitUntilDone(audioid_t *audioid);
 
+// Learn from a manifest of labelled recordings (each line: sound file, tab, label file), processed in parallel by worker threads
+bool AudioIdLearnManifest(audioid_t *audioid, const char *manifestFile);
+
 // Load state
 bool AudioIdStateLoad(audioid_t *audioid, const char *filename);
 
 // Save state
 bool AudioIdStateSave(audioid_t *audioid, const char *filename);
 
+// Set a named configuration option (as used in the global section of the state file)
+bool AudioIdSetOption(audioid_t *audioid, const char *name, const char *value);
+
+// Run micro-benchmarks of the processing stages using the current configuration
+void AudioIdBenchmark(audioid_t *audioid);
+
+// Run self-tests of the processing stages, returns true if all pass
+bool AudioIdSelfTest(void);
+
 // Shutdown an audioid object (but do not destroy it), the object can be used again
 void AudioIdShutdown(audioid_t *audioid);
 
@@ -0,0 +1,353 @@
+// AudioId - Daniel Jackson, 2022.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "fixed.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Magnitude approximation: max(a0 * hi + b0 * lo, a1 * hi + b1 * lo) / 128, where hi/lo are the larger/smaller of |real| and |imaginary|
+#define MAGNITUDE_A0 127
+#define MAGNITUDE_B0 24
+#define MAGNITUDE_A1 108
+#define MAGNITUDE_B1 71
+#define MAGNITUDE_BITS 7
+
+// Position of the highest set bit of a non-zero value
+static inline int FixedHighestBit(uint64_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+    return 63 - __builtin_clzll(value);
+#else
+    int bit = 0;
+    while (value >>= 1) bit++;
+    return bit;
+#endif
+}
+
+
+// --- FFT ---
+
+bool FixedFftInit(fixed_fft_t *fft, size_t size) {
+    memset(fft, 0, sizeof(*fft));
+    if (size < 4 || (size & (size - 1)) != 0) return false;
+    int bits = FixedHighestBit(size);
+    if (bits + 1 > 31 - 8) return false;   // keep at least 8 fractional bits
+    fft->size = size;
+    fft->guardBits = bits + 1;
+    fft->fractionBits = 31 - fft->guardBits;
+
+    fft->twiddles = malloc(sizeof(int32_t) * 2 * size);
+    fft->reverse = malloc(sizeof(uint32_t) * (size / 2));
+    if (fft->twiddles == NULL || fft->reverse == NULL) { fprintf(stderr, "ERROR: Memory failure (fixed-point FFT).\n"); exit(-1); }
+    for (size_t k = 0; k < size; k++) {
+        double angle = 2 * M_PI * k / size;
+        fft->twiddles[2 * k] = (int32_t)floor(cos(angle) * (1 << FIXED_TWIDDLE_BITS) + 0.5);
+        fft->twiddles[2 * k + 1] = (int32_t)floor(-sin(angle) * (1 << FIXED_TWIDDLE_BITS) + 0.5);
+    }
+    int countBits = bits - 1;   // of the size/2 complex values
+    for (size_t i = 0; i < size / 2; i++) {
+        uint32_t reversed = 0;
+        for (int b = 0; b < countBits; b++) {
+            if (i & ((size_t)1 << b)) reversed |= 1u << (countBits - 1 - b);
+        }
+        fft->reverse[i] = reversed;
+    }
+    return true;
+}
+
+void FixedFftDestroy(fixed_fft_t *fft) {
+    if (fft->twiddles != NULL) {
+        free(fft->twiddles);
+        fft->twiddles = NULL;
+    }
+    if (fft->reverse != NULL) {
+        free(fft->reverse);
+        fft->reverse = NULL;
+    }
+}
+
+// value * twiddle (Q30), rounded
+static inline void FixedTwiddle(int32_t *value, int32_t real, int32_t imaginary, const int32_t *twiddle) {
+    int64_t r = (int64_t)real * twiddle[0] - (int64_t)imaginary * twiddle[1];
+    int64_t i = (int64_t)real * twiddle[1] + (int64_t)imaginary * twiddle[0];
+    value[0] = (int32_t)((r + ((int64_t)1 << (FIXED_TWIDDLE_BITS - 1))) >> FIXED_TWIDDLE_BITS);
+    value[1] = (int32_t)((i + ((int64_t)1 << (FIXED_TWIDDLE_BITS - 1))) >> FIXED_TWIDDLE_BITS);
+}
+
+// In-place complex FFT of size/2 interleaved values, by decimation in frequency with pairs of radix-2 stages merged into radix-4 butterflies (radix-2^2: the cost of radix-4, with the results in plain bit-reversed order), and a final radix-2 stage if required
+static void FixedFftComplex(const fixed_fft_t *fft, int32_t *data) {
+    size_t count = fft->size / 2;
+    size_t span = count;
+    for (; span >= 4; span /= 4) {
+        size_t q = span / 4;
+        size_t step = fft->size / span;     // twiddle index of W(span)^1
+        for (size_t block = 0; block < count; block += span) {
+            for (size_t k = 0; k < q; k++) {
+                int32_t *x0 = data + 2 * (block + k);
+                int32_t *x1 = x0 + 2 * q;
+                int32_t *x2 = x1 + 2 * q;
+                int32_t *x3 = x2 + 2 * q;
+                int32_t s0r = x0[0] + x2[0], s0i = x0[1] + x2[1];
+                int32_t s1r = x1[0] + x3[0], s1i = x1[1] + x3[1];
+                int32_t ar = x0[0] - x2[0], ai = x0[1] - x2[1];
+                int32_t br = x1[1] - x3[1], bi = x3[0] - x1[0];     // -j * (x1 - x3)
+                x0[0] = s0r + s1r;
+                x0[1] = s0i + s1i;
+                if (k == 0) {
+                    x1[0] = s0r - s1r; x1[1] = s0i - s1i;
+                    x2[0] = ar + br; x2[1] = ai + bi;
+                    x3[0] = ar - br; x3[1] = ai - bi;
+                } else {
+                    FixedTwiddle(x1, s0r - s1r, s0i - s1i, fft->twiddles + 2 * (2 * k * step));
+                    FixedTwiddle(x2, ar + br, ai + bi, fft->twiddles + 2 * (k * step));
+                    FixedTwiddle(x3, ar - br, ai - bi, fft->twiddles + 2 * (3 * k * step));
+                }
+            }
+        }
+    }
+    if (span == 2) {
+        for (size_t block = 0; block < count; block += 2) {
+            int32_t *x0 = data + 2 * block;
+            int32_t ar = x0[0], ai = x0[1];
+            x0[0] = ar + x0[2]; x0[1] = ai + x0[3];
+            x0[2] = ar - x0[2]; x0[3] = ai - x0[3];
+        }
+    }
+
+    // Natural order
+    for (size_t i = 0; i < count; i++) {
+        size_t j = fft->reverse[i];
+        if (j > i) {
+            int32_t r = data[2 * i], m = data[2 * i + 1];
+            data[2 * i] = data[2 * j]; data[2 * i + 1] = data[2 * j + 1];
+            data[2 * j] = r; data[2 * j + 1] = m;
+        }
+    }
+}
+
+void FixedFftReal(const fixed_fft_t *fft, int32_t *data) {
+    // Even/odd real inputs as the real/imaginary parts of a half-length complex FFT
+    FixedFftComplex(fft, data);
+
+    // Separate the spectra of the even and odd inputs, E[k] = (Z[k] + Z*[M-k]) / 2, O[k] = (Z[k] - Z*[M-k]) / 2j, and combine: X[k] = E[k] + W^k O[k], X[M-k] = (E[k] - W^k O[k])*
+    size_t half = fft->size / 2;
+    int32_t z0r = data[0], z0i = data[1];
+    data[0] = z0r + z0i; data[1] = 0;
+    data[2 * half] = z0r - z0i; data[2 * half + 1] = 0;
+    for (size_t k = 1; k <= half / 2; k++) {
+        size_t m = half - k;
+        int64_t a = data[2 * k], b = data[2 * k + 1], c = data[2 * m], d = data[2 * m + 1];
+        // Doubled E and O, with the halving folded into the final shift
+        int64_t er = a + c, ei = b - d;
+        int64_t orr = b + d, oi = c - a;
+        const int32_t *w = fft->twiddles + 2 * k;
+        int64_t wor = orr * w[0] - oi * w[1];
+        int64_t woi = orr * w[1] + oi * w[0];
+        const int64_t one = (int64_t)1 << FIXED_TWIDDLE_BITS;    // (also the rounding term of the final shift)
+        data[2 * k] = (int32_t)((er * one + wor + one) >> (FIXED_TWIDDLE_BITS + 1));
+        data[2 * k + 1] = (int32_t)((ei * one + woi + one) >> (FIXED_TWIDDLE_BITS + 1));
+        data[2 * m] = (int32_t)((er * one - wor + one) >> (FIXED_TWIDDLE_BITS + 1));
+        data[2 * m + 1] = (int32_t)((woi - ei * one + one) >> (FIXED_TWIDDLE_BITS + 1));
+    }
+}
+
+
+// --- Kernels ---
+
+// Window-weight a circular buffer, oldest first: from the start position to the end, then from the beginning
+void FixedWindow(int32_t *dst, const int32_t *window, const int16_t *ring, size_t start, size_t count, int shift) {
+    int32_t round = (int32_t)1 << (shift - 1);
+    size_t countOlder = count - start;
+    for (size_t i = 0; i < countOlder; i++) {
+        dst[i] = (window[i] * ring[start + i] + round) >> shift;
+    }
+    for (size_t i = 0; i < start; i++) {
+        dst[countOlder + i] = (window[countOlder + i] * ring[i] + round) >> shift;
+    }
+}
+
+void FixedMagnitude(uint64_t *dst, const int32_t *src, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        uint64_t r = (uint64_t)(src[2 * i] < 0 ? -(int64_t)src[2 * i] : src[2 * i]);
+        uint64_t m = (uint64_t)(src[2 * i + 1] < 0 ? -(int64_t)src[2 * i + 1] : src[2 * i + 1]);
+        uint64_t hi = r > m ? r : m;
+        uint64_t lo = r > m ? m : r;
+        uint64_t first = MAGNITUDE_A0 * hi + MAGNITUDE_B0 * lo;
+        uint64_t second = MAGNITUDE_A1 * hi + MAGNITUDE_B1 * lo;
+        dst[i] = (first > second ? first : second) >> MAGNITUDE_BITS;
+    }
+}
+
+void FixedPower(uint64_t *dst, const int32_t *src, size_t count, int shift) {
+    for (size_t i = 0; i < count; i++) {
+        int64_t r = src[2 * i];
+        int64_t m = src[2 * i + 1];
+        dst[i] = (uint64_t)(r * r + m * m) >> shift;
+    }
+}
+
+void FixedBucketMeans(uint64_t *dst, const uint64_t *values, const size_t *bounds, size_t countBuckets) {
+    for (size_t i = 0; i < countBuckets; i++) {
+        uint64_t sum = 0;
+        for (size_t j = bounds[i]; j < bounds[i + 1]; j++) {
+            sum += values[j];
+        }
+        size_t count = bounds[i + 1] - bounds[i];
+        dst[i] = count > 0 ? sum / count : 0;
+    }
+}
+
+void FixedProject(uint64_t *dst, const uint64_t *values, const size_t *first, const size_t *offsets, const uint32_t *weights, size_t countRows) {
+    const uint64_t mask = ((uint64_t)1 << FIXED_WEIGHT_BITS) - 1;
+    for (size_t i = 0; i < countRows; i++) {
+        const uint64_t *v = values + first[i];
+        const uint32_t *w = weights + offsets[i];
+        size_t count = offsets[i + 1] - offsets[i];
+        uint64_t sum = 0;
+        for (size_t j = 0; j < count; j++) {
+            // (split so that the product cannot overflow)
+            sum += (v[j] >> FIXED_WEIGHT_BITS) * w[j] + (((v[j] & mask) * w[j]) >> FIXED_WEIGHT_BITS);
+        }
+        dst[i] = sum;
+    }
+}
+
+int32_t FixedLog2(uint64_t value) {
+    if (value == 0) value = 1;
+    int exponent = FixedHighestBit(value);
+    // Mantissa in [1, 2), Q30
+    int64_t m = (int64_t)(exponent >= 30 ? value >> (exponent - 30) : value << (30 - exponent));
+    // (-0.34484843 m + 2.02466578) m - 1.67487759, as for the floating point version
+    const int64_t c2 = (int64_t)(-0.34484843 * (1 << 30));
+    const int64_t c1 = (int64_t)(2.02466578 * (1 << 30));
+    const int64_t c0 = (int64_t)(1.67487759 * (1 << 30));
+    int64_t fraction = ((((c2 * m) >> 30) + c1) * m >> 30) - c0;
+    return (int32_t)(exponent << FIXED_LOG2_BITS) + (int32_t)((fraction + ((int64_t)1 << (29 - FIXED_LOG2_BITS))) >> (30 - FIXED_LOG2_BITS));
+}
+
+
+// --- Self-test ---
+
+static bool FixedCheck(const char *name, double error, double tolerance) {
+    bool pass = error <= tolerance;
+    printf("SELF-TEST: fixed-point %s: max error %g (tolerance %g) %s\n", name, error, tolerance, pass ? "ok" : "FAILED");
+    return pass;
+}
+
+bool FixedSelfTest(void) {
+    const size_t sizes[] = { 16, 32, 256, 2048 };   // (both odd and even counts of radix-2 stages)
+    const size_t maxSize = 2048;
+    bool pass = true;
+
+    int32_t *data = malloc(sizeof(int32_t) * (maxSize + 2));
+    double *input = malloc(sizeof(double) * maxSize);
+    uint64_t *values = malloc(sizeof(uint64_t) * maxSize);
+    if (data == NULL || input == NULL || values == NULL) { fprintf(stderr, "ERROR: Memory failure (self-test).\n"); exit(-1); }
+    uint32_t seed = 0x6b43a9b5;
+
+    // FFT against a direct double-precision DFT, relative to full scale (the size)
+    double errorFft = 0;
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        size_t size = sizes[s];
+        fixed_fft_t fft;
+        if (!FixedFftInit(&fft, size)) { pass = false; continue; }
+        for (size_t i = 0; i < size; i++) {
+            seed = seed * 1664525 + 1013904223;
+            data[i] = (int32_t)(seed >> (32 - fft.fractionBits - 1)) - ((int32_t)1 << fft.fractionBits);   // [-1, 1)
+            input[i] = (double)data[i] / ((int32_t)1 << fft.fractionBits);
+        }
+        data[0] = -((int32_t)1 << fft.fractionBits);     // full-scale extremes
+        input[0] = -1;
+        FixedFftReal(&fft, data);
+        for (size_t k = 0; k <= size / 2; k++) {
+            double re = 0, im = 0;
+            for (size_t n = 0; n < size; n++) {
+                double angle = 2 * M_PI * (double)((k * n) % size) / size;
+                re += input[n] * cos(angle);
+                im -= input[n] * sin(angle);
+            }
+            double scale = (double)((int32_t)1 << fft.fractionBits);
+            double error = (fabs(data[2 * k] / scale - re) + fabs(data[2 * k + 1] / scale - im)) / size;
+            if (error > errorFft || error != error) errorFft = error;
+        }
+        FixedFftDestroy(&fft);
+    }
+    pass &= FixedCheck("fft", errorFft, 1e-5);
+
+    // Magnitude approximation, relative to the exact magnitude
+    double errorMagnitude = 0;
+    for (size_t i = 0; i < maxSize / 2; i++) {
+        seed = seed * 1664525 + 1013904223;
+        data[2 * i] = (int32_t)seed >> 2;
+        seed = seed * 1664525 + 1013904223;
+        data[2 * i + 1] = (int32_t)seed >> (2 + i % 16);
+    }
+    FixedMagnitude(values, data, maxSize / 2);
+    for (size_t i = 0; i < maxSize / 2; i++) {
+        double exact = sqrt((double)data[2 * i] * data[2 * i] + (double)data[2 * i + 1] * data[2 * i + 1]);
+        double error = exact > 0 ? fabs((double)values[i] - exact) / exact : 0;
+        if (error > errorMagnitude || error != error) errorMagnitude = error;
+    }
+    pass &= FixedCheck("magnitude", errorMagnitude, 0.012);
+
+    // Power, exact apart from the shift
+    double errorPower = 0;
+    FixedPower(values, data, maxSize / 2, 8);
+    for (size_t i = 0; i < maxSize / 2; i++) {
+        double exact = ((double)data[2 * i] * data[2 * i] + (double)data[2 * i + 1] * data[2 * i + 1]) / 256;
+        double error = fabs((double)values[i] - exact) / (exact > 1 ? exact : 1);
+        if (error > errorPower || error != error) errorPower = error;
+    }
+    pass &= FixedCheck("power", errorPower, 1e-9);
+
+    // Log2 over a wide range of values
+    double errorLog = 0;
+    for (int i = 0; i < 4000; i++) {
+        seed = seed * 1664525 + 1013904223;
+        uint64_t value = ((uint64_t)seed << 31 | seed) >> (i % 62);
+        if (value == 0) continue;
+        double error = fabs((double)FixedLog2(value) / (1 << FIXED_LOG2_BITS) - log2((double)value));
+        if (error > errorLog || error != error) errorLog = error;
+    }
+    pass &= FixedCheck("log2", errorLog, 0.005);
+
+    // Sparse projection with weights summing to one, relative to the double-precision result
+    double errorProject = 0;
+    {
+        const size_t countRows = 64;
+        size_t first[64], offsets[65];
+        uint32_t *weights = malloc(sizeof(uint32_t) * maxSize);
+        if (weights == NULL) { fprintf(stderr, "ERROR: Memory failure (self-test).\n"); exit(-1); }
+        offsets[0] = 0;
+        for (size_t i = 0; i < countRows; i++) {
+            size_t length = 1 + i % 24;
+            first[i] = (i * 13) % (maxSize / 2 - length);
+            offsets[i + 1] = offsets[i] + length;
+            for (size_t j = 0; j < length; j++) weights[offsets[i] + j] = (uint32_t)((1 << FIXED_WEIGHT_BITS) / length);
+        }
+        for (size_t i = 0; i < maxSize / 2; i++) {
+            seed = seed * 1664525 + 1013904223;
+            values[i] = ((uint64_t)seed << 24) >> (i % 40);
+        }
+        uint64_t result[64];
+        FixedProject(result, values, first, offsets, weights, countRows);
+        for (size_t i = 0; i < countRows; i++) {
+            double exact = 0;
+            for (size_t j = offsets[i]; j < offsets[i + 1]; j++) exact += (double)values[first[i] + j - offsets[i]] * weights[j] / (1 << FIXED_WEIGHT_BITS);
+            double error = fabs((double)result[i] - exact) / (exact > 1 ? exact : 1);
+            if (error > errorProject || error != error) errorProject = error;
+        }
+        free(weights);
+    }
+    pass &= FixedCheck("project", errorProject, 1e-6);
+
+    free(values);
+    free(input);
+    free(data);
+    return pass;
+}
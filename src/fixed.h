@@ -0,0 +1,64 @@
+// AudioId - Daniel Jackson, 2022.
+
+// Fixed-point fingerprint front end, for targets without fast floating point: Q15 samples and window, a real FFT on 32-bit values, and integer magnitude, power and bucket kernels.
+
+#ifndef FIXED_H
+#define FIXED_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define FIXED_WINDOW_BITS 15    // window weights are Q15 (held in 32 bits, so that 1.0 is representable)
+#define FIXED_TWIDDLE_BITS 30   // FFT twiddle factors are Q30
+#define FIXED_WEIGHT_BITS 16    // sparse bucket weights are Q16
+#define FIXED_LOG2_BITS 16      // log2 results are Q16
+
+// Real FFT state.  Values in [-1, 1) are held with (31 - guardBits) fractional bits, leaving enough headroom that no stage can overflow (so no per-stage scaling is needed).
+typedef struct {
+    size_t size;            // number of real inputs (a power of two, >= 4)
+    int guardBits;          // log2(size) + 1
+    int fractionBits;       // 31 - guardBits
+    int32_t *twiddles;      // Q30 (cos, -sin) of 2*pi*k/size, for k < size
+    uint32_t *reverse;      // bit-reversal permutation of the size/2 complex values
+} fixed_fft_t;
+
+// Initialize the FFT for a size, returns false if the size is not supported
+bool FixedFftInit(fixed_fft_t *fft, size_t size);
+
+// Free the FFT state
+void FixedFftDestroy(fixed_fft_t *fft);
+
+// In-place real FFT: data holds size values (with fractionBits fractional bits) and must have room for the size/2+1 interleaved complex (real, imaginary) results, which are in the same units (unnormalized)
+void FixedFftReal(const fixed_fft_t *fft, int32_t *data);
+
+// dst[i] = (window[i] * ring[(start + i) % count]) >> shift (rounded), window-weighting a circular buffer of 16-bit samples oldest first
+void FixedWindow(int32_t *dst, const int32_t *window, const int16_t *ring, size_t start, size_t count, int shift);
+
+// dst[i] ~= |src[i]|, where src is interleaved complex (real, imaginary) pairs, by a two-segment max/min approximation (relative error < 1.2%)
+void FixedMagnitude(uint64_t *dst, const int32_t *src, size_t count);
+
+// dst[i] = |src[i]|^2 >> shift, where src is interleaved complex (real, imaginary) pairs
+void FixedPower(uint64_t *dst, const int32_t *src, size_t count, int shift);
+
+// dst[i] = mean of values[bounds[i]] to values[bounds[i + 1] - 1] (0 if empty, rounded down)
+void FixedBucketMeans(uint64_t *dst, const uint64_t *values, const size_t *bounds, size_t countBuckets);
+
+// dst[i] = sum of (weights[offsets[i] + j] * values[first[i] + j]) >> FIXED_WEIGHT_BITS, for j < offsets[i + 1] - offsets[i]
+void FixedProject(uint64_t *dst, const uint64_t *values, const size_t *first, const size_t *offsets, const uint32_t *weights, size_t countRows);
+
+// Approximate log2 (Q16) of a value >= 1, from the leading bit position and a quadratic fit of the mantissa (absolute error < 0.005)
+int32_t FixedLog2(uint64_t value);
+
+// Check the FFT and kernels against double-precision references, returns true if all are within tolerance
+bool FixedSelfTest(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
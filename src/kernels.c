@@ -0,0 +1,1355 @@
+// AudioId - Daniel Jackson, 2022.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "kernels.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+    #define KERNELS_X86
+    #include <immintrin.h>
+    #ifdef _MSC_VER
+        #include <intrin.h>
+        #define KERNELS_TARGET(isa)
+    #else
+        #define KERNELS_TARGET(isa) __attribute__((target(isa)))
+    #endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+    #define KERNELS_NEON
+    #define KERNELS_NEON_SQRT   // AArch64 has vector square root
+    #define KERNELS_NEON_DOUBLE // AArch64 has double-precision vectors
+    #include <arm_neon.h>
+#elif defined(__ARM_NEON) && MINFFT_SINGLE
+    #define KERNELS_NEON        // 32-bit ARM NEON is single precision only
+    #include <arm_neon.h>
+#endif
+
+#define SAMPLE_SCALE ((real_t)1 / 32768)    // exact (power of two), so multiplying matches dividing
+
+
+// --- Scalar reference ---
+
+static inline void ScalarConvert(real_t *dst, const int16_t *src, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        dst[i] = (real_t)src[i] / 32768;
+    }
+}
+
+static inline void ScalarMultiply(real_t *dst, const real_t *a, const real_t *b, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        dst[i] = a[i] * b[i];
+    }
+}
+
+// Window-weight a circular buffer, oldest first: from the start position to the end, then from the beginning
+static inline void ScalarWindow(real_t *dst, const real_t *window, const real_t *ring, size_t start, size_t count) {
+    size_t countOlder = count - start;
+    ScalarMultiply(dst, window, ring + start, countOlder);
+    ScalarMultiply(dst + countOlder, window + countOlder, ring, start);
+}
+
+static inline void ScalarMagnitude(real_t *dst, const real_t *src, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        real_t nr = src[2 * i];
+        real_t ni = src[2 * i + 1];
+        dst[i] = real_sqrt(nr * nr + ni * ni);
+    }
+}
+
+static inline void ScalarPower(real_t *dst, const real_t *src, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        real_t nr = src[2 * i];
+        real_t ni = src[2 * i + 1];
+        dst[i] = nr * nr + ni * ni;
+    }
+}
+
+// A single running-sum pass over the values, emitting the mean at each bucket boundary
+static inline void ScalarBucketMeans(real_t *dst, const real_t *values, const size_t *bounds, size_t countBuckets) {
+    size_t index = bounds[0];
+    for (size_t i = 0; i < countBuckets; i++) {
+        size_t iEndBefore = bounds[i + 1];
+        real_t sum = 0;
+        for (; index < iEndBefore; index++) {
+            sum += values[index];
+        }
+        dst[i] = (iEndBefore > bounds[i]) ? sum / (real_t)(iEndBefore - bounds[i]) : 0;
+    }
+}
+
+// Sparse matrix-vector product, where each row is a contiguous run of weights starting at a column
+static inline void ScalarProject(real_t *dst, const real_t *values, const size_t *first, const size_t *offsets, const real_t *weights, size_t countRows) {
+    for (size_t i = 0; i < countRows; i++) {
+        const real_t *v = values + first[i];
+        const real_t *w = weights + offsets[i];
+        size_t count = offsets[i + 1] - offsets[i];
+        real_t sum = 0;
+        for (size_t j = 0; j < count; j++) {
+            sum += w[j] * v[j];
+        }
+        dst[i] = sum;
+    }
+}
+
+// L1 distance from the input to each row of a matrix
+static inline void ScalarDistanceL1(double *dst, const double *input, const double *rows, size_t stride, size_t count, size_t countRows) {
+    for (size_t r = 0; r < countRows; r++) {
+        const double *row = rows + r * stride;
+        double sum = 0;
+        for (size_t i = 0; i < count; i++) {
+            sum += fabs(input[i] - row[i]);
+        }
+        dst[r] = sum;
+    }
+}
+
+// Weighted L1 distance from the input to each row of a matrix
+static inline void ScalarDistanceWeightedL1(double *dst, const double *input, const double *rows, const double *weights, size_t stride, size_t count, size_t countRows) {
+    for (size_t r = 0; r < countRows; r++) {
+        const double *row = rows + r * stride;
+        const double *weight = weights + r * stride;
+        double sum = 0;
+        for (size_t i = 0; i < count; i++) {
+            sum += weight[i] * fabs(input[i] - row[i]);
+        }
+        dst[r] = sum;
+    }
+}
+
+// Dot product of the input with each row of a matrix
+static inline void ScalarDot(double *dst, const double *input, const double *rows, size_t stride, size_t count, size_t countRows) {
+    for (size_t r = 0; r < countRows; r++) {
+        const double *row = rows + r * stride;
+        double sum = 0;
+        for (size_t i = 0; i < count; i++) {
+            sum += input[i] * row[i];
+        }
+        dst[r] = sum;
+    }
+}
+
+// L1 distance (weighted, if there are weights) from the input to one row, summed a block at a time until the sum exceeds the bound
+static inline size_t ScalarDistanceL1Bounded(double *dst, const double *input, const double *row, const double *weights, size_t count, double bound) {
+    double sum = 0;
+    size_t i = 0;
+    while (i < count) {
+        size_t end = (count - i > KERNELS_BOUNDED_BLOCK) ? i + KERNELS_BOUNDED_BLOCK : count;
+        if (weights != NULL) {
+            for (; i < end; i++) sum += weights[i] * fabs(input[i] - row[i]);
+        } else {
+            for (; i < end; i++) sum += fabs(input[i] - row[i]);
+        }
+        if (sum > bound) break;
+    }
+    *dst = sum;
+    return i;
+}
+
+// L1 distance of bytes from the input to each row of a matrix
+static inline void ScalarDistanceSad(uint32_t *dst, const uint8_t *input, const uint8_t *rows, size_t stride, size_t count, size_t countRows) {
+    for (size_t r = 0; r < countRows; r++) {
+        const uint8_t *row = rows + r * stride;
+        uint32_t sum = 0;
+        for (size_t i = 0; i < count; i++) {
+            sum += (uint32_t)(input[i] > row[i] ? input[i] - row[i] : row[i] - input[i]);
+        }
+        dst[r] = sum;
+    }
+}
+
+
+// --- x86 SSE2 ---
+
+#ifdef KERNELS_X86
+
+#if MINFFT_SINGLE
+    #define SSE_LANES 4
+    typedef __m128 sse_real;
+    #define sse_loadu _mm_loadu_ps
+    #define sse_storeu _mm_storeu_ps
+    #define sse_mul _mm_mul_ps
+    #define sse_add _mm_add_ps
+    #define sse_sqrt _mm_sqrt_ps
+    #define sse_set1 _mm_set1_ps
+    #define sse_zero _mm_setzero_ps
+#else
+    #define SSE_LANES 2
+    typedef __m128d sse_real;
+    #define sse_loadu _mm_loadu_pd
+    #define sse_storeu _mm_storeu_pd
+    #define sse_mul _mm_mul_pd
+    #define sse_add _mm_add_pd
+    #define sse_sqrt _mm_sqrt_pd
+    #define sse_set1 _mm_set1_pd
+    #define sse_zero _mm_setzero_pd
+#endif
+
+KERNELS_TARGET("sse2")
+static inline void Sse2Convert(real_t *dst, const int16_t *src, size_t count) {
+    const sse_real scale = sse_set1(SAMPLE_SCALE);
+    size_t i = 0;
+#if MINFFT_SINGLE
+    for (; i + 8 <= count; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);  // sign-extend
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+        _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+        _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+    }
+#else
+    for (; i + 4 <= count; i += 4) {
+        __m128i x = _mm_loadl_epi64((const __m128i *)(src + i));
+        __m128i v = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);  // sign-extend
+        _mm_storeu_pd(dst + i, _mm_mul_pd(_mm_cvtepi32_pd(v), scale));
+        _mm_storeu_pd(dst + i + 2, _mm_mul_pd(_mm_cvtepi32_pd(_mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2))), scale));
+    }
+#endif
+    ScalarConvert(dst + i, src + i, count - i);
+}
+
+KERNELS_TARGET("sse2")
+static inline void Sse2Multiply(real_t *dst, const real_t *a, const real_t *b, size_t count) {
+    size_t i = 0;
+    for (; i + SSE_LANES <= count; i += SSE_LANES) {
+        sse_storeu(dst + i, sse_mul(sse_loadu(a + i), sse_loadu(b + i)));
+    }
+    ScalarMultiply(dst + i, a + i, b + i, count - i);
+}
+
+KERNELS_TARGET("sse2")
+static inline void Sse2Window(real_t *dst, const real_t *window, const real_t *ring, size_t start, size_t count) {
+    size_t countOlder = count - start;
+    Sse2Multiply(dst, window, ring + start, countOlder);
+    Sse2Multiply(dst + countOlder, window + countOlder, ring, start);
+}
+
+KERNELS_TARGET("sse2")
+static inline void Sse2Magnitude(real_t *dst, const real_t *src, size_t count) {
+    size_t i = 0;
+    for (; i + SSE_LANES <= count; i += SSE_LANES) {
+        sse_real a = sse_loadu(src + 2 * i);
+        sse_real b = sse_loadu(src + 2 * i + SSE_LANES);
+#if MINFFT_SINGLE
+        sse_real re = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+        sse_real im = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+#else
+        sse_real re = _mm_unpacklo_pd(a, b);
+        sse_real im = _mm_unpackhi_pd(a, b);
+#endif
+        sse_storeu(dst + i, sse_sqrt(sse_add(sse_mul(re, re), sse_mul(im, im))));
+    }
+    ScalarMagnitude(dst + i, src + 2 * i, count - i);
+}
+
+KERNELS_TARGET("sse2")
+static inline void Sse2Power(real_t *dst, const real_t *src, size_t count) {
+    size_t i = 0;
+    for (; i + SSE_LANES <= count; i += SSE_LANES) {
+        sse_real a = sse_loadu(src + 2 * i);
+        sse_real b = sse_loadu(src + 2 * i + SSE_LANES);
+        a = sse_mul(a, a);
+        b = sse_mul(b, b);
+#if MINFFT_SINGLE
+        sse_real sum = _mm_add_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)), _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+#else
+        sse_real sum = _mm_add_pd(_mm_unpacklo_pd(a, b), _mm_unpackhi_pd(a, b));
+#endif
+        sse_storeu(dst + i, sum);
+    }
+    ScalarPower(dst + i, src + 2 * i, count - i);
+}
+
+KERNELS_TARGET("sse2")
+static inline void Sse2BucketMeans(real_t *dst, const real_t *values, const size_t *bounds, size_t countBuckets) {
+    for (size_t i = 0; i < countBuckets; i++) {
+        size_t index = bounds[i];
+        size_t iEndBefore = bounds[i + 1];
+        real_t sum = 0;
+        if (iEndBefore >= index + SSE_LANES) {
+            sse_real vsum = sse_zero();
+            for (; index + SSE_LANES <= iEndBefore; index += SSE_LANES) {
+                vsum = sse_add(vsum, sse_loadu(values + index));
+            }
+            real_t lanes[SSE_LANES];
+            sse_storeu(lanes, vsum);
+            for (size_t j = 0; j < SSE_LANES; j++) sum += lanes[j];
+        }
+        for (; index < iEndBefore; index++) {
+            sum += values[index];
+        }
+        dst[i] = (iEndBefore > bounds[i]) ? sum / (real_t)(iEndBefore - bounds[i]) : 0;
+    }
+}
+
+
+KERNELS_TARGET("sse2")
+static inline void Sse2Project(real_t *dst, const real_t *values, const size_t *first, const size_t *offsets, const real_t *weights, size_t countRows) {
+    for (size_t i = 0; i < countRows; i++) {
+        const real_t *v = values + first[i];
+        const real_t *w = weights + offsets[i];
+        size_t count = offsets[i + 1] - offsets[i];
+        size_t j = 0;
+        real_t sum = 0;
+        if (count >= SSE_LANES) {
+            sse_real vsum = sse_zero();
+            for (; j + SSE_LANES <= count; j += SSE_LANES) {
+                vsum = sse_add(vsum, sse_mul(sse_loadu(w + j), sse_loadu(v + j)));
+            }
+            real_t lanes[SSE_LANES];
+            sse_storeu(lanes, vsum);
+            for (size_t k = 0; k < SSE_LANES; k++) sum += lanes[k];
+        }
+        for (; j < count; j++) {
+            sum += w[j] * v[j];
+        }
+        dst[i] = sum;
+    }
+}
+
+// Two accumulators, so that consecutive additions are independent
+KERNELS_TARGET("sse2")
+static inline void Sse2DistanceL1(double *dst, const double *input, const double *rows, size_t stride, size_t count, size_t countRows) {
+    const __m128d sign = _mm_set1_pd(-0.0);
+    for (size_t r = 0; r < countRows; r++) {
+        const double *row = rows + r * stride;
+        __m128d sum0 = _mm_setzero_pd();
+        __m128d sum1 = _mm_setzero_pd();
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4) {
+            sum0 = _mm_add_pd(sum0, _mm_andnot_pd(sign, _mm_sub_pd(_mm_loadu_pd(input + i), _mm_loadu_pd(row + i))));
+            sum1 = _mm_add_pd(sum1, _mm_andnot_pd(sign, _mm_sub_pd(_mm_loadu_pd(input + i + 2), _mm_loadu_pd(row + i + 2))));
+        }
+        double lanes[2];
+        _mm_storeu_pd(lanes, _mm_add_pd(sum0, sum1));
+        double sum = lanes[0] + lanes[1];
+        for (; i < count; i++) {
+            sum += fabs(input[i] - row[i]);
+        }
+        dst[r] = sum;
+    }
+}
+
+KERNELS_TARGET("sse2")
+static inline void Sse2DistanceWeightedL1(double *dst, const double *input, const double *rows, const double *weights, size_t stride, size_t count, size_t countRows) {
+    const __m128d sign = _mm_set1_pd(-0.0);
+    for (size_t r = 0; r < countRows; r++) {
+        const double *row = rows + r * stride;
+        const double *weight = weights + r * stride;
+        __m128d sum0 = _mm_setzero_pd();
+        __m128d sum1 = _mm_setzero_pd();
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4) {
+            sum0 = _mm_add_pd(sum0, _mm_mul_pd(_mm_loadu_pd(weight + i), _mm_andnot_pd(sign, _mm_sub_pd(_mm_loadu_pd(input + i), _mm_loadu_pd(row + i)))));
+            sum1 = _mm_add_pd(sum1, _mm_mul_pd(_mm_loadu_pd(weight + i + 2), _mm_andnot_pd(sign, _mm_sub_pd(_mm_loadu_pd(input + i + 2), _mm_loadu_pd(row + i + 2)))));
+        }
+        double lanes[2];
+        _mm_storeu_pd(lanes, _mm_add_pd(sum0, sum1));
+        double sum = lanes[0] + lanes[1];
+        for (; i < count; i++) {
+            sum += weight[i] * fabs(input[i] - row[i]);
+        }
+        dst[r] = sum;
+    }
+}
+
+KERNELS_TARGET("sse2")
+static inline void Sse2Dot(double *dst, const double *input, const double *rows, size_t stride, size_t count, size_t countRows) {
+    for (size_t r = 0; r < countRows; r++) {
+        const double *row = rows + r * stride;
+        __m128d sum0 = _mm_setzero_pd();
+        __m128d sum1 = _mm_setzero_pd();
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4) {
+            sum0 = _mm_add_pd(sum0, _mm_mul_pd(_mm_loadu_pd(input + i), _mm_loadu_pd(row + i)));
+            sum1 = _mm_add_pd(sum1, _mm_mul_pd(_mm_loadu_pd(input + i + 2), _mm_loadu_pd(row + i + 2)));
+        }
+        double lanes[2];
+        _mm_storeu_pd(lanes, _mm_add_pd(sum0, sum1));
+        double sum = lanes[0] + lanes[1];
+        for (; i < count; i++) {
+            sum += input[i] * row[i];
+        }
+        dst[r] = sum;
+    }
+}
+
+// The accumulators are reduced for the check at the end of each block
+KERNELS_TARGET("sse2")
+static inline size_t Sse2DistanceL1Bounded(double *dst, const double *input, const double *row, const double *weights, size_t count, double bound) {
+    const __m128d sign = _mm_set1_pd(-0.0);
+    __m128d sum0 = _mm_setzero_pd();
+    __m128d sum1 = _mm_setzero_pd();
+    double lanes[2];
+    size_t i = 0;
+    while (i + KERNELS_BOUNDED_BLOCK <= count) {
+        for (size_t end = i + KERNELS_BOUNDED_BLOCK; i < end; i += 4) {
+            __m128d diff0 = _mm_andnot_pd(sign, _mm_sub_pd(_mm_loadu_pd(input + i), _mm_loadu_pd(row + i)));
+            __m128d diff1 = _mm_andnot_pd(sign, _mm_sub_pd(_mm_loadu_pd(input + i + 2), _mm_loadu_pd(row + i + 2)));
+            if (weights != NULL) {
+                diff0 = _mm_mul_pd(_mm_loadu_pd(weights + i), diff0);
+                diff1 = _mm_mul_pd(_mm_loadu_pd(weights + i + 2), diff1);
+            }
+            sum0 = _mm_add_pd(sum0, diff0);
+            sum1 = _mm_add_pd(sum1, diff1);
+        }
+        _mm_storeu_pd(lanes, _mm_add_pd(sum0, sum1));
+        if (lanes[0] + lanes[1] > bound) {
+            *dst = lanes[0] + lanes[1];
+            return i;
+        }
+    }
+    _mm_storeu_pd(lanes, _mm_add_pd(sum0, sum1));
+    double sum = lanes[0] + lanes[1];
+    for (; i < count; i++) {
+        sum += (weights != NULL ? weights[i] : 1) * fabs(input[i] - row[i]);
+    }
+    *dst = sum;
+    return count;
+}
+
+// psadbw sums the absolute differences of 8 bytes into each 64-bit lane
+KERNELS_TARGET("sse2")
+static inline void Sse2DistanceSad(uint32_t *dst, const uint8_t *input, const uint8_t *rows, size_t stride, size_t count, size_t countRows) {
+    for (size_t r = 0; r < countRows; r++) {
+        const uint8_t *row = rows + r * stride;
+        __m128i sum = _mm_setzero_si128();
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            sum = _mm_add_epi64(sum, _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(input + i)), _mm_loadu_si128((const __m128i *)(row + i))));
+        }
+        uint32_t total = (uint32_t)_mm_cvtsi128_si32(sum) + (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
+        for (; i < count; i++) {
+            total += (uint32_t)(input[i] > row[i] ? input[i] - row[i] : row[i] - input[i]);
+        }
+        dst[r] = total;
+    }
+}
+
+// --- x86 AVX2 ---
+
+#if MINFFT_SINGLE
+    #define AVX_LANES 8
+    typedef __m256 avx_real;
+    #define avx_loadu _mm256_loadu_ps
+    #define avx_storeu _mm256_storeu_ps
+    #define avx_mul _mm256_mul_ps
+    #define avx_add _mm256_add_ps
+    #define avx_sqrt _mm256_sqrt_ps
+    #define avx_set1 _mm256_set1_ps
+    #define avx_zero _mm256_setzero_ps
+#else
+    #define AVX_LANES 4
+    typedef __m256d avx_real;
+    #define avx_loadu _mm256_loadu_pd
+    #define avx_storeu _mm256_storeu_pd
+    #define avx_mul _mm256_mul_pd
+    #define avx_add _mm256_add_pd
+    #define avx_sqrt _mm256_sqrt_pd
+    #define avx_set1 _mm256_set1_pd
+    #define avx_zero _mm256_setzero_pd
+#endif
+
+KERNELS_TARGET("avx2")
+static inline void Avx2Convert(real_t *dst, const int16_t *src, size_t count) {
+    const avx_real scale = avx_set1(SAMPLE_SCALE);
+    size_t i = 0;
+    for (; i + AVX_LANES <= count; i += AVX_LANES) {
+#if MINFFT_SINGLE
+        __m256i v = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(src + i)));
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+#else
+        __m128i v = _mm_cvtepi16_epi32(_mm_loadl_epi64((const __m128i *)(src + i)));
+        _mm256_storeu_pd(dst + i, _mm256_mul_pd(_mm256_cvtepi32_pd(v), scale));
+#endif
+    }
+    ScalarConvert(dst + i, src + i, count - i);
+}
+
+KERNELS_TARGET("avx2")
+static inline void Avx2Multiply(real_t *dst, const real_t *a, const real_t *b, size_t count) {
+    size_t i = 0;
+    for (; i + AVX_LANES <= count; i += AVX_LANES) {
+        avx_storeu(dst + i, avx_mul(avx_loadu(a + i), avx_loadu(b + i)));
+    }
+    ScalarMultiply(dst + i, a + i, b + i, count - i);
+}
+
+KERNELS_TARGET("avx2")
+static inline void Avx2Window(real_t *dst, const real_t *window, const real_t *ring, size_t start, size_t count) {
+    size_t countOlder = count - start;
+    Avx2Multiply(dst, window, ring + start, countOlder);
+    Avx2Multiply(dst + countOlder, window + countOlder, ring, start);
+}
+
+KERNELS_TARGET("avx2")
+static inline void Avx2Magnitude(real_t *dst, const real_t *src, size_t count) {
+    size_t i = 0;
+    for (; i + AVX_LANES <= count; i += AVX_LANES) {
+        avx_real a = avx_loadu(src + 2 * i);
+        avx_real b = avx_loadu(src + 2 * i + AVX_LANES);
+        // In-lane de-interleave leaves the results in 64-bit chunk order 0,2,1,3, which is then restored
+#if MINFFT_SINGLE
+        avx_real re = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+        avx_real im = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+        avx_real m = avx_sqrt(avx_add(avx_mul(re, re), avx_mul(im, im)));
+        m = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(m), _MM_SHUFFLE(3, 1, 2, 0)));
+#else
+        avx_real re = _mm256_unpacklo_pd(a, b);
+        avx_real im = _mm256_unpackhi_pd(a, b);
+        avx_real m = avx_sqrt(avx_add(avx_mul(re, re), avx_mul(im, im)));
+        m = _mm256_permute4x64_pd(m, _MM_SHUFFLE(3, 1, 2, 0));
+#endif
+        avx_storeu(dst + i, m);
+    }
+    ScalarMagnitude(dst + i, src + 2 * i, count - i);
+}
+
+KERNELS_TARGET("avx2")
+static inline void Avx2Power(real_t *dst, const real_t *src, size_t count) {
+    size_t i = 0;
+    for (; i + AVX_LANES <= count; i += AVX_LANES) {
+        avx_real a = avx_loadu(src + 2 * i);
+        avx_real b = avx_loadu(src + 2 * i + AVX_LANES);
+        a = avx_mul(a, a);
+        b = avx_mul(b, b);
+#if MINFFT_SINGLE
+        avx_real p = _mm256_add_ps(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)), _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+        p = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(p), _MM_SHUFFLE(3, 1, 2, 0)));
+#else
+        avx_real p = _mm256_add_pd(_mm256_unpacklo_pd(a, b), _mm256_unpackhi_pd(a, b));
+        p = _mm256_permute4x64_pd(p, _MM_SHUFFLE(3, 1, 2, 0));
+#endif
+        avx_storeu(dst + i, p);
+    }
+    ScalarPower(dst + i, src + 2 * i, count - i);
+}
+
+KERNELS_TARGET("avx2")
+static inline void Avx2BucketMeans(real_t *dst, const real_t *values, const size_t *bounds, size_t countBuckets) {
+    for (size_t i = 0; i < countBuckets; i++) {
+        size_t index = bounds[i];
+        size_t iEndBefore = bounds[i + 1];
+        real_t sum = 0;
+        if (iEndBefore >= index + AVX_LANES) {
+            avx_real vsum = avx_zero();
+            for (; index + AVX_LANES <= iEndBefore; index += AVX_LANES) {
+                vsum = avx_add(vsum, avx_loadu(values + index));
+            }
+            real_t lanes[AVX_LANES];
+            avx_storeu(lanes, vsum);
+            for (size_t j = 0; j < AVX_LANES; j++) sum += lanes[j];
+        }
+        for (; index < iEndBefore; index++) {
+            sum += values[index];
+        }
+        dst[i] = (iEndBefore > bounds[i]) ? sum / (real_t)(iEndBefore - bounds[i]) : 0;
+    }
+}
+
+KERNELS_TARGET("avx2")
+static inline void Avx2Project(real_t *dst, const real_t *values, const size_t *first, const size_t *offsets, const real_t *weights, size_t countRows) {
+    for (size_t i = 0; i < countRows; i++) {
+        const real_t *v = values + first[i];
+        const real_t *w = weights + offsets[i];
+        size_t count = offsets[i + 1] - offsets[i];
+        size_t j = 0;
+        real_t sum = 0;
+        if (count >= AVX_LANES) {
+            avx_real vsum = avx_zero();
+            for (; j + AVX_LANES <= count; j += AVX_LANES) {
+                vsum = avx_add(vsum, avx_mul(avx_loadu(w + j), avx_loadu(v + j)));
+            }
+            real_t lanes[AVX_LANES];
+            avx_storeu(lanes, vsum);
+            for (size_t k = 0; k < AVX_LANES; k++) sum += lanes[k];
+        }
+        for (; j < count; j++) {
+            sum += w[j] * v[j];
+        }
+        dst[i] = sum;
+    }
+}
+
+KERNELS_TARGET("avx2")
+static inline void Avx2DistanceL1(double *dst, const double *input, const double *rows, size_t stride, size_t count, size_t countRows) {
+    const __m256d sign = _mm256_set1_pd(-0.0);
+    for (size_t r = 0; r < countRows; r++) {
+        const double *row = rows + r * stride;
+        __m256d sum0 = _mm256_setzero_pd();
+        __m256d sum1 = _mm256_setzero_pd();
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            sum0 = _mm256_add_pd(sum0, _mm256_andnot_pd(sign, _mm256_sub_pd(_mm256_loadu_pd(input + i), _mm256_loadu_pd(row + i))));
+            sum1 = _mm256_add_pd(sum1, _mm256_andnot_pd(sign, _mm256_sub_pd(_mm256_loadu_pd(input + i + 4), _mm256_loadu_pd(row + i + 4))));
+        }
+        double lanes[4];
+        _mm256_storeu_pd(lanes, _mm256_add_pd(sum0, sum1));
+        double sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+        for (; i < count; i++) {
+            sum += fabs(input[i] - row[i]);
+        }
+        dst[r] = sum;
+    }
+}
+
+KERNELS_TARGET("avx2")
+static inline void Avx2DistanceWeightedL1(double *dst, const double *input, const double *rows, const double *weights, size_t stride, size_t count, size_t countRows) {
+    const __m256d sign = _mm256_set1_pd(-0.0);
+    for (size_t r = 0; r < countRows; r++) {
+        const double *row = rows + r * stride;
+        const double *weight = weights + r * stride;
+        __m256d sum0 = _mm256_setzero_pd();
+        __m256d sum1 = _mm256_setzero_pd();
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            sum0 = _mm256_add_pd(sum0, _mm256_mul_pd(_mm256_loadu_pd(weight + i), _mm256_andnot_pd(sign, _mm256_sub_pd(_mm256_loadu_pd(input + i), _mm256_loadu_pd(row + i)))));
+            sum1 = _mm256_add_pd(sum1, _mm256_mul_pd(_mm256_loadu_pd(weight + i + 4), _mm256_andnot_pd(sign, _mm256_sub_pd(_mm256_loadu_pd(input + i + 4), _mm256_loadu_pd(row + i + 4)))));
+        }
+        double lanes[4];
+        _mm256_storeu_pd(lanes, _mm256_add_pd(sum0, sum1));
+        double sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+        for (; i < count; i++) {
+            sum += weight[i] * fabs(input[i] - row[i]);
+        }
+        dst[r] = sum;
+    }
+}
+
+KERNELS_TARGET("avx2")
+static inline void Avx2Dot(double *dst, const double *input, const double *rows, size_t stride, size_t count, size_t countRows) {
+    for (size_t r = 0; r < countRows; r++) {
+        const double *row = rows + r * stride;
+        __m256d sum0 = _mm256_setzero_pd();
+        __m256d sum1 = _mm256_setzero_pd();
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            sum0 = _mm256_add_pd(sum0, _mm256_mul_pd(_mm256_loadu_pd(input + i), _mm256_loadu_pd(row + i)));
+            sum1 = _mm256_add_pd(sum1, _mm256_mul_pd(_mm256_loadu_pd(input + i + 4), _mm256_loadu_pd(row + i + 4)));
+        }
+        double lanes[4];
+        _mm256_storeu_pd(lanes, _mm256_add_pd(sum0, sum1));
+        double sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+        for (; i < count; i++) {
+            sum += input[i] * row[i];
+        }
+        dst[r] = sum;
+    }
+}
+
+KERNELS_TARGET("avx2")
+static inline size_t Avx2DistanceL1Bounded(double *dst, const double *input, const double *row, const double *weights, size_t count, double bound) {
+    const __m256d sign = _mm256_set1_pd(-0.0);
+    __m256d sum0 = _mm256_setzero_pd();
+    __m256d sum1 = _mm256_setzero_pd();
+    double lanes[4];
+    size_t i = 0;
+    while (i + KERNELS_BOUNDED_BLOCK <= count) {
+        for (size_t end = i + KERNELS_BOUNDED_BLOCK; i < end; i += 8) {
+            __m256d diff0 = _mm256_andnot_pd(sign, _mm256_sub_pd(_mm256_loadu_pd(input + i), _mm256_loadu_pd(row + i)));
+            __m256d diff1 = _mm256_andnot_pd(sign, _mm256_sub_pd(_mm256_loadu_pd(input + i + 4), _mm256_loadu_pd(row + i + 4)));
+            if (weights != NULL) {
+                diff0 = _mm256_mul_pd(_mm256_loadu_pd(weights + i), diff0);
+                diff1 = _mm256_mul_pd(_mm256_loadu_pd(weights + i + 4), diff1);
+            }
+            sum0 = _mm256_add_pd(sum0, diff0);
+            sum1 = _mm256_add_pd(sum1, diff1);
+        }
+        _mm256_storeu_pd(lanes, _mm256_add_pd(sum0, sum1));
+        double sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+        if (sum > bound) {
+            *dst = sum;
+            return i;
+        }
+    }
+    _mm256_storeu_pd(lanes, _mm256_add_pd(sum0, sum1));
+    double sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    for (; i < count; i++) {
+        sum += (weights != NULL ? weights[i] : 1) * fabs(input[i] - row[i]);
+    }
+    *dst = sum;
+    return count;
+}
+
+// (also used by the AVX-512 kernels, as a 512-bit psadbw needs AVX-512BW)
+KERNELS_TARGET("avx2")
+static inline void Avx2DistanceSad(uint32_t *dst, const uint8_t *input, const uint8_t *rows, size_t stride, size_t count, size_t countRows) {
+    for (size_t r = 0; r < countRows; r++) {
+        const uint8_t *row = rows + r * stride;
+        __m256i sum0 = _mm256_setzero_si256();
+        __m256i sum1 = _mm256_setzero_si256();
+        size_t i = 0;
+        for (; i + 64 <= count; i += 64) {
+            sum0 = _mm256_add_epi64(sum0, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i *)(input + i)), _mm256_loadu_si256((const __m256i *)(row + i))));
+            sum1 = _mm256_add_epi64(sum1, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i *)(input + i + 32)), _mm256_loadu_si256((const __m256i *)(row + i + 32))));
+        }
+        __m256i sum256 = _mm256_add_epi64(sum0, sum1);
+        __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(sum256), _mm256_extracti128_si256(sum256, 1));
+        for (; i + 16 <= count; i += 16) {
+            sum = _mm_add_epi64(sum, _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(input + i)), _mm_loadu_si128((const __m128i *)(row + i))));
+        }
+        uint32_t total = (uint32_t)_mm_cvtsi128_si32(sum) + (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
+        for (; i < count; i++) {
+            total += (uint32_t)(input[i] > row[i] ? input[i] - row[i] : row[i] - input[i]);
+        }
+        dst[r] = total;
+    }
+}
+
+// --- x86 AVX-512 ---
+
+// Only the distance kernel has an AVX-512 implementation (the front end uses the AVX2 kernels), the tail is a masked load rather than a scalar loop
+KERNELS_TARGET("avx512f")
+static inline void Avx512DistanceL1(double *dst, const double *input, const double *rows, size_t stride, size_t count, size_t countRows) {
+    for (size_t r = 0; r < countRows; r++) {
+        const double *row = rows + r * stride;
+        __m512d sum0 = _mm512_setzero_pd();
+        __m512d sum1 = _mm512_setzero_pd();
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            sum0 = _mm512_add_pd(sum0, _mm512_abs_pd(_mm512_sub_pd(_mm512_loadu_pd(input + i), _mm512_loadu_pd(row + i))));
+            sum1 = _mm512_add_pd(sum1, _mm512_abs_pd(_mm512_sub_pd(_mm512_loadu_pd(input + i + 8), _mm512_loadu_pd(row + i + 8))));
+        }
+        for (; i < count; i += 8) {
+            __mmask8 mask = (count - i >= 8) ? (__mmask8)0xff : (__mmask8)((1u << (count - i)) - 1);
+            sum0 = _mm512_add_pd(sum0, _mm512_abs_pd(_mm512_sub_pd(_mm512_maskz_loadu_pd(mask, input + i), _mm512_maskz_loadu_pd(mask, row + i))));
+        }
+        dst[r] = _mm512_reduce_add_pd(_mm512_add_pd(sum0, sum1));
+    }
+}
+
+KERNELS_TARGET("avx512f")
+static inline void Avx512DistanceWeightedL1(double *dst, const double *input, const double *rows, const double *weights, size_t stride, size_t count, size_t countRows) {
+    for (size_t r = 0; r < countRows; r++) {
+        const double *row = rows + r * stride;
+        const double *weight = weights + r * stride;
+        __m512d sum0 = _mm512_setzero_pd();
+        __m512d sum1 = _mm512_setzero_pd();
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            sum0 = _mm512_add_pd(sum0, _mm512_mul_pd(_mm512_loadu_pd(weight + i), _mm512_abs_pd(_mm512_sub_pd(_mm512_loadu_pd(input + i), _mm512_loadu_pd(row + i)))));
+            sum1 = _mm512_add_pd(sum1, _mm512_mul_pd(_mm512_loadu_pd(weight + i + 8), _mm512_abs_pd(_mm512_sub_pd(_mm512_loadu_pd(input + i + 8), _mm512_loadu_pd(row + i + 8)))));
+        }
+        for (; i < count; i += 8) {
+            __mmask8 mask = (count - i >= 8) ? (__mmask8)0xff : (__mmask8)((1u << (count - i)) - 1);
+            sum0 = _mm512_add_pd(sum0, _mm512_mul_pd(_mm512_maskz_loadu_pd(mask, weight + i), _mm512_abs_pd(_mm512_sub_pd(_mm512_maskz_loadu_pd(mask, input + i), _mm512_maskz_loadu_pd(mask, row + i)))));
+        }
+        dst[r] = _mm512_reduce_add_pd(_mm512_add_pd(sum0, sum1));
+    }
+}
+
+KERNELS_TARGET("avx512f")
+static inline void Avx512Dot(double *dst, const double *input, const double *rows, size_t stride, size_t count, size_t countRows) {
+    for (size_t r = 0; r < countRows; r++) {
+        const double *row = rows + r * stride;
+        __m512d sum0 = _mm512_setzero_pd();
+        __m512d sum1 = _mm512_setzero_pd();
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            sum0 = _mm512_add_pd(sum0, _mm512_mul_pd(_mm512_loadu_pd(input + i), _mm512_loadu_pd(row + i)));
+            sum1 = _mm512_add_pd(sum1, _mm512_mul_pd(_mm512_loadu_pd(input + i + 8), _mm512_loadu_pd(row + i + 8)));
+        }
+        for (; i < count; i += 8) {
+            __mmask8 mask = (count - i >= 8) ? (__mmask8)0xff : (__mmask8)((1u << (count - i)) - 1);
+            sum0 = _mm512_add_pd(sum0, _mm512_mul_pd(_mm512_maskz_loadu_pd(mask, input + i), _mm512_maskz_loadu_pd(mask, row + i)));
+        }
+        dst[r] = _mm512_reduce_add_pd(_mm512_add_pd(sum0, sum1));
+    }
+}
+
+KERNELS_TARGET("avx512f")
+static inline size_t Avx512DistanceL1Bounded(double *dst, const double *input, const double *row, const double *weights, size_t count, double bound) {
+    __m512d sum0 = _mm512_setzero_pd();
+    __m512d sum1 = _mm512_setzero_pd();
+    size_t i = 0;
+    while (i + KERNELS_BOUNDED_BLOCK <= count) {
+        for (size_t end = i + KERNELS_BOUNDED_BLOCK; i < end; i += 16) {
+            __m512d diff0 = _mm512_abs_pd(_mm512_sub_pd(_mm512_loadu_pd(input + i), _mm512_loadu_pd(row + i)));
+            __m512d diff1 = _mm512_abs_pd(_mm512_sub_pd(_mm512_loadu_pd(input + i + 8), _mm512_loadu_pd(row + i + 8)));
+            if (weights != NULL) {
+                diff0 = _mm512_mul_pd(_mm512_loadu_pd(weights + i), diff0);
+                diff1 = _mm512_mul_pd(_mm512_loadu_pd(weights + i + 8), diff1);
+            }
+            sum0 = _mm512_add_pd(sum0, diff0);
+            sum1 = _mm512_add_pd(sum1, diff1);
+        }
+        double sum = _mm512_reduce_add_pd(_mm512_add_pd(sum0, sum1));
+        if (sum > bound) {
+            *dst = sum;
+            return i;
+        }
+    }
+    for (; i < count; i += 8) {
+        __mmask8 mask = (count - i >= 8) ? (__mmask8)0xff : (__mmask8)((1u << (count - i)) - 1);
+        __m512d diff = _mm512_abs_pd(_mm512_sub_pd(_mm512_maskz_loadu_pd(mask, input + i), _mm512_maskz_loadu_pd(mask, row + i)));
+        if (weights != NULL) diff = _mm512_mul_pd(_mm512_maskz_loadu_pd(mask, weights + i), diff);
+        sum0 = _mm512_add_pd(sum0, diff);
+    }
+    *dst = _mm512_reduce_add_pd(_mm512_add_pd(sum0, sum1));
+    return count;
+}
+
+// CPU feature detection
+static bool CpuHasSse2(void) {
+#if defined(__x86_64__) || defined(_M_X64)
+    return true;    // baseline for x86-64
+#elif defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[3] & (1 << 26)) != 0;
+#else
+    return __builtin_cpu_supports("sse2");
+#endif
+}
+
+static bool CpuHasAvx2(void) {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx) return false;
+    if ((_xgetbv(0) & 0x6) != 0x6) return false;    // OS saves XMM and YMM state
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+static bool CpuHasAvx512(void) {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+    __cpuid(info, 1);
+    if ((info[2] & (1 << 27)) == 0) return false;   // OSXSAVE
+    if ((_xgetbv(0) & 0xe6) != 0xe6) return false;  // OS saves XMM, YMM, opmask and ZMM state
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 16)) != 0;
+#else
+    return __builtin_cpu_supports("avx512f");
+#endif
+}
+
+#endif
+
+
+// --- ARM NEON ---
+
+#ifdef KERNELS_NEON
+
+#if MINFFT_SINGLE
+    #define NEON_LANES 4
+    typedef float32x4_t neon_real;
+    typedef float32x4x2_t neon_real2;
+    #define neon_loadu vld1q_f32
+    #define neon_load2 vld2q_f32
+    #define neon_storeu vst1q_f32
+    #define neon_mul vmulq_f32
+    #define neon_add vaddq_f32
+    #define neon_sqrt vsqrtq_f32
+    #define neon_set1 vdupq_n_f32
+#else
+    #define NEON_LANES 2
+    typedef float64x2_t neon_real;
+    typedef float64x2x2_t neon_real2;
+    #define neon_loadu vld1q_f64
+    #define neon_load2 vld2q_f64
+    #define neon_storeu vst1q_f64
+    #define neon_mul vmulq_f64
+    #define neon_add vaddq_f64
+    #define neon_sqrt vsqrtq_f64
+    #define neon_set1 vdupq_n_f64
+#endif
+
+static inline void NeonConvert(real_t *dst, const int16_t *src, size_t count) {
+    const neon_real scale = neon_set1(SAMPLE_SCALE);
+    size_t i = 0;
+#if MINFFT_SINGLE
+    for (; i + 8 <= count; i += 8) {
+        int16x8_t x = vld1q_s16(src + i);
+        int32x4_t lo = vmovl_s16(vget_low_s16(x));
+        int32x4_t hi = vmovl_s16(vget_high_s16(x));
+        vst1q_f32(dst + i, vmulq_f32(vcvtq_f32_s32(lo), scale));
+        vst1q_f32(dst + i + 4, vmulq_f32(vcvtq_f32_s32(hi), scale));
+    }
+#else
+    for (; i + 4 <= count; i += 4) {
+        int32x4_t x = vmovl_s16(vld1_s16(src + i));
+        int64x2_t lo = vmovl_s32(vget_low_s32(x));
+        int64x2_t hi = vmovl_s32(vget_high_s32(x));
+        vst1q_f64(dst + i, vmulq_f64(vcvtq_f64_s64(lo), scale));
+        vst1q_f64(dst + i + 2, vmulq_f64(vcvtq_f64_s64(hi), scale));
+    }
+#endif
+    ScalarConvert(dst + i, src + i, count - i);
+}
+
+static inline void NeonMultiply(real_t *dst, const real_t *a, const real_t *b, size_t count) {
+    size_t i = 0;
+    for (; i + NEON_LANES <= count; i += NEON_LANES) {
+        neon_storeu(dst + i, neon_mul(neon_loadu(a + i), neon_loadu(b + i)));
+    }
+    ScalarMultiply(dst + i, a + i, b + i, count - i);
+}
+
+static inline void NeonWindow(real_t *dst, const real_t *window, const real_t *ring, size_t start, size_t count) {
+    size_t countOlder = count - start;
+    NeonMultiply(dst, window, ring + start, countOlder);
+    NeonMultiply(dst + countOlder, window + countOlder, ring, start);
+}
+
+#ifdef KERNELS_NEON_SQRT
+static inline void NeonMagnitude(real_t *dst, const real_t *src, size_t count) {
+    size_t i = 0;
+    for (; i + NEON_LANES <= count; i += NEON_LANES) {
+        neon_real2 c = neon_load2(src + 2 * i);     // de-interleaves real and imaginary parts
+        neon_storeu(dst + i, neon_sqrt(neon_add(neon_mul(c.val[0], c.val[0]), neon_mul(c.val[1], c.val[1]))));
+    }
+    ScalarMagnitude(dst + i, src + 2 * i, count - i);
+}
+#else
+static inline void NeonMagnitude(real_t *dst, const real_t *src, size_t count) {
+    ScalarMagnitude(dst, src, count);
+}
+#endif
+
+static inline void NeonPower(real_t *dst, const real_t *src, size_t count) {
+    size_t i = 0;
+    for (; i + NEON_LANES <= count; i += NEON_LANES) {
+        neon_real2 c = neon_load2(src + 2 * i);     // de-interleaves real and imaginary parts
+        neon_storeu(dst + i, neon_add(neon_mul(c.val[0], c.val[0]), neon_mul(c.val[1], c.val[1])));
+    }
+    ScalarPower(dst + i, src + 2 * i, count - i);
+}
+
+static inline void NeonBucketMeans(real_t *dst, const real_t *values, const size_t *bounds, size_t countBuckets) {
+    for (size_t i = 0; i < countBuckets; i++) {
+        size_t index = bounds[i];
+        size_t iEndBefore = bounds[i + 1];
+        real_t sum = 0;
+        if (iEndBefore >= index + NEON_LANES) {
+            neon_real vsum = neon_set1(0);
+            for (; index + NEON_LANES <= iEndBefore; index += NEON_LANES) {
+                vsum = neon_add(vsum, neon_loadu(values + index));
+            }
+            real_t lanes[NEON_LANES];
+            neon_storeu(lanes, vsum);
+            for (size_t j = 0; j < NEON_LANES; j++) sum += lanes[j];
+        }
+        for (; index < iEndBefore; index++) {
+            sum += values[index];
+        }
+        dst[i] = (iEndBefore > bounds[i]) ? sum / (real_t)(iEndBefore - bounds[i]) : 0;
+    }
+}
+
+static inline void NeonProject(real_t *dst, const real_t *values, const size_t *first, const size_t *offsets, const real_t *weights, size_t countRows) {
+    for (size_t i = 0; i < countRows; i++) {
+        const real_t *v = values + first[i];
+        const real_t *w = weights + offsets[i];
+        size_t count = offsets[i + 1] - offsets[i];
+        size_t j = 0;
+        real_t sum = 0;
+        if (count >= NEON_LANES) {
+            neon_real vsum = neon_set1(0);
+            for (; j + NEON_LANES <= count; j += NEON_LANES) {
+                vsum = neon_add(vsum, neon_mul(neon_loadu(w + j), neon_loadu(v + j)));
+            }
+            real_t lanes[NEON_LANES];
+            neon_storeu(lanes, vsum);
+            for (size_t k = 0; k < NEON_LANES; k++) sum += lanes[k];
+        }
+        for (; j < count; j++) {
+            sum += w[j] * v[j];
+        }
+        dst[i] = sum;
+    }
+}
+
+// Byte absolute differences, pairwise-widened into 32-bit lanes (integer, so also on 32-bit ARM)
+static inline void NeonDistanceSad(uint32_t *dst, const uint8_t *input, const uint8_t *rows, size_t stride, size_t count, size_t countRows) {
+    for (size_t r = 0; r < countRows; r++) {
+        const uint8_t *row = rows + r * stride;
+        uint32x4_t sum = vdupq_n_u32(0);
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            sum = vpadalq_u16(sum, vpaddlq_u8(vabdq_u8(vld1q_u8(input + i), vld1q_u8(row + i))));
+        }
+        uint32_t total = vgetq_lane_u32(sum, 0) + vgetq_lane_u32(sum, 1) + vgetq_lane_u32(sum, 2) + vgetq_lane_u32(sum, 3);
+        for (; i < count; i++) {
+            total += (uint32_t)(input[i] > row[i] ? input[i] - row[i] : row[i] - input[i]);
+        }
+        dst[r] = total;
+    }
+}
+
+#ifdef KERNELS_NEON_DOUBLE
+static inline void NeonDistanceL1(double *dst, const double *input, const double *rows, size_t stride, size_t count, size_t countRows) {
+    for (size_t r = 0; r < countRows; r++) {
+        const double *row = rows + r * stride;
+        float64x2_t sum0 = vdupq_n_f64(0);
+        float64x2_t sum1 = vdupq_n_f64(0);
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4) {
+            sum0 = vaddq_f64(sum0, vabdq_f64(vld1q_f64(input + i), vld1q_f64(row + i)));
+            sum1 = vaddq_f64(sum1, vabdq_f64(vld1q_f64(input + i + 2), vld1q_f64(row + i + 2)));
+        }
+        double sum = vaddvq_f64(vaddq_f64(sum0, sum1));
+        for (; i < count; i++) {
+            sum += fabs(input[i] - row[i]);
+        }
+        dst[r] = sum;
+    }
+}
+
+static inline void NeonDistanceWeightedL1(double *dst, const double *input, const double *rows, const double *weights, size_t stride, size_t count, size_t countRows) {
+    for (size_t r = 0; r < countRows; r++) {
+        const double *row = rows + r * stride;
+        const double *weight = weights + r * stride;
+        float64x2_t sum0 = vdupq_n_f64(0);
+        float64x2_t sum1 = vdupq_n_f64(0);
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4) {
+            sum0 = vaddq_f64(sum0, vmulq_f64(vld1q_f64(weight + i), vabdq_f64(vld1q_f64(input + i), vld1q_f64(row + i))));
+            sum1 = vaddq_f64(sum1, vmulq_f64(vld1q_f64(weight + i + 2), vabdq_f64(vld1q_f64(input + i + 2), vld1q_f64(row + i + 2))));
+        }
+        double sum = vaddvq_f64(vaddq_f64(sum0, sum1));
+        for (; i < count; i++) {
+            sum += weight[i] * fabs(input[i] - row[i]);
+        }
+        dst[r] = sum;
+    }
+}
+
+static inline void NeonDot(double *dst, const double *input, const double *rows, size_t stride, size_t count, size_t countRows) {
+    for (size_t r = 0; r < countRows; r++) {
+        const double *row = rows + r * stride;
+        float64x2_t sum0 = vdupq_n_f64(0);
+        float64x2_t sum1 = vdupq_n_f64(0);
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4) {
+            sum0 = vaddq_f64(sum0, vmulq_f64(vld1q_f64(input + i), vld1q_f64(row + i)));
+            sum1 = vaddq_f64(sum1, vmulq_f64(vld1q_f64(input + i + 2), vld1q_f64(row + i + 2)));
+        }
+        double sum = vaddvq_f64(vaddq_f64(sum0, sum1));
+        for (; i < count; i++) {
+            sum += input[i] * row[i];
+        }
+        dst[r] = sum;
+    }
+}
+
+static inline size_t NeonDistanceL1Bounded(double *dst, const double *input, const double *row, const double *weights, size_t count, double bound) {
+    float64x2_t sum0 = vdupq_n_f64(0);
+    float64x2_t sum1 = vdupq_n_f64(0);
+    size_t i = 0;
+    while (i + KERNELS_BOUNDED_BLOCK <= count) {
+        for (size_t end = i + KERNELS_BOUNDED_BLOCK; i < end; i += 4) {
+            float64x2_t diff0 = vabdq_f64(vld1q_f64(input + i), vld1q_f64(row + i));
+            float64x2_t diff1 = vabdq_f64(vld1q_f64(input + i + 2), vld1q_f64(row + i + 2));
+            if (weights != NULL) {
+                diff0 = vmulq_f64(vld1q_f64(weights + i), diff0);
+                diff1 = vmulq_f64(vld1q_f64(weights + i + 2), diff1);
+            }
+            sum0 = vaddq_f64(sum0, diff0);
+            sum1 = vaddq_f64(sum1, diff1);
+        }
+        double sum = vaddvq_f64(vaddq_f64(sum0, sum1));
+        if (sum > bound) {
+            *dst = sum;
+            return i;
+        }
+    }
+    double sum = vaddvq_f64(vaddq_f64(sum0, sum1));
+    for (; i < count; i++) {
+        sum += (weights != NULL ? weights[i] : 1) * fabs(input[i] - row[i]);
+    }
+    *dst = sum;
+    return count;
+}
+#else
+    // No double-precision vectors on 32-bit ARM
+    #define NeonDistanceL1 ScalarDistanceL1
+    #define NeonDistanceWeightedL1 ScalarDistanceWeightedL1
+    #define NeonDot ScalarDot
+    #define NeonDistanceL1Bounded ScalarDistanceL1Bounded
+#endif
+
+#endif
+
+
+// --- Selection ---
+
+static const kernels_t kernelsTable[KERNELS_COUNT] = {
+    { KERNELS_SCALAR, "scalar", ScalarConvert, ScalarWindow, ScalarMagnitude, ScalarPower, ScalarBucketMeans, ScalarProject, ScalarDistanceL1, ScalarDistanceWeightedL1, ScalarDot, ScalarDistanceL1Bounded, ScalarDistanceSad },
+#ifdef KERNELS_X86
+    { KERNELS_SSE2, "sse2", Sse2Convert, Sse2Window, Sse2Magnitude, Sse2Power, Sse2BucketMeans, Sse2Project, Sse2DistanceL1, Sse2DistanceWeightedL1, Sse2Dot, Sse2DistanceL1Bounded, Sse2DistanceSad },
+    { KERNELS_AVX2, "avx2", Avx2Convert, Avx2Window, Avx2Magnitude, Avx2Power, Avx2BucketMeans, Avx2Project, Avx2DistanceL1, Avx2DistanceWeightedL1, Avx2Dot, Avx2DistanceL1Bounded, Avx2DistanceSad },
+    { KERNELS_AVX512, "avx512", Avx2Convert, Avx2Window, Avx2Magnitude, Avx2Power, Avx2BucketMeans, Avx2Project, Avx512DistanceL1, Avx512DistanceWeightedL1, Avx512Dot, Avx512DistanceL1Bounded, Avx2DistanceSad },
+#else
+    { KERNELS_SSE2, "sse2", NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL },
+    { KERNELS_AVX2, "avx2", NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL },
+    { KERNELS_AVX512, "avx512", NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL },
+#endif
+#ifdef KERNELS_NEON
+    { KERNELS_NEON, "neon", NeonConvert, NeonWindow, NeonMagnitude, NeonPower, NeonBucketMeans, NeonProject, NeonDistanceL1, NeonDistanceWeightedL1, NeonDot, NeonDistanceL1Bounded, NeonDistanceSad },
+#else
+    { KERNELS_NEON, "neon", NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL },
+#endif
+};
+
+const char *KernelsName(kernels_isa_t isa) {
+    if (isa == KERNELS_AUTO) return "auto";
+    if (isa < 0 || isa >= KERNELS_COUNT) return NULL;
+    return kernelsTable[isa].name;
+}
+
+bool KernelsFromName(const char *name, kernels_isa_t *outIsa) {
+    if (strcmp(name, "auto") == 0) {
+        *outIsa = KERNELS_AUTO;
+        return true;
+    }
+    for (int i = 0; i < KERNELS_COUNT; i++) {
+        if (strcmp(name, kernelsTable[i].name) == 0) {
+            *outIsa = (kernels_isa_t)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool KernelsAvailable(kernels_isa_t isa) {
+    if (isa == KERNELS_AUTO) return true;
+    if (isa < 0 || isa >= KERNELS_COUNT || kernelsTable[isa].convert == NULL) return false;
+    switch (isa) {
+#ifdef KERNELS_X86
+        case KERNELS_SSE2: return CpuHasSse2();
+        case KERNELS_AVX2: return CpuHasAvx2();
+        case KERNELS_AVX512: return CpuHasAvx2() && CpuHasAvx512();
+#endif
+        default: return true;
+    }
+}
+
+bool KernelsSelect(kernels_t *kernels, kernels_isa_t isa) {
+    if (isa == KERNELS_AUTO) {
+        // Best available (highest to lowest)
+        isa = KERNELS_SCALAR;
+        for (int i = KERNELS_COUNT - 1; i > KERNELS_SCALAR; i--) {
+            if (KernelsAvailable((kernels_isa_t)i)) { isa = (kernels_isa_t)i; break; }
+        }
+    }
+    if (!KernelsAvailable(isa)) return false;
+    *kernels = kernelsTable[isa];
+    return true;
+}
+
+
+// --- Self-test ---
+
+// Maximum difference relative to the reference magnitude (absolute for small values)
+static double KernelsMaxError(const real_t *reference, const real_t *values, size_t count) {
+    double maxError = 0;
+    for (size_t i = 0; i < count; i++) {
+        double scale = fabs((double)reference[i]) > 1 ? fabs((double)reference[i]) : 1;
+        double error = fabs((double)values[i] - (double)reference[i]) / scale;
+        if (error > maxError || error != error) maxError = error;     // (propagate NaN)
+    }
+    return maxError;
+}
+
+static bool KernelsCheck(const char *isaName, const char *kernelName, double error, double tolerance) {
+    bool pass = error <= tolerance;
+    printf("SELF-TEST: kernels %s %s: max error %g (tolerance %g) %s\n", isaName, kernelName, error, tolerance, pass ? "ok" : "FAILED");
+    return pass;
+}
+
+bool KernelsSelfTest(void) {
+    // Element-wise kernels may differ from the reference only by contraction (FMA), bucket sums also differ in summation order
+    const double tolerance = (sizeof(real_t) == sizeof(float)) ? 1e-5 : 1e-12;
+    const size_t sizes[] = { 1, 7, 8, 33, 1025, 2048 };
+    const size_t maxSize = 2048;
+    const size_t countBuckets = 256;
+    const size_t countRows = 3;
+    const double toleranceDistance = 1e-12;   // (double precision in every build) sums differ in order
+    bool pass = true;
+
+    int16_t *samples = malloc(sizeof(int16_t) * maxSize);
+    real_t *a = malloc(sizeof(real_t) * 2 * maxSize);
+    real_t *b = malloc(sizeof(real_t) * 2 * maxSize);
+    real_t *reference = malloc(sizeof(real_t) * maxSize);
+    real_t *result = malloc(sizeof(real_t) * maxSize);
+    size_t *bounds = malloc(sizeof(size_t) * (countBuckets + 1));
+    size_t *first = malloc(sizeof(size_t) * countBuckets);
+    size_t *offsets = malloc(sizeof(size_t) * (countBuckets + 1));
+    double *input = malloc(sizeof(double) * maxSize);
+    double *rows = malloc(sizeof(double) * countRows * maxSize);
+    double *distanceReference = malloc(sizeof(double) * countRows);
+    double *distanceResult = malloc(sizeof(double) * countRows);
+    uint8_t *inputBytes = malloc(maxSize);
+    uint8_t *rowBytes = malloc(countRows * maxSize);
+    uint32_t *sadReference = malloc(sizeof(uint32_t) * countRows);
+    uint32_t *sadResult = malloc(sizeof(uint32_t) * countRows);
+    if (!samples || !a || !b || !reference || !result || !bounds || !first || !offsets || !input || !rows || !distanceReference || !distanceResult || !inputBytes || !rowBytes || !sadReference || !sadResult) { fprintf(stderr, "ERROR: Memory failure (self-test).\n"); exit(-1); }
+
+    // Deterministic pseudo-random data
+    uint32_t seed = 0x2545f491;
+    for (size_t i = 0; i < maxSize; i++) {
+        seed = seed * 1664525 + 1013904223;
+        samples[i] = (int16_t)(seed >> 16);
+    }
+    samples[0] = -32768; samples[1] = 32767;
+    for (size_t i = 0; i < 2 * maxSize; i++) {
+        seed = seed * 1664525 + 1013904223;
+        a[i] = (real_t)((double)(seed >> 8) / (1 << 24) * 64 - 32);
+        seed = seed * 1664525 + 1013904223;
+        b[i] = (real_t)((double)(seed >> 8) / (1 << 24));
+    }
+    for (size_t i = 0; i < countRows * maxSize; i++) {
+        seed = seed * 1664525 + 1013904223;
+        rows[i] = (double)(seed >> 8) / (1 << 24) * 4;
+        if (i < maxSize) input[i] = rows[i] / 3 + 0.1;
+        rowBytes[i] = (uint8_t)(seed >> 24);
+        if (i < maxSize) inputBytes[i] = (uint8_t)(seed >> 16);
+    }
+
+    // Log-spaced contiguous buckets, as used by the fingerprint
+    size_t countValues = maxSize / 2 + 1;
+    double logScale = log((double)countValues) / log((double)countBuckets);
+    for (size_t i = 0; i <= countBuckets; i++) {
+        size_t bound = (size_t)pow((double)i, logScale);
+        bounds[i] = bound > countValues ? countValues : bound;
+    }
+
+    // Overlapping sparse rows of varied lengths (some longer than the vector lanes, some empty), with non-negative weights
+    offsets[0] = 0;
+    for (size_t i = 0; i < countBuckets; i++) {
+        size_t length = (i % 8 == 0) ? 24 : i % 9;     // (1648 weights in total)
+        first[i] = (i * 3) % (countValues - length);
+        offsets[i + 1] = offsets[i] + length;
+    }
+
+    kernels_t scalar;
+    KernelsSelect(&scalar, KERNELS_SCALAR);
+    for (int isa = KERNELS_SCALAR + 1; isa < KERNELS_COUNT; isa++) {
+        kernels_t kernels;
+        if (!KernelsSelect(&kernels, (kernels_isa_t)isa)) {
+            printf("SELF-TEST: kernels %s: not available\n", KernelsName((kernels_isa_t)isa));
+            continue;
+        }
+
+        double errorConvert = 0, errorWindow = 0, errorMagnitude = 0, errorPower = 0, errorDistance = 0, errorWeighted = 0, errorDot = 0, errorBounded = 0, errorSad = 0;
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            size_t count = sizes[s];
+            size_t start = count / 3;
+            double error;
+
+            scalar.convert(reference, samples, sizes[s]);
+            kernels.convert(result, samples, sizes[s]);
+            error = KernelsMaxError(reference, result, sizes[s]);
+            if (error > errorConvert || error != error) errorConvert = error;
+
+            scalar.window(reference, b, a, start, count);
+            kernels.window(result, b, a, start, count);
+            error = KernelsMaxError(reference, result, count);
+            if (error > errorWindow || error != error) errorWindow = error;
+
+            scalar.magnitude(reference, a, count);
+            kernels.magnitude(result, a, count);
+            error = KernelsMaxError(reference, result, count);
+            if (error > errorMagnitude || error != error) errorMagnitude = error;
+
+            scalar.power(reference, a, count);
+            kernels.power(result, a, count);
+            error = KernelsMaxError(reference, result, count);
+            if (error > errorPower || error != error) errorPower = error;
+
+            scalar.distanceL1(distanceReference, input, rows, maxSize, sizes[s], countRows);
+            kernels.distanceL1(distanceResult, input, rows, maxSize, sizes[s], countRows);
+            for (size_t row = 0; row < countRows; row++) {
+                error = fabs(distanceResult[row] - distanceReference[row]) / (distanceReference[row] > 1 ? distanceReference[row] : 1);
+                if (error > errorDistance || error != error) errorDistance = error;
+            }
+
+            // (the matrix is also used as its own non-negative weights)
+            scalar.distanceWeightedL1(distanceReference, input, rows, rows, maxSize, sizes[s], countRows);
+            kernels.distanceWeightedL1(distanceResult, input, rows, rows, maxSize, sizes[s], countRows);
+            for (size_t row = 0; row < countRows; row++) {
+                error = fabs(distanceResult[row] - distanceReference[row]) / (distanceReference[row] > 1 ? distanceReference[row] : 1);
+                if (error > errorWeighted || error != error) errorWeighted = error;
+            }
+
+            scalar.dot(distanceReference, input, rows, maxSize, sizes[s], countRows);
+            kernels.dot(distanceResult, input, rows, maxSize, sizes[s], countRows);
+            for (size_t row = 0; row < countRows; row++) {
+                error = fabs(distanceResult[row] - distanceReference[row]) / (distanceReference[row] > 1 ? distanceReference[row] : 1);
+                if (error > errorDot || error != error) errorDot = error;
+            }
+
+            // Unbounded, stopping at the first block, and part-way (unweighted, then weighted): the sum over the values summed, which must be whole blocks ending once over the bound
+            for (size_t row = 0; row < countRows; row++) {
+                const double *rowValues = rows + row * maxSize;
+                for (int b = 0; b < 6; b++) {
+                    const double *weights = (b >= 3) ? rowValues : NULL;
+                    double full, sum, reference;
+                    scalar.distanceL1Bounded(&full, input, rowValues, weights, sizes[s], HUGE_VAL);
+                    double bound = (b % 3 == 0) ? HUGE_VAL : (b % 3 == 1) ? -1 : full / 2;
+                    size_t summed = kernels.distanceL1Bounded(&sum, input, rowValues, weights, sizes[s], bound);
+                    scalar.distanceL1Bounded(&reference, input, rowValues, weights, summed, HUGE_VAL);
+                    error = fabs(sum - reference) / (reference > 1 ? reference : 1);
+                    if (summed < sizes[s] && (summed % KERNELS_BOUNDED_BLOCK != 0 || !(sum > bound))) error = HUGE_VAL;
+                    if (b % 3 == 1 && summed != (sizes[s] < KERNELS_BOUNDED_BLOCK ? sizes[s] : KERNELS_BOUNDED_BLOCK)) error = HUGE_VAL;
+                    if (error > errorBounded || error != error) errorBounded = error;
+                }
+            }
+
+            scalar.distanceSad(sadReference, inputBytes, rowBytes, maxSize, sizes[s], countRows);
+            kernels.distanceSad(sadResult, inputBytes, rowBytes, maxSize, sizes[s], countRows);
+            for (size_t row = 0; row < countRows; row++) {
+                error = fabs((double)sadResult[row] - (double)sadReference[row]);
+                if (error > errorSad) errorSad = error;
+            }
+        }
+        scalar.bucketMeans(reference, b, bounds, countBuckets);
+        kernels.bucketMeans(result, b, bounds, countBuckets);
+        double errorBuckets = KernelsMaxError(reference, result, countBuckets);
+        scalar.project(reference, b, first, offsets, b + maxSize, countBuckets);
+        kernels.project(result, b, first, offsets, b + maxSize, countBuckets);
+        double errorProject = KernelsMaxError(reference, result, countBuckets);
+
+        pass &= KernelsCheck(kernels.name, "convert", errorConvert, tolerance);
+        pass &= KernelsCheck(kernels.name, "window", errorWindow, tolerance);
+        pass &= KernelsCheck(kernels.name, "magnitude", errorMagnitude, tolerance);
+        pass &= KernelsCheck(kernels.name, "power", errorPower, tolerance);
+        pass &= KernelsCheck(kernels.name, "bucket-means", errorBuckets, tolerance);
+        pass &= KernelsCheck(kernels.name, "project", errorProject, tolerance);
+        pass &= KernelsCheck(kernels.name, "distance-l1", errorDistance, toleranceDistance);
+        pass &= KernelsCheck(kernels.name, "distance-weighted-l1", errorWeighted, toleranceDistance);
+        pass &= KernelsCheck(kernels.name, "dot", errorDot, toleranceDistance);
+        pass &= KernelsCheck(kernels.name, "distance-l1-bounded", errorBounded, toleranceDistance);
+        pass &= KernelsCheck(kernels.name, "distance-sad", errorSad, 0);
+    }
+
+    free(samples);
+    free(a);
+    free(b);
+    free(reference);
+    free(result);
+    free(bounds);
+    free(first);
+    free(offsets);
+    free(input);
+    free(rows);
+    free(distanceReference);
+    free(distanceResult);
+    free(inputBytes);
+    free(rowBytes);
+    free(sadReference);
+    free(sadResult);
+    return pass;
+}
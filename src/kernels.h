@@ -0,0 +1,85 @@
+// AudioId - Daniel Jackson, 2022.
+
+// Processing kernels for the fingerprint front end: a scalar reference implementation, and vectorized versions selected at runtime.
+
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "minfft.h"
+
+// Floating point type of the fingerprint front end, matching the FFT (single precision when built with MINFFT_SINGLE=1)
+typedef minfft_real real_t;
+#if MINFFT_SINGLE
+    #define real_sqrt sqrtf
+#else
+    #define real_sqrt sqrt
+#endif
+
+#define KERNELS_BOUNDED_BLOCK 16    // values summed between checks of the bound by distanceL1Bounded (a multiple of the widest vectors, unrolled twice)
+
+// Instruction set of a kernel implementation
+typedef enum {
+    KERNELS_AUTO = -1,      // best available
+    KERNELS_SCALAR = 0,     // reference implementation
+    KERNELS_SSE2,
+    KERNELS_AVX2,
+    KERNELS_AVX512,         // AVX-512F distance kernel, AVX2 front end
+    KERNELS_NEON,
+    KERNELS_COUNT
+} kernels_isa_t;
+
+typedef struct kernels_tag {
+    kernels_isa_t isa;
+    const char *name;
+    // dst[i] = src[i] / 32768
+    void (*convert)(real_t *dst, const int16_t *src, size_t count);
+    // dst[i] = window[i] * ring[(start + i) % count], window-weighting a circular buffer oldest first
+    void (*window)(real_t *dst, const real_t *window, const real_t *ring, size_t start, size_t count);
+    // dst[i] = |src[i]|, where src is interleaved complex (real, imaginary) pairs
+    void (*magnitude)(real_t *dst, const real_t *src, size_t count);
+    // dst[i] = |src[i]|^2, where src is interleaved complex (real, imaginary) pairs
+    void (*power)(real_t *dst, const real_t *src, size_t count);
+    // dst[i] = mean of values[bounds[i]] to values[bounds[i + 1] - 1] (0 if empty), buckets must be contiguous
+    void (*bucketMeans)(real_t *dst, const real_t *values, const size_t *bounds, size_t countBuckets);
+    // dst[i] = sum of weights[offsets[i] + j] * values[first[i] + j], for j < offsets[i + 1] - offsets[i] (a sparse matrix-vector product with contiguous rows)
+    void (*project)(real_t *dst, const real_t *values, const size_t *first, const size_t *offsets, const real_t *weights, size_t countRows);
+    // dst[r] = sum of |input[i] - rows[r * stride + i]|, for i < count and r < countRows (the L1 distance from one vector to each row of a matrix, in double precision whatever the front end's precision)
+    void (*distanceL1)(double *dst, const double *input, const double *rows, size_t stride, size_t count, size_t countRows);
+    // dst[r] = sum of weights[r * stride + i] * |input[i] - rows[r * stride + i]|, for i < count and r < countRows (weights have the same layout as the rows)
+    void (*distanceWeightedL1)(double *dst, const double *input, const double *rows, const double *weights, size_t stride, size_t count, size_t countRows);
+    // dst[r] = sum of input[i] * rows[r * stride + i], for i < count and r < countRows (a dense matrix-vector product)
+    void (*dot)(double *dst, const double *input, const double *rows, size_t stride, size_t count, size_t countRows);
+    // *dst = sum of (weights[i] *) |input[i] - row[i]| (weights may be NULL), summed KERNELS_BOUNDED_BLOCK values at a time and stopping after the first block at which the sum exceeds the bound (for early abandoning), returns the number of values summed
+    size_t (*distanceL1Bounded)(double *dst, const double *input, const double *row, const double *weights, size_t count, double bound);
+    // dst[r] = sum of |input[i] - rows[r * stride + i]|, for i < count and r < countRows, of bytes (the L1 distance between quantized values, exact for count < 2^24)
+    void (*distanceSad)(uint32_t *dst, const uint8_t *input, const uint8_t *rows, size_t stride, size_t count, size_t countRows);
+} kernels_t;
+
+// Name of an instruction set (NULL if invalid)
+const char *KernelsName(kernels_isa_t isa);
+
+// Instruction set from its name ("auto", "scalar", "sse2", "avx2", "avx512", "neon")
+bool KernelsFromName(const char *name, kernels_isa_t *outIsa);
+
+// Whether the kernels for an instruction set are built and supported by this CPU
+bool KernelsAvailable(kernels_isa_t isa);
+
+// Kernels for an instruction set (or the best available for KERNELS_AUTO), returns false if not available
+bool KernelsSelect(kernels_t *kernels, kernels_isa_t isa);
+
+// Check each available vectorized implementation against the scalar reference, returns true if all are within tolerance
+bool KernelsSelfTest(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -9,7 +9,9 @@
 
 #include "audioid.h"
 
-int run(const char *filename, int visualize, bool learn, const char *eventsFile, const char *stateFile, const char *labelFile, const char *outputStateFile) {
+#define MAX_OPTIONS 32
+
+int run(const char *filename, int visualize, bool learn, const char *eventsFile, const char *stateFile, const char *labelFile, const char *manifestFile, const char *outputStateFile, const char **options, int countOptions, bool benchmark) {
     audioid_t *audioid = AudioIdCreate();
 
     AudioIdInit(audioid, visualize);
@@ -30,6 +32,40 @@ int run(const char *filename, int visualize, bool learn, const char *eventsFile,
         }
     }
 
+    // Apply command-line options (after state, so incompatible options are detected)
+    for (int i = 0; i < countOptions; i++) {
+        char name[64];
+        const char *equals = strchr(options[i], '=');
+        size_t nameLength = equals != NULL ? (size_t)(equals - options[i]) : strlen(options[i]);
+        if (nameLength >= sizeof(name)) nameLength = sizeof(name) - 1;
+        memcpy(name, options[i], nameLength);
+        name[nameLength] = '\0';
+        if (!AudioIdSetOption(audioid, name, equals != NULL ? equals + 1 : "")) {
+            fprintf(stderr, "ERROR: Problem with option: %s\n", options[i]);
+            return -1;
+        }
+    }
+
+    // Benchmark only
+    if (benchmark) {
+        AudioIdBenchmark(audioid);
+        AudioIdDestroy(audioid);
+        return 0;
+    }
+
+    // Learn from a manifest of labelled recordings
+    if (manifestFile != NULL) {
+        if (!AudioIdLearnManifest(audioid, manifestFile)) {
+            fprintf(stderr, "ERROR: Problem learning from manifest: %s\n", manifestFile);
+            return -1;
+        }
+        if (outputStateFile != NULL) {
+            AudioIdStateSave(audioid, outputStateFile);
+        }
+        AudioIdDestroy(audioid);
+        return 0;
+    }
+
     // Configure
     if (learn) {
         // Configure to learn from labelled audio
@@ -66,11 +102,16 @@ int main(int argc, char *argv[]) {
     int positional = 0;
     const char *filename = NULL;
     const char *labelFile = NULL;
+    const char *manifestFile = NULL;
     const char *eventsFile = NULL;
     const char *stateFile = NULL;
     const char *outputStateFile = NULL;
+    const char *options[MAX_OPTIONS];
+    int countOptions = 0;
     int visualize = 0;
     bool learn = false;
+    bool benchmark = false;
+    bool selfTest = false;
 
     #ifdef _WIN32
         SetConsoleOutputCP(65001);    // CP_UTF8 65001
@@ -83,6 +124,12 @@ int main(int argc, char *argv[]) {
         else if (allowFlags && strcmp(argv[i], "--visualize") == 0) { visualize = 1; }
         else if (allowFlags && strcmp(argv[i], "--visualize:reduced") == 0) { visualize = 2; }
         else if (allowFlags && strcmp(argv[i], "--learn") == 0) { learn = true; }
+        else if (allowFlags && strcmp(argv[i], "--benchmark") == 0) { benchmark = true; }
+        else if (allowFlags && strcmp(argv[i], "--self-test") == 0) { selfTest = true; }
+        else if (allowFlags && strcmp(argv[i], "--option") == 0) {
+            if (i + 1 < argc && countOptions < MAX_OPTIONS) options[countOptions++] = argv[++i];
+            else { printf("ERROR: Missing parameter value (or too many) for: --option\n"); help = true; }
+        }
         else if (allowFlags && strcmp(argv[i], "--events") == 0) {
             if (i + 1 < argc) eventsFile = argv[++i]; 
             else { printf("ERROR: Missing parameter value for: --events\n"); help = true; }
@@ -95,6 +142,10 @@ int main(int argc, char *argv[]) {
             if (i + 1 < argc) { labelFile = argv[++i]; }
             else { printf("ERROR: Missing parameter value for: --labels\n"); help = true; }
         }
+        else if (allowFlags && strcmp(argv[i], "--manifest") == 0) {
+            if (i + 1 < argc) { manifestFile = argv[++i]; }
+            else { printf("ERROR: Missing parameter value for: --manifest\n"); help = true; }
+        }
         else if (allowFlags && strcmp(argv[i], "--write-state") == 0) {
             if (i + 1 < argc) { outputStateFile = argv[++i]; }
             else { printf("ERROR: Missing parameter value for: --write-state\n"); help = true; }
@@ -117,7 +168,30 @@ int main(int argc, char *argv[]) {
         printf("AudioID - Daniel Jackson, 2022.\n");
         printf("https://github.com/danielgjackson/audioid\n");
         printf("\n");
-        printf("Usage:  audioid [--events events.ini] [--state state.ini] [--visualize[:reduced]] [sound.wav] [--labels sound.txt [--learn [--write-state state.ini]]]\n");
+        printf("Usage:  audioid [--events events.ini] [--state state.ini] [--visualize[:reduced]] [sound.wav] [--labels sound.txt [--learn [--write-state state.ini]]] [--option name=value]...\n");
+        printf("        audioid [--events events.ini] [--state state.ini] --manifest manifest.txt --learn [--write-state state.ini] [--option name=value]...\n");
+        printf("        audioid [--option name=value]... --benchmark\n");
+        printf("        audioid --self-test\n");
+        printf("\n");
+        printf("Options:  window=hamming|hann|blackman-harris|flat-top\n");
+        printf("          fingerprint=magnitude|power|logpower\n");
+        printf("          analysisrate=<Hz>\n");
+        printf("          windowsize=<samples>\n");
+        printf("          bucketcount=<count>\n");
+        printf("          filterbank=log|linear|mel|erb\n");
+        printf("          distance=l1|normalized|cosine|zscore\n");
+        printf("          search=auto|scan|abandon|tree|groups\n");
+        printf("          searcherror=<proportion>\n");
+        printf("          searchgroups=<count>\n");
+        printf("          quantize=off|on|check\n");
+        printf("          projection=off|<dimension>\n");
+        printf("          adaptive=off|on\n");
+        printf("          adaptivemargin=<proportion>\n");
+        printf("          hop=<samples>\n");
+        printf("          cyclecount=<frames>\n");
+        printf("          gate=auto|off|<dBFS>\n");
+        printf("          kernels=auto|scalar|sse2|avx2|avx512|neon\n");
+        printf("          threads=auto|<count>\n");
         printf("\n");
         printf("This program is available under the MIT license, and makes use of:\n");
         printf("\n");
@@ -127,6 +201,15 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    int returnValue = run(filename, visualize, learn, eventsFile, stateFile, labelFile, outputStateFile);
+    if (manifestFile != NULL && (!learn || filename != NULL || labelFile != NULL)) {
+        printf("ERROR: --manifest is used with --learn, instead of a sound file and --labels.\n");
+        return 1;
+    }
+
+    if (selfTest) {
+        return AudioIdSelfTest() ? 0 : 1;
+    }
+
+    int returnValue = run(filename, visualize, learn, eventsFile, stateFile, labelFile, manifestFile, outputStateFile, options, countOptions, benchmark);
     return returnValue;
 }